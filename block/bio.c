@@ -19,6 +19,9 @@
 #include <linux/highmem.h>
 #include <linux/sched/sysctl.h>
 #include <linux/blk-crypto.h>
+#include <linux/cpuhotplug.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <trace/events/block.h>
 #include "blk.h"
@@ -48,6 +51,31 @@ static struct biovec_slab bvec_slabs[BVEC_POOL_NR] __read_mostly = {
 struct bio_set fs_bio_set;
 EXPORT_SYMBOL(fs_bio_set);
 
+/*
+ * Per-cpu cache of free bios for a bio_set created with BIOSET_PERCPU_CACHE.
+ * Only touched from process context, with preemption disabled.
+ */
+#define ALLOC_CACHE_MAX		512
+#define ALLOC_CACHE_SLACK	16
+
+struct bio_alloc_cache {
+	struct bio_list		free_list;
+	unsigned int		nr;
+	unsigned long		hits;
+	unsigned long		misses;
+};
+
+struct bioset_cache {
+	struct bio_alloc_cache __percpu	*cache;
+	struct bio_set			*bs;
+	struct hlist_node		cpuhp_dead;
+	struct list_head		list;
+};
+
+static int bio_cache_cpuhp_state = -EINVAL;
+static LIST_HEAD(bio_caches);
+static DEFINE_MUTEX(bio_caches_lock);
+
 /*
  * Our slab pool management
  */
@@ -529,6 +557,51 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, unsigned int nr_iovecs,
 }
 EXPORT_SYMBOL(bio_alloc_bioset);
 
+/**
+ * bio_alloc_kiocb - Allocate a bio from bio_set based on kiocb
+ * @kiocb:	kiocb describing the IO
+ * @nr_vecs:	number of iovecs to pre-allocate
+ * @bs:		bio_set to allocate from
+ *
+ * Description:
+ *    Like @bio_alloc_bioset, but pass in the kiocb. The kiocb is only
+ *    used to check if we should dip into the per-cpu bio_set allocation
+ *    cache. The allocation uses GFP_KERNEL internally. On return, the
+ *    bio is marked BIO_PERCPU_CACHE, and the final put of the bio
+ *    should be done from process context to recycle it, a put from
+ *    hard/soft IRQ context frees it to the mempool instead.
+ */
+struct bio *bio_alloc_kiocb(struct kiocb *kiocb, unsigned int nr_vecs,
+			    struct bio_set *bs)
+{
+	struct bio_alloc_cache *cache;
+	struct bio *bio;
+
+	if (!(kiocb->ki_flags & IOCB_ALLOC_CACHE) || !bs->cache ||
+	    nr_vecs > BIO_INLINE_VECS)
+		return bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+
+	cache = per_cpu_ptr(bs->cache->cache, get_cpu());
+	bio = bio_list_pop(&cache->free_list);
+	if (bio) {
+		cache->nr--;
+		cache->hits++;
+		put_cpu();
+		bio_init(bio, nr_vecs ? bio->bi_inline_vecs : NULL, nr_vecs);
+		bio->bi_pool = bs;
+	} else {
+		cache->misses++;
+		put_cpu();
+		bio = bio_alloc_bioset(GFP_KERNEL, nr_vecs, bs);
+		if (!bio)
+			return NULL;
+	}
+
+	bio_set_flag(bio, BIO_PERCPU_CACHE);
+	return bio;
+}
+EXPORT_SYMBOL_GPL(bio_alloc_kiocb);
+
 void zero_fill_bio_iter(struct bio *bio, struct bvec_iter start)
 {
 	unsigned long flags;
@@ -637,6 +710,56 @@ void guard_bio_eod(struct bio *bio)
 	bio_truncate(bio, maxsector << 9);
 }
 
+static void bio_alloc_cache_prune(struct bio_alloc_cache *cache,
+				  unsigned int nr)
+{
+	unsigned int i = 0;
+	struct bio *bio;
+
+	while ((bio = bio_list_pop(&cache->free_list)) != NULL) {
+		cache->nr--;
+		bio_free(bio);
+		if (++i == nr)
+			break;
+	}
+}
+
+static void bio_put_percpu_cache(struct bio *bio)
+{
+	struct bio_list excess = BIO_EMPTY_LIST;
+	struct bio_alloc_cache *cache;
+
+	/* the cache isn't irq safe, irq completions don't recycle */
+	if (!in_task()) {
+		bio_free(bio);
+		return;
+	}
+
+	bio_uninit(bio);
+	cache = per_cpu_ptr(bio->bi_pool->cache->cache, get_cpu());
+	bio_list_add_head(&cache->free_list, bio);
+	if (++cache->nr > ALLOC_CACHE_MAX + ALLOC_CACHE_SLACK) {
+		unsigned int i;
+
+		for (i = 0; i < ALLOC_CACHE_SLACK; i++)
+			bio_list_add(&excess, bio_list_pop(&cache->free_list));
+		cache->nr -= ALLOC_CACHE_SLACK;
+	}
+	put_cpu();
+
+	/* mempool_free() may sleep on PREEMPT_RT, free with preemption on */
+	while ((bio = bio_list_pop(&excess)) != NULL)
+		bio_free(bio);
+}
+
+static void __bio_put(struct bio *bio)
+{
+	if (bio_flagged(bio, BIO_PERCPU_CACHE))
+		bio_put_percpu_cache(bio);
+	else
+		bio_free(bio);
+}
+
 /**
  * bio_put - release a reference to a bio
  * @bio:   bio to release reference to
@@ -648,7 +771,7 @@ void guard_bio_eod(struct bio *bio)
 void bio_put(struct bio *bio)
 {
 	if (!bio_flagged(bio, BIO_REFFED))
-		bio_free(bio);
+		__bio_put(bio);
 	else {
 		BIO_BUG_ON(!atomic_read(&bio->__bi_cnt));
 
@@ -656,7 +779,7 @@ void bio_put(struct bio *bio)
 		 * last put frees it
 		 */
 		if (atomic_dec_and_test(&bio->__bi_cnt))
-			bio_free(bio);
+			__bio_put(bio);
 	}
 }
 EXPORT_SYMBOL(bio_put);
@@ -1546,6 +1669,64 @@ int biovec_init_pool(mempool_t *pool, int pool_entries)
 	return mempool_init_slab_pool(pool, pool_entries, bp->slab);
 }
 
+static int bio_cpu_dead(unsigned int cpu, struct hlist_node *node)
+{
+	struct bioset_cache *bc;
+
+	bc = hlist_entry_safe(node, struct bioset_cache, cpuhp_dead);
+	bio_alloc_cache_prune(per_cpu_ptr(bc->cache, cpu), -1U);
+	return 0;
+}
+
+static int bioset_cache_init(struct bio_set *bs)
+{
+	struct bioset_cache *bc;
+
+	/* no hotplug state, run without the cache */
+	if (bio_cache_cpuhp_state < 0)
+		return 0;
+
+	bc = kzalloc(sizeof(*bc), GFP_KERNEL);
+	if (!bc)
+		return -ENOMEM;
+	bc->cache = alloc_percpu(struct bio_alloc_cache);
+	if (!bc->cache) {
+		kfree(bc);
+		return -ENOMEM;
+	}
+	bc->bs = bs;
+	cpuhp_state_add_instance_nocalls(bio_cache_cpuhp_state,
+					 &bc->cpuhp_dead);
+
+	mutex_lock(&bio_caches_lock);
+	list_add_tail(&bc->list, &bio_caches);
+	mutex_unlock(&bio_caches_lock);
+
+	bs->cache = bc;
+	return 0;
+}
+
+static void bioset_cache_exit(struct bio_set *bs)
+{
+	struct bioset_cache *bc = bs->cache;
+	int cpu;
+
+	if (!bc)
+		return;
+
+	mutex_lock(&bio_caches_lock);
+	list_del(&bc->list);
+	mutex_unlock(&bio_caches_lock);
+
+	cpuhp_state_remove_instance_nocalls(bio_cache_cpuhp_state,
+					    &bc->cpuhp_dead);
+	for_each_possible_cpu(cpu)
+		bio_alloc_cache_prune(per_cpu_ptr(bc->cache, cpu), -1U);
+	free_percpu(bc->cache);
+	kfree(bc);
+	bs->cache = NULL;
+}
+
 /*
  * bioset_exit - exit a bioset initialized with bioset_init()
  *
@@ -1554,6 +1735,7 @@ int biovec_init_pool(mempool_t *pool, int pool_entries)
  */
 void bioset_exit(struct bio_set *bs)
 {
+	bioset_cache_exit(bs);
 	if (bs->rescue_workqueue)
 		destroy_workqueue(bs->rescue_workqueue);
 	bs->rescue_workqueue = NULL;
@@ -1573,8 +1755,8 @@ EXPORT_SYMBOL(bioset_exit);
  * @bs:		pool to initialize
  * @pool_size:	Number of bio and bio_vecs to cache in the mempool
  * @front_pad:	Number of bytes to allocate in front of the returned bio
- * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS
- *              and %BIOSET_NEED_RESCUER
+ * @flags:	Flags to modify behavior, currently %BIOSET_NEED_BVECS,
+ *              %BIOSET_NEED_RESCUER and %BIOSET_PERCPU_CACHE
  *
  * Description:
  *    Set up a bio_set to be used with @bio_alloc_bioset. Allows the caller
@@ -1587,6 +1769,9 @@ EXPORT_SYMBOL(bioset_exit);
  *    for allocating iovecs.  This pool is not needed e.g. for bio_clone_fast().
  *    If %BIOSET_NEED_RESCUER is set, a workqueue is created which can be used to
  *    dispatch queued requests when the mempool runs out of space.
+ *    If %BIOSET_PERCPU_CACHE is set, bios allocated with bio_alloc_kiocb()
+ *    are recycled through a per-cpu cache instead of going back to the
+ *    mempool on the final put.
  *
  */
 int bioset_init(struct bio_set *bs,
@@ -1597,6 +1782,7 @@ int bioset_init(struct bio_set *bs,
 	unsigned int back_pad = BIO_INLINE_VECS * sizeof(struct bio_vec);
 
 	bs->front_pad = front_pad;
+	bs->cache = NULL;
 
 	spin_lock_init(&bs->rescue_lock);
 	bio_list_init(&bs->rescue_list);
@@ -1613,6 +1799,9 @@ int bioset_init(struct bio_set *bs,
 	    biovec_init_pool(&bs->bvec_pool, pool_size))
 		goto bad;
 
+	if ((flags & BIOSET_PERCPU_CACHE) && bioset_cache_init(bs))
+		goto bad;
+
 	if (!(flags & BIOSET_NEED_RESCUER))
 		return 0;
 
@@ -1640,6 +1829,8 @@ int bioset_init_from_src(struct bio_set *bs, struct bio_set *src)
 		flags |= BIOSET_NEED_BVECS;
 	if (src->rescue_workqueue)
 		flags |= BIOSET_NEED_RESCUER;
+	if (src->cache)
+		flags |= BIOSET_PERCPU_CACHE;
 
 	return bioset_init(bs, src->bio_pool.min_nr, src->front_pad, flags);
 }
@@ -1679,6 +1870,10 @@ static int __init init_bio(void)
 	bio_integrity_init();
 	biovec_init_slabs();
 
+	bio_cache_cpuhp_state = cpuhp_setup_state_multi(CPUHP_BP_PREPARE_DYN,
+							"block/bio:dead", NULL,
+							bio_cpu_dead);
+
 	if (bioset_init(&fs_bio_set, BIO_POOL_SIZE, 0, BIOSET_NEED_BVECS))
 		panic("bio: can't allocate bios\n");
 
@@ -1688,3 +1883,39 @@ static int __init init_bio(void)
 	return 0;
 }
 subsys_initcall(init_bio);
+
+#ifdef CONFIG_DEBUG_FS
+static int bio_cache_show(struct seq_file *m, void *v)
+{
+	struct bioset_cache *bc;
+	int cpu;
+
+	mutex_lock(&bio_caches_lock);
+	list_for_each_entry(bc, &bio_caches, list) {
+		unsigned long hits = 0, misses = 0, cached = 0;
+
+		for_each_possible_cpu(cpu) {
+			struct bio_alloc_cache *cache;
+
+			cache = per_cpu_ptr(bc->cache, cpu);
+			hits += READ_ONCE(cache->hits);
+			misses += READ_ONCE(cache->misses);
+			cached += READ_ONCE(cache->nr);
+		}
+		seq_printf(m, "%ps: hits %lu misses %lu cached %lu\n",
+			   bc->bs, hits, misses, cached);
+	}
+	mutex_unlock(&bio_caches_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bio_cache);
+
+static int __init bio_cache_debugfs_init(void)
+{
+	debugfs_create_file("bio_cache", 0400, blk_debugfs_root, NULL,
+			    &bio_cache_fops);
+	return 0;
+}
+late_initcall(bio_cache_debugfs_init);
+#endif
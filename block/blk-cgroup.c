@@ -31,6 +31,8 @@
 #include <linux/tracehook.h>
 #include <linux/psi.h>
 #include "blk.h"
+#include "blk-rq-qos.h"
+#include "blk-stat.h"
 
 #define MAX_KEY_LEN 100
 
@@ -55,6 +57,29 @@ static struct blkcg_policy *blkcg_policy[BLKCG_MAX_POLS];
 static LIST_HEAD(all_blkcgs);		/* protected by blkcg_pol_mutex */
 
 bool blkcg_debug_stats = false;
+
+enum {
+	BLKG_LAT_QUEUE,		/* submission until the driver got it */
+	BLKG_LAT_DEV,		/* in the driver and device */
+	BLKG_LAT_TOTAL,
+	BLKG_LAT_NR,
+};
+
+struct blkg_lat_hist {
+	u32				cnt[BLKG_LAT_NR][BLKG_IOSTAT_NR]
+					   [BLK_LAT_HIST_BUCKETS];
+};
+
+/*
+ * io.stat sums the per-cpu counts into cur and prints that, so the counts
+ * are cumulative and a re-shown record after a seq_file overflow is exact.
+ */
+struct blkg_lat_hist_set {
+	struct blkg_lat_hist		cur;
+	/* for freeing both once the histograms are switched off */
+	struct blkg_lat_hist __percpu	*cpu;
+	struct rcu_head			rcu_head;
+};
 static struct workqueue_struct *blkcg_punt_bio_wq;
 
 #define BLKG_DESTROY_BATCH_SIZE  64
@@ -65,6 +90,21 @@ static bool blkcg_policy_enabled(struct request_queue *q,
 	return pol && test_bit(pol->plid, q->blkcg_pols);
 }
 
+/* histograms are optional, go without them rather than fail */
+static void blkg_alloc_lat_hist(struct blkcg_gq *blkg, struct request_queue *q,
+				gfp_t gfp_mask)
+{
+	blkg->lat_hist_cpu = alloc_percpu_gfp(struct blkg_lat_hist, gfp_mask);
+	blkg->lat_hist = kzalloc_node(sizeof(*blkg->lat_hist), gfp_mask,
+				      q->node);
+	if (!blkg->lat_hist_cpu || !blkg->lat_hist) {
+		free_percpu(blkg->lat_hist_cpu);
+		kfree(blkg->lat_hist);
+		blkg->lat_hist_cpu = NULL;
+		blkg->lat_hist = NULL;
+	}
+}
+
 /**
  * blkg_free - free a blkg
  * @blkg: blkg to free
@@ -83,6 +123,8 @@ static void blkg_free(struct blkcg_gq *blkg)
 			blkcg_policy[i]->pd_free_fn(blkg->pd[i]);
 
 	free_percpu(blkg->iostat_cpu);
+	free_percpu(blkg->lat_hist_cpu);
+	kfree(blkg->lat_hist);
 	percpu_ref_exit(&blkg->refcnt);
 	kfree(blkg);
 }
@@ -167,6 +209,9 @@ static struct blkcg_gq *blkg_alloc(struct blkcg *blkcg, struct request_queue *q,
 	if (!blkg->iostat_cpu)
 		goto err_free;
 
+	if (test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags))
+		blkg_alloc_lat_hist(blkg, q, gfp_mask);
+
 	blkg->q = q;
 	INIT_LIST_HEAD(&blkg->q_node);
 	spin_lock_init(&blkg->async_bio_lock);
@@ -262,6 +307,21 @@ static struct blkcg_gq *blkg_create(struct blkcg *blkcg,
 	}
 	blkg = new_blkg;
 
+	/*
+	 * The histograms may have been switched on or off since @blkg was
+	 * allocated.  blkcg_lat_hist_store() only sees blkgs on blkg_list,
+	 * so settle them here, under the queue_lock, before the insertion.
+	 */
+	if (test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags)) {
+		if (!blkg->lat_hist_cpu)
+			blkg_alloc_lat_hist(blkg, q, GFP_NOWAIT | __GFP_NOWARN);
+	} else if (blkg->lat_hist_cpu) {
+		free_percpu(blkg->lat_hist_cpu);
+		kfree(blkg->lat_hist);
+		blkg->lat_hist_cpu = NULL;
+		blkg->lat_hist = NULL;
+	}
+
 	/* link parent */
 	if (blkcg_parent(blkcg)) {
 		blkg->parent = __blkg_lookup(blkcg_parent(blkcg), q, false);
@@ -886,6 +946,65 @@ static void blkcg_fill_root_iostats(void)
 	}
 }
 
+static const char blkg_lat_op[BLKG_IOSTAT_NR] = {
+	[BLKG_IOSTAT_READ]	= 'r',
+	[BLKG_IOSTAT_WRITE]	= 'w',
+	[BLKG_IOSTAT_DISCARD]	= 'd',
+};
+
+static const char *const blkg_lat_name[BLKG_LAT_NR] = {
+	[BLKG_LAT_QUEUE]	= "queue",
+	[BLKG_LAT_DEV]		= "dev",
+	[BLKG_LAT_TOTAL]	= "total",
+};
+
+/*
+ * Print the histogram buckets which saw any IOs as
+ * "rlat_dev=LOWER_USECS:NR,LOWER_USECS:NR,...".
+ */
+static size_t blkg_print_lat_hist(struct blkcg_gq *blkg, char *buf,
+				  size_t size)
+{
+	struct blkg_lat_hist_set *hs = blkg->lat_hist;
+	size_t off = 0;
+	int cpu, rwd, t, b;
+
+	memset(&hs->cur, 0, sizeof(hs->cur));
+	for_each_possible_cpu(cpu) {
+		struct blkg_lat_hist *h = per_cpu_ptr(blkg->lat_hist_cpu, cpu);
+
+		for (t = 0; t < BLKG_LAT_NR; t++)
+			for (rwd = 0; rwd < BLKG_IOSTAT_NR; rwd++)
+				for (b = 0; b < BLK_LAT_HIST_BUCKETS; b++)
+					hs->cur.cnt[t][rwd][b] +=
+						h->cnt[t][rwd][b];
+	}
+
+	for (rwd = 0; rwd < BLKG_IOSTAT_NR; rwd++) {
+		for (t = 0; t < BLKG_LAT_NR; t++) {
+			char sep = '=';
+
+			for (b = 0; b < BLK_LAT_HIST_BUCKETS; b++) {
+				u32 nr = hs->cur.cnt[t][rwd][b];
+
+				if (!nr)
+					continue;
+				if (sep == '=')
+					off += scnprintf(buf+off, size-off,
+							 " %clat_%s",
+							 blkg_lat_op[rwd],
+							 blkg_lat_name[t]);
+				off += scnprintf(buf+off, size-off, "%c%llu:%u",
+						 sep, blk_lat_hist_bucket_usecs(b),
+						 nr);
+				sep = ',';
+			}
+		}
+	}
+
+	return off;
+}
+
 static int blkcg_print_stat(struct seq_file *sf, void *v)
 {
 	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
@@ -952,6 +1071,15 @@ static int blkcg_print_stat(struct seq_file *sf, void *v)
 					(unsigned long long)atomic64_read(&blkg->delay_nsec));
 		}
 
+		if (blkg->lat_hist) {
+			size_t written;
+
+			written = blkg_print_lat_hist(blkg, buf+off, size-off);
+			if (written)
+				has_stats = true;
+			off += written;
+		}
+
 		for (i = 0; i < BLKCG_MAX_POLS; i++) {
 			struct blkcg_policy *pol = blkcg_policy[i];
 			size_t written;
@@ -1217,17 +1345,23 @@ int blkcg_init_queue(struct request_queue *q)
 	if (preloaded)
 		radix_tree_preload_end();
 
-	ret = blk_throtl_init(q);
+	ret = blk_ioprio_init(q);
 	if (ret)
 		goto err_destroy_all;
 
+	ret = blk_throtl_init(q);
+	if (ret)
+		goto err_qos_exit;
+
 	ret = blk_iolatency_init(q);
 	if (ret) {
 		blk_throtl_exit(q);
-		goto err_destroy_all;
+		goto err_qos_exit;
 	}
 	return 0;
 
+err_qos_exit:
+	rq_qos_exit(q);
 err_destroy_all:
 	blkg_destroy_all(q);
 	return ret;
@@ -1972,6 +2106,145 @@ void blk_cgroup_bio_start(struct bio *bio)
 	put_cpu();
 }
 
+/*
+ * Account a completed bio in the latency histograms of its blkg.  The total
+ * latency starts when the bio entered the block layer, so it includes time
+ * spent throttled or waiting for a request.
+ */
+void __blkcg_bio_lat_done(struct request *rq, struct bio *bio)
+{
+	struct blkg_lat_hist __percpu *hist;
+	int rwd = blk_cgroup_io_type(bio);
+	u64 now, issue, dev, total;
+
+	if (!rq->io_start_time_ns)
+		return;
+
+	/*
+	 * Pairs with the release in blkcg_alloc_lat_hists().  Switching the
+	 * histograms off frees them after a grace period.
+	 */
+	rcu_read_lock();
+	hist = smp_load_acquire(&bio->bi_blkg->lat_hist_cpu);
+	if (!hist)
+		goto out;
+
+	now = ktime_get_ns();
+	dev = now > rq->io_start_time_ns ? now - rq->io_start_time_ns : 0;
+
+	/* bi_issue only keeps the low bits of the time */
+	issue = bio_issue_time(&bio->bi_issue);
+	total = __bio_issue_time(now);
+	total = total > issue ? total - issue : 0;
+	total = max(total, dev);
+
+	this_cpu_inc(hist->cnt[BLKG_LAT_QUEUE][rwd]
+			      [blk_lat_hist_bucket(total - dev)]);
+	this_cpu_inc(hist->cnt[BLKG_LAT_DEV][rwd][blk_lat_hist_bucket(dev)]);
+	this_cpu_inc(hist->cnt[BLKG_LAT_TOTAL][rwd][blk_lat_hist_bucket(total)]);
+out:
+	rcu_read_unlock();
+}
+
+/* give every blkg of @q which doesn't have them yet its histograms */
+static int blkcg_alloc_lat_hists(struct request_queue *q)
+{
+	struct blkg_lat_hist __percpu *hist_cpu = NULL;
+	struct blkg_lat_hist_set *hist = NULL;
+	struct blkcg_gq *blkg;
+	int ret = 0;
+
+	while (true) {
+		if (!hist_cpu)
+			hist_cpu = alloc_percpu(struct blkg_lat_hist);
+		if (!hist)
+			hist = kzalloc_node(sizeof(*hist), GFP_KERNEL, q->node);
+		if (!hist_cpu || !hist) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		spin_lock_irq(&q->queue_lock);
+		list_for_each_entry(blkg, &q->blkg_list, q_node) {
+			if (blkg->lat_hist_cpu)
+				continue;
+			blkg->lat_hist = hist;
+			smp_store_release(&blkg->lat_hist_cpu, hist_cpu);
+			hist = NULL;
+			hist_cpu = NULL;
+			break;
+		}
+		spin_unlock_irq(&q->queue_lock);
+
+		/* nothing left to install into */
+		if (hist)
+			break;
+	}
+
+	free_percpu(hist_cpu);
+	kfree(hist);
+	return ret;
+}
+
+static void blkg_lat_hist_free_rcu(struct rcu_head *rcu)
+{
+	struct blkg_lat_hist_set *hist =
+		container_of(rcu, struct blkg_lat_hist_set, rcu_head);
+
+	free_percpu(hist->cpu);
+	kfree(hist);
+}
+
+/* take the histograms away from every blkg of @q */
+static void blkcg_free_lat_hists(struct request_queue *q)
+{
+	struct blkcg_gq *blkg;
+
+	spin_lock_irq(&q->queue_lock);
+	list_for_each_entry(blkg, &q->blkg_list, q_node) {
+		struct blkg_lat_hist_set *hist = blkg->lat_hist;
+
+		if (!hist)
+			continue;
+		hist->cpu = blkg->lat_hist_cpu;
+		WRITE_ONCE(blkg->lat_hist_cpu, NULL);
+		blkg->lat_hist = NULL;
+		call_rcu(&hist->rcu_head, blkg_lat_hist_free_rcu);
+	}
+	spin_unlock_irq(&q->queue_lock);
+}
+
+ssize_t blkcg_lat_hist_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%d\n",
+		       test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags));
+}
+
+ssize_t blkcg_lat_hist_store(struct request_queue *q, const char *page,
+			     size_t count)
+{
+	bool enable;
+	int ret;
+
+	if (kstrtobool(page, &enable))
+		return -EINVAL;
+
+	if (!enable) {
+		blk_queue_flag_clear(QUEUE_FLAG_LAT_HIST, q);
+		blkcg_free_lat_hists(q);
+		return count;
+	}
+
+	/* the device latency needs rq->io_start_time_ns */
+	blk_stat_enable_accounting(q);
+	blk_queue_flag_set(QUEUE_FLAG_LAT_HIST, q);
+
+	ret = blkcg_alloc_lat_hists(q);
+	if (ret)
+		return ret;
+	return count;
+}
+
 static int __init blkcg_init(void)
 {
 	blkcg_punt_bio_wq = alloc_workqueue("blkcg_punt_bio",
@@ -274,8 +274,10 @@ static void req_bio_endio(struct request *rq, struct bio *bio,
 	}
 
 	/* don't actually finish bio if it's part of flush sequence */
-	if (bio->bi_iter.bi_size == 0 && !(rq->rq_flags & RQF_FLUSH_SEQ))
+	if (bio->bi_iter.bi_size == 0 && !(rq->rq_flags & RQF_FLUSH_SEQ)) {
+		blkcg_bio_lat_done(rq, bio);
 		bio_endio(bio);
+	}
 }
 
 void blk_dump_rq_flags(struct request *rq, char *msg)
@@ -1753,18 +1755,19 @@ int kblockd_mod_delayed_work_on(int cpu, struct delayed_work *dwork,
 EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
 
 /**
- * blk_start_plug - initialize blk_plug and track it inside the task_struct
+ * blk_start_plug_nr_ios - initialize blk_plug with a hint of the batch size
  * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of I/Os the caller expects to submit under the plug
  *
  * Description:
- *   blk_start_plug() indicates to the block layer an intent by the caller
- *   to submit multiple I/O requests in a batch.  The block layer may use
- *   this hint to defer submitting I/Os from the caller until blk_finish_plug()
- *   is called.  However, the block layer may choose to submit requests
- *   before a call to blk_finish_plug() if the number of queued I/Os
- *   exceeds %BLK_MAX_REQUEST_COUNT, or if the size of the I/O is larger than
- *   %BLK_PLUG_FLUSH_SIZE.  The queued I/Os may also be submitted early if
- *   the task schedules (see below).
+ *   blk_start_plug_nr_ios() indicates to the block layer an intent by the
+ *   caller to submit multiple I/O requests in a batch.  The block layer may
+ *   use this hint to defer submitting I/Os from the caller until
+ *   blk_finish_plug() is called.  However, the block layer may choose to
+ *   submit requests before a call to blk_finish_plug() if the number of
+ *   queued I/Os exceeds %BLK_MAX_REQUEST_COUNT, or if the size of the I/O
+ *   is larger than %BLK_PLUG_FLUSH_SIZE.  The queued I/Os may also be
+ *   submitted early if the task schedules (see below).
  *
  *   Tracking blk_plug inside the task_struct will help with auto-flushing the
  *   pending I/O should the task end up blocking between blk_start_plug() and
@@ -1774,8 +1777,12 @@ EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
  *   page belonging to that request that is currently residing in our private
  *   plug. By flushing the pending I/O when the process goes to sleep, we avoid
  *   this kind of deadlock.
+ *
+ *   If @nr_ios is larger than one, blk-mq may allocate that many requests
+ *   at once for a queue and keep the unused ones with the plug until it is
+ *   flushed.
  */
-void blk_start_plug(struct blk_plug *plug)
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned int nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -1790,6 +1797,7 @@ void blk_start_plug(struct blk_plug *plug)
 	plug->rq_count = 0;
 	plug->multiple_queues = false;
 	plug->nowait = false;
+	plug->nr_ios = min_t(unsigned int, nr_ios, BLK_MAX_REQUEST_COUNT);
 
 	/*
 	 * Store ordering should not be needed here, since a potential
@@ -1797,6 +1805,19 @@ void blk_start_plug(struct blk_plug *plug)
 	 */
 	tsk->plug = plug;
 }
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
+
+/**
+ * blk_start_plug - initialize blk_plug and track it inside the task_struct
+ * @plug:	The &struct blk_plug that needs to be initialized
+ *
+ * See blk_start_plug_nr_ios(), for a caller that doesn't know how many
+ * I/Os it is going to submit.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
 EXPORT_SYMBOL(blk_start_plug);
 
 static void flush_plug_callbacks(struct blk_plug *plug, bool from_schedule)
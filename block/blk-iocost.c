@@ -46,6 +46,16 @@
  * If needed, tools/cgroup/iocost_coef_gen.py can be used to generate
  * device-specific coefficients.
  *
+ * The coefficients can also be learned online from the IOs the device
+ * completes.  Writing "MAJ:MIN start [duration=SECS]" to
+ * /sys/fs/cgroup/io.cost.calibrate samples the completions once a second
+ * for the given duration and, for each of the six model parameters, keeps
+ * the highest rate seen in samples made up of that kind of IO.  Rates seen
+ * while the device was saturated replace the current parameter, others
+ * can only raise it.  pct(90) completion latencies are proposed as QoS
+ * targets.  The proposal is shown in io.cost.calibrate for review and only
+ * takes effect on "MAJ:MIN apply".
+ *
  * 2. Control Strategy
  *
  * The device virtual time (vtime) is used as the primary control metric.
@@ -257,6 +267,7 @@ enum {
 	VRATE_MAX_PPM		= 100000000,	/* 10000% */
 
 	VRATE_MIN		= VTIME_PER_USEC * VRATE_MIN_PPM / MILLION,
+	VRATE_MAX		= VTIME_PER_USEC * VRATE_MAX_PPM / MILLION,
 	VRATE_CLAMP_ADJ_PCT	= 4,
 
 	/* switch iff the conditions are met for longer than this */
@@ -315,6 +326,27 @@ enum {
 	LCOEF_RANDIO_PAGES	= 4096,
 };
 
+enum {
+	/* calibration samples once a second for at most ten minutes */
+	CALIB_SAMPLE_MSEC	= MSEC_PER_SEC,
+	CALIB_DFL_SECS		= 30,
+	CALIB_MAX_SECS		= 600,
+
+	/*
+	 * A sample measures one of the model parameters if at least 90% of
+	 * its IOs (or pages for bandwidth) are of the matching kind.
+	 * Sequential IOs of 128k and up measure bandwidth.
+	 */
+	CALIB_PURE_PCT		= 90,
+	CALIB_MIN_IOS		= 100,
+	CALIB_BIG_PAGES		= 32,
+
+	/* latency buckets are powers of two in usecs, up to ~8s */
+	CALIB_LAT_BUCKETS	= 24,
+	CALIB_LAT_PPM		= 900000,
+	CALIB_MIN_LAT_IOS	= 1000,
+};
+
 enum ioc_running {
 	IOC_IDLE,
 	IOC_RUNNING,
@@ -346,6 +378,32 @@ enum {
 	NR_COST_CTRL_PARAMS,
 };
 
+/* io.cost.calibrate commands */
+enum {
+	CALIB_START,
+	CALIB_STOP,
+	CALIB_APPLY,
+	CALIB_DURATION,
+	NR_CALIB_PARAMS,
+};
+
+/* per-cpu completion counters used by calibration */
+enum {
+	CALIB_STAT_IOS,
+	CALIB_STAT_PAGES,
+	CALIB_STAT_SEQIOS,		/* 4k sequential */
+	CALIB_STAT_RANDIOS,		/* 4k random */
+	CALIB_STAT_SEQ_PAGES,		/* pages of big sequential IOs */
+	CALIB_STAT_MISSED,		/* missed the latency target */
+	NR_CALIB_STATS,
+};
+
+enum ioc_calib_state {
+	IOC_CALIB_IDLE,
+	IOC_CALIB_RUNNING,
+	IOC_CALIB_DONE,
+};
+
 /* builtin linear cost model coefficients */
 enum {
 	I_LCOEF_RBPS,
@@ -405,6 +463,41 @@ struct ioc_pcpu_stat {
 	u64				last_rq_wait_ns;
 };
 
+struct ioc_calib_pcpu_stat {
+	local64_t			stat[2][NR_CALIB_STATS];
+	local64_t			lat[2][CALIB_LAT_BUCKETS];
+	local64_t			rq_wait_ns;
+	sector_t			cursor;
+};
+
+/* highest rate seen for one of the I_LCOEF_* parameters */
+struct ioc_calib_class {
+	u64				max_rate;
+	u64				max_busy_rate;
+	u32				nr_samples;
+	u32				nr_busy;
+};
+
+struct ioc_calib {
+	enum ioc_calib_state		state;
+	struct timer_list		timer;
+	struct ioc_calib_pcpu_stat __percpu *pcpu_stat;
+
+	u32				nr_samples;
+	u32				samples_done;
+	u32				nr_busy;
+	u64				sample_at;	/* ns */
+	u64				last_stat[2][NR_CALIB_STATS];
+	u64				last_rq_wait_ns;
+	u64				lat_base[2][CALIB_LAT_BUCKETS];
+
+	struct ioc_calib_class		cls[NR_I_LCOEFS];
+
+	/* the proposal, valid in IOC_CALIB_DONE */
+	u64				i_lcoefs[NR_I_LCOEFS];
+	u32				qos[NR_QOS_PARAMS];
+};
+
 /* per device */
 struct ioc {
 	struct rq_qos			rqos;
@@ -448,6 +541,8 @@ struct ioc {
 	int				autop_idx;
 	bool				user_qos_params:1;
 	bool				user_cost_model:1;
+
+	struct ioc_calib		calib;
 };
 
 struct iocg_pcpu_stat {
@@ -2372,6 +2467,10 @@ static void ioc_timer_fn(struct timer_list *timer)
 		u64 vrate = ioc->vtime_base_rate;
 		u64 vrate_min = ioc->vrate_min, vrate_max = ioc->vrate_max;
 
+		/* don't let a low max hide the device capacity from calibration */
+		if (ioc->calib.state == IOC_CALIB_RUNNING)
+			vrate_max = VRATE_MAX;
+
 		/*
 		 * If vrate is out of bounds, apply clamp gradually as the
 		 * bounds can change abruptly.  Otherwise, apply busy_level
@@ -2435,6 +2534,293 @@ static void ioc_timer_fn(struct timer_list *timer)
 	spin_unlock_irq(&ioc->lock);
 }
 
+/* sum up the calibration counters of all cpus */
+static void ioc_calib_sum(struct ioc_calib *calib,
+			  u64 stat[2][NR_CALIB_STATS], u64 *rq_wait_ns,
+			  u64 lat[2][CALIB_LAT_BUCKETS])
+{
+	int cpu, rw, i;
+
+	if (stat)
+		memset(stat, 0, sizeof(u64) * 2 * NR_CALIB_STATS);
+	if (rq_wait_ns)
+		*rq_wait_ns = 0;
+	if (lat)
+		memset(lat, 0, sizeof(u64) * 2 * CALIB_LAT_BUCKETS);
+
+	for_each_possible_cpu(cpu) {
+		struct ioc_calib_pcpu_stat *cs =
+			per_cpu_ptr(calib->pcpu_stat, cpu);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			for (i = 0; stat && i < NR_CALIB_STATS; i++)
+				stat[rw][i] += local64_read(&cs->stat[rw][i]);
+			for (i = 0; lat && i < CALIB_LAT_BUCKETS; i++)
+				lat[rw][i] += local64_read(&cs->lat[rw][i]);
+		}
+		if (rq_wait_ns)
+			*rq_wait_ns += local64_read(&cs->rq_wait_ns);
+	}
+}
+
+static void ioc_calib_account(struct ioc *ioc, struct request *rq, int rw,
+			      u64 lat_ns, u64 rq_wait_ns, bool missed)
+{
+	struct ioc_calib_pcpu_stat *cs = this_cpu_ptr(ioc->calib.pcpu_stat);
+	u64 sectors = blk_rq_stats_sectors(rq);
+	u64 pages = max_t(u64, sectors >> IOC_SECT_TO_PAGE_SHIFT, 1);
+	u64 seek_pages = 0;
+	sector_t start;
+	int bucket;
+
+	/* a completed request has been advanced past what it transferred */
+	start = blk_rq_pos(rq) + blk_rq_sectors(rq) - sectors;
+
+	if (cs->cursor) {
+		seek_pages = abs(start - cs->cursor);
+		seek_pages >>= IOC_SECT_TO_PAGE_SHIFT;
+	}
+	cs->cursor = start + sectors;
+
+	local64_inc(&cs->stat[rw][CALIB_STAT_IOS]);
+	local64_add(pages, &cs->stat[rw][CALIB_STAT_PAGES]);
+
+	if (seek_pages > LCOEF_RANDIO_PAGES) {
+		if (pages == 1)
+			local64_inc(&cs->stat[rw][CALIB_STAT_RANDIOS]);
+	} else {
+		if (pages == 1)
+			local64_inc(&cs->stat[rw][CALIB_STAT_SEQIOS]);
+		else if (pages >= CALIB_BIG_PAGES)
+			local64_add(pages, &cs->stat[rw][CALIB_STAT_SEQ_PAGES]);
+	}
+
+	if (missed)
+		local64_inc(&cs->stat[rw][CALIB_STAT_MISSED]);
+	local64_add(rq_wait_ns, &cs->rq_wait_ns);
+
+	bucket = min_t(int, fls64(div_u64(lat_ns, NSEC_PER_USEC)),
+		       CALIB_LAT_BUCKETS - 1);
+	local64_inc(&cs->lat[rw][bucket]);
+}
+
+static void ioc_calib_update(struct ioc_calib_class *cls, u64 count,
+			     u64 dur_us, bool busy)
+{
+	u64 rate = div64_u64(count * USEC_PER_SEC, dur_us);
+
+	cls->nr_samples++;
+	cls->max_rate = max(cls->max_rate, rate);
+	if (busy) {
+		cls->nr_busy++;
+		cls->max_busy_rate = max(cls->max_busy_rate, rate);
+	}
+}
+
+/*
+ * Classify the completions of the last sample.  The device is considered
+ * saturated by the same rq wait and latency criteria ioc_timer_fn() uses.
+ */
+static void ioc_calib_sample(struct ioc *ioc, u64 stat[2][NR_CALIB_STATS],
+			     u64 rq_wait_ns, u64 dur_ns)
+{
+	struct ioc_calib *calib = &ioc->calib;
+	u64 d[2][NR_CALIB_STATS];
+	u64 ios, pages, dur_us = div_u64(dur_ns, NSEC_PER_USEC);
+	bool busy;
+	int rw, i;
+
+	lockdep_assert_held(&ioc->lock);
+
+	for (rw = READ; rw <= WRITE; rw++)
+		for (i = 0; i < NR_CALIB_STATS; i++)
+			d[rw][i] = stat[rw][i] - calib->last_stat[rw][i];
+
+	ios = d[READ][CALIB_STAT_IOS] + d[WRITE][CALIB_STAT_IOS];
+	pages = d[READ][CALIB_STAT_PAGES] + d[WRITE][CALIB_STAT_PAGES];
+	if (ios < CALIB_MIN_IOS || !dur_us)
+		return;
+
+	busy = div64_u64((rq_wait_ns - calib->last_rq_wait_ns) * 100,
+			 dur_ns) > RQ_WAIT_BUSY_PCT;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		u32 ppm = ioc->params.qos[rw == READ ? QOS_RPPM : QOS_WPPM];
+
+		if (ppm && d[rw][CALIB_STAT_IOS] &&
+		    div64_u64(d[rw][CALIB_STAT_MISSED] * MILLION,
+			      d[rw][CALIB_STAT_IOS]) > MILLION - ppm)
+			busy = true;
+	}
+
+	if (busy)
+		calib->nr_busy++;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		struct ioc_calib_class *cls = &calib->cls[rw == READ ?
+						I_LCOEF_RBPS : I_LCOEF_WBPS];
+
+		/* the bps, seqiops and randiops classes are consecutive */
+		if (d[rw][CALIB_STAT_SEQ_PAGES] * 100 >= pages * CALIB_PURE_PCT)
+			ioc_calib_update(&cls[0],
+					 d[rw][CALIB_STAT_PAGES] * IOC_PAGE_SIZE,
+					 dur_us, busy);
+		if (d[rw][CALIB_STAT_SEQIOS] * 100 >= ios * CALIB_PURE_PCT)
+			ioc_calib_update(&cls[1], d[rw][CALIB_STAT_IOS],
+					 dur_us, busy);
+		if (d[rw][CALIB_STAT_RANDIOS] * 100 >= ios * CALIB_PURE_PCT)
+			ioc_calib_update(&cls[2], d[rw][CALIB_STAT_IOS],
+					 dur_us, busy);
+	}
+}
+
+/* turn what was seen into a proposed cost model and QoS targets */
+static void ioc_calib_finish(struct ioc *ioc)
+{
+	struct ioc_calib *calib = &ioc->calib;
+	u64 lat[2][CALIB_LAT_BUCKETS];
+	int i, rw;
+
+	lockdep_assert_held(&ioc->lock);
+
+	for (i = 0; i < NR_I_LCOEFS; i++) {
+		struct ioc_calib_class *cls = &calib->cls[i];
+
+		if (cls->nr_busy)
+			calib->i_lcoefs[i] = cls->max_busy_rate;
+		else
+			calib->i_lcoefs[i] = max(ioc->params.i_lcoefs[i],
+						 cls->max_rate);
+	}
+
+	memcpy(calib->qos, ioc->params.qos, sizeof(calib->qos));
+	ioc_calib_sum(calib, NULL, NULL, lat);
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		u64 total = 0, sum = 0;
+
+		for (i = 0; i < CALIB_LAT_BUCKETS; i++) {
+			lat[rw][i] -= calib->lat_base[rw][i];
+			total += lat[rw][i];
+		}
+		if (total < CALIB_MIN_LAT_IOS)
+			continue;
+
+		for (i = 0; i < CALIB_LAT_BUCKETS - 1; i++) {
+			sum += lat[rw][i];
+			if (sum * MILLION >= total * CALIB_LAT_PPM)
+				break;
+		}
+
+		/* bucket i holds latencies below 2^i usecs */
+		calib->qos[rw == READ ? QOS_RPPM : QOS_WPPM] = CALIB_LAT_PPM;
+		calib->qos[rw == READ ? QOS_RLAT : QOS_WLAT] = 1U << i;
+	}
+
+	calib->state = IOC_CALIB_DONE;
+	if (!ioc->enabled)
+		blk_queue_flag_clear(QUEUE_FLAG_RQ_ALLOC_TIME, ioc->rqos.q);
+}
+
+static void ioc_calib_timer_fn(struct timer_list *timer)
+{
+	struct ioc *ioc = container_of(timer, struct ioc, calib.timer);
+	struct ioc_calib *calib = &ioc->calib;
+	u64 stat[2][NR_CALIB_STATS];
+	u64 rq_wait_ns, now_ns;
+
+	spin_lock_irq(&ioc->lock);
+
+	if (calib->state != IOC_CALIB_RUNNING)
+		goto out_unlock;
+
+	ioc_calib_sum(calib, stat, &rq_wait_ns, NULL);
+	now_ns = ktime_get_ns();
+	ioc_calib_sample(ioc, stat, rq_wait_ns, now_ns - calib->sample_at);
+
+	memcpy(calib->last_stat, stat, sizeof(calib->last_stat));
+	calib->last_rq_wait_ns = rq_wait_ns;
+	calib->sample_at = now_ns;
+
+	if (++calib->samples_done >= calib->nr_samples)
+		ioc_calib_finish(ioc);
+	else
+		mod_timer(&calib->timer,
+			  jiffies + msecs_to_jiffies(CALIB_SAMPLE_MSEC));
+out_unlock:
+	spin_unlock_irq(&ioc->lock);
+}
+
+static int ioc_calib_start(struct ioc *ioc, u32 secs)
+{
+	struct ioc_calib *calib = &ioc->calib;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (calib->state == IOC_CALIB_RUNNING)
+		return -EBUSY;
+
+	memset(calib->cls, 0, sizeof(calib->cls));
+	calib->nr_samples = secs * MSEC_PER_SEC / CALIB_SAMPLE_MSEC;
+	calib->samples_done = 0;
+	calib->nr_busy = 0;
+	ioc_calib_sum(calib, calib->last_stat, &calib->last_rq_wait_ns,
+		      calib->lat_base);
+	calib->sample_at = ktime_get_ns();
+
+	blk_stat_enable_accounting(ioc->rqos.q);
+	blk_queue_flag_set(QUEUE_FLAG_RQ_ALLOC_TIME, ioc->rqos.q);
+
+	/* pairs with the acquire in ioc_rqos_done(), publishes pcpu_stat */
+	smp_store_release(&calib->state, IOC_CALIB_RUNNING);
+	mod_timer(&calib->timer, jiffies + msecs_to_jiffies(CALIB_SAMPLE_MSEC));
+	return 0;
+}
+
+static void ioc_calib_stop(struct ioc *ioc)
+{
+	struct ioc_calib *calib = &ioc->calib;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (calib->state != IOC_CALIB_RUNNING)
+		return;
+
+	calib->state = IOC_CALIB_IDLE;
+	del_timer(&calib->timer);
+	if (!ioc->enabled)
+		blk_queue_flag_clear(QUEUE_FLAG_RQ_ALLOC_TIME, ioc->rqos.q);
+}
+
+static int ioc_calib_apply(struct ioc *ioc)
+{
+	struct ioc_calib *calib = &ioc->calib;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (calib->state != IOC_CALIB_DONE)
+		return -EINVAL;
+
+	memcpy(ioc->params.i_lcoefs, calib->i_lcoefs,
+	       sizeof(ioc->params.i_lcoefs));
+	ioc->params.qos[QOS_RPPM] = calib->qos[QOS_RPPM];
+	ioc->params.qos[QOS_RLAT] = calib->qos[QOS_RLAT];
+	ioc->params.qos[QOS_WPPM] = calib->qos[QOS_WPPM];
+	ioc->params.qos[QOS_WLAT] = calib->qos[QOS_WLAT];
+	ioc->user_cost_model = true;
+	ioc->user_qos_params = true;
+
+	/*
+	 * vrate was compensating for the old model, start the new one from
+	 * 100% and let the busy feedback take it from there.
+	 */
+	ioc->vtime_base_rate = VTIME_PER_USEC;
+	atomic64_set(&ioc->vtime_rate, VTIME_PER_USEC);
+
+	ioc_refresh_params(ioc, true);
+	return 0;
+}
+
 static u64 adjust_inuse_and_calc_cost(struct ioc_gq *iocg, u64 vtime,
 				      u64 abs_cost, struct ioc_now *now)
 {
@@ -2778,12 +3164,15 @@ static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 	u64 on_q_ns, rq_wait_ns, size_nsec;
 	int pidx, rw;
 	struct request_wrapper *rq_wrapper;
+	bool calib, missed;
 
 	if (WARN_ON_ONCE(!(rq->rq_flags & RQF_FROM_BLOCK)))
 		return;
 
 	rq_wrapper = request_to_wrapper(rq);
-	if (!ioc->enabled || !rq_wrapper->alloc_time_ns || !rq->start_time_ns)
+	calib = smp_load_acquire(&ioc->calib.state) == IOC_CALIB_RUNNING;
+	if ((!ioc->enabled && !calib) || !rq_wrapper->alloc_time_ns ||
+	    !rq->start_time_ns)
 		return;
 
 	switch (req_op(rq) & REQ_OP_MASK) {
@@ -2803,15 +3192,24 @@ static void ioc_rqos_done(struct rq_qos *rqos, struct request *rq)
 	rq_wait_ns = rq->start_time_ns - rq_wrapper->alloc_time_ns;
 	size_nsec = div64_u64(calc_size_vtime_cost(rq, ioc), VTIME_PER_NSEC);
 
+	missed = on_q_ns > size_nsec &&
+		 on_q_ns - size_nsec > ioc->params.qos[pidx] * NSEC_PER_USEC;
+
 	ccs = get_cpu_ptr(ioc->pcpu_stat);
 
-	if (on_q_ns <= size_nsec ||
-	    on_q_ns - size_nsec <= ioc->params.qos[pidx] * NSEC_PER_USEC)
-		local_inc(&ccs->missed[rw].nr_met);
-	else
-		local_inc(&ccs->missed[rw].nr_missed);
+	if (ioc->enabled) {
+		if (!missed)
+			local_inc(&ccs->missed[rw].nr_met);
+		else
+			local_inc(&ccs->missed[rw].nr_missed);
 
-	local64_add(rq_wait_ns, &ccs->rq_wait_ns);
+		local64_add(rq_wait_ns, &ccs->rq_wait_ns);
+	}
+
+	if (calib)
+		ioc_calib_account(ioc, rq, rw,
+				  on_q_ns > size_nsec ? on_q_ns - size_nsec : 0,
+				  rq_wait_ns, missed);
 
 	put_cpu_ptr(ccs);
 }
@@ -2833,9 +3231,12 @@ static void ioc_rqos_exit(struct rq_qos *rqos)
 
 	spin_lock_irq(&ioc->lock);
 	ioc->running = IOC_STOP;
+	ioc->calib.state = IOC_CALIB_IDLE;
 	spin_unlock_irq(&ioc->lock);
 
 	del_timer_sync(&ioc->timer);
+	del_timer_sync(&ioc->calib.timer);
+	free_percpu(ioc->calib.pcpu_stat);
 	free_percpu(ioc->pcpu_stat);
 	kfree(ioc);
 }
@@ -2882,6 +3283,7 @@ static int blk_iocost_init(struct request_queue *q)
 
 	spin_lock_init(&ioc->lock);
 	timer_setup(&ioc->timer, ioc_timer_fn, 0);
+	timer_setup(&ioc->calib.timer, ioc_calib_timer_fn, 0);
 	INIT_LIST_HEAD(&ioc->active_iocgs);
 
 	ioc->running = IOC_IDLE;
@@ -3305,7 +3707,10 @@ static ssize_t ioc_qos_write(struct kernfs_open_file *of, char *input,
 		blk_queue_flag_set(QUEUE_FLAG_RQ_ALLOC_TIME, ioc->rqos.q);
 		ioc->enabled = true;
 	} else {
-		blk_queue_flag_clear(QUEUE_FLAG_RQ_ALLOC_TIME, ioc->rqos.q);
+		/* calibration still needs the alloc times */
+		if (ioc->calib.state != IOC_CALIB_RUNNING)
+			blk_queue_flag_clear(QUEUE_FLAG_RQ_ALLOC_TIME,
+					     ioc->rqos.q);
 		ioc->enabled = false;
 	}
 
@@ -3458,6 +3863,159 @@ static ssize_t ioc_cost_model_write(struct kernfs_open_file *of, char *input,
 	return ret;
 }
 
+static const char * const calib_state_name[] = {
+	[IOC_CALIB_IDLE]	= "idle",
+	[IOC_CALIB_RUNNING]	= "running",
+	[IOC_CALIB_DONE]	= "done",
+};
+
+static u64 ioc_calibrate_prfill(struct seq_file *sf,
+				struct blkg_policy_data *pd, int off)
+{
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct ioc *ioc = pd_to_iocg(pd)->ioc;
+	struct ioc_calib *calib = &ioc->calib;
+	u64 *u = calib->i_lcoefs;
+	u32 *qos = calib->qos;
+
+	if (!dname)
+		return 0;
+
+	seq_printf(sf, "%s state=%s samples=%u/%u busy=%u",
+		   dname, calib_state_name[calib->state],
+		   calib->samples_done, calib->nr_samples, calib->nr_busy);
+
+	if (calib->state == IOC_CALIB_DONE)
+		seq_printf(sf, " rbps=%llu rseqiops=%llu rrandiops=%llu "
+			   "wbps=%llu wseqiops=%llu wrandiops=%llu "
+			   "rpct=%u.%02u rlat=%u wpct=%u.%02u wlat=%u",
+			   u[I_LCOEF_RBPS], u[I_LCOEF_RSEQIOPS],
+			   u[I_LCOEF_RRANDIOPS], u[I_LCOEF_WBPS],
+			   u[I_LCOEF_WSEQIOPS], u[I_LCOEF_WRANDIOPS],
+			   qos[QOS_RPPM] / 10000, qos[QOS_RPPM] % 10000 / 100,
+			   qos[QOS_RLAT],
+			   qos[QOS_WPPM] / 10000, qos[QOS_WPPM] % 10000 / 100,
+			   qos[QOS_WLAT]);
+
+	seq_putc(sf, '\n');
+	return 0;
+}
+
+static int ioc_calibrate_show(struct seq_file *sf, void *v)
+{
+	struct blkcg *blkcg = css_to_blkcg(seq_css(sf));
+
+	blkcg_print_blkgs(sf, blkcg, ioc_calibrate_prfill,
+			  &blkcg_policy_iocost, seq_cft(sf)->private, false);
+	return 0;
+}
+
+static const match_table_t calib_tokens = {
+	{ CALIB_START,		"start"		},
+	{ CALIB_STOP,		"stop"		},
+	{ CALIB_APPLY,		"apply"		},
+	{ CALIB_DURATION,	"duration=%u"	},
+	{ NR_CALIB_PARAMS,	NULL		},
+};
+
+static ssize_t ioc_calibrate_write(struct kernfs_open_file *of, char *input,
+				   size_t nbytes, loff_t off)
+{
+	struct ioc_calib_pcpu_stat __percpu *pcpu_stat = NULL;
+	int cmd = NR_CALIB_PARAMS;
+	u32 secs = CALIB_DFL_SECS;
+	struct gendisk *disk;
+	struct ioc *ioc;
+	char *p;
+	int ret;
+
+	disk = blkcg_conf_get_disk(&input);
+	if (IS_ERR(disk))
+		return PTR_ERR(disk);
+	if (!queue_is_mq(disk->queue)) {
+		ret = -EOPNOTSUPP;
+		goto err;
+	}
+
+	ioc = q_to_ioc(disk->queue);
+	if (!ioc) {
+		ret = blk_iocost_init(disk->queue);
+		if (ret)
+			goto err;
+		ioc = q_to_ioc(disk->queue);
+	}
+
+	while ((p = strsep(&input, " \t\n"))) {
+		substring_t args[MAX_OPT_ARGS];
+		int tok, v;
+
+		if (!*p)
+			continue;
+
+		tok = match_token(p, calib_tokens, args);
+		switch (tok) {
+		case CALIB_START:
+		case CALIB_STOP:
+		case CALIB_APPLY:
+			if (cmd != NR_CALIB_PARAMS)
+				goto einval;
+			cmd = tok;
+			break;
+		case CALIB_DURATION:
+			if (match_int(&args[0], &v) || v <= 0 ||
+			    v > CALIB_MAX_SECS)
+				goto einval;
+			secs = v;
+			break;
+		default:
+			goto einval;
+		}
+	}
+
+	if (cmd == NR_CALIB_PARAMS)
+		goto einval;
+
+	if (cmd == CALIB_START && !ioc->calib.pcpu_stat) {
+		pcpu_stat = alloc_percpu(struct ioc_calib_pcpu_stat);
+		if (!pcpu_stat) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	ret = 0;
+	spin_lock_irq(&ioc->lock);
+	switch (cmd) {
+	case CALIB_START:
+		if (!ioc->calib.pcpu_stat) {
+			ioc->calib.pcpu_stat = pcpu_stat;
+			pcpu_stat = NULL;
+		}
+		ret = ioc_calib_start(ioc, secs);
+		break;
+	case CALIB_STOP:
+		ioc_calib_stop(ioc);
+		break;
+	case CALIB_APPLY:
+		ret = ioc_calib_apply(ioc);
+		break;
+	}
+	spin_unlock_irq(&ioc->lock);
+
+	free_percpu(pcpu_stat);
+	if (ret)
+		goto err;
+
+	put_disk_and_module(disk);
+	return nbytes;
+
+einval:
+	ret = -EINVAL;
+err:
+	put_disk_and_module(disk);
+	return ret;
+}
+
 static struct cftype ioc_legacy_files[] = {
 	{
 		.name = "cost.weight",
@@ -3477,6 +4035,12 @@ static struct cftype ioc_legacy_files[] = {
 		.seq_show = ioc_cost_model_show,
 		.write = ioc_cost_model_write,
 	},
+	{
+		.name = "cost.calibrate",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_calibrate_show,
+		.write = ioc_calibrate_write,
+	},
 	{}
 };
 
@@ -3499,6 +4063,12 @@ static struct cftype ioc_files[] = {
 		.seq_show = ioc_cost_model_show,
 		.write = ioc_cost_model_write,
 	},
+	{
+		.name = "cost.calibrate",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = ioc_calibrate_show,
+		.write = ioc_calibrate_write,
+	},
 	{}
 };
 
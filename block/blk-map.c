@@ -333,6 +333,66 @@ static int bio_map_user_iov(struct request *rq, struct iov_iter *iter,
 	return ret;
 }
 
+/*
+ * Map a bvec iter, e.g. a registered io_uring buffer, in place. Its pages
+ * stay pinned by the owner for the whole I/O, so no page references are
+ * taken and nothing is dirtied on unmap, which makes blk_rq_unmap_user()
+ * safe from atomic context for such a bio.
+ */
+static int bio_map_user_bvec(struct request *rq, struct iov_iter *iter,
+		gfp_t gfp_mask)
+{
+	unsigned int max_sectors = queue_max_hw_sectors(rq->q);
+	struct bio *bio, *bounce_bio;
+	int ret;
+
+	if (!iov_iter_count(iter))
+		return -EINVAL;
+
+	bio = bio_kmalloc(gfp_mask, iov_iter_npages(iter, BIO_MAX_PAGES));
+	if (!bio)
+		return -ENOMEM;
+	bio->bi_opf |= req_op(rq);
+	bio_set_flag(bio, BIO_NO_PAGE_REF);
+
+	while (iov_iter_count(iter)) {
+		const struct bio_vec *bv = iter->bvec;
+		unsigned int offs = bv->bv_offset + iter->iov_offset;
+		unsigned int len = min_t(size_t, bv->bv_len - iter->iov_offset,
+					 iov_iter_count(iter));
+		bool same_page = false;
+
+		if (unlikely(offs & queue_dma_alignment(rq->q)))
+			break;
+		if (bio_add_hw_page(rq->q, bio, bv->bv_page, len, offs,
+				    max_sectors, &same_page) != len)
+			break;
+		iov_iter_advance(iter, len);
+	}
+
+	/* unlike user pages, these can't be split over several bios */
+	ret = -EINVAL;
+	if (iov_iter_count(iter))
+		goto out_put;
+
+	/* see bio_map_user_iov() for the extra references */
+	bio_get(bio);
+
+	bounce_bio = bio;
+	ret = blk_rq_append_bio(rq, &bounce_bio);
+	if (ret)
+		goto out_put_orig;
+
+	bio_get(bounce_bio);
+	return 0;
+
+ out_put_orig:
+	bio_put(bio);
+ out_put:
+	bio_put(bio);
+	return ret;
+}
+
 /**
  *	bio_unmap_user	-	unmap a bio
  *	@bio:		the bio being unmapped
@@ -559,7 +619,7 @@ EXPORT_SYMBOL(blk_rq_append_bio);
  * @q:		request queue where request should be inserted
  * @rq:		request to map data to
  * @map_data:   pointer to the rq_map_data holding pages (if necessary)
- * @iter:	iovec iterator
+ * @iter:	iovec or bvec iterator
  * @gfp_mask:	memory allocation flags
  *
  * Description:
@@ -585,7 +645,7 @@ int blk_rq_map_user_iov(struct request_queue *q, struct request *rq,
 	struct iov_iter i;
 	int ret = -EINVAL;
 
-	if (!iter_is_iovec(iter))
+	if (!iter_is_iovec(iter) && !iov_iter_is_bvec(iter))
 		goto fail;
 
 	if (map_data)
@@ -595,10 +655,20 @@ int blk_rq_map_user_iov(struct request_queue *q, struct request *rq,
 	else if (queue_virt_boundary(q))
 		copy = queue_virt_boundary(q) & iov_iter_gap_alignment(iter);
 
+	/*
+	 * A bvec iter is mapped in place, see bio_map_user_bvec(). The bounce
+	 * path only deals with user iovecs, so such a buffer has to meet the
+	 * queue limits as is.
+	 */
+	if (copy && iov_iter_is_bvec(iter))
+		goto fail;
+
 	i = *iter;
 	do {
 		if (copy)
 			ret = bio_copy_user_iov(rq, map_data, &i, gfp_mask);
+		else if (iov_iter_is_bvec(&i))
+			ret = bio_map_user_bvec(rq, &i, gfp_mask);
 		else
 			ret = bio_map_user_iov(rq, &i, gfp_mask);
 		if (ret)
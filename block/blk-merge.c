@@ -1085,10 +1085,11 @@ bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
 
 /*
  * Iterate list of requests and see if we can merge this bio with any
- * of them.
+ * of them.  Returns the request @bio was merged into, or NULL.
  */
-bool blk_bio_list_merge(struct request_queue *q, struct list_head *list,
-			struct bio *bio, unsigned int nr_segs)
+struct request *blk_bio_list_merge_rq(struct request_queue *q,
+				      struct list_head *list,
+				      struct bio *bio, unsigned int nr_segs)
 {
 	struct request *rq;
 	int checked = 8;
@@ -1101,14 +1102,21 @@ bool blk_bio_list_merge(struct request_queue *q, struct list_head *list,
 		case BIO_MERGE_NONE:
 			continue;
 		case BIO_MERGE_OK:
-			return true;
+			return rq;
 		case BIO_MERGE_FAILED:
-			return false;
+			return NULL;
 		}
 
 	}
 
-	return false;
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(blk_bio_list_merge_rq);
+
+bool blk_bio_list_merge(struct request_queue *q, struct list_head *list,
+			struct bio *bio, unsigned int nr_segs)
+{
+	return blk_bio_list_merge_rq(q, list, bio, nr_segs) != NULL;
 }
 EXPORT_SYMBOL_GPL(blk_bio_list_merge);
 
@@ -243,6 +243,31 @@ unsigned int blk_mq_get_tag(struct blk_mq_alloc_data *data)
 	return tag + tag_offset;
 }
 
+/*
+ * Grab up to @nr_tags driver tags without sleeping.  Only used for plain
+ * allocations on a queue that doesn't share its tags with anyone, as the
+ * fair share and shallow depth limits are applied one tag at a time.
+ */
+unsigned long blk_mq_get_tags(struct blk_mq_alloc_data *data, int nr_tags,
+			      unsigned int *offset)
+{
+	struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
+	unsigned long ret;
+
+	if (data->shallow_depth || (data->flags & BLK_MQ_REQ_RESERVED) ||
+	    (data->hctx->flags & BLK_MQ_F_TAG_QUEUE_SHARED) ||
+	    blk_mq_is_sbitmap_shared(data->hctx->flags) ||
+	    unlikely(test_bit(BLK_MQ_S_INACTIVE, &data->hctx->state)))
+		return 0;
+
+	ret = __sbitmap_queue_get_batch(&tags->bitmap_tags, nr_tags, offset);
+	/* *offset isn't set when nothing was allocated */
+	if (!ret)
+		return 0;
+	*offset += tags->nr_reserved_tags;
+	return ret;
+}
+
 void blk_mq_put_tag(struct blk_mq_tags *tags, struct blk_mq_ctx *ctx,
 		    unsigned int tag)
 {
@@ -257,6 +282,12 @@ void blk_mq_put_tag(struct blk_mq_tags *tags, struct blk_mq_ctx *ctx,
 	}
 }
 
+void blk_mq_put_tags(struct blk_mq_tags *tags, int *tag_array, int nr_tags)
+{
+	sbitmap_queue_clear_batch(&tags->bitmap_tags, tags->nr_reserved_tags,
+				  tag_array, nr_tags);
+}
+
 struct bt_iter_data {
 	struct blk_mq_hw_ctx *hctx;
 	struct request_queue *q;
@@ -347,11 +347,6 @@ void blk_mq_wake_waiters(struct request_queue *q)
  * Only need start/end time stamping if we have iostat or
  * blk stats enabled, or using an IO scheduler.
  */
-static inline bool blk_mq_need_time_stamp(struct request *rq)
-{
-	return (rq->rq_flags & (RQF_IO_STAT | RQF_STATS)) || rq->q->elevator;
-}
-
 static struct request *blk_mq_rq_ctx_init(struct blk_mq_alloc_data *data,
 		unsigned int tag, u64 alloc_time_ns)
 {
@@ -585,22 +580,12 @@ static void __blk_mq_free_request(struct request *rq)
 	blk_queue_exit(q);
 }
 
-void blk_mq_free_request(struct request *rq)
+static void __blk_mq_finish_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
-	struct elevator_queue *e = q->elevator;
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
 	struct blk_mq_hw_ctx *hctx = rq->mq_hctx;
 
-	if (rq->rq_flags & RQF_ELVPRIV) {
-		if (e && e->type->ops.finish_request)
-			e->type->ops.finish_request(rq);
-		if (rq->elv.icq) {
-			put_io_context(rq->elv.icq->ioc);
-			rq->elv.icq = NULL;
-		}
-	}
-
 	ctx->rq_completed[rq_is_sync(rq)]++;
 	if (rq->rq_flags & RQF_MQ_INFLIGHT) {
 		__blk_mq_dec_active_requests(hctx);
@@ -614,6 +599,23 @@ void blk_mq_free_request(struct request *rq)
 		laptop_io_completion(q->backing_dev_info);
 
 	rq_qos_done(q, rq);
+}
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct elevator_queue *e = q->elevator;
+
+	if (rq->rq_flags & RQF_ELVPRIV) {
+		if (e && e->type->ops.finish_request)
+			e->type->ops.finish_request(rq);
+		if (rq->elv.icq) {
+			put_io_context(rq->elv.icq->ioc);
+			rq->elv.icq = NULL;
+		}
+	}
+
+	__blk_mq_finish_request(rq);
 
 	WRITE_ONCE(rq->state, MQ_RQ_IDLE);
 	if (refcount_dec_and_test(&rq->ref))
@@ -621,13 +623,8 @@ void blk_mq_free_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(blk_mq_free_request);
 
-inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
+static inline void __blk_mq_end_request_acct(struct request *rq, u64 now)
 {
-	u64 now = 0;
-
-	if (blk_mq_need_time_stamp(rq))
-		now = ktime_get_ns();
-
 	if (rq->rq_flags & RQF_STATS) {
 		blk_mq_poll_stats_start(rq->q);
 		blk_stat_add(rq, now);
@@ -636,6 +633,16 @@ inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
 	blk_mq_sched_completed_request(rq, now);
 
 	blk_account_io_done(rq, now);
+}
+
+inline void __blk_mq_end_request(struct request *rq, blk_status_t error)
+{
+	u64 now = 0;
+
+	if (blk_mq_need_time_stamp(rq))
+		now = ktime_get_ns();
+
+	__blk_mq_end_request_acct(rq, now);
 
 	if (rq->end_io) {
 		rq_qos_done(rq->q, rq);
@@ -654,6 +661,73 @@ void blk_mq_end_request(struct request *rq, blk_status_t error)
 }
 EXPORT_SYMBOL(blk_mq_end_request);
 
+#define TAG_COMP_BATCH		32
+
+static inline void blk_mq_flush_tag_batch(struct blk_mq_hw_ctx *hctx,
+					  int *tag_array, int nr_tags)
+{
+	struct request_queue *q = hctx->queue;
+
+	blk_mq_put_tags(hctx->tags, tag_array, nr_tags);
+	blk_mq_sched_restart(hctx);
+	percpu_ref_put_many(&q->q_usage_counter, nr_tags);
+}
+
+/**
+ * blk_mq_end_request_batch - end a batch of successfully completed requests
+ * @iob:	requests collected with blk_mq_add_to_batch()
+ *
+ * Like blk_mq_end_request() on each request, except that the completion
+ * time is only read once for the whole batch and the driver tags and queue
+ * references are given back in bulk for each run of requests from the same
+ * hardware queue.
+ */
+void blk_mq_end_request_batch(struct io_comp_batch *iob)
+{
+	int tags[TAG_COMP_BATCH], nr_tags = 0;
+	struct blk_mq_hw_ctx *cur_hctx = NULL;
+	struct request *rq, *next;
+	u64 now = 0;
+
+	if (iob->need_ts)
+		now = ktime_get_ns();
+
+	list_for_each_entry_safe(rq, next, &iob->req_list, queuelist) {
+		struct blk_mq_hw_ctx *hctx = rq->mq_hctx;
+
+		list_del_init(&rq->queuelist);
+		if (blk_update_request(rq, BLK_STS_OK, blk_rq_bytes(rq)))
+			BUG();
+		__blk_mq_end_request_acct(rq, now);
+		__blk_mq_finish_request(rq);
+
+		WRITE_ONCE(rq->state, MQ_RQ_IDLE);
+		if (!refcount_dec_and_test(&rq->ref))
+			continue;
+
+		if (blk_mq_tag_is_reserved(hctx->tags, rq->tag)) {
+			__blk_mq_free_request(rq);
+			continue;
+		}
+
+		blk_crypto_free_request(rq);
+		blk_pm_mark_last_busy(rq);
+		rq->mq_hctx = NULL;
+
+		if (nr_tags == TAG_COMP_BATCH || cur_hctx != hctx) {
+			if (cur_hctx)
+				blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+			nr_tags = 0;
+			cur_hctx = hctx;
+		}
+		tags[nr_tags++] = rq->tag;
+	}
+
+	if (nr_tags)
+		blk_mq_flush_tag_batch(cur_hctx, tags, nr_tags);
+}
+EXPORT_SYMBOL_GPL(blk_mq_end_request_batch);
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
@@ -2285,6 +2359,114 @@ static void blk_add_rq_to_plug(struct blk_plug *plug, struct request *rq)
 	}
 }
 
+/*
+ * Requests allocated ahead of time for a plug that announced a batch with
+ * blk_start_plug_nr_ios().  There is one cache per queue, hanging off the
+ * plug callback list so that the unused requests, and the queue usage
+ * references they hold, are given back whenever the plug is flushed.
+ */
+struct blk_mq_plug_cache {
+	struct blk_plug_cb	cb;
+	unsigned short		nr;
+	struct request		*rqs[BLK_MAX_REQUEST_COUNT];
+};
+
+static void blk_mq_plug_cache_unplug(struct blk_plug_cb *cb,
+				     bool from_schedule)
+{
+	struct blk_mq_plug_cache *cache =
+		container_of(cb, struct blk_mq_plug_cache, cb);
+
+	while (cache->nr)
+		blk_mq_free_request(cache->rqs[--cache->nr]);
+	kfree(cache);
+}
+
+/*
+ * Allocate up to @nr requests with a single pass over the tag bitmap,
+ * return the first one and park the rest in @cache.  Never sleeps, the
+ * caller falls back to __blk_mq_alloc_request() if nothing was found.
+ */
+static struct request *blk_mq_alloc_batch(struct blk_mq_alloc_data *data,
+		struct blk_mq_plug_cache *cache, unsigned int nr)
+{
+	struct request_queue *q = data->q;
+	struct request *rq = NULL;
+	u64 alloc_time_ns = 0;
+	unsigned int offset, i;
+	unsigned long tags;
+
+	if (blk_queue_rq_alloc_time(q))
+		alloc_time_ns = ktime_get_ns();
+
+	data->ctx = blk_mq_get_ctx(q);
+	data->hctx = blk_mq_map_queue(q, data->cmd_flags, data->ctx);
+	blk_mq_tag_busy(data->hctx);
+
+	tags = blk_mq_get_tags(data, nr, &offset);
+	for (i = 0; tags; i++, tags >>= 1) {
+		if (!(tags & 1))
+			continue;
+		if (!rq) {
+			rq = blk_mq_rq_ctx_init(data, offset + i, alloc_time_ns);
+			continue;
+		}
+		/* each cached request pins the queue on its own */
+		percpu_ref_get(&q->q_usage_counter);
+		cache->rqs[cache->nr++] = blk_mq_rq_ctx_init(data, offset + i,
+							     alloc_time_ns);
+	}
+
+	return rq;
+}
+
+static struct request *blk_mq_get_cached_request(struct blk_plug *plug,
+		struct blk_mq_alloc_data *data)
+{
+	struct request_queue *q = data->q;
+	struct blk_mq_plug_cache *cache;
+	struct blk_plug_cb *cb;
+	struct request *rq;
+	unsigned int nr;
+
+	list_for_each_entry(cb, &plug->cb_list, list) {
+		if (cb->callback != blk_mq_plug_cache_unplug || cb->data != q)
+			continue;
+
+		cache = container_of(cb, struct blk_mq_plug_cache, cb);
+		if (!cache->nr)
+			break;
+
+		rq = cache->rqs[cache->nr - 1];
+		if (blk_mq_map_queue(q, data->cmd_flags, rq->mq_ctx) !=
+		    rq->mq_hctx)
+			return NULL;
+
+		cache->nr--;
+		rq->cmd_flags = data->cmd_flags;
+		if (blk_mq_need_time_stamp(rq))
+			rq->start_time_ns = ktime_get_ns();
+		data->ctx = rq->mq_ctx;
+		data->hctx = rq->mq_hctx;
+
+		/* drop the reference taken at submission, rq holds its own */
+		blk_queue_exit(q);
+		return rq;
+	}
+
+	/* the batch hint is only good for one allocation */
+	nr = plug->nr_ios;
+	if (nr <= 1)
+		return NULL;
+	plug->nr_ios = 1;
+
+	cb = blk_check_plugged(blk_mq_plug_cache_unplug, q, sizeof(*cache));
+	if (!cb)
+		return NULL;
+	cache = container_of(cb, struct blk_mq_plug_cache, cb);
+	return blk_mq_alloc_batch(data, cache, nr);
+}
+
 /*
  * Allow 2x BLK_MAX_REQUEST_COUNT requests on plug queue for multiple
  * queues. This is important for md arrays to benefit from merging
@@ -2343,7 +2525,12 @@ blk_qc_t blk_mq_submit_bio(struct bio *bio)
 	rq_qos_throttle(q, bio);
 
 	data.cmd_flags = bio->bi_opf;
-	rq = __blk_mq_alloc_request(&data);
+	plug = blk_mq_plug(q, bio);
+	rq = NULL;
+	if (plug && !is_flush_fua && !q->elevator)
+		rq = blk_mq_get_cached_request(plug, &data);
+	if (!rq)
+		rq = __blk_mq_alloc_request(&data);
 	if (unlikely(!rq)) {
 		rq_qos_cleanup(q, bio);
 		if (bio->bi_opf & REQ_NOWAIT)
@@ -2367,7 +2554,6 @@ blk_qc_t blk_mq_submit_bio(struct bio *bio)
 		return BLK_QC_T_NONE;
 	}
 
-	plug = blk_mq_plug(q, bio);
 	if (unlikely(is_flush_fua)) {
 		/* Bypass scheduler for flush requests */
 		blk_insert_flush(rq);
@@ -164,6 +164,41 @@ static inline void blk_stat_activate_msecs(struct blk_stat_callback *cb,
 	mod_timer(&cb->timer, jiffies + msecs_to_jiffies(msecs));
 }
 
+/*
+ * Log-linear latency histograms: two buckets per power of two usecs, so the
+ * lower bounds go 0, 1, 2, 3, 4, 6, 8, 12, 16, ... up to ~8s.  The last
+ * bucket also counts anything slower.
+ */
+#define BLK_LAT_HIST_SUB_SHIFT	1
+#define BLK_LAT_HIST_SUB	(1 << BLK_LAT_HIST_SUB_SHIFT)
+#define BLK_LAT_HIST_BUCKETS	46
+
+static inline unsigned int blk_lat_hist_bucket(u64 nsecs)
+{
+	u64 usecs = div_u64(nsecs, NSEC_PER_USEC);
+	unsigned int shift, bucket;
+
+	if (usecs < BLK_LAT_HIST_SUB)
+		return usecs;
+
+	shift = fls64(usecs) - 1 - BLK_LAT_HIST_SUB_SHIFT;
+	bucket = (shift + 1) * BLK_LAT_HIST_SUB +
+		 ((usecs >> shift) & (BLK_LAT_HIST_SUB - 1));
+	return min_t(unsigned int, bucket, BLK_LAT_HIST_BUCKETS - 1);
+}
+
+/* lower bound of @bucket in usecs */
+static inline u64 blk_lat_hist_bucket_usecs(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < BLK_LAT_HIST_SUB)
+		return bucket;
+
+	shift = bucket / BLK_LAT_HIST_SUB - 1;
+	return (u64)(BLK_LAT_HIST_SUB + bucket % BLK_LAT_HIST_SUB) << shift;
+}
+
 void blk_rq_stat_add(struct blk_rq_stat *, u64);
 void blk_rq_stat_sum(struct blk_rq_stat *, struct blk_rq_stat *);
 void blk_rq_stat_init(struct blk_rq_stat *);
@@ -604,6 +604,12 @@ QUEUE_RO_ENTRY(queue_dax, "dax");
 QUEUE_RW_ENTRY(queue_io_timeout, "io_timeout");
 QUEUE_RW_ENTRY(queue_wb_lat, "wbt_lat_usec");
 
+#ifdef CONFIG_BLK_DEV_THROTTLING
+QUEUE_RW_ENTRY(blk_throtl_pcpu_window, "throttle_pcpu_window");
+#endif
+#ifdef CONFIG_BLK_CGROUP
+QUEUE_RW_ENTRY(blkcg_lat_hist, "cgroup_lat_hist");
+#endif
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 QUEUE_RW_ENTRY(blk_throtl_sample_time, "throttle_sample_time");
 #endif
@@ -659,6 +665,12 @@ static struct attribute *queue_attrs[] = {
 	&queue_wb_lat_entry.attr,
 	&queue_poll_delay_entry.attr,
 	&queue_io_timeout_entry.attr,
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	&blk_throtl_pcpu_window_entry.attr,
+#endif
+#ifdef CONFIG_BLK_CGROUP
+	&blkcg_lat_hist_entry.attr,
+#endif
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 	&blk_throtl_sample_time_entry.attr,
 #endif
@@ -118,6 +118,20 @@ enum {
 	LIMIT_CNT,
 };
 
+/*
+ * Dispatch budget handed out to one cpu by the locked path.  The budget
+ * has already been charged to the group and all its ancestors, so bios
+ * covered by it can be dispatched without taking the queue lock.
+ */
+struct throtl_pcpu_budget {
+	uint64_t bytes[2];
+	unsigned int ios[2];
+	unsigned long expires[2];
+	unsigned int gen[2];
+	/* bios dispatched against the budget, for debug stats */
+	uint64_t nr_dispatched[2];
+};
+
 struct throtl_grp {
 	/* must be the first member */
 	struct blkg_policy_data pd;
@@ -197,6 +211,8 @@ struct throtl_grp {
 
 	struct blkg_rwstat stat_bytes;
 	struct blkg_rwstat stat_ios;
+
+	struct throtl_pcpu_budget __percpu *pcpu_budget;
 };
 
 /* We measure latency for request size from <= 4k to >= 1M */
@@ -241,6 +257,11 @@ struct throtl_data
 	unsigned long filtered_latency;
 
 	bool track_bio_latency;
+
+	/* lifetime of per-cpu budgets in jiffies, 0 disables them */
+	unsigned long pcpu_window;
+	/* bumped to invalidate all per-cpu budgets */
+	unsigned int pcpu_gen;
 };
 
 static void throtl_pending_timer_fn(struct timer_list *t);
@@ -518,6 +539,10 @@ static struct blkg_policy_data *throtl_pd_alloc(gfp_t gfp,
 	if (blkg_rwstat_init(&tg->stat_ios, gfp))
 		goto err_exit_stat_bytes;
 
+	tg->pcpu_budget = alloc_percpu_gfp(struct throtl_pcpu_budget, gfp);
+	if (!tg->pcpu_budget)
+		goto err_exit_stat_ios;
+
 	throtl_service_queue_init(&tg->service_queue);
 
 	for (rw = READ; rw <= WRITE; rw++) {
@@ -543,6 +568,8 @@ static struct blkg_policy_data *throtl_pd_alloc(gfp_t gfp,
 
 	return &tg->pd;
 
+err_exit_stat_ios:
+	blkg_rwstat_exit(&tg->stat_ios);
 err_exit_stat_bytes:
 	blkg_rwstat_exit(&tg->stat_bytes);
 err_free_tg:
@@ -655,9 +682,32 @@ static void throtl_pd_free(struct blkg_policy_data *pd)
 	del_timer_sync(&tg->service_queue.pending_timer);
 	blkg_rwstat_exit(&tg->stat_bytes);
 	blkg_rwstat_exit(&tg->stat_ios);
+	free_percpu(tg->pcpu_budget);
 	kfree(tg);
 }
 
+static size_t throtl_pd_stat(struct blkg_policy_data *pd, char *buf,
+			     size_t size)
+{
+	struct throtl_grp *tg = pd_to_tg(pd);
+	u64 nr[2] = { 0, 0 };
+	int cpu;
+
+	if (!blkcg_debug_stats || !READ_ONCE(tg->td->pcpu_window))
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct throtl_pcpu_budget *budget;
+
+		budget = per_cpu_ptr(tg->pcpu_budget, cpu);
+		nr[READ] += READ_ONCE(budget->nr_dispatched[READ]);
+		nr[WRITE] += READ_ONCE(budget->nr_dispatched[WRITE]);
+	}
+
+	return scnprintf(buf, size, " throttle.pcpu_rios=%llu throttle.pcpu_wios=%llu",
+			 nr[READ], nr[WRITE]);
+}
+
 static struct throtl_grp *
 throtl_rb_first(struct throtl_service_queue *parent_sq)
 {
@@ -1094,6 +1144,153 @@ static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
 		bio_set_flag(bio, BIO_THROTTLED);
 }
 
+/*
+ * Clamp the per-cpu grant for @rw in @bytes, @ios and @expires to what is
+ * left of @tg's allowance in the current slice, and to the share of one
+ * cpu over @window jiffies.  The grant must expire before the slice ends,
+ * as a new slice starts from scratch and would not see it.  A level without
+ * a limit for @rw is not charged and runs no slice, so it doesn't bound the
+ * grant at all.
+ */
+static void tg_clamp_pcpu_grant(struct throtl_grp *tg, bool rw,
+				unsigned long window, unsigned int nr_cpus,
+				u64 *bytes, unsigned int *ios,
+				unsigned long *expires)
+{
+	u64 bps_limit = tg_bps_limit(tg, rw);
+	u32 iops_limit = tg_iops_limit(tg, rw);
+	unsigned long jiffy_elapsed_rnd;
+	u64 allowed, share;
+
+	jiffy_elapsed_rnd = max(jiffies - tg->slice_start[rw], 1UL);
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, tg->td->throtl_slice);
+
+	if (bps_limit != U64_MAX) {
+		allowed = mul_u64_u64_div_u64(bps_limit, (u64)jiffy_elapsed_rnd,
+					      (u64)HZ);
+		share = mul_u64_u64_div_u64(bps_limit, (u64)window,
+					    (u64)HZ * nr_cpus);
+		if (allowed > tg->bytes_disp[rw])
+			*bytes = min3(*bytes, allowed - tg->bytes_disp[rw],
+				      share);
+		else
+			*bytes = 0;
+		if (time_before(tg->slice_end[rw], *expires))
+			*expires = tg->slice_end[rw];
+	}
+
+	if (iops_limit != UINT_MAX) {
+		allowed = div_u64((u64)iops_limit * jiffy_elapsed_rnd, HZ);
+		share = div64_u64((u64)iops_limit * window, (u64)HZ * nr_cpus);
+		share = max_t(u64, share, 1);
+		if (allowed > tg->io_disp[rw])
+			*ios = min_t(u64, *ios,
+				     min(allowed - tg->io_disp[rw], share));
+		else
+			*ios = 0;
+		if (time_before(tg->slice_end[rw], *expires))
+			*expires = tg->slice_end[rw];
+	}
+}
+
+/*
+ * @tg just dispatched a bio directly, so every level up to the root is
+ * within its limits.  Charge a chunk of the remaining allowance to all of
+ * them upfront and hand it to the local cpu, so that the bios following
+ * on this cpu can be dispatched by throtl_pcpu_dispatch() without the
+ * queue lock.  Since the budget is charged before it is used, and expires
+ * with the slice it was charged to, the limits are never exceeded; at
+ * worst a budget that expires unused is lost for the slice.
+ */
+static void throtl_pcpu_refill(struct throtl_grp *tg, bool rw)
+{
+	struct throtl_data *td = tg->td;
+	struct throtl_pcpu_budget *budget;
+	unsigned long expires = jiffies + td->pcpu_window;
+	unsigned int nr_cpus = num_online_cpus();
+	unsigned int ios = UINT_MAX;
+	u64 bytes = U64_MAX;
+	struct throtl_grp *pos;
+
+	lockdep_assert_held(&td->queue->queue_lock);
+
+	/* low limits need to see every bio to decide on up/downgrades */
+	if (!td->pcpu_window || td->limit_valid[LIMIT_LOW])
+		return;
+
+	for (pos = tg; pos; pos = sq_to_tg(pos->service_queue.parent_sq))
+		tg_clamp_pcpu_grant(pos, rw, td->pcpu_window, nr_cpus,
+				    &bytes, &ios, &expires);
+	if (!bytes || !ios || !time_after(expires, jiffies))
+		return;
+
+	for (pos = tg; pos; pos = sq_to_tg(pos->service_queue.parent_sq)) {
+		if (tg_bps_limit(pos, rw) != U64_MAX)
+			pos->bytes_disp[rw] += bytes;
+		if (tg_iops_limit(pos, rw) != UINT_MAX)
+			pos->io_disp[rw] += ios;
+	}
+
+	/*
+	 * Top up a budget that is still valid rather than dropping what is
+	 * left of it.  It was charged to the current slices as well, since
+	 * none of them can have restarted before it expires.
+	 */
+	budget = this_cpu_ptr(tg->pcpu_budget);
+	if (budget->gen[rw] == td->pcpu_gen &&
+	    time_before(jiffies, budget->expires[rw])) {
+		if (bytes != U64_MAX && budget->bytes[rw] != U64_MAX)
+			bytes += budget->bytes[rw];
+		if (ios != UINT_MAX && budget->ios[rw] != UINT_MAX)
+			ios = min_t(u64, (u64)ios + budget->ios[rw],
+				    UINT_MAX - 1);
+	}
+
+	budget->bytes[rw] = bytes;
+	budget->ios[rw] = ios;
+	budget->expires[rw] = expires;
+	budget->gen[rw] = td->pcpu_gen;
+
+	throtl_log(&tg->service_queue,
+		   "[%c] pcpu budget bytes=%llu ios=%u expires=%lu",
+		   rw == READ ? 'R' : 'W', bytes, ios, expires);
+}
+
+/*
+ * Try to dispatch @bio against the local cpu's budget without taking the
+ * queue lock.  Returns true if @bio was covered by the budget.
+ */
+static bool throtl_pcpu_dispatch(struct throtl_grp *tg, struct bio *bio)
+{
+	struct throtl_data *td = tg->td;
+	struct throtl_pcpu_budget *budget;
+	bool rw = bio_data_dir(bio);
+	unsigned int bio_size = throtl_bio_data_size(bio);
+	unsigned long flags;
+	bool ret = false;
+
+	/* throtl is FIFO - if bios are already queued, should queue */
+	if (!READ_ONCE(td->pcpu_window) ||
+	    READ_ONCE(tg->service_queue.nr_queued[rw]))
+		return false;
+
+	local_irq_save(flags);
+	budget = this_cpu_ptr(tg->pcpu_budget);
+	if (budget->gen[rw] == READ_ONCE(td->pcpu_gen) &&
+	    time_before(jiffies, budget->expires[rw]) &&
+	    budget->ios[rw] && budget->bytes[rw] >= bio_size) {
+		if (budget->bytes[rw] != U64_MAX)
+			budget->bytes[rw] -= bio_size;
+		if (budget->ios[rw] != UINT_MAX)
+			budget->ios[rw]--;
+		budget->nr_dispatched[rw]++;
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
 /**
  * throtl_add_bio_tg - add a bio to the specified throtl_grp
  * @bio: bio to add
@@ -1480,6 +1677,9 @@ static void tg_conf_updated(struct throtl_grp *tg, u64 *old_limits, bool global)
 		   tg_bps_limit(tg, READ), tg_bps_limit(tg, WRITE),
 		   tg_iops_limit(tg, READ), tg_iops_limit(tg, WRITE));
 
+	/* budgets handed out under the old limits are no longer valid */
+	tg->td->pcpu_gen++;
+
 	/*
 	 * Update has_rules[] flags for the updated tg's subtree.  A tg is
 	 * considered to have rules if either the tg itself or any of its
@@ -1903,6 +2103,7 @@ static struct blkcg_policy blkcg_policy_throtl = {
 	.pd_online_fn		= throtl_pd_online,
 	.pd_offline_fn		= throtl_pd_offline,
 	.pd_free_fn		= throtl_pd_free,
+	.pd_stat_fn		= throtl_pd_stat,
 };
 
 static unsigned long __tg_last_low_overflow_time(struct throtl_grp *tg)
@@ -2339,6 +2540,11 @@ bool blk_throtl_bio(struct bio *bio)
 		goto out;
 	}
 
+	if (throtl_pcpu_dispatch(tg, bio)) {
+		locked = false;
+		goto out;
+	}
+
 	spin_lock_irq(&q->queue_lock);
 
 	throtl_update_latency_buckets(td);
@@ -2391,8 +2597,10 @@ bool blk_throtl_bio(struct bio *bio)
 		qn = &tg->qnode_on_parent[rw];
 		sq = sq->parent_sq;
 		tg = sq_to_tg(sq);
-		if (!tg)
+		if (!tg) {
+			throtl_pcpu_refill(blkg_to_tg(blkg), rw);
 			goto out;
+		}
 	}
 
 	/* out-of-limit, queue to @tg */
@@ -2550,6 +2758,7 @@ int blk_throtl_init(struct request_queue *q)
 	td->limit_index = LIMIT_MAX;
 	td->low_upgrade_time = jiffies;
 	td->low_downgrade_time = jiffies;
+	td->pcpu_gen = 1;
 
 	/* activate policy */
 	ret = blkcg_activate_policy(q, &blkcg_policy_throtl);
@@ -2601,6 +2810,34 @@ void blk_throtl_register_queue(struct request_queue *q)
 		blk_stat_enable_accounting(q);
 }
 
+ssize_t blk_throtl_pcpu_window_show(struct request_queue *q, char *page)
+{
+	if (!q->td)
+		return -EINVAL;
+	return sprintf(page, "%u\n", jiffies_to_msecs(q->td->pcpu_window));
+}
+
+ssize_t blk_throtl_pcpu_window_store(struct request_queue *q,
+	const char *page, size_t count)
+{
+	unsigned long v;
+	unsigned long t;
+
+	if (!q->td)
+		return -EINVAL;
+	if (kstrtoul(page, 10, &v))
+		return -EINVAL;
+	t = msecs_to_jiffies(v);
+	if (t > MAX_THROTL_SLICE)
+		return -EINVAL;
+
+	spin_lock_irq(&q->queue_lock);
+	q->td->pcpu_window = t;
+	q->td->pcpu_gen++;
+	spin_unlock_irq(&q->queue_lock);
+	return count;
+}
+
 #ifdef CONFIG_BLK_DEV_THROTTLING_LOW
 ssize_t blk_throtl_sample_time_show(struct request_queue *q, char *page)
 {
@@ -184,6 +184,9 @@ bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
 		unsigned int nr_segs, struct request **same_queue_rq);
 bool blk_bio_list_merge(struct request_queue *q, struct list_head *list,
 			struct bio *bio, unsigned int nr_segs);
+struct request *blk_bio_list_merge_rq(struct request_queue *q,
+				      struct list_head *list,
+				      struct bio *bio, unsigned int nr_segs);
 
 void blk_account_io_start(struct request *req);
 void blk_account_io_done(struct request *req, u64 now);
@@ -309,6 +312,10 @@ extern void blk_throtl_exit(struct request_queue *q);
 extern void blk_throtl_register_queue(struct request_queue *q);
 extern void blk_throtl_charge_bio_split(struct bio *bio);
 bool blk_throtl_bio(struct bio *bio);
+extern ssize_t blk_throtl_pcpu_window_show(struct request_queue *q,
+	char *page);
+extern ssize_t blk_throtl_pcpu_window_store(struct request_queue *q,
+	const char *page, size_t count);
 #else /* CONFIG_BLK_DEV_THROTTLING */
 static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
@@ -340,12 +347,34 @@ static inline void blk_queue_bounce(struct request_queue *q, struct bio **bio)
 }
 #endif /* CONFIG_BOUNCE */
 
+#ifdef CONFIG_BLK_CGROUP
+void __blkcg_bio_lat_done(struct request *rq, struct bio *bio);
+ssize_t blkcg_lat_hist_show(struct request_queue *q, char *page);
+ssize_t blkcg_lat_hist_store(struct request_queue *q, const char *page,
+			     size_t count);
+
+static inline void blkcg_bio_lat_done(struct request *rq, struct bio *bio)
+{
+	if (unlikely(test_bit(QUEUE_FLAG_LAT_HIST, &rq->q->queue_flags)) &&
+	    bio->bi_blkg)
+		__blkcg_bio_lat_done(rq, bio);
+}
+#else
+static inline void blkcg_bio_lat_done(struct request *rq, struct bio *bio) { }
+#endif
+
 #ifdef CONFIG_BLK_CGROUP_IOLATENCY
 extern int blk_iolatency_init(struct request_queue *q);
 #else
 static inline int blk_iolatency_init(struct request_queue *q) { return 0; }
 #endif
 
+#ifdef CONFIG_BLK_CGROUP_IOPRIO
+extern int blk_ioprio_init(struct request_queue *q);
+#else
+static inline int blk_ioprio_init(struct request_queue *q) { return 0; }
+#endif
+
 struct bio *blk_next_bio(struct bio *bio, unsigned int nr_pages, gfp_t gfp);
 
 #ifdef CONFIG_BLK_DEV_ZONED
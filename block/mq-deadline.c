@@ -17,6 +17,7 @@
 #include <linux/compiler.h>
 #include <linux/rbtree.h>
 #include <linux/sbitmap.h>
+#include <linux/ioprio.h>
 
 #include "blk.h"
 #include "blk-mq.h"
@@ -32,24 +33,72 @@ static const int write_expire = 5 * HZ; /* ditto for writes, these limits are SO
 static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
+/*
+ * Time after which a request of a lower priority class is dispatched even
+ * if requests of a higher priority class are pending.
+ */
+static const int prio_aging_expire = 10 * HZ;
 
-struct deadline_data {
-	/*
-	 * run time data
-	 */
+enum dd_prio {
+	DD_RT_PRIO	= 0,
+	DD_BE_PRIO	= 1,
+	DD_IDLE_PRIO	= 2,
+	DD_PRIO_MAX	= 2,
+};
 
-	/*
-	 * requests (deadline_rq s) are present on both sort_list and fifo_list
-	 */
+enum { DD_PRIO_COUNT = 3 };
+
+/* I/O priority class to mq-deadline priority level translation table. */
+static const enum dd_prio ioprio_class_to_prio[] = {
+	[IOPRIO_CLASS_NONE]	= DD_BE_PRIO,
+	[IOPRIO_CLASS_RT]	= DD_RT_PRIO,
+	[IOPRIO_CLASS_BE]	= DD_BE_PRIO,
+	[IOPRIO_CLASS_IDLE]	= DD_IDLE_PRIO,
+};
+
+/* I/O statistics per I/O priority level, protected by the shard lock. */
+struct io_stats_per_prio {
+	u32		inserted;
+	u32		merged;
+	u32		dispatched;
+	atomic_t	completed;
+};
+
+/*
+ * Deadline scheduler data per I/O priority (enum dd_prio). Requests are
+ * present on both sort_list[] and fifo_list[].
+ */
+struct dd_per_prio {
+	struct list_head dispatch;
 	struct rb_root sort_list[2];
 	struct list_head fifo_list[2];
-
-	/*
-	 * next in sort order. read, write or both are NULL
-	 */
+	/* Next request in sector order. Read, write or both are NULL. */
 	struct request *next_rq[2];
+	struct io_stats_per_prio stats;
+};
+
+/*
+ * Run time data of one shard. Queues with several hardware queues get one
+ * shard per hardware queue, so that inserts and dispatches on different
+ * hardware queues do not contend on the same lock. The deadline and
+ * priority rules apply within each shard. Zoned and single queue devices
+ * use one shard for all hardware queues.
+ */
+struct dd_shard {
+	spinlock_t lock;
+
+	struct dd_per_prio per_prio[DD_PRIO_COUNT];
+
 	unsigned int batching;		/* number of sequential requests made */
 	unsigned int starved;		/* times reads have starved writes */
+} ____cacheline_aligned_in_smp;
+
+struct deadline_data {
+	/*
+	 * run time data, hctx->sched_data points to the shard of a hctx
+	 */
+	struct dd_shard *shards;
+	unsigned int nr_shards;
 
 	/*
 	 * settings that change how the i/o scheduler behaves
@@ -58,16 +107,36 @@ struct deadline_data {
 	int fifo_batch;
 	int writes_starved;
 	int front_merges;
+	int prio_aging_expire;
 
-	spinlock_t lock;
 	spinlock_t zone_lock;
-	struct list_head dispatch;
 };
 
+/* Maps an I/O priority to a deadline scheduler priority. */
+static inline enum dd_prio dd_ioprio_to_prio(unsigned short ioprio)
+{
+	unsigned int class = IOPRIO_PRIO_CLASS(ioprio);
+
+	if (class >= ARRAY_SIZE(ioprio_class_to_prio))
+		return DD_BE_PRIO;
+	return ioprio_class_to_prio[class];
+}
+
+static inline struct dd_shard *dd_rq_shard(struct request *rq)
+{
+	return rq->mq_hctx->sched_data;
+}
+
+static inline struct dd_per_prio *
+dd_rq_per_prio(struct dd_shard *shard, struct request *rq)
+{
+	return &shard->per_prio[dd_ioprio_to_prio(req_get_ioprio(rq))];
+}
+
 static inline struct rb_root *
-deadline_rb_root(struct deadline_data *dd, struct request *rq)
+deadline_rb_root(struct dd_per_prio *per_prio, struct request *rq)
 {
-	return &dd->sort_list[rq_data_dir(rq)];
+	return &per_prio->sort_list[rq_data_dir(rq)];
 }
 
 /*
@@ -85,38 +154,38 @@ deadline_latter_request(struct request *rq)
 }
 
 static void
-deadline_add_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_add_rq_rb(struct dd_per_prio *per_prio, struct request *rq)
 {
-	struct rb_root *root = deadline_rb_root(dd, rq);
+	struct rb_root *root = deadline_rb_root(per_prio, rq);
 
 	elv_rb_add(root, rq);
 }
 
 static inline void
-deadline_del_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_del_rq_rb(struct dd_per_prio *per_prio, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	if (dd->next_rq[data_dir] == rq)
-		dd->next_rq[data_dir] = deadline_latter_request(rq);
+	if (per_prio->next_rq[data_dir] == rq)
+		per_prio->next_rq[data_dir] = deadline_latter_request(rq);
 
-	elv_rb_del(deadline_rb_root(dd, rq), rq);
+	elv_rb_del(deadline_rb_root(per_prio, rq), rq);
 }
 
 /*
  * remove rq from rbtree and fifo.
  */
-static void deadline_remove_request(struct request_queue *q, struct request *rq)
+static void deadline_remove_request(struct request_queue *q,
+				    struct dd_per_prio *per_prio,
+				    struct request *rq)
 {
-	struct deadline_data *dd = q->elevator->elevator_data;
-
 	list_del_init(&rq->queuelist);
 
 	/*
 	 * We might not be on the rbtree, if we are doing an insert merge
 	 */
 	if (!RB_EMPTY_NODE(&rq->rb_node))
-		deadline_del_rq_rb(dd, rq);
+		deadline_del_rq_rb(per_prio, rq);
 
 	elv_rqhash_del(q, rq);
 	if (q->last_merge == rq)
@@ -126,20 +195,27 @@ static void deadline_remove_request(struct request_queue *q, struct request *rq)
 static void dd_request_merged(struct request_queue *q, struct request *req,
 			      enum elv_merge type)
 {
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_per_prio *per_prio = dd_rq_per_prio(dd_rq_shard(req), req);
 
 	/*
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (type == ELEVATOR_FRONT_MERGE) {
-		elv_rb_del(deadline_rb_root(dd, req), req);
-		deadline_add_rq_rb(dd, req);
+		elv_rb_del(deadline_rb_root(per_prio, req), req);
+		deadline_add_rq_rb(per_prio, req);
 	}
 }
 
 static void dd_merged_requests(struct request_queue *q, struct request *req,
 			       struct request *next)
 {
+	struct dd_shard *shard = dd_rq_shard(next);
+	struct dd_per_prio *per_prio = dd_rq_per_prio(shard, next);
+
+	lockdep_assert_held(&shard->lock);
+
+	per_prio->stats.merged++;
+
 	/*
 	 * if next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo
@@ -155,34 +231,44 @@ static void dd_merged_requests(struct request_queue *q, struct request *req,
 	/*
 	 * kill knowledge of next, this one is a goner
 	 */
-	deadline_remove_request(q, next);
+	deadline_remove_request(q, per_prio, next);
 }
 
 /*
  * move an entry to dispatch queue
  */
 static void
-deadline_move_request(struct deadline_data *dd, struct request *rq)
+deadline_move_request(struct dd_per_prio *per_prio, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	dd->next_rq[READ] = NULL;
-	dd->next_rq[WRITE] = NULL;
-	dd->next_rq[data_dir] = deadline_latter_request(rq);
+	per_prio->next_rq[READ] = NULL;
+	per_prio->next_rq[WRITE] = NULL;
+	per_prio->next_rq[data_dir] = deadline_latter_request(rq);
 
 	/*
 	 * take it off the sort and fifo list
 	 */
-	deadline_remove_request(rq->q, rq);
+	deadline_remove_request(rq->q, per_prio, rq);
+}
+
+/* Number of requests queued for a given priority level. */
+static u32 dd_queued(struct dd_shard *shard, enum dd_prio prio)
+{
+	const struct io_stats_per_prio *stats = &shard->per_prio[prio].stats;
+
+	lockdep_assert_held(&shard->lock);
+
+	return stats->inserted - atomic_read(&stats->completed);
 }
 
 /*
  * deadline_check_fifo returns 0 if there are no expired requests on the fifo,
- * 1 otherwise. Requires !list_empty(&dd->fifo_list[data_dir])
+ * 1 otherwise. Requires !list_empty(&per_prio->fifo_list[data_dir])
  */
-static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
+static inline int deadline_check_fifo(struct dd_per_prio *per_prio, int ddir)
 {
-	struct request *rq = rq_entry_fifo(dd->fifo_list[ddir].next);
+	struct request *rq = rq_entry_fifo(per_prio->fifo_list[ddir].next);
 
 	/*
 	 * rq is expired!
@@ -198,7 +284,8 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
  * dispatch using arrival ordered lists.
  */
 static struct request *
-deadline_fifo_request(struct deadline_data *dd, int data_dir)
+deadline_fifo_request(struct deadline_data *dd, struct dd_per_prio *per_prio,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -206,10 +293,10 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	if (list_empty(&dd->fifo_list[data_dir]))
+	if (list_empty(&per_prio->fifo_list[data_dir]))
 		return NULL;
 
-	rq = rq_entry_fifo(dd->fifo_list[data_dir].next);
+	rq = rq_entry_fifo(per_prio->fifo_list[data_dir].next);
 	if (data_dir == READ || !blk_queue_is_zoned(rq->q))
 		return rq;
 
@@ -218,7 +305,7 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	 * an unlocked target zone.
 	 */
 	spin_lock_irqsave(&dd->zone_lock, flags);
-	list_for_each_entry(rq, &dd->fifo_list[WRITE], queuelist) {
+	list_for_each_entry(rq, &per_prio->fifo_list[WRITE], queuelist) {
 		if (blk_req_can_dispatch_to_zone(rq))
 			goto out;
 	}
@@ -234,7 +321,8 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
  * dispatch using sector position sorted lists.
  */
 static struct request *
-deadline_next_request(struct deadline_data *dd, int data_dir)
+deadline_next_request(struct deadline_data *dd, struct dd_per_prio *per_prio,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -242,7 +330,7 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	rq = dd->next_rq[data_dir];
+	rq = per_prio->next_rq[data_dir];
 	if (!rq)
 		return NULL;
 
@@ -265,32 +353,55 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
 }
 
 /*
- * deadline_dispatch_requests selects the best request according to
- * read/write expire, fifo_batch, etc
+ * Returns true if and only if @rq was inserted after @latest_start, which
+ * must be a time in jiffies.
+ */
+static bool started_after(struct deadline_data *dd, struct request *rq,
+			  unsigned long latest_start)
+{
+	unsigned long start_time = (unsigned long)rq->fifo_time;
+
+	start_time -= dd->fifo_expire[rq_data_dir(rq)];
+
+	return time_after(start_time, latest_start);
+}
+
+/*
+ * deadline_dispatch_requests selects the best request from @per_prio
+ * according to read/write expire, fifo_batch, etc. Only requests that were
+ * inserted before @latest_start are considered.
  */
-static struct request *__dd_dispatch_request(struct deadline_data *dd)
+static struct request *__dd_dispatch_request(struct deadline_data *dd,
+					     struct dd_shard *shard,
+					     struct dd_per_prio *per_prio,
+					     unsigned long latest_start)
 {
 	struct request *rq, *next_rq;
 	bool reads, writes;
 	int data_dir;
 
-	if (!list_empty(&dd->dispatch)) {
-		rq = list_first_entry(&dd->dispatch, struct request, queuelist);
+	lockdep_assert_held(&shard->lock);
+
+	if (!list_empty(&per_prio->dispatch)) {
+		rq = list_first_entry(&per_prio->dispatch, struct request,
+				      queuelist);
+		if (started_after(dd, rq, latest_start))
+			return NULL;
 		list_del_init(&rq->queuelist);
 		goto done;
 	}
 
-	reads = !list_empty(&dd->fifo_list[READ]);
-	writes = !list_empty(&dd->fifo_list[WRITE]);
+	reads = !list_empty(&per_prio->fifo_list[READ]);
+	writes = !list_empty(&per_prio->fifo_list[WRITE]);
 
 	/*
 	 * batches are currently reads XOR writes
 	 */
-	rq = deadline_next_request(dd, WRITE);
+	rq = deadline_next_request(dd, per_prio, WRITE);
 	if (!rq)
-		rq = deadline_next_request(dd, READ);
+		rq = deadline_next_request(dd, per_prio, READ);
 
-	if (rq && dd->batching < dd->fifo_batch)
+	if (rq && shard->batching < dd->fifo_batch)
 		/* we have a next request are still entitled to batch */
 		goto dispatch_request;
 
@@ -300,10 +411,10 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	 */
 
 	if (reads) {
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[READ]));
+		BUG_ON(RB_EMPTY_ROOT(&per_prio->sort_list[READ]));
 
-		if (deadline_fifo_request(dd, WRITE) &&
-		    (dd->starved++ >= dd->writes_starved))
+		if (deadline_fifo_request(dd, per_prio, WRITE) &&
+		    (shard->starved++ >= dd->writes_starved))
 			goto dispatch_writes;
 
 		data_dir = READ;
@@ -317,9 +428,9 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 
 	if (writes) {
 dispatch_writes:
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[WRITE]));
+		BUG_ON(RB_EMPTY_ROOT(&per_prio->sort_list[WRITE]));
 
-		dd->starved = 0;
+		shard->starved = 0;
 
 		data_dir = WRITE;
 
@@ -332,14 +443,14 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
-	next_rq = deadline_next_request(dd, data_dir);
-	if (deadline_check_fifo(dd, data_dir) || !next_rq) {
+	next_rq = deadline_next_request(dd, per_prio, data_dir);
+	if (deadline_check_fifo(per_prio, data_dir) || !next_rq) {
 		/*
 		 * A deadline has expired, the last request was in the other
 		 * direction, or we have run out of higher-sectored requests.
 		 * Start again from the request with the earliest expiry time.
 		 */
-		rq = deadline_fifo_request(dd, data_dir);
+		rq = deadline_fifo_request(dd, per_prio, data_dir);
 	} else {
 		/*
 		 * The last req was the same dir and we have a next request in
@@ -355,15 +466,19 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	if (!rq)
 		return NULL;
 
-	dd->batching = 0;
+	shard->batching = 0;
 
 dispatch_request:
+	if (started_after(dd, rq, latest_start))
+		return NULL;
+
 	/*
 	 * rq is the selected appropriate request.
 	 */
-	dd->batching++;
-	deadline_move_request(dd, rq);
+	shard->batching++;
+	deadline_move_request(per_prio, rq);
 done:
+	per_prio->stats.dispatched++;
 	/*
 	 * If the request needs its target zone locked, do it.
 	 */
@@ -372,20 +487,73 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	return rq;
 }
 
+/*
+ * Check whether there are any requests with priority other than DD_RT_PRIO
+ * that were inserted more than prio_aging_expire jiffies ago, and dispatch
+ * the oldest of them so that lower priority classes are not starved.
+ */
+static struct request *dd_dispatch_prio_aged_requests(struct deadline_data *dd,
+						      struct dd_shard *shard,
+						      unsigned long now)
+{
+	struct request *rq;
+	enum dd_prio prio;
+	int prio_cnt;
+
+	lockdep_assert_held(&shard->lock);
+
+	prio_cnt = !!dd_queued(shard, DD_RT_PRIO) +
+		   !!dd_queued(shard, DD_BE_PRIO) +
+		   !!dd_queued(shard, DD_IDLE_PRIO);
+	if (prio_cnt < 2)
+		return NULL;
+
+	for (prio = DD_BE_PRIO; prio <= DD_PRIO_MAX; prio++) {
+		rq = __dd_dispatch_request(dd, shard, &shard->per_prio[prio],
+					   now - dd->prio_aging_expire);
+		if (rq)
+			return rq;
+	}
+
+	return NULL;
+}
+
 /*
  * One confusing aspect here is that we get called for a specific
  * hardware queue, but we may return a request that is for a
- * different hardware queue. This is because mq-deadline has shared
- * state for all hardware queues, in terms of sorting, FIFOs, etc.
+ * different hardware queue. This happens when all hardware queues
+ * share one shard, in terms of sorting, FIFOs, etc.
+ *
+ * Requests of a lower priority class are only dispatched once no requests
+ * of a higher priority class are queued or in flight, except for requests
+ * that have aged past prio_aging_expire.
  */
 static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *shard = hctx->sched_data;
+	const unsigned long now = jiffies;
 	struct request *rq;
+	enum dd_prio prio;
+
+	spin_lock(&shard->lock);
+	rq = dd_dispatch_prio_aged_requests(dd, shard, now);
+	if (rq)
+		goto unlock;
+
+	/*
+	 * Next, dispatch requests in priority order. Ignore lower priority
+	 * requests if any higher priority requests are pending.
+	 */
+	for (prio = 0; prio <= DD_PRIO_MAX; prio++) {
+		rq = __dd_dispatch_request(dd, shard, &shard->per_prio[prio],
+					   now);
+		if (rq || dd_queued(shard, prio))
+			break;
+	}
 
-	spin_lock(&dd->lock);
-	rq = __dd_dispatch_request(dd);
-	spin_unlock(&dd->lock);
+unlock:
+	spin_unlock(&shard->lock);
 
 	return rq;
 }
@@ -393,10 +561,20 @@ static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 static void dd_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
+	unsigned int i;
+	enum dd_prio prio;
+
+	for (i = 0; i < dd->nr_shards; i++) {
+		for (prio = 0; prio <= DD_PRIO_MAX; prio++) {
+			struct dd_per_prio *per_prio =
+				&dd->shards[i].per_prio[prio];
 
-	BUG_ON(!list_empty(&dd->fifo_list[READ]));
-	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
+			BUG_ON(!list_empty(&per_prio->fifo_list[READ]));
+			BUG_ON(!list_empty(&per_prio->fifo_list[WRITE]));
+		}
+	}
 
+	kfree(dd->shards);
 	kfree(dd);
 }
 
@@ -407,6 +585,8 @@ static int dd_init_queue(struct request_queue *q, struct elevator_type *e)
 {
 	struct deadline_data *dd;
 	struct elevator_queue *eq;
+	unsigned int i;
+	enum dd_prio prio;
 
 	eq = elevator_alloc(q, e);
 	if (!eq)
@@ -419,34 +599,79 @@ static int dd_init_queue(struct request_queue *q, struct elevator_type *e)
 	}
 	eq->elevator_data = dd;
 
-	INIT_LIST_HEAD(&dd->fifo_list[READ]);
-	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
-	dd->sort_list[READ] = RB_ROOT;
-	dd->sort_list[WRITE] = RB_ROOT;
+	/*
+	 * Zoned devices need all writes to a zone in one place to keep them
+	 * in order, so they get a single shard like single queue devices.
+	 */
+	if (q->nr_hw_queues > 1 && !blk_queue_is_zoned(q))
+		dd->nr_shards = q->nr_hw_queues;
+	else
+		dd->nr_shards = 1;
+
+	dd->shards = kcalloc_node(dd->nr_shards, sizeof(*dd->shards),
+				  GFP_KERNEL, q->node);
+	if (!dd->shards) {
+		kfree(dd);
+		kobject_put(&eq->kobj);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < dd->nr_shards; i++) {
+		struct dd_shard *shard = &dd->shards[i];
+
+		spin_lock_init(&shard->lock);
+		for (prio = 0; prio <= DD_PRIO_MAX; prio++) {
+			struct dd_per_prio *per_prio = &shard->per_prio[prio];
+
+			INIT_LIST_HEAD(&per_prio->dispatch);
+			INIT_LIST_HEAD(&per_prio->fifo_list[READ]);
+			INIT_LIST_HEAD(&per_prio->fifo_list[WRITE]);
+			per_prio->sort_list[READ] = RB_ROOT;
+			per_prio->sort_list[WRITE] = RB_ROOT;
+		}
+	}
 	dd->fifo_expire[READ] = read_expire;
 	dd->fifo_expire[WRITE] = write_expire;
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
-	spin_lock_init(&dd->lock);
+	dd->prio_aging_expire = prio_aging_expire;
 	spin_lock_init(&dd->zone_lock);
-	INIT_LIST_HEAD(&dd->dispatch);
 
 	q->elevator = eq;
 	return 0;
 }
 
+static int dd_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+
+	hctx->sched_data = &dd->shards[hctx_idx % dd->nr_shards];
+	return 0;
+}
+
+static void dd_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	hctx->sched_data = NULL;
+}
+
+/*
+ * Only used when all hardware queues share a single shard, as the elevator
+ * merge hash and q->last_merge are not sharded.
+ */
 static int dd_request_merge(struct request_queue *q, struct request **rq,
 			    struct bio *bio)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
+	const enum dd_prio prio = dd_ioprio_to_prio(bio_prio(bio));
+	struct dd_per_prio *per_prio = &dd->shards[0].per_prio[prio];
 	sector_t sector = bio_end_sector(bio);
 	struct request *__rq;
 
 	if (!dd->front_merges)
 		return ELEVATOR_NO_MERGE;
 
-	__rq = elv_rb_find(&dd->sort_list[bio_data_dir(bio)], sector);
+	__rq = elv_rb_find(&per_prio->sort_list[bio_data_dir(bio)], sector);
 	if (__rq) {
 		BUG_ON(sector != blk_rq_pos(__rq));
 
@@ -461,16 +686,52 @@ static int dd_request_merge(struct request_queue *q, struct request **rq,
 	return ELEVATOR_NO_MERGE;
 }
 
+/*
+ * With several shards, try to merge @bio into the last few requests queued
+ * on the shard of the submitting cpu only, without using the elevator merge
+ * hash. A front merge moves the start of the request, so it has to be
+ * repositioned in the sort list.
+ */
+static bool dd_shard_bio_merge(struct dd_shard *shard, struct bio *bio,
+			       unsigned int nr_segs)
+{
+	struct dd_per_prio *per_prio;
+	struct request *rq;
+
+	per_prio = &shard->per_prio[dd_ioprio_to_prio(bio_prio(bio))];
+
+	spin_lock(&shard->lock);
+	rq = blk_bio_list_merge_rq(bio->bi_disk->queue,
+				   &per_prio->fifo_list[bio_data_dir(bio)],
+				   bio, nr_segs);
+	if (rq && rq->bio == bio) {
+		elv_rb_del(deadline_rb_root(per_prio, rq), rq);
+		deadline_add_rq_rb(per_prio, rq);
+	}
+	spin_unlock(&shard->lock);
+
+	return rq != NULL;
+}
+
 static bool dd_bio_merge(struct request_queue *q, struct bio *bio,
 		unsigned int nr_segs)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *shard = &dd->shards[0];
 	struct request *free = NULL;
 	bool ret;
 
-	spin_lock(&dd->lock);
+	if (dd->nr_shards > 1) {
+		struct blk_mq_ctx *ctx = blk_mq_get_ctx(q);
+		struct blk_mq_hw_ctx *hctx;
+
+		hctx = blk_mq_map_queue(q, bio->bi_opf, ctx);
+		return dd_shard_bio_merge(hctx->sched_data, bio, nr_segs);
+	}
+
+	spin_lock(&shard->lock);
 	ret = blk_mq_sched_try_merge(q, bio, nr_segs, &free);
-	spin_unlock(&dd->lock);
+	spin_unlock(&shard->lock);
 
 	if (free)
 		blk_mq_free_request(free);
@@ -486,51 +747,70 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *shard = hctx->sched_data;
+	const bool sharded = dd->nr_shards > 1;
 	const int data_dir = rq_data_dir(rq);
+	struct dd_per_prio *per_prio;
 	LIST_HEAD(free);
 
+	lockdep_assert_held(&shard->lock);
+
 	/*
 	 * This may be a requeue of a write request that has locked its
 	 * target zone. If it is the case, this releases the zone lock.
 	 */
 	blk_req_zone_write_unlock(rq);
 
-	if (blk_mq_sched_try_insert_merge(q, rq, &free)) {
+	if (!sharded && blk_mq_sched_try_insert_merge(q, rq, &free)) {
 		blk_mq_free_requests(&free);
 		return;
 	}
 
 	blk_mq_sched_request_inserted(rq);
 
+	per_prio = dd_rq_per_prio(shard, rq);
+	/*
+	 * Only count a request once, also if it is requeued. dd_finish_request()
+	 * uses the same flag to count its completion.
+	 */
+	if (!rq->elv.priv[0]) {
+		per_prio->stats.inserted++;
+		rq->elv.priv[0] = (void *)(uintptr_t)1;
+	}
+
+	/*
+	 * The fifo time is also used by started_after() for aging, so set it
+	 * for requests on the dispatch list too.
+	 */
+	rq->fifo_time = jiffies + dd->fifo_expire[data_dir];
+
 	if (at_head || blk_rq_is_passthrough(rq)) {
 		if (at_head)
-			list_add(&rq->queuelist, &dd->dispatch);
+			list_add(&rq->queuelist, &per_prio->dispatch);
 		else
-			list_add_tail(&rq->queuelist, &dd->dispatch);
+			list_add_tail(&rq->queuelist, &per_prio->dispatch);
 	} else {
-		deadline_add_rq_rb(dd, rq);
+		deadline_add_rq_rb(per_prio, rq);
 
-		if (rq_mergeable(rq)) {
+		if (!sharded && rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
 				q->last_merge = rq;
 		}
 
 		/*
-		 * set expire time and add to fifo list
+		 * add to fifo list
 		 */
-		rq->fifo_time = jiffies + dd->fifo_expire[data_dir];
-		list_add_tail(&rq->queuelist, &dd->fifo_list[data_dir]);
+		list_add_tail(&rq->queuelist, &per_prio->fifo_list[data_dir]);
 	}
 }
 
 static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 			       struct list_head *list, bool at_head)
 {
-	struct request_queue *q = hctx->queue;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *shard = hctx->sched_data;
 
-	spin_lock(&dd->lock);
+	spin_lock(&shard->lock);
 	while (!list_empty(list)) {
 		struct request *rq;
 
@@ -538,15 +818,24 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 		list_del_init(&rq->queuelist);
 		dd_insert_request(hctx, rq, at_head);
 	}
-	spin_unlock(&dd->lock);
+	spin_unlock(&shard->lock);
 }
 
-/*
- * Nothing to do here. This is defined only to ensure that .finish_request
- * method is called upon request completion.
- */
+/* Callback from inside blk_mq_rq_ctx_init(). */
 static void dd_prepare_request(struct request *rq)
 {
+	rq->elv.priv[0] = NULL;
+}
+
+static bool dd_has_write_work(struct dd_shard *shard)
+{
+	enum dd_prio prio;
+
+	for (prio = 0; prio <= DD_PRIO_MAX; prio++)
+		if (!list_empty_careful(&shard->per_prio[prio].fifo_list[WRITE]))
+			return true;
+
+	return false;
 }
 
 /*
@@ -566,26 +855,47 @@ static void dd_prepare_request(struct request *rq)
 static void dd_finish_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *shard = dd_rq_shard(rq);
+
+	/*
+	 * The block layer core may call dd_finish_request() without having
+	 * called dd_insert_requests(). Skip requests that bypassed I/O
+	 * scheduling.
+	 */
+	if (!rq->elv.priv[0])
+		return;
+
+	atomic_inc(&dd_rq_per_prio(shard, rq)->stats.completed);
 
 	if (blk_queue_is_zoned(q)) {
-		struct deadline_data *dd = q->elevator->elevator_data;
 		unsigned long flags;
 
 		spin_lock_irqsave(&dd->zone_lock, flags);
 		blk_req_zone_write_unlock(rq);
-		if (!list_empty(&dd->fifo_list[WRITE]))
+		if (dd_has_write_work(shard))
 			blk_mq_sched_mark_restart_hctx(rq->mq_hctx);
 		spin_unlock_irqrestore(&dd->zone_lock, flags);
 	}
 }
 
+static bool dd_has_work_for_prio(struct dd_per_prio *per_prio)
+{
+	return !list_empty_careful(&per_prio->dispatch) ||
+		!list_empty_careful(&per_prio->fifo_list[READ]) ||
+		!list_empty_careful(&per_prio->fifo_list[WRITE]);
+}
+
 static bool dd_has_work(struct blk_mq_hw_ctx *hctx)
 {
-	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *shard = hctx->sched_data;
+	enum dd_prio prio;
+
+	for (prio = 0; prio <= DD_PRIO_MAX; prio++)
+		if (dd_has_work_for_prio(&shard->per_prio[prio]))
+			return true;
 
-	return !list_empty_careful(&dd->dispatch) ||
-		!list_empty_careful(&dd->fifo_list[0]) ||
-		!list_empty_careful(&dd->fifo_list[1]);
+	return false;
 }
 
 /*
@@ -619,6 +929,7 @@ SHOW_FUNCTION(deadline_write_expire_show, dd->fifo_expire[WRITE], 1);
 SHOW_FUNCTION(deadline_writes_starved_show, dd->writes_starved, 0);
 SHOW_FUNCTION(deadline_front_merges_show, dd->front_merges, 0);
 SHOW_FUNCTION(deadline_fifo_batch_show, dd->fifo_batch, 0);
+SHOW_FUNCTION(deadline_prio_aging_expire_show, dd->prio_aging_expire, 1);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -642,6 +953,7 @@ STORE_FUNCTION(deadline_write_expire_store, &dd->fifo_expire[WRITE], 0, INT_MAX,
 STORE_FUNCTION(deadline_writes_starved_store, &dd->writes_starved, INT_MIN, INT_MAX, 0);
 STORE_FUNCTION(deadline_front_merges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(deadline_prio_aging_expire_store, &dd->prio_aging_expire, 0, INT_MAX, 1);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -653,38 +965,41 @@ static struct elv_fs_entry deadline_attrs[] = {
 	DD_ATTR(writes_starved),
 	DD_ATTR(front_merges),
 	DD_ATTR(fifo_batch),
+	DD_ATTR(prio_aging_expire),
 	__ATTR_NULL
 };
 
 #ifdef CONFIG_BLK_DEBUG_FS
-#define DEADLINE_DEBUGFS_DDIR_ATTRS(ddir, name)				\
+#define DEADLINE_DEBUGFS_DDIR_ATTRS(prio, ddir, name)			\
 static void *deadline_##name##_fifo_start(struct seq_file *m,		\
 					  loff_t *pos)			\
-	__acquires(&dd->lock)						\
+	__acquires(&shard->lock)					\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
+	struct dd_per_prio *per_prio = &shard->per_prio[prio];		\
 									\
-	spin_lock(&dd->lock);						\
-	return seq_list_start(&dd->fifo_list[ddir], *pos);		\
+	spin_lock(&shard->lock);					\
+	return seq_list_start(&per_prio->fifo_list[ddir], *pos);	\
 }									\
 									\
 static void *deadline_##name##_fifo_next(struct seq_file *m, void *v,	\
 					 loff_t *pos)			\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
+	struct dd_per_prio *per_prio = &shard->per_prio[prio];		\
 									\
-	return seq_list_next(v, &dd->fifo_list[ddir], pos);		\
+	return seq_list_next(v, &per_prio->fifo_list[ddir], pos);	\
 }									\
 									\
 static void deadline_##name##_fifo_stop(struct seq_file *m, void *v)	\
-	__releases(&dd->lock)						\
+	__releases(&shard->lock)					\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
 									\
-	spin_unlock(&dd->lock);						\
+	spin_unlock(&shard->lock);					\
 }									\
 									\
 static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
@@ -697,82 +1012,202 @@ static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
 static int deadline_##name##_next_rq_show(void *data,			\
 					  struct seq_file *m)		\
 {									\
-	struct request_queue *q = data;					\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
-	struct request *rq = dd->next_rq[ddir];				\
+	struct blk_mq_hw_ctx *hctx = data;				\
+	struct dd_shard *shard = hctx->sched_data;			\
+	struct dd_per_prio *per_prio = &shard->per_prio[prio];		\
+	struct request *rq = per_prio->next_rq[ddir];			\
 									\
 	if (rq)								\
 		__blk_mq_debugfs_rq_show(m, rq);			\
 	return 0;							\
 }
-DEADLINE_DEBUGFS_DDIR_ATTRS(READ, read)
-DEADLINE_DEBUGFS_DDIR_ATTRS(WRITE, write)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_RT_PRIO, READ, read0)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_RT_PRIO, WRITE, write0)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_BE_PRIO, READ, read1)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_BE_PRIO, WRITE, write1)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_IDLE_PRIO, READ, read2)
+DEADLINE_DEBUGFS_DDIR_ATTRS(DD_IDLE_PRIO, WRITE, write2)
 #undef DEADLINE_DEBUGFS_DDIR_ATTRS
 
 static int deadline_batching_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *shard = hctx->sched_data;
 
-	seq_printf(m, "%u\n", dd->batching);
+	seq_printf(m, "%u\n", shard->batching);
 	return 0;
 }
 
 static int deadline_starved_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *shard = hctx->sched_data;
 
-	seq_printf(m, "%u\n", dd->starved);
+	seq_printf(m, "%u\n", shard->starved);
 	return 0;
 }
 
-static void *deadline_dispatch_start(struct seq_file *m, loff_t *pos)
-	__acquires(&dd->lock)
+/* Number of requests owned by the block driver for a given priority. */
+static u32 dd_owned_by_driver(struct dd_shard *shard, enum dd_prio prio)
 {
-	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	const struct io_stats_per_prio *stats = &shard->per_prio[prio].stats;
+
+	lockdep_assert_held(&shard->lock);
 
-	spin_lock(&dd->lock);
-	return seq_list_start(&dd->dispatch, *pos);
+	return stats->dispatched + stats->merged -
+		atomic_read(&stats->completed);
 }
 
-static void *deadline_dispatch_next(struct seq_file *m, void *v, loff_t *pos)
+static int dd_queued_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *shard = hctx->sched_data;
+	u32 rt, be, idle;
+
+	spin_lock(&shard->lock);
+	rt = dd_queued(shard, DD_RT_PRIO);
+	be = dd_queued(shard, DD_BE_PRIO);
+	idle = dd_queued(shard, DD_IDLE_PRIO);
+	spin_unlock(&shard->lock);
+
+	seq_printf(m, "%u %u %u\n", rt, be, idle);
+
+	return 0;
+}
+
+static int dd_owned_by_driver_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *shard = hctx->sched_data;
+	u32 rt, be, idle;
+
+	spin_lock(&shard->lock);
+	rt = dd_owned_by_driver(shard, DD_RT_PRIO);
+	be = dd_owned_by_driver(shard, DD_BE_PRIO);
+	idle = dd_owned_by_driver(shard, DD_IDLE_PRIO);
+	spin_unlock(&shard->lock);
+
+	seq_printf(m, "%u %u %u\n", rt, be, idle);
+
+	return 0;
+}
+
+static const char *const dd_prio_name[DD_PRIO_COUNT] = {
+	[DD_RT_PRIO]	= "rt",
+	[DD_BE_PRIO]	= "be",
+	[DD_IDLE_PRIO]	= "idle",
+};
 
-	return seq_list_next(v, &dd->dispatch, pos);
+/* Cumulative counters of each priority level, one line per level. */
+static int dd_stats_show(void *data, struct seq_file *m)
+{
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *shard = hctx->sched_data;
+	struct io_stats_per_prio stats[DD_PRIO_COUNT];
+	enum dd_prio prio;
+
+	spin_lock(&shard->lock);
+	for (prio = 0; prio <= DD_PRIO_MAX; prio++)
+		stats[prio] = shard->per_prio[prio].stats;
+	spin_unlock(&shard->lock);
+
+	for (prio = 0; prio <= DD_PRIO_MAX; prio++)
+		seq_printf(m, "%s: inserted %u merged %u dispatched %u completed %u\n",
+			   dd_prio_name[prio], stats[prio].inserted,
+			   stats[prio].merged, stats[prio].dispatched,
+			   atomic_read(&stats[prio].completed));
+
+	return 0;
+}
+
+#define DEADLINE_DISPATCH_ATTR(prio)					\
+static void *deadline_dispatch##prio##_start(struct seq_file *m,	\
+					     loff_t *pos)		\
+	__acquires(&shard->lock)					\
+{									\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
+	struct dd_per_prio *per_prio = &shard->per_prio[prio];		\
+									\
+	spin_lock(&shard->lock);					\
+	return seq_list_start(&per_prio->dispatch, *pos);		\
+}									\
+									\
+static void *deadline_dispatch##prio##_next(struct seq_file *m,	\
+					    void *v, loff_t *pos)	\
+{									\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
+	struct dd_per_prio *per_prio = &shard->per_prio[prio];		\
+									\
+	return seq_list_next(v, &per_prio->dispatch, pos);		\
+}									\
+									\
+static void deadline_dispatch##prio##_stop(struct seq_file *m, void *v)	\
+	__releases(&shard->lock)					\
+{									\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *shard = hctx->sched_data;			\
+									\
+	spin_unlock(&shard->lock);					\
+}									\
+									\
+static const struct seq_operations deadline_dispatch##prio##_seq_ops = { \
+	.start	= deadline_dispatch##prio##_start,			\
+	.next	= deadline_dispatch##prio##_next,			\
+	.stop	= deadline_dispatch##prio##_stop,			\
+	.show	= blk_mq_debugfs_rq_show,				\
 }
 
-static void deadline_dispatch_stop(struct seq_file *m, void *v)
-	__releases(&dd->lock)
+DEADLINE_DISPATCH_ATTR(0);
+DEADLINE_DISPATCH_ATTR(1);
+DEADLINE_DISPATCH_ATTR(2);
+#undef DEADLINE_DISPATCH_ATTR
+
+static int deadline_nr_shards_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = m->private;
+	struct request_queue *q = data;
 	struct deadline_data *dd = q->elevator->elevator_data;
 
-	spin_unlock(&dd->lock);
+	seq_printf(m, "%u\n", dd->nr_shards);
+	return 0;
 }
 
-static const struct seq_operations deadline_dispatch_seq_ops = {
-	.start	= deadline_dispatch_start,
-	.next	= deadline_dispatch_next,
-	.stop	= deadline_dispatch_stop,
-	.show	= blk_mq_debugfs_rq_show,
+static const struct blk_mq_debugfs_attr deadline_queue_debugfs_attrs[] = {
+	{"nr_shards", 0400, deadline_nr_shards_show},
+	{},
 };
 
-#define DEADLINE_QUEUE_DDIR_ATTRS(name)						\
-	{#name "_fifo_list", 0400, .seq_ops = &deadline_##name##_fifo_seq_ops},	\
+#define DEADLINE_HCTX_DDIR_ATTRS(name)					\
+	{#name "_fifo_list", 0400,					\
+			.seq_ops = &deadline_##name##_fifo_seq_ops}
+#define DEADLINE_NEXT_RQ_ATTR(name)					\
 	{#name "_next_rq", 0400, deadline_##name##_next_rq_show}
-static const struct blk_mq_debugfs_attr deadline_queue_debugfs_attrs[] = {
-	DEADLINE_QUEUE_DDIR_ATTRS(read),
-	DEADLINE_QUEUE_DDIR_ATTRS(write),
+static const struct blk_mq_debugfs_attr deadline_hctx_debugfs_attrs[] = {
+	DEADLINE_HCTX_DDIR_ATTRS(read0),
+	DEADLINE_HCTX_DDIR_ATTRS(write0),
+	DEADLINE_HCTX_DDIR_ATTRS(read1),
+	DEADLINE_HCTX_DDIR_ATTRS(write1),
+	DEADLINE_HCTX_DDIR_ATTRS(read2),
+	DEADLINE_HCTX_DDIR_ATTRS(write2),
+	DEADLINE_NEXT_RQ_ATTR(read0),
+	DEADLINE_NEXT_RQ_ATTR(write0),
+	DEADLINE_NEXT_RQ_ATTR(read1),
+	DEADLINE_NEXT_RQ_ATTR(write1),
+	DEADLINE_NEXT_RQ_ATTR(read2),
+	DEADLINE_NEXT_RQ_ATTR(write2),
 	{"batching", 0400, deadline_batching_show},
 	{"starved", 0400, deadline_starved_show},
-	{"dispatch", 0400, .seq_ops = &deadline_dispatch_seq_ops},
+	{"dispatch0", 0400, .seq_ops = &deadline_dispatch0_seq_ops},
+	{"dispatch1", 0400, .seq_ops = &deadline_dispatch1_seq_ops},
+	{"dispatch2", 0400, .seq_ops = &deadline_dispatch2_seq_ops},
+	{"owned_by_driver", 0400, dd_owned_by_driver_show},
+	{"queued", 0400, dd_queued_show},
+	{"stats", 0400, dd_stats_show},
 	{},
 };
-#undef DEADLINE_QUEUE_DDIR_ATTRS
+#undef DEADLINE_NEXT_RQ_ATTR
+#undef DEADLINE_HCTX_DDIR_ATTRS
 #endif
 
 static struct elevator_type mq_deadline = {
@@ -790,10 +1225,13 @@ static struct elevator_type mq_deadline = {
 		.has_work		= dd_has_work,
 		.init_sched		= dd_init_queue,
 		.exit_sched		= dd_exit_queue,
+		.init_hctx		= dd_init_hctx,
+		.exit_hctx		= dd_exit_hctx,
 	},
 
 #ifdef CONFIG_BLK_DEBUG_FS
 	.queue_debugfs_attrs = deadline_queue_debugfs_attrs,
+	.hctx_debugfs_attrs = deadline_hctx_debugfs_attrs,
 #endif
 	.elevator_attrs = deadline_attrs,
 	.elevator_name = "mq-deadline",
@@ -10,6 +10,7 @@
 #include <linux/init.h>
 #include <linux/vmalloc.h>
 #include <linux/kthread.h>
+#include <linux/rwsem.h>
 #include <linux/dm-io.h>
 #include <linux/dm-kcopyd.h>
 #include <linux/dax.h>
@@ -107,7 +108,7 @@ struct wc_entry {
 #define WC_MODE_SORT_FREELIST(wc)		(!WC_MODE_PMEM(wc))
 
 struct dm_writecache {
-	struct mutex lock;
+	struct rw_semaphore lock;
 	struct list_head lru;
 	union {
 		struct list_head freelist;
@@ -221,14 +222,38 @@ struct copy_struct {
 DECLARE_DM_KCOPYD_THROTTLE_WITH_MODULE_PARM(dm_writecache_throttle,
 					    "A percentage of time allocated for data copying");
 
+/*
+ * The lock is held for write by everything that modifies the tree, the lru
+ * or the freelist.  Reads only look up the tree and copy from or remap to
+ * an entry, so they hold it for read and run in parallel with each other.
+ */
 static void wc_lock(struct dm_writecache *wc)
 {
-	mutex_lock(&wc->lock);
+	down_write(&wc->lock);
 }
 
 static void wc_unlock(struct dm_writecache *wc)
 {
-	mutex_unlock(&wc->lock);
+	up_write(&wc->lock);
+}
+
+static void wc_lock_read(struct dm_writecache *wc)
+{
+	down_read(&wc->lock);
+}
+
+static void wc_unlock_read(struct dm_writecache *wc)
+{
+	up_read(&wc->lock);
+}
+
+/*
+ * The in-core metadata is walked on every I/O, keep it on the node the
+ * cache device is attached to.
+ */
+static int writecache_numa_node(struct dm_writecache *wc)
+{
+	return dev_to_node(disk_to_dev(wc->ssd_dev->bdev->bd_disk));
 }
 
 #ifdef DM_WRITECACHE_HAS_PMEM
@@ -937,7 +962,8 @@ static int writecache_alloc_entries(struct dm_writecache *wc)
 
 	if (wc->entries)
 		return 0;
-	wc->entries = vmalloc(array_size(sizeof(struct wc_entry), wc->n_blocks));
+	wc->entries = vmalloc_node(array_size(sizeof(struct wc_entry), wc->n_blocks),
+				   writecache_numa_node(wc));
 	if (!wc->entries)
 		return -ENOMEM;
 	for (b = 0; b < wc->n_blocks; b++) {
@@ -1285,6 +1311,112 @@ static void writecache_offload_bio(struct dm_writecache *wc, struct bio *bio)
 	bio_list_add(&wc->flush_list, bio);
 }
 
+static bool writecache_bio_aligned(struct dm_writecache *wc, struct bio *bio)
+{
+	if (likely(!(((unsigned)bio->bi_iter.bi_sector | bio_sectors(bio)) &
+		     (wc->block_size / 512 - 1))))
+		return true;
+
+	DMERR("I/O is not aligned, sector %llu, size %u, block size %u",
+	      (unsigned long long)bio->bi_iter.bi_sector,
+	      bio->bi_iter.bi_size, wc->block_size);
+	return false;
+}
+
+static int writecache_map_read(struct dm_writecache *wc, struct bio *bio)
+{
+	struct wc_entry *e;
+
+	bio->bi_iter.bi_sector = dm_target_offset(wc->ti, bio->bi_iter.bi_sector);
+
+	if (unlikely(!writecache_bio_aligned(wc, bio))) {
+		bio_io_error(bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	wc_lock_read(wc);
+
+read_next_block:
+	e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
+	if (e && read_original_sector(wc, e) == bio->bi_iter.bi_sector) {
+		if (WC_MODE_PMEM(wc)) {
+			bio_copy_block(wc, bio, memory_data(wc, e));
+			if (bio->bi_iter.bi_size)
+				goto read_next_block;
+			wc_unlock_read(wc);
+			bio_endio(bio);
+			return DM_MAPIO_SUBMITTED;
+		}
+
+		dm_accept_partial_bio(bio, wc->block_size >> SECTOR_SHIFT);
+		bio_set_dev(bio, wc->ssd_dev->bdev);
+		bio->bi_iter.bi_sector = cache_sector(wc, e);
+		if (!writecache_entry_is_committed(wc, e))
+			writecache_wait_for_ios(wc, WRITE);
+		/* make sure that writecache_end_io decrements bio_in_progress: */
+		bio->bi_private = (void *)1;
+		atomic_inc(&wc->bio_in_progress[READ]);
+		wc_unlock_read(wc);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (e) {
+		sector_t next_boundary =
+			read_original_sector(wc, e) - bio->bi_iter.bi_sector;
+		if (next_boundary < bio->bi_iter.bi_size >> SECTOR_SHIFT)
+			dm_accept_partial_bio(bio, next_boundary);
+	}
+	bio_set_dev(bio, wc->dev->bdev);
+	wc_unlock_read(wc);
+	return DM_MAPIO_REMAPPED;
+}
+
+/*
+ * Copy one block of a pmem write into the free entry @e with the lock
+ * dropped, so that writers copy in parallel, then publish the entry.  It
+ * is stamped with the sequence count and linked into the tree and the lru
+ * only after the data is in place: readers never see a partial block and
+ * writecache_flush() still finds every uncommitted entry in seq_count
+ * order.  Called and returns with the lock held.
+ */
+static bool writecache_copy_unlocked(struct dm_writecache *wc, struct bio *bio,
+				     struct wc_entry *e)
+{
+	sector_t sector = bio->bi_iter.bi_sector;
+	struct wc_entry *old;
+
+	wc_unlock(wc);
+	bio_copy_block(wc, bio, memory_data(wc, e));
+	/* the commit may run on another cpu, drain our stores first */
+	pmem_wmb();
+	wc_lock(wc);
+
+	if (unlikely(writecache_has_error(wc))) {
+		writecache_add_to_freelist(wc, e);
+		return false;
+	}
+
+	/*
+	 * A concurrent write to the same block may have published its entry
+	 * meanwhile.  Two uncommitted entries of one sector would share the
+	 * sequence count, so overwrite that one and give @e back.
+	 */
+	old = writecache_find_entry(wc, sector, 0);
+	if (old && !writecache_entry_is_committed(wc, old)) {
+		memcpy_flushcache_optimized(memory_data(wc, old),
+					    memory_data(wc, e), wc->block_size);
+		writecache_add_to_freelist(wc, e);
+		if (unlikely(waitqueue_active(&wc->freelist_wait)))
+			wake_up(&wc->freelist_wait);
+		return true;
+	}
+
+	write_original_sector_seq_count(wc, e, sector, wc->seq_count);
+	writecache_insert_entry(wc, e);
+	wc->uncommitted_blocks++;
+	return true;
+}
+
 static int writecache_map(struct dm_target *ti, struct bio *bio)
 {
 	struct wc_entry *e;
@@ -1292,6 +1424,9 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 
 	bio->bi_private = NULL;
 
+	if (bio_data_dir(bio) == READ)
+		return writecache_map_read(wc, bio);
+
 	wc_lock(wc);
 
 	if (unlikely(bio->bi_opf & REQ_PREFLUSH)) {
@@ -1314,13 +1449,8 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 
 	bio->bi_iter.bi_sector = dm_target_offset(ti, bio->bi_iter.bi_sector);
 
-	if (unlikely((((unsigned)bio->bi_iter.bi_sector | bio_sectors(bio)) &
-				(wc->block_size / 512 - 1)) != 0)) {
-		DMERR("I/O is not aligned, sector %llu, size %u, block size %u",
-		      (unsigned long long)bio->bi_iter.bi_sector,
-		      bio->bi_iter.bi_size, wc->block_size);
+	if (unlikely(!writecache_bio_aligned(wc, bio)))
 		goto unlock_error;
-	}
 
 	if (unlikely(bio_op(bio) == REQ_OP_DISCARD)) {
 		if (writecache_has_error(wc))
@@ -1334,134 +1464,110 @@ static int writecache_map(struct dm_target *ti, struct bio *bio)
 		}
 	}
 
-	if (bio_data_dir(bio) == READ) {
-read_next_block:
-		e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
-		if (e && read_original_sector(wc, e) == bio->bi_iter.bi_sector) {
-			if (WC_MODE_PMEM(wc)) {
-				bio_copy_block(wc, bio, memory_data(wc, e));
-				if (bio->bi_iter.bi_size)
-					goto read_next_block;
-				goto unlock_submit;
-			} else {
-				dm_accept_partial_bio(bio, wc->block_size >> SECTOR_SHIFT);
-				bio_set_dev(bio, wc->ssd_dev->bdev);
-				bio->bi_iter.bi_sector = cache_sector(wc, e);
-				if (!writecache_entry_is_committed(wc, e))
-					writecache_wait_for_ios(wc, WRITE);
-				goto unlock_remap;
+	do {
+		bool found_entry = false;
+		bool search_used = false;
+		if (writecache_has_error(wc))
+			goto unlock_error;
+		e = writecache_find_entry(wc, bio->bi_iter.bi_sector, 0);
+		if (e) {
+			if (!writecache_entry_is_committed(wc, e)) {
+				search_used = true;
+				goto bio_copy;
 			}
-		} else {
-			if (e) {
-				sector_t next_boundary =
-					read_original_sector(wc, e) - bio->bi_iter.bi_sector;
-				if (next_boundary < bio->bi_iter.bi_size >> SECTOR_SHIFT) {
-					dm_accept_partial_bio(bio, next_boundary);
-				}
+			if (!WC_MODE_PMEM(wc) && !e->write_in_progress) {
+				wc->overwrote_committed = true;
+				search_used = true;
+				goto bio_copy;
 			}
-			goto unlock_remap_origin;
+			found_entry = true;
+		} else {
+			if (unlikely(wc->cleaner))
+				goto direct_write;
 		}
-	} else {
-		do {
-			bool found_entry = false;
-			bool search_used = false;
-			if (writecache_has_error(wc))
-				goto unlock_error;
-			e = writecache_find_entry(wc, bio->bi_iter.bi_sector, 0);
-			if (e) {
-				if (!writecache_entry_is_committed(wc, e)) {
-					search_used = true;
-					goto bio_copy;
-				}
-				if (!WC_MODE_PMEM(wc) && !e->write_in_progress) {
-					wc->overwrote_committed = true;
-					search_used = true;
-					goto bio_copy;
-				}
-				found_entry = true;
-			} else {
-				if (unlikely(wc->cleaner))
-					goto direct_write;
-			}
-			e = writecache_pop_from_freelist(wc, (sector_t)-1);
-			if (unlikely(!e)) {
-				if (!WC_MODE_PMEM(wc) && !found_entry) {
+		e = writecache_pop_from_freelist(wc, (sector_t)-1);
+		if (unlikely(!e)) {
+			if (!WC_MODE_PMEM(wc) && !found_entry) {
 direct_write:
-					e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
-					if (e) {
-						sector_t next_boundary = read_original_sector(wc, e) - bio->bi_iter.bi_sector;
-						BUG_ON(!next_boundary);
-						if (next_boundary < bio->bi_iter.bi_size >> SECTOR_SHIFT) {
-							dm_accept_partial_bio(bio, next_boundary);
-						}
+				e = writecache_find_entry(wc, bio->bi_iter.bi_sector, WFE_RETURN_FOLLOWING);
+				if (e) {
+					sector_t next_boundary = read_original_sector(wc, e) - bio->bi_iter.bi_sector;
+					BUG_ON(!next_boundary);
+					if (next_boundary < bio->bi_iter.bi_size >> SECTOR_SHIFT) {
+						dm_accept_partial_bio(bio, next_boundary);
 					}
-					goto unlock_remap_origin;
 				}
-				writecache_wait_on_freelist(wc);
-				continue;
+				goto unlock_remap_origin;
 			}
-			write_original_sector_seq_count(wc, e, bio->bi_iter.bi_sector, wc->seq_count);
-			writecache_insert_entry(wc, e);
-			wc->uncommitted_blocks++;
+			writecache_wait_on_freelist(wc);
+			continue;
+		}
+		if (WC_MODE_PMEM(wc)) {
+			if (unlikely(!writecache_copy_unlocked(wc, bio, e)))
+				goto unlock_error;
+			continue;
+		}
+		write_original_sector_seq_count(wc, e, bio->bi_iter.bi_sector, wc->seq_count);
+		writecache_insert_entry(wc, e);
+		wc->uncommitted_blocks++;
 bio_copy:
-			if (WC_MODE_PMEM(wc)) {
-				bio_copy_block(wc, bio, memory_data(wc, e));
-			} else {
-				unsigned bio_size = wc->block_size;
-				sector_t start_cache_sec = cache_sector(wc, e);
-				sector_t current_cache_sec = start_cache_sec + (bio_size >> SECTOR_SHIFT);
-
-				while (bio_size < bio->bi_iter.bi_size) {
-					if (!search_used) {
-						struct wc_entry *f = writecache_pop_from_freelist(wc, current_cache_sec);
-						if (!f)
-							break;
-						write_original_sector_seq_count(wc, f, bio->bi_iter.bi_sector +
-										(bio_size >> SECTOR_SHIFT), wc->seq_count);
-						writecache_insert_entry(wc, f);
-						wc->uncommitted_blocks++;
-					} else {
-						struct wc_entry *f;
-						struct rb_node *next = rb_next(&e->rb_node);
-						if (!next)
-							break;
-						f = container_of(next, struct wc_entry, rb_node);
-						if (f != e + 1)
-							break;
-						if (read_original_sector(wc, f) !=
-						    read_original_sector(wc, e) + (wc->block_size >> SECTOR_SHIFT))
-							break;
-						if (unlikely(f->write_in_progress))
-							break;
-						if (writecache_entry_is_committed(wc, f))
-							wc->overwrote_committed = true;
-						e = f;
-					}
-					bio_size += wc->block_size;
-					current_cache_sec += wc->block_size >> SECTOR_SHIFT;
+		if (WC_MODE_PMEM(wc)) {
+			bio_copy_block(wc, bio, memory_data(wc, e));
+		} else {
+			unsigned bio_size = wc->block_size;
+			sector_t start_cache_sec = cache_sector(wc, e);
+			sector_t current_cache_sec = start_cache_sec + (bio_size >> SECTOR_SHIFT);
+
+			while (bio_size < bio->bi_iter.bi_size) {
+				if (!search_used) {
+					struct wc_entry *f = writecache_pop_from_freelist(wc, current_cache_sec);
+					if (!f)
+						break;
+					write_original_sector_seq_count(wc, f, bio->bi_iter.bi_sector +
+									(bio_size >> SECTOR_SHIFT), wc->seq_count);
+					writecache_insert_entry(wc, f);
+					wc->uncommitted_blocks++;
+				} else {
+					struct wc_entry *f;
+					struct rb_node *next = rb_next(&e->rb_node);
+					if (!next)
+						break;
+					f = container_of(next, struct wc_entry, rb_node);
+					if (f != e + 1)
+						break;
+					if (read_original_sector(wc, f) !=
+					    read_original_sector(wc, e) + (wc->block_size >> SECTOR_SHIFT))
+						break;
+					if (unlikely(f->write_in_progress))
+						break;
+					if (writecache_entry_is_committed(wc, f))
+						wc->overwrote_committed = true;
+					e = f;
 				}
+				bio_size += wc->block_size;
+				current_cache_sec += wc->block_size >> SECTOR_SHIFT;
+			}
 
-				bio_set_dev(bio, wc->ssd_dev->bdev);
-				bio->bi_iter.bi_sector = start_cache_sec;
-				dm_accept_partial_bio(bio, bio_size >> SECTOR_SHIFT);
+			bio_set_dev(bio, wc->ssd_dev->bdev);
+			bio->bi_iter.bi_sector = start_cache_sec;
+			dm_accept_partial_bio(bio, bio_size >> SECTOR_SHIFT);
 
-				if (unlikely(wc->uncommitted_blocks >= wc->autocommit_blocks)) {
-					wc->uncommitted_blocks = 0;
-					queue_work(wc->writeback_wq, &wc->flush_work);
-				} else {
-					writecache_schedule_autocommit(wc);
-				}
-				goto unlock_remap;
+			if (unlikely(wc->uncommitted_blocks >= wc->autocommit_blocks)) {
+				wc->uncommitted_blocks = 0;
+				queue_work(wc->writeback_wq, &wc->flush_work);
+			} else {
+				writecache_schedule_autocommit(wc);
 			}
-		} while (bio->bi_iter.bi_size);
+			goto unlock_remap;
+		}
+	} while (bio->bi_iter.bi_size);
 
-		if (unlikely(bio->bi_opf & REQ_FUA ||
-			     wc->uncommitted_blocks >= wc->autocommit_blocks))
-			writecache_flush(wc);
-		else
-			writecache_schedule_autocommit(wc);
-		goto unlock_submit;
-	}
+	if (unlikely(bio->bi_opf & REQ_FUA ||
+		     wc->uncommitted_blocks >= wc->autocommit_blocks))
+		writecache_flush(wc);
+	else
+		writecache_schedule_autocommit(wc);
+	goto unlock_submit;
 
 unlock_remap_origin:
 	bio_set_dev(bio, wc->dev->bdev);
@@ -2108,7 +2214,7 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	ti->private = wc;
 	wc->ti = ti;
 
-	mutex_init(&wc->lock);
+	init_rwsem(&wc->lock);
 	wc->max_age = MAX_AGE_UNSPECIFIED;
 	writecache_poison_lists(wc);
 	init_waitqueue_head(&wc->freelist_wait);
@@ -2378,7 +2484,8 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 			goto bad;
 		}
 
-		wc->memory_map = vmalloc(n_metadata_blocks << wc->block_size_bits);
+		wc->memory_map = vmalloc_node(n_metadata_blocks << wc->block_size_bits,
+					      writecache_numa_node(wc));
 		if (!wc->memory_map) {
 			r = -ENOMEM;
 			ti->error = "Unable to allocate memory for metadata";
@@ -2396,7 +2503,8 @@ static int writecache_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		wc->metadata_sectors = n_metadata_blocks << (wc->block_size_bits - SECTOR_SHIFT);
 		wc->dirty_bitmap_size = (n_bitmap_bits + BITS_PER_LONG - 1) /
 			BITS_PER_LONG * sizeof(unsigned long);
-		wc->dirty_bitmap = vzalloc(wc->dirty_bitmap_size);
+		wc->dirty_bitmap = vzalloc_node(wc->dirty_bitmap_size,
+						writecache_numa_node(wc));
 		if (!wc->dirty_bitmap) {
 			r = -ENOMEM;
 			ti->error = "Unable to allocate dirty bitmap";
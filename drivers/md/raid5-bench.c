@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * raid456 full stripe write benchmark
+ *
+ * Writes full stripes to an md raid4/5/6 array from one thread per online
+ * cpu and reports the throughput.  Each thread owns a stripe aligned region
+ * of the array and writes it one full stripe (the io_opt of the array) per
+ * plug, so the writes take the full stripe batching path of raid5 and
+ * parity is generated by the boot-selected xor and lib/raid6 routines.
+ *
+ * THE DATA ON THE ARRAY IS OVERWRITTEN.  Run it with
+ *
+ *	modprobe raid5-bench dev=/dev/md0
+ *
+ * The module does its run from init and then fails to load on purpose, so
+ * it can be loaded again without an rmmod in between.
+ */
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched/task.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+
+#define RB_PAGE_SECTORS		(PAGE_SIZE >> 9)
+
+static char *dev;
+module_param(dev, charp, 0444);
+MODULE_PARM_DESC(dev, "md array to write to, its contents are destroyed");
+
+static unsigned int size_mb = 256;
+module_param(size_mb, uint, 0444);
+MODULE_PARM_DESC(size_mb, "MB written by each thread (default 256)");
+
+struct rb_thread {
+	struct task_struct *task;
+	struct block_device *bdev;
+	sector_t start;
+	sector_t end;
+	unsigned int stripe_sectors;
+};
+
+static atomic_t rb_running;
+static DECLARE_COMPLETION(rb_start);
+static DECLARE_COMPLETION(rb_done);
+
+/*
+ * The bios of a stripe are chained to the last one, which is waited for.
+ * No completion handler of ours runs, so nothing is left in module text
+ * once the write has returned.
+ */
+static int rb_write_stripe(struct rb_thread *t, struct page *page,
+			   sector_t sector)
+{
+	unsigned int left = t->stripe_sectors;
+	struct bio *bio = NULL;
+	struct blk_plug plug;
+	int ret;
+
+	blk_start_plug(&plug);
+	while (left) {
+		unsigned int nr_pages = min_t(unsigned int, BIO_MAX_PAGES,
+					      left / RB_PAGE_SECTORS);
+		struct bio *new;
+		unsigned int i;
+
+		new = bio_alloc(GFP_NOIO, nr_pages);
+		bio_set_dev(new, t->bdev);
+		new->bi_iter.bi_sector = sector;
+		new->bi_opf = REQ_OP_WRITE;
+		for (i = 0; i < nr_pages; i++)
+			bio_add_page(new, page, PAGE_SIZE, 0);
+
+		sector += bio_sectors(new);
+		left -= bio_sectors(new);
+		if (bio) {
+			bio_chain(bio, new);
+			submit_bio(bio);
+		}
+		bio = new;
+	}
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	blk_finish_plug(&plug);
+
+	return ret;
+}
+
+static int rb_thread_fn(void *arg)
+{
+	struct rb_thread *t = arg;
+	struct page *page;
+	sector_t sector;
+	int ret = 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		ret = -ENOMEM;
+
+	wait_for_completion(&rb_start);
+
+	for (sector = t->start; !ret && sector < t->end;
+	     sector += t->stripe_sectors)
+		ret = rb_write_stripe(t, page, sector);
+
+	if (page)
+		__free_page(page);
+
+	if (atomic_dec_and_test(&rb_running))
+		complete(&rb_done);
+
+	/* raid5_bench_run() reaps us with kthread_stop() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return ret;
+}
+
+static int raid5_bench_run(struct block_device *bdev)
+{
+	unsigned int stripe_sectors = queue_io_opt(bdev_get_queue(bdev)) >> 9;
+	unsigned int nr_threads = 0;
+	sector_t region, capacity = get_capacity(bdev->bd_disk);
+	struct rb_thread *threads;
+	u64 start, ns, bytes, mbps;
+	int cpu, i, ret = 0;
+
+	if (!stripe_sectors || stripe_sectors % RB_PAGE_SECTORS) {
+		pr_err("raid5-bench: %s has no full stripe size\n", dev);
+		return -EINVAL;
+	}
+
+	threads = kcalloc(nr_cpu_ids, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	cpus_read_lock();
+
+	/* a stripe aligned region per thread, shrunk to fit the array */
+	region = (sector_t)size_mb << (20 - 9);
+	region = min_t(sector_t, region, div_u64(capacity, num_online_cpus()));
+	region = rounddown(region, stripe_sectors);
+	if (!region) {
+		cpus_read_unlock();
+		kfree(threads);
+		pr_err("raid5-bench: %s is too small\n", dev);
+		return -ENOSPC;
+	}
+
+	/* the count is dropped below once all threads are created */
+	atomic_set(&rb_running, 1);
+
+	for_each_online_cpu(cpu) {
+		struct rb_thread *t = &threads[nr_threads];
+		struct task_struct *task;
+
+		t->bdev = bdev;
+		t->start = nr_threads * region;
+		t->end = t->start + region;
+		t->stripe_sectors = stripe_sectors;
+
+		task = kthread_create_on_cpu(rb_thread_fn, t, cpu,
+					     "raid5-bench/%u");
+		if (WARN_ON(IS_ERR(task)))
+			continue;
+		get_task_struct(task);
+		t->task = task;
+		atomic_inc(&rb_running);
+		nr_threads++;
+		wake_up_process(task);
+	}
+	cpus_read_unlock();
+
+	start = ktime_get_ns();
+	complete_all(&rb_start);
+	if (!atomic_dec_and_test(&rb_running))
+		wait_for_completion(&rb_done);
+	ns = ktime_get_ns() - start;
+
+	for (i = 0; i < nr_threads; i++) {
+		int err = kthread_stop(threads[i].task);
+
+		put_task_struct(threads[i].task);
+		if (err && !ret)
+			ret = err;
+	}
+	kfree(threads);
+
+	if (ret) {
+		pr_err("raid5-bench: %s: write failed: %d\n", dev, ret);
+		return ret;
+	}
+
+	bytes = (u64)nr_threads * region << 9;
+	mbps = ns ? div64_u64(bytes * 1000, ns) : 0;
+	pr_info("raid5-bench: %s, %u KiB full stripes, %u threads: %llu MB/s total, %llu MB/s per thread\n",
+		dev, stripe_sectors / 2, nr_threads, mbps,
+		nr_threads ? div_u64(mbps, nr_threads) : 0);
+
+	return 0;
+}
+
+static int __init raid5_bench_init(void)
+{
+	const fmode_t mode = FMODE_WRITE | FMODE_EXCL;
+	struct block_device *bdev;
+	int ret;
+
+	if (!dev) {
+		pr_err("raid5-bench: dev= is required\n");
+		return -EINVAL;
+	}
+
+	bdev = blkdev_get_by_path(dev, mode, &dev);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	ret = raid5_bench_run(bdev);
+	blkdev_put(bdev, mode);
+
+	/* never stay loaded, see the comment at the top */
+	return ret ? ret : -EAGAIN;
+}
+
+module_init(raid5_bench_init);
+MODULE_DESCRIPTION("raid456 full stripe write benchmark");
+MODULE_LICENSE("GPL");
@@ -801,6 +801,41 @@ static void unlock_two_stripes(struct stripe_head *sh1, struct stripe_head *sh2)
 	spin_unlock_irq(&sh2->stripe_lock);
 }
 
+struct raid5_plug_cb {
+	struct blk_plug_cb	cb;
+	struct list_head	list;
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	/*
+	 * The last stripe that became a full stripe write under this plug,
+	 * with a reference held.  The next stripe of the chunk is batched
+	 * behind it without looking it up in the stripe hash.
+	 */
+	struct stripe_head	*batch_last;
+};
+
+static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule);
+
+static struct raid5_plug_cb *raid5_check_plugged(struct mddev *mddev)
+{
+	struct blk_plug_cb *blk_cb = blk_check_plugged(
+		raid5_unplug, mddev,
+		sizeof(struct raid5_plug_cb));
+	struct raid5_plug_cb *cb;
+
+	if (!blk_cb)
+		return NULL;
+
+	cb = container_of(blk_cb, struct raid5_plug_cb, cb);
+
+	if (cb->list.next == NULL) {
+		int i;
+		INIT_LIST_HEAD(&cb->list);
+		for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+			INIT_LIST_HEAD(cb->temp_inactive_list + i);
+	}
+	return cb;
+}
+
 /* Only freshly new full stripe normal write stripe can be added to a batch list */
 static bool stripe_can_batch(struct stripe_head *sh)
 {
@@ -813,10 +848,49 @@ static bool stripe_can_batch(struct stripe_head *sh)
 		is_full_stripe_write(sh);
 }
 
+/*
+ * A task writing full stripes goes through the stripes of a chunk in order,
+ * so the previous stripe of the chunk is normally the one it made a full
+ * stripe write last.  Take it from the plug, where we hold a reference to
+ * it, so that batching needs neither the hash lock nor the device_lock.
+ */
+static struct stripe_head *stripe_get_plugged_head(struct raid5_plug_cb *cb,
+						   struct r5conf *conf,
+						   sector_t head_sector)
+{
+	struct stripe_head *head;
+
+	if (!cb || !cb->batch_last)
+		return NULL;
+
+	head = cb->batch_last;
+	if (head->sector != head_sector || head->generation != conf->generation)
+		return NULL;
+
+	atomic_inc(&head->count);
+	return head;
+}
+
+static void stripe_set_plugged_head(struct raid5_plug_cb *cb,
+				    struct stripe_head *sh)
+{
+	struct stripe_head *old;
+
+	if (!cb)
+		return;
+
+	old = cb->batch_last;
+	atomic_inc(&sh->count);
+	cb->batch_last = sh;
+	if (old)
+		raid5_release_stripe(old);
+}
+
 /* we only do back search */
 static void stripe_add_to_batch_list(struct r5conf *conf, struct stripe_head *sh)
 {
 	struct stripe_head *head;
+	struct raid5_plug_cb *cb = raid5_check_plugged(conf->mddev);
 	sector_t head_sector, tmp_sec;
 	int hash;
 	int dd_idx;
@@ -825,9 +899,13 @@ static void stripe_add_to_batch_list(struct r5conf *conf, struct stripe_head *sh
 	/* Don't cross chunks, so stripe pd_idx/qd_idx is the same */
 	tmp_sec = sh->sector;
 	if (!sector_div(tmp_sec, conf->chunk_sectors))
-		return;
+		goto set_head;
 	head_sector = sh->sector - RAID5_STRIPE_SECTORS(conf);
 
+	head = stripe_get_plugged_head(cb, conf, head_sector);
+	if (head)
+		goto found;
+
 	hash = stripe_hash_locks_hash(conf, head_sector);
 	spin_lock_irq(conf->hash_locks + hash);
 	head = __find_stripe(conf, head_sector, conf->generation);
@@ -855,7 +933,8 @@ static void stripe_add_to_batch_list(struct r5conf *conf, struct stripe_head *sh
 	spin_unlock_irq(conf->hash_locks + hash);
 
 	if (!head)
-		return;
+		goto set_head;
+found:
 	if (!stripe_can_batch(head))
 		goto out;
 
@@ -923,6 +1002,8 @@ static void stripe_add_to_batch_list(struct r5conf *conf, struct stripe_head *sh
 	unlock_two_stripes(head, sh);
 out:
 	raid5_release_stripe(head);
+set_head:
+	stripe_set_plugged_head(cb, sh);
 }
 
 /* Determine if 'data_offset' or 'new_data_offset' should be used
@@ -5593,12 +5674,6 @@ static struct stripe_head *__get_priority_stripe(struct r5conf *conf, int group)
 	return sh;
 }
 
-struct raid5_plug_cb {
-	struct blk_plug_cb	cb;
-	struct list_head	list;
-	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
-};
-
 static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 {
 	struct raid5_plug_cb *cb = container_of(
@@ -5631,6 +5706,8 @@ static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 		}
 		spin_unlock_irq(&conf->device_lock);
 	}
+	if (cb->batch_last)
+		raid5_release_stripe(cb->batch_last);
 	release_inactive_stripe_list(conf, cb->temp_inactive_list,
 				     NR_STRIPE_HASH_LOCKS);
 	if (mddev->queue)
@@ -5641,25 +5718,13 @@ static void raid5_unplug(struct blk_plug_cb *blk_cb, bool from_schedule)
 static void release_stripe_plug(struct mddev *mddev,
 				struct stripe_head *sh)
 {
-	struct blk_plug_cb *blk_cb = blk_check_plugged(
-		raid5_unplug, mddev,
-		sizeof(struct raid5_plug_cb));
-	struct raid5_plug_cb *cb;
+	struct raid5_plug_cb *cb = raid5_check_plugged(mddev);
 
-	if (!blk_cb) {
+	if (!cb) {
 		raid5_release_stripe(sh);
 		return;
 	}
 
-	cb = container_of(blk_cb, struct raid5_plug_cb, cb);
-
-	if (cb->list.next == NULL) {
-		int i;
-		INIT_LIST_HEAD(&cb->list);
-		for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
-			INIT_LIST_HEAD(cb->temp_inactive_list + i);
-	}
-
 	if (!test_and_set_bit(STRIPE_ON_UNPLUG_LIST, &sh->state))
 		list_add_tail(&sh->lru, &cb->list);
 	else
@@ -18,6 +18,7 @@
 #include <linux/pr.h>
 #include <linux/ptrace.h>
 #include <linux/nvme_ioctl.h>
+#include <linux/io_uring.h>
 #include <linux/pm_qos.h>
 #include <asm/unaligned.h>
 
@@ -280,15 +281,19 @@ static inline enum nvme_disposition nvme_decide_disposition(struct request *req)
 	return RETRY;
 }
 
-static inline void nvme_end_req(struct request *req)
+static inline void nvme_end_req_zoned(struct request *req)
 {
-	blk_status_t status = nvme_error_status(nvme_req(req)->status);
-
 	if (IS_ENABLED(CONFIG_BLK_DEV_ZONED) &&
 	    req_op(req) == REQ_OP_ZONE_APPEND)
 		req->__sector = nvme_lba_to_sect(req->q->queuedata,
 			le64_to_cpu(nvme_req(req)->result.u64));
+}
 
+static inline void nvme_end_req(struct request *req)
+{
+	blk_status_t status = nvme_error_status(nvme_req(req)->status);
+
+	nvme_end_req_zoned(req);
 	nvme_trace_bio_complete(req, status);
 	blk_mq_end_request(req, status);
 }
@@ -315,6 +320,24 @@ void nvme_complete_rq(struct request *req)
 }
 EXPORT_SYMBOL_GPL(nvme_complete_rq);
 
+/*
+ * Called for each request of a completion batch, which only ever holds
+ * requests that completed without error, before the batch is ended with
+ * blk_mq_end_request_batch().
+ */
+void nvme_complete_batch_req(struct request *req)
+{
+	trace_nvme_complete_rq(req);
+	nvme_cleanup_cmd(req);
+
+	if (nvme_req(req)->ctrl->kas)
+		nvme_req(req)->ctrl->comp_seen = true;
+
+	nvme_end_req_zoned(req);
+	nvme_trace_bio_complete(req, BLK_STS_OK);
+}
+EXPORT_SYMBOL_GPL(nvme_complete_batch_req);
+
 bool nvme_cancel_request(struct request *req, void *data, bool reserved)
 {
 	dev_dbg_ratelimited(((struct nvme_ctrl *) data)->device,
@@ -518,10 +541,27 @@ static inline void nvme_clear_nvme_request(struct request *req)
 	}
 }
 
+static inline unsigned int nvme_req_op(struct nvme_command *cmd)
+{
+	return nvme_is_write(cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
+}
+
+static void nvme_init_request(struct request *req, struct nvme_command *cmd)
+{
+	if (req->q->queuedata)
+		req->timeout = NVME_IO_TIMEOUT;
+	else /* no queuedata implies admin queue */
+		req->timeout = ADMIN_TIMEOUT;
+
+	req->cmd_flags |= REQ_FAILFAST_DRIVER;
+	nvme_clear_nvme_request(req);
+	nvme_req(req)->cmd = cmd;
+}
+
 struct request *nvme_alloc_request(struct request_queue *q,
 		struct nvme_command *cmd, blk_mq_req_flags_t flags, int qid)
 {
-	unsigned op = nvme_is_write(cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
+	unsigned op = nvme_req_op(cmd);
 	struct request *req;
 
 	if (qid == NVME_QID_ANY) {
@@ -533,15 +573,7 @@ struct request *nvme_alloc_request(struct request_queue *q,
 	if (IS_ERR(req))
 		return req;
 
-	if (req->q->queuedata)
-		req->timeout = NVME_IO_TIMEOUT;
-	else /* no queuedata implies admin queue */
-		req->timeout = ADMIN_TIMEOUT;
-
-	req->cmd_flags |= REQ_FAILFAST_DRIVER;
-	nvme_clear_nvme_request(req);
-	nvme_req(req)->cmd = cmd;
-
+	nvme_init_request(req, cmd);
 	return req;
 }
 EXPORT_SYMBOL_GPL(nvme_alloc_request);
@@ -1076,14 +1108,59 @@ void nvme_execute_passthru_rq(struct request *rq)
 }
 EXPORT_SYMBOL_NS_GPL(nvme_execute_passthru_rq, NVME_TARGET_PASSTHRU);
 
+/*
+ * Map the user data, and metadata if any, of a passthrough request. With
+ * @ioucmd set and IORING_URING_CMD_FIXED, @ubuffer is inside a registered
+ * io_uring buffer and is mapped without pinning the pages again.
+ */
+static int nvme_map_user_request(struct request *req, void __user *ubuffer,
+		unsigned bufflen, void __user *meta_buffer, unsigned meta_len,
+		u32 meta_seed, void **metap, struct io_uring_cmd *ioucmd)
+{
+	bool write = nvme_is_write(nvme_req(req)->cmd);
+	struct request_queue *q = req->q;
+	struct nvme_ns *ns = q->queuedata;
+	struct gendisk *disk = ns ? ns->disk : NULL;
+	struct bio *bio;
+	void *meta;
+	int ret;
+
+	if (ioucmd && (ioucmd->flags & IORING_URING_CMD_FIXED)) {
+		struct iov_iter iter;
+
+		ret = io_uring_cmd_import_fixed((u64)(uintptr_t)ubuffer,
+				bufflen, rq_data_dir(req), &iter, ioucmd);
+		if (ret < 0)
+			return ret;
+		ret = blk_rq_map_user_iov(q, req, NULL, &iter, GFP_KERNEL);
+	} else {
+		ret = blk_rq_map_user(q, req, NULL, ubuffer, bufflen,
+				GFP_KERNEL);
+	}
+	if (ret)
+		return ret;
+
+	bio = req->bio;
+	bio->bi_disk = disk;
+	if (disk && meta_buffer && meta_len) {
+		meta = nvme_add_user_metadata(bio, meta_buffer, meta_len,
+				meta_seed, write);
+		if (IS_ERR(meta)) {
+			blk_rq_unmap_user(bio);
+			return PTR_ERR(meta);
+		}
+		req->cmd_flags |= REQ_INTEGRITY;
+		*metap = meta;
+	}
+	return 0;
+}
+
 static int nvme_submit_user_cmd(struct request_queue *q,
 		struct nvme_command *cmd, void __user *ubuffer,
 		unsigned bufflen, void __user *meta_buffer, unsigned meta_len,
 		u32 meta_seed, u64 *result, unsigned timeout)
 {
 	bool write = nvme_is_write(cmd);
-	struct nvme_ns *ns = q->queuedata;
-	struct gendisk *disk = ns ? ns->disk : NULL;
 	struct request *req;
 	struct bio *bio = NULL;
 	void *meta = NULL;
@@ -1098,21 +1175,11 @@ static int nvme_submit_user_cmd(struct request_queue *q,
 	nvme_req(req)->flags |= NVME_REQ_USERCMD;
 
 	if (ubuffer && bufflen) {
-		ret = blk_rq_map_user(q, req, NULL, ubuffer, bufflen,
-				GFP_KERNEL);
+		ret = nvme_map_user_request(req, ubuffer, bufflen, meta_buffer,
+				meta_len, meta_seed, &meta, NULL);
 		if (ret)
 			goto out;
 		bio = req->bio;
-		bio->bi_disk = disk;
-		if (disk && meta_buffer && meta_len) {
-			meta = nvme_add_user_metadata(bio, meta_buffer, meta_len,
-					meta_seed, write);
-			if (IS_ERR(meta)) {
-				ret = PTR_ERR(meta);
-				goto out_unmap;
-			}
-			req->cmd_flags |= REQ_INTEGRITY;
-		}
 	}
 
 	nvme_execute_passthru_rq(req);
@@ -1127,7 +1194,6 @@ static int nvme_submit_user_cmd(struct request_queue *q,
 			ret = -EFAULT;
 	}
 	kfree(meta);
- out_unmap:
 	if (bio)
 		blk_rq_unmap_user(bio);
  out:
@@ -1654,6 +1720,246 @@ static int nvme_user_cmd64(struct nvme_ctrl *ctrl, struct nvme_ns *ns,
 	return status;
 }
 
+/* metadata of a command, kept out of line to leave room in the pdu */
+struct nvme_uring_meta {
+	void *buf; /* kernel-resident buffer */
+	void __user *ubuf;
+	u32 len;
+};
+
+struct nvme_uring_cmd_pdu {
+	union {
+		struct bio *bio;
+		struct request *req;
+	};
+	struct nvme_uring_meta *meta;
+	/* queue and blk_qc_t of the request, for IORING_SETUP_IOPOLL */
+	struct request_queue *q;
+	unsigned int cookie;
+};
+
+static inline struct nvme_uring_cmd_pdu *nvme_uring_cmd_pdu(
+		struct io_uring_cmd *ioucmd)
+{
+	return (struct nvme_uring_cmd_pdu *)&ioucmd->pdu;
+}
+
+static void nvme_uring_task_cb(struct io_uring_cmd *ioucmd)
+{
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	struct request *req = pdu->req;
+	struct bio *bio = req->bio;
+	int status;
+	u64 result;
+
+	if (nvme_req(req)->flags & NVME_REQ_CANCELLED)
+		status = -EINTR;
+	else
+		status = nvme_req(req)->status;
+	result = le64_to_cpu(nvme_req(req)->result.u64);
+
+	if (pdu->meta) {
+		if (!status && !op_is_write(req_op(req)) &&
+		    copy_to_user(pdu->meta->ubuf, pdu->meta->buf, pdu->meta->len))
+			status = -EFAULT;
+		kfree(pdu->meta->buf);
+		kfree(pdu->meta);
+	}
+	if (bio)
+		blk_rq_unmap_user(bio);
+	blk_mq_free_request(req);
+
+	io_uring_cmd_done(ioucmd, status, result);
+}
+
+static void nvme_uring_cmd_end_io(struct request *req, blk_status_t err)
+{
+	struct io_uring_cmd *ioucmd = req->end_io_data;
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	/* extract bio before reusing the same field for request */
+	struct bio *bio = pdu->bio;
+
+	/* the command was copied into the SQ entry at dispatch */
+	kfree(nvme_req(req)->cmd);
+	nvme_req(req)->cmd = NULL;
+
+	pdu->req = req;
+	req->bio = bio;
+
+	/*
+	 * Poll queues complete from the io_uring poller. Without metadata to
+	 * copy or user pages to release, the request can be finished right
+	 * here instead of taking a trip through task_work.
+	 */
+	if (req->mq_hctx->type == HCTX_TYPE_POLL && !pdu->meta &&
+	    (!bio || bio_flagged(bio, BIO_NO_PAGE_REF)))
+		nvme_uring_task_cb(ioucmd);
+	else
+		io_uring_cmd_complete_in_task(ioucmd, nvme_uring_task_cb);
+}
+
+static int nvme_uring_cmd_io(struct nvme_ctrl *ctrl, struct nvme_ns *ns,
+		struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	const struct nvme_uring_cmd *cmd = ioucmd->cmd;
+	struct request_queue *q = ns->queue;
+	blk_mq_req_flags_t blk_flags = 0;
+	unsigned int op_flags = 0;
+	struct nvme_command *c;
+	struct request *req;
+	u32 data_len, metadata_len, timeout_ms;
+	u64 addr, metadata;
+	void *meta = NULL;
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct nvme_uring_cmd_pdu) > sizeof(ioucmd->pdu));
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	if (READ_ONCE(cmd->flags))
+		return -EINVAL;
+
+	/*
+	 * The SQE may be reused as soon as we return and the request keeps a
+	 * pointer to its command until it is dispatched, so it needs a copy.
+	 */
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+	c->common.opcode = READ_ONCE(cmd->opcode);
+	c->common.nsid = cpu_to_le32(READ_ONCE(cmd->nsid));
+	c->common.cdw2[0] = cpu_to_le32(READ_ONCE(cmd->cdw2));
+	c->common.cdw2[1] = cpu_to_le32(READ_ONCE(cmd->cdw3));
+	c->common.cdw10 = cpu_to_le32(READ_ONCE(cmd->cdw10));
+	c->common.cdw11 = cpu_to_le32(READ_ONCE(cmd->cdw11));
+	c->common.cdw12 = cpu_to_le32(READ_ONCE(cmd->cdw12));
+	c->common.cdw13 = cpu_to_le32(READ_ONCE(cmd->cdw13));
+	c->common.cdw14 = cpu_to_le32(READ_ONCE(cmd->cdw14));
+	c->common.cdw15 = cpu_to_le32(READ_ONCE(cmd->cdw15));
+
+	addr = READ_ONCE(cmd->addr);
+	data_len = READ_ONCE(cmd->data_len);
+	metadata = READ_ONCE(cmd->metadata);
+	metadata_len = READ_ONCE(cmd->metadata_len);
+	timeout_ms = READ_ONCE(cmd->timeout_ms);
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		blk_flags |= BLK_MQ_REQ_NOWAIT;
+	/* REQ_HIPRI maps the request to a poll queue, if there are any */
+	if (issue_flags & IO_URING_F_IOPOLL)
+		op_flags |= REQ_HIPRI;
+
+	req = blk_mq_alloc_request(q, nvme_req_op(c) | op_flags, blk_flags);
+	if (IS_ERR(req)) {
+		ret = PTR_ERR(req);
+		goto out_free_cmd;
+	}
+	nvme_init_request(req, c);
+
+	if (timeout_ms)
+		req->timeout = msecs_to_jiffies(timeout_ms);
+	nvme_req(req)->flags |= NVME_REQ_USERCMD;
+
+	if (addr && data_len) {
+		ret = nvme_map_user_request(req, nvme_to_user_ptr(addr),
+				data_len, nvme_to_user_ptr(metadata),
+				metadata_len, 0, &meta, ioucmd);
+		if (ret)
+			goto out_free_req;
+	}
+
+	pdu->meta = NULL;
+	if (meta) {
+		pdu->meta = kmalloc(sizeof(*pdu->meta), GFP_KERNEL);
+		if (!pdu->meta) {
+			ret = -ENOMEM;
+			blk_rq_unmap_user(req->bio);
+			kfree(meta);
+			goto out_free_req;
+		}
+		pdu->meta->buf = meta;
+		pdu->meta->ubuf = nvme_to_user_ptr(metadata);
+		pdu->meta->len = metadata_len;
+	}
+
+	/* to free bio on completion, as req->bio will be null at that time */
+	pdu->bio = req->bio;
+	/* the path's queue: a multipath head may switch paths meanwhile */
+	pdu->q = req->q;
+	pdu->cookie = request_to_qc_t(req->mq_hctx, req);
+	req->end_io_data = ioucmd;
+
+	blk_execute_rq_nowait(q, ns->disk, req, 0, nvme_uring_cmd_end_io);
+	return -EIOCBQUEUED;
+
+ out_free_req:
+	blk_mq_free_request(req);
+ out_free_cmd:
+	kfree(c);
+	return ret;
+}
+
+static int nvme_uring_cmd(struct block_device *bdev,
+		struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	struct nvme_ns_head *head = NULL;
+	struct nvme_ns *ns;
+	int srcu_idx, ret;
+
+	/* struct nvme_uring_cmd only fits in a 128 byte SQE */
+	if (!(issue_flags & IO_URING_F_SQE128))
+		return -EOPNOTSUPP;
+
+	ns = nvme_get_ns_from_disk(bdev->bd_disk, &head, &srcu_idx);
+	if (unlikely(!ns))
+		return -EWOULDBLOCK;
+
+	switch (ioucmd->cmd_op) {
+	case NVME_URING_CMD_IO:
+		ret = nvme_uring_cmd_io(ns->ctrl, ns, ioucmd, issue_flags);
+		break;
+	default:
+		ret = -ENOTTY;
+	}
+
+	nvme_put_ns_from_disk(head, srcu_idx);
+	return ret;
+}
+
+static int nvme_uring_cmd_iopoll(struct block_device *bdev,
+		struct io_uring_cmd *ioucmd, bool spin)
+{
+	struct nvme_uring_cmd_pdu *pdu = nvme_uring_cmd_pdu(ioucmd);
+	struct request_queue *q = READ_ONCE(pdu->q);
+	unsigned int cookie = READ_ONCE(pdu->cookie);
+#ifdef CONFIG_NVME_MULTIPATH
+	struct gendisk *disk = bdev->bd_disk;
+
+	/*
+	 * Poll the path the command was issued on, not the current one.
+	 * That path may have been removed since, and its queue with it, so
+	 * only poll it while it is still one of the head's siblings.
+	 */
+	if (disk->fops == &nvme_ns_head_ops) {
+		struct nvme_ns_head *head = disk->private_data;
+		struct nvme_ns *ns;
+		int srcu_idx, ret = 0;
+
+		srcu_idx = srcu_read_lock(&head->srcu);
+		list_for_each_entry_rcu(ns, &head->list, siblings) {
+			if (ns->queue == q) {
+				ret = blk_poll(q, cookie, spin);
+				break;
+			}
+		}
+		srcu_read_unlock(&head->srcu, srcu_idx);
+		return ret;
+	}
+#endif
+	return blk_poll(q, cookie, spin);
+}
+
 /*
  * Issue ioctl requests on the first available path.  Note that unlike normal
  * block layer requests we will not retry failed request on another controller.
@@ -2310,6 +2616,8 @@ static const struct block_device_operations nvme_fops = {
 	.owner		= THIS_MODULE,
 	.ioctl		= nvme_ioctl,
 	.compat_ioctl	= nvme_compat_ioctl,
+	.uring_cmd	= nvme_uring_cmd,
+	.uring_cmd_iopoll = nvme_uring_cmd_iopoll,
 	.open		= nvme_open,
 	.release	= nvme_release,
 	.getgeo		= nvme_getgeo,
@@ -2339,6 +2647,8 @@ const struct block_device_operations nvme_ns_head_ops = {
 	.release	= nvme_ns_head_release,
 	.ioctl		= nvme_ioctl,
 	.compat_ioctl	= nvme_compat_ioctl,
+	.uring_cmd	= nvme_uring_cmd,
+	.uring_cmd_iopoll = nvme_uring_cmd_iopoll,
 	.getgeo		= nvme_getgeo,
 	.report_zones	= nvme_report_zones,
 	.pr_ops		= &nvme_pr_ops,
@@ -286,9 +286,8 @@ static int vhost_net_set_ubuf_info(struct vhost_net *n)
 		if (!zcopy)
 			continue;
 		n->vqs[i].ubuf_info =
-			kmalloc_array(UIO_MAXIOV,
-				      sizeof(*n->vqs[i].ubuf_info),
-				      GFP_KERNEL);
+			kcalloc(UIO_MAXIOV, sizeof(*n->vqs[i].ubuf_info),
+				GFP_KERNEL);
 		if  (!n->vqs[i].ubuf_info)
 			goto err;
 	}
@@ -9,25 +9,22 @@
 #include <linux/sched.h>
 #include <linux/proc_fs.h>
 #include <linux/kdev_t.h>
-#include <linux/vmalloc.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/backing-dev.h>
+#include <linux/cgroup.h>
+#include <linux/dirty_pages.h>
 #include "internal.h"
 
-static char *buf_dirty;	/* buffer to store number of dirty pages */
-static unsigned long buf_size;	/* size of buffer in bytes */
-static long buff_num;	/* size of buffer in number of pages */
+static long buff_num;	/* legacy buffer size knob, no longer used */
 static int buff_limit;	/* filter threshold of dirty pages*/
 
 static struct proc_dir_entry *dirty_dir;
 
-static struct mutex buff_used;	/* buffer is in used */
-static struct mutex buff_lock;	/* lock when buffer is changed */
-
 /* proc root directory */
 #define DIRTY_ROOT "dirty"
-/* proc file for buffer allocation and release */
+/* proc file kept for compatibility, the dump no longer needs a buffer */
 #define DIRTY_SWITCH "buffer_size"
 /* proc file to obtain diry pages of each inode */
 #define DIRTY_PAGES "dirty_list"
@@ -35,10 +32,41 @@ static struct mutex buff_lock;	/* lock when buffer is changed */
 #define DIRTY_LIMIT "page_threshold"
 
 #define MAX_BUFF_SIZE 102400
-static void seq_set_overflow(struct seq_file *m)
-{
-	m->count = m->size;
-}
+
+/*
+ * Number of clean inodes skipped under s_inode_list_lock before the
+ * walk pins its position and drops the lock.
+ */
+#define DIRTY_SCAN_BATCH 1024
+
+/*
+ * Per-open iterator state.  The walk is resumable across read() calls:
+ * the superblock being walked is kept alive with an active reference
+ * and the position within it with a reference on the current inode,
+ * so the inode list lock is never held for more than one batch.
+ */
+struct dirty_iter {
+	/* filters, set by writing to the file before the first read */
+	unsigned long threshold;
+	dev_t dev;
+	u64 cgroup_id;
+	bool binary;
+
+	bool started;
+	bool done;
+	bool have_rec;
+	loff_t index;
+
+	dev_t *devs;
+	unsigned int nr_devs;
+	unsigned int cap_devs;
+	unsigned int dev_idx;
+
+	struct super_block *sb;
+	struct inode *inode;
+	struct dirty_page_record rec;
+	char *tmpname;
+};
 
 static unsigned long dump_dirtypages_inode(struct inode *inode)
 {
@@ -92,43 +120,104 @@ static inline bool is_sb_writable(struct super_block *sb)
 	return true;
 }
 
+static u64 inode_wb_cgroup_id(struct inode *inode)
+{
+	u64 id = 0;
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb;
+
+	rcu_read_lock();
+	wb = READ_ONCE(inode->i_wb);
+	if (wb && wb->memcg_css)
+		id = cgroup_id(wb->memcg_css->cgroup);
+	rcu_read_unlock();
+#endif
+	return id;
+}
+
+static void collect_sb_dev(struct super_block *sb, void *arg)
+{
+	struct dirty_iter *iter = arg;
+	dev_t *devs;
+
+	if (iter->dev && sb->s_dev != iter->dev)
+		return;
+
+	if (iter->nr_devs == iter->cap_devs) {
+		unsigned int cap = max(16U, iter->cap_devs * 2);
+
+		devs = krealloc(iter->devs, cap * sizeof(dev_t), GFP_KERNEL);
+		if (!devs)
+			return;
+		iter->devs = devs;
+		iter->cap_devs = cap;
+	}
+	iter->devs[iter->nr_devs++] = sb->s_dev;
+}
+
 /*
- * dump_dirtypages_sb - dump the dirty pages of each inode in the sb
- * @sb the super block
- * @m the seq_file witch is initialized in proc_dpages_open
- *
- * For each inode in the sb, call dump_dirtypages_pages to get the number
- * of dirty pages. And use seq_printf to store the result in the buffer
- * if it's not less than the threshold. The inode in unusual state will
- * be skipped.
+ * Move on to the next superblock of the snapshot taken at the first
+ * read.  Superblocks that went away or became read-only in between are
+ * skipped.
  */
-static void dump_dirtypages_sb(struct super_block *sb, struct seq_file *m)
+static bool dirty_iter_next_sb(struct dirty_iter *iter)
 {
-	struct inode *inode, *toput_inode = NULL;
-	unsigned long nr_dirtys;
-	const char *fstype;
-	char *filename;
-	char *tmpname;
-	int limit = READ_ONCE(buff_limit);
+	struct super_block *sb;
 
-	if (!is_sb_writable(sb))
-		return;
+	while (iter->dev_idx < iter->nr_devs) {
+		sb = user_get_super(iter->devs[iter->dev_idx++]);
+		if (!sb)
+			continue;
 
-	tmpname = kmalloc(PATH_MAX, GFP_KERNEL);
-	if (!tmpname)
-		return;
+		if (is_sb_writable(sb) && atomic_inc_not_zero(&sb->s_active))
+			iter->sb = sb;
+		drop_super(sb);
+
+		if (iter->sb)
+			return true;
+	}
+
+	return false;
+}
+
+static void dirty_iter_put_sb(struct dirty_iter *iter)
+{
+	iput(iter->inode);
+	iter->inode = NULL;
+	if (iter->sb) {
+		deactivate_super(iter->sb);
+		iter->sb = NULL;
+	}
+}
+
+/*
+ * dirty_iter_next_inode - find the next inode of iter->sb with dirty pages
+ *
+ * Resumes after iter->inode, whose reference keeps it on the sb list.
+ * Every DIRTY_SCAN_BATCH clean inodes the current one is pinned instead
+ * and s_inode_list_lock is dropped, so no single hold covers more than
+ * one batch regardless of how many inodes the sb has.  Returns the inode
+ * with a reference held in iter->inode, or NULL when the sb is done.
+ */
+static struct inode *dirty_iter_next_inode(struct dirty_iter *iter)
+{
+	struct super_block *sb = iter->sb;
+	struct inode *inode, *prev = iter->inode;
+	unsigned int scanned = 0;
+	bool dirty;
 
 	spin_lock(&sb->s_inode_list_lock);
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+	inode = prev ? list_next_entry(prev, i_sb_list) :
+		list_first_entry(&sb->s_inodes, struct inode, i_sb_list);
+	for (; &inode->i_sb_list != &sb->s_inodes;
+	     inode = list_next_entry(inode, i_sb_list)) {
 		spin_lock(&inode->i_lock);
-
-		/*
-		 * We must skip inodes in unusual state. We may also skip
-		 * inodes without pages but we deliberately won't in case
-		 * we need to reschedule to avoid softlockups.
-		 */
-		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
-		    (inode->i_mapping->nrpages == 0 && !need_resched())) {
+		if (inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		dirty = mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY);
+		if (!dirty && ++scanned < DIRTY_SCAN_BATCH) {
 			spin_unlock(&inode->i_lock);
 			continue;
 		}
@@ -136,117 +225,241 @@ static void dump_dirtypages_sb(struct super_block *sb, struct seq_file *m)
 		spin_unlock(&inode->i_lock);
 		spin_unlock(&sb->s_inode_list_lock);
 
-		cond_resched();
+		iput(prev);
+		prev = inode;
+		iter->inode = inode;
+		if (dirty)
+			return inode;
 
-		nr_dirtys = dump_dirtypages_inode(inode);
-		if (!nr_dirtys || nr_dirtys < limit)
-			goto skip;
-
-		filename = inode_filename(inode, tmpname);
-		if (IS_ERR_OR_NULL(filename))
-			filename = "unknown";
-
-		if (sb->s_type && sb->s_type->name)
-			fstype = sb->s_type->name;
-		else
-			fstype = "unknown";
-		/*
-		 * seq_printf return nothing, if the buffer is exhausted
-		 * (m->size <= m->count), seq_printf will not store
-		 * anything, just set m->count = m->size and return. In
-		 * that case, log a warn message in buffer to remind users.
-		 */
-		if (m->size <= m->count) {
-			seq_set_overflow(m);
-			strncpy(m->buf+m->count-12, "terminated\n\0", 12);
-			iput(inode);
-			goto done;
-		}
-		seq_printf(m, "FSType: %s, Dev ID: %u(%u:%u) ino %lu, dirty pages %lu, path %s\n",
-			fstype, sb->s_dev, MAJOR(sb->s_dev),
-			MINOR(sb->s_dev), inode->i_ino,
-			nr_dirtys, filename);
-skip:
-		iput(toput_inode);
-		toput_inode = inode;
+		scanned = 0;
+		cond_resched();
 		spin_lock(&sb->s_inode_list_lock);
 	}
 	spin_unlock(&sb->s_inode_list_lock);
-done:
-	iput(toput_inode);
-	kfree(tmpname);
+
+	iput(prev);
+	iter->inode = NULL;
+	return NULL;
 }
 
-static int proc_dpages_show(struct seq_file *m, void *v)
+/* Produce the next record passing the filters into iter->rec. */
+static bool dirty_iter_advance(struct dirty_iter *iter)
 {
-	iterate_supers((void *)dump_dirtypages_sb, (void *)m);
-	return 0;
-}
+	struct inode *inode;
+	unsigned long nr_dirtys;
+	u64 cgid;
+
+	for (;;) {
+		if (!iter->sb && !dirty_iter_next_sb(iter))
+			return false;
+
+		while ((inode = dirty_iter_next_inode(iter))) {
+			cgid = inode_wb_cgroup_id(inode);
+			if (iter->cgroup_id && cgid != iter->cgroup_id)
+				continue;
+
+			nr_dirtys = dump_dirtypages_inode(inode);
+			if (!nr_dirtys || nr_dirtys < iter->threshold)
+				continue;
+
+			iter->rec.dev_major = MAJOR(inode->i_sb->s_dev);
+			iter->rec.dev_minor = MINOR(inode->i_sb->s_dev);
+			iter->rec.ino = inode->i_ino;
+			iter->rec.nr_dirty = nr_dirtys;
+			iter->rec.cgroup_id = cgid;
+			return true;
+		}
 
+		dirty_iter_put_sb(iter);
+	}
+}
 
-static ssize_t seq_read_dirty(
-	struct file *file,
-	char __user *buf,
-	size_t size,
-	loff_t *ppos)
+static void *dirty_seq_start(struct seq_file *m, loff_t *pos)
 {
-	struct seq_file *m = (struct seq_file *)file->private_data;
-	size_t copied = 0;
-	size_t n;
-	int err = 0;
-
-	if (!mutex_trylock(&buff_used))
-		return -EBUSY;
-	/* don't allow buffer to change during read */
-	mutex_lock(&buff_lock);
-	if (m->count == 0) {
-		memset(buf_dirty, 0, buf_size);
-		if (!m->buf) {
-			m->size = buf_size;
-			m->buf = buf_dirty;
+	struct dirty_iter *iter = m->private;
+
+	if (!iter->started) {
+		iter->started = true;
+		iterate_supers(collect_sb_dev, iter);
+		if (!dirty_iter_advance(iter)) {
+			iter->done = true;
+			return NULL;
 		}
-		err = m->op->show(m, NULL);
-		if (err < 0)
-			goto done;
+		iter->have_rec = true;
+		iter->index = *pos;
 	}
 
-	/* if buffer changed somehow */
-	if (m->size != buf_size) {
-		mutex_unlock(&buff_lock);
-		mutex_unlock(&buff_used);
-		return -EFAULT;
+	/* seq_file restarts at the record it could not fit last time */
+	if (iter->have_rec && *pos == iter->index)
+		return iter;
+	return NULL;
+}
+
+static void *dirty_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct dirty_iter *iter = m->private;
+
+	++*pos;
+	iter->have_rec = false;
+	if (iter->done || !dirty_iter_advance(iter)) {
+		iter->done = true;
+		return NULL;
 	}
+	iter->have_rec = true;
+	iter->index = *pos;
+	return iter;
+}
+
+static void dirty_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+static int dirty_seq_show(struct seq_file *m, void *v)
+{
+	struct dirty_iter *iter = v;
+	struct super_block *sb = iter->sb;
+	const char *fstype;
+	char *filename;
 
-	n = min(m->count - m->from, size);
-	/* check if this is the last read */
-	if (n == 0)
-		goto done;
-	n -= copy_to_user(buf, m->buf + m->from, n);
-	if (unlikely(!n)) {
-		err = -EFAULT;
-		goto done;
+	if (iter->binary) {
+		seq_write(m, &iter->rec, sizeof(iter->rec));
+		return 0;
 	}
-	m->from += n;
-	copied += n;
-done:
-	if (!copied)
-		copied = err;
+
+	filename = inode_filename(iter->inode, iter->tmpname);
+	if (IS_ERR_OR_NULL(filename))
+		filename = "unknown";
+
+	if (sb->s_type && sb->s_type->name)
+		fstype = sb->s_type->name;
 	else
-		*ppos += copied;
+		fstype = "unknown";
+
+	seq_printf(m, "FSType: %s, Dev ID: %u(%u:%u) ino %lu, dirty pages %llu, path %s\n",
+		   fstype, sb->s_dev, MAJOR(sb->s_dev), MINOR(sb->s_dev),
+		   iter->inode->i_ino, iter->rec.nr_dirty, filename);
+	return 0;
+}
+
+static const struct seq_operations dirty_seq_ops = {
+	.start	= dirty_seq_start,
+	.next	= dirty_seq_next,
+	.stop	= dirty_seq_stop,
+	.show	= dirty_seq_show,
+};
+
+static int proc_dpages_open(struct inode *inode, struct file *filp)
+{
+	struct dirty_iter *iter;
+
+	iter = __seq_open_private(filp, &dirty_seq_ops, sizeof(*iter));
+	if (!iter)
+		return -ENOMEM;
 
-	mutex_unlock(&buff_lock);
-	mutex_unlock(&buff_used);
-	return copied;
+	iter->tmpname = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!iter->tmpname) {
+		seq_release_private(inode, filp);
+		return -ENOMEM;
+	}
+	iter->threshold = READ_ONCE(buff_limit);
+
+	return nonseekable_open(inode, filp);
 }
 
-static void free_buf_dirty(void)
+static int seq_release_dirty(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+	struct dirty_iter *iter = m->private;
+
+	dirty_iter_put_sb(iter);
+	kfree(iter->devs);
+	kfree(iter->tmpname);
+	return seq_release_private(inode, file);
+}
+
+/*
+ * Per-open filters, given as space separated "key=value" tokens:
+ *   threshold=<pages>	only report inodes with at least this many
+ *   dev=<major>:<minor>	only walk this superblock
+ *   cgroup=<id>		only report inodes written back by this cgroup
+ *   format=text|binary	binary emits struct dirty_page_record
+ */
+static ssize_t write_dpages_filter(struct file *filp, const char __user *buf,
+				   size_t count, loff_t *offp)
 {
-	if (buf_dirty != NULL) {
-		vfree(buf_dirty);
-		buf_dirty = NULL;
-		buf_size = 0;
+	struct seq_file *m = filp->private_data;
+	struct dirty_iter *iter = m->private;
+	char *msg, *opts, *opt;
+	unsigned int major, minor;
+	unsigned long long val;
+	int ret = 0;
+
+	if (count > PAGE_SIZE)
+		return -EINVAL;
+
+	msg = memdup_user_nul(buf, count);
+	if (IS_ERR(msg))
+		return PTR_ERR(msg);
+
+	mutex_lock(&m->lock);
+	if (iter->started) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	opts = strim(msg);
+	while ((opt = strsep(&opts, " \t\n")) != NULL) {
+		if (!*opt)
+			continue;
+		if (!strncmp(opt, "threshold=", 10)) {
+			ret = kstrtoull(opt + 10, 10, &val);
+			if (ret)
+				goto out;
+			iter->threshold = val;
+		} else if (!strncmp(opt, "dev=", 4)) {
+			if (sscanf(opt + 4, "%u:%u", &major, &minor) != 2) {
+				ret = -EINVAL;
+				goto out;
+			}
+			iter->dev = MKDEV(major, minor);
+		} else if (!strncmp(opt, "cgroup=", 7)) {
+			if (!IS_ENABLED(CONFIG_CGROUP_WRITEBACK)) {
+				ret = -EOPNOTSUPP;
+				goto out;
+			}
+			ret = kstrtoull(opt + 7, 10, &val);
+			if (ret)
+				goto out;
+			iter->cgroup_id = val;
+		} else if (!strcmp(opt, "format=text")) {
+			iter->binary = false;
+		} else if (!strcmp(opt, "format=binary")) {
+			iter->binary = true;
+		} else {
+			ret = -EINVAL;
+			goto out;
+		}
 	}
+	ret = count;
+out:
+	mutex_unlock(&m->lock);
+	kfree(msg);
+	return ret;
 }
+
+static const struct proc_ops proc_dpages_operations = {
+	.proc_open           = proc_dpages_open,
+	.proc_read           = seq_read,
+	.proc_write          = write_dpages_filter,
+	.proc_lseek          = no_llseek,
+	.proc_release        = seq_release_dirty,
+};
+
+/*
+ * The dump used to be rendered into a buffer sized through this file.
+ * It is streamed now; the knob only remembers what was written so that
+ * existing tooling keeps working.
+ */
 static ssize_t write_proc(
 	struct file *filp,
 	const char *buf,
@@ -255,10 +468,7 @@ static ssize_t write_proc(
 {
 	char *msg;
 	int ret = 0;
-	long old_buff_num;
-
-	if (!mutex_trylock(&buff_used))
-		return -EBUSY;
+	long temp;
 
 	if (count > PAGE_SIZE) {
 		ret = -EINVAL;
@@ -275,71 +485,24 @@ static ssize_t write_proc(
 		ret = -EINVAL;
 		goto free;
 	}
-	old_buff_num = buff_num;
-	ret = kstrtol(msg, 10, &buff_num);
-	if (ret != 0 || buff_num < 0 || buff_num > MAX_BUFF_SIZE) {
-		buff_num = old_buff_num;
+	ret = kstrtol(msg, 10, &temp);
+	if (ret != 0 || temp < 0 || temp > MAX_BUFF_SIZE) {
 		ret = -EINVAL;
 		goto free;
 	}
 
-	mutex_lock(&buff_lock);
-
+	WRITE_ONCE(buff_num, temp);
 	ret = count;
-	if (buff_num == 0) {
-		free_buf_dirty();
-		goto out;
-	}
-	if (buff_num == old_buff_num)
-		goto out;
-
-	free_buf_dirty();
-	buf_size = PAGE_SIZE * buff_num;
-	buf_dirty = vzalloc(buf_size);
 
-	if (!buf_dirty) {
-		ret = -ENOMEM;
-		goto out;
-	}
-out:
-	mutex_unlock(&buff_lock);
 free:
 	kfree(msg);
 error:
-	mutex_unlock(&buff_used);
 	return ret;
 }
 
-static int proc_dpages_open(struct inode *inode, struct file *filp)
-{
-	if (buf_dirty == NULL || buf_size == 0) {
-		pr_warn("please allocate buffer before getting dirty pages\n");
-		return -ENOMEM;
-	}
-
-	return single_open(filp, proc_dpages_show, NULL);
-
-}
-
-static int seq_release_dirty(struct inode *inode, struct file *file)
-{
-	struct seq_file *m = file->private_data;
-
-	/* we don't want to free the buf */
-	m->buf = NULL;
-	single_release(inode, file);
-	return 0;
-}
-
-static const struct proc_ops proc_dpages_operations = {
-	.proc_open           = proc_dpages_open,
-	.proc_read           = seq_read_dirty,
-	.proc_release        = seq_release_dirty,
-};
-
 static int proc_switch_show(struct seq_file *m, void *v)
 {
-	seq_printf(m, "%ld\n", buff_num);
+	seq_printf(m, "%ld\n", READ_ONCE(buff_num));
 	return 0;
 }
 
@@ -425,7 +588,7 @@ static int __init dpages_proc_init(void)
 	if (!dirty_dir)
 		goto fail_dir;
 
-	proc_file = proc_create(DIRTY_PAGES, 0440,
+	proc_file = proc_create(DIRTY_PAGES, 0640,
 					dirty_dir, &proc_dpages_operations);
 	if (!proc_file)
 		goto fail_pages;
@@ -440,8 +603,6 @@ static int __init dpages_proc_init(void)
 	if (!proc_file)
 		goto fail_limit;
 
-	mutex_init(&buff_used);
-	mutex_init(&buff_lock);
 	return 0;
 
 fail_limit:
@@ -456,9 +617,6 @@ static int __init dpages_proc_init(void)
 
 static void dpages_proc_exit(void)
 {
-	mutex_lock(&buff_lock);
-	free_buf_dirty();
-	mutex_unlock(&buff_lock);
 	remove_proc_entry(DIRTY_PAGES, dirty_dir);
 	remove_proc_entry(DIRTY_SWITCH, dirty_dir);
 	remove_proc_entry(DIRTY_LIMIT, dirty_dir);
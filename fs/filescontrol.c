@@ -26,10 +26,20 @@
 #include <linux/fdtable.h>
 #include <linux/sched/signal.h>
 #include <linux/module.h>
+#include <linux/cpuhotplug.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
 
 #define FILES_MAX D_COUNT_MAX
 #define FILES_MAX_STR "max"
 
+/*
+ * Number of fd charges a cpu may pre-charge from the shared page_counter
+ * and hand out locally, so that open/close does not bounce the counter's
+ * cacheline on every operation.
+ */
+#define FILES_CHARGE_BATCH 32U
+
 static bool no_acct;
 struct cgroup_subsys files_cgrp_subsys __read_mostly;
 EXPORT_SYMBOL(files_cgrp_subsys);
@@ -58,6 +68,149 @@ files_cgroup_from_files(struct files_struct *files)
 	return files->files_cgroup;
 }
 
+static inline bool files_cgroup_is_descendant(struct files_cgroup *fcg,
+					      struct files_cgroup *root)
+{
+	if (fcg == root)
+		return true;
+	return cgroup_is_descendant(fcg->css.cgroup, root->css.cgroup);
+}
+
+struct files_stock_pcp {
+	struct files_cgroup *cached;
+	unsigned int nr_fds;
+};
+static DEFINE_PER_CPU(struct files_stock_pcp, files_stock);
+
+/*
+ * Try to consume @n pre-charged fds from this cpu's stock.  The stock
+ * is only touched with irqs disabled, which also serializes against
+ * the remote drain IPI.
+ */
+static bool files_consume_stock(struct files_cgroup *fcg, unsigned int n)
+{
+	struct files_stock_pcp *stock;
+	unsigned long flags;
+	bool ret = false;
+
+	if (n > FILES_CHARGE_BATCH)
+		return ret;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&files_stock);
+	if (stock->cached == fcg && stock->nr_fds >= n) {
+		stock->nr_fds -= n;
+		ret = true;
+	}
+
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+/* Return the stocked charges to the page_counter and drop the cache. */
+static void files_drain_stock(struct files_stock_pcp *stock)
+{
+	struct files_cgroup *old = stock->cached;
+
+	if (!old)
+		return;
+
+	if (stock->nr_fds) {
+		page_counter_uncharge(&old->open_handles, stock->nr_fds);
+		stock->nr_fds = 0;
+	}
+
+	css_put(&old->css);
+	stock->cached = NULL;
+}
+
+static void files_refill_stock(struct files_cgroup *fcg, unsigned int n)
+{
+	struct files_stock_pcp *stock;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	stock = this_cpu_ptr(&files_stock);
+	if (stock->cached != fcg) {
+		files_drain_stock(stock);
+		css_get(&fcg->css);
+		stock->cached = fcg;
+	}
+	stock->nr_fds += n;
+
+	if (stock->nr_fds > FILES_CHARGE_BATCH)
+		files_drain_stock(stock);
+
+	local_irq_restore(flags);
+}
+
+static bool files_stock_held_under(int cpu, void *info)
+{
+	struct files_stock_pcp *stock = &per_cpu(files_stock, cpu);
+	struct files_cgroup *fcg;
+	bool ret = false;
+
+	rcu_read_lock();
+	fcg = READ_ONCE(stock->cached);
+	if (fcg && files_cgroup_is_descendant(fcg, info))
+		ret = true;
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static void files_drain_local_stock(void *info)
+{
+	struct files_stock_pcp *stock;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	stock = this_cpu_ptr(&files_stock);
+	if (stock->cached && files_cgroup_is_descendant(stock->cached, info))
+		files_drain_stock(stock);
+	local_irq_restore(flags);
+}
+
+/*
+ * Synchronously return every cpu's stocked charges for @root and its
+ * descendants, so that a subsequent charge against @root is checked
+ * against the exact number of open fds.  Must not be called with irqs
+ * disabled.
+ */
+static void files_drain_all_stock(struct files_cgroup *root)
+{
+	on_each_cpu_cond(files_stock_held_under, files_drain_local_stock,
+			 root, true);
+}
+
+/* Charges sitting in per-cpu stocks of @root's subtree, for reporting. */
+static unsigned long files_stocked_fds(struct files_cgroup *root)
+{
+	unsigned long nr = 0;
+	int cpu;
+
+	rcu_read_lock();
+	for_each_possible_cpu(cpu) {
+		struct files_stock_pcp *stock = &per_cpu(files_stock, cpu);
+		struct files_cgroup *fcg = READ_ONCE(stock->cached);
+
+		if (fcg && files_cgroup_is_descendant(fcg, root))
+			nr += READ_ONCE(stock->nr_fds);
+	}
+	rcu_read_unlock();
+
+	return nr;
+}
+
+static int files_cgroup_cpu_dead(unsigned int cpu)
+{
+	files_drain_stock(&per_cpu(files_stock, cpu));
+	return 0;
+}
+
 
 static struct cgroup_subsys_state *
 files_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
@@ -85,6 +238,12 @@ files_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	return ERR_PTR(-ENOMEM);
 }
 
+static void files_cgroup_css_offline(struct cgroup_subsys_state *css)
+{
+	/* Stocks pin the css, give them back so it can be freed. */
+	files_drain_all_stock(css_fcg(css));
+}
+
 static void files_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	kfree(css_fcg(css));
@@ -165,9 +324,36 @@ int files_cgroup_alloc_fd(struct files_struct *files, u64 n)
 		struct page_counter *fail_res;
 		struct files_cgroup *files_cgroup =
 			files_cgroup_from_files(files);
-		if (!page_counter_try_charge(&files_cgroup->open_handles,
-				       n, &fail_res))
-			return -ENOMEM;
+		u64 batch = max_t(u64, n, FILES_CHARGE_BATCH);
+		bool drained = false;
+
+		if (files_consume_stock(files_cgroup, n))
+			return 0;
+retry:
+		if (page_counter_try_charge(&files_cgroup->open_handles,
+					    batch, &fail_res)) {
+			if (batch > n)
+				files_refill_stock(files_cgroup, batch - n);
+			return 0;
+		}
+
+		/*
+		 * Close to the limit: stop pre-charging and fall back to
+		 * exact charges, then pull back whatever other cpus still
+		 * hold in their stocks before declaring failure.
+		 */
+		if (batch > n) {
+			batch = n;
+			goto retry;
+		}
+		if (!drained) {
+			files_drain_all_stock(container_of(fail_res,
+						struct files_cgroup,
+						open_handles));
+			drained = true;
+			goto retry;
+		}
+		return -ENOMEM;
 	}
 	return 0;
 }
@@ -182,7 +368,11 @@ void files_cgroup_unalloc_fd(struct files_struct *files, u64 n)
 	if (!no_acct && files != &init_files) {
 		struct files_cgroup *files_cgroup =
 		       files_cgroup_from_files(files);
-		page_counter_uncharge(&files_cgroup->open_handles, n);
+
+		if (n <= FILES_CHARGE_BATCH)
+			files_refill_stock(files_cgroup, n);
+		else
+			page_counter_uncharge(&files_cgroup->open_handles, n);
 	}
 }
 EXPORT_SYMBOL(files_cgroup_unalloc_fd);
@@ -238,7 +428,10 @@ static ssize_t files_limit_write(struct kernfs_open_file *of,
 	/*
 	 * Limit updates don't need to be mutex'd, since it isn't
 	 * critical that any racing fork()s follow the new limit.
+	 * Stocked charges are returned first so that they don't count
+	 * against a lowered limit.
 	 */
+	files_drain_all_stock(fcg);
 	page_counter_set_max(&fcg->open_handles, limit);
 	return nbytes;
 }
@@ -248,8 +441,10 @@ static u64 files_usage_read(struct cgroup_subsys_state *css,
 			struct cftype *cft)
 {
 	struct files_cgroup *fcg = css_fcg(css);
+	unsigned long usage = page_counter_read(&fcg->open_handles);
+	unsigned long stocked = files_stocked_fds(fcg);
 
-	return page_counter_read(&fcg->open_handles);
+	return usage > stocked ? usage - stocked : 0;
 }
 
 static struct cftype files[] = {
@@ -274,12 +469,24 @@ static struct cftype files[] = {
 
 struct cgroup_subsys files_cgrp_subsys = {
 	.css_alloc = files_cgroup_css_alloc,
+	.css_offline = files_cgroup_css_offline,
 	.css_free = files_cgroup_css_free,
 	.can_attach = files_cgroup_can_attach,
 	.legacy_cftypes = files,
 	.dfl_cftypes = files,
 };
 
+static int __init files_cgroup_init(void)
+{
+	int ret;
+
+	ret = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN,
+					"fs/files_cgroup:dead", NULL,
+					files_cgroup_cpu_dead);
+	return ret < 0 ? ret : 0;
+}
+subsys_initcall(files_cgroup_init);
+
 /*
  * It could race against cgroup migration of current task, and
  * using task_get_css() to get a valid css.
@@ -80,6 +80,9 @@ struct blkg_iostat_set {
 	struct blkg_iostat		last;
 };
 
+struct blkg_lat_hist;
+struct blkg_lat_hist_set;
+
 /*
  * A blkcg_gq (blkg) is association between a block cgroup (blkcg) and a
  * request_queue (q).  This is used by blkcg policies which need to track
@@ -130,6 +133,10 @@ struct blkcg_gq {
 	struct blkg_iostat_set __percpu	*iostat_cpu;
 	struct blkg_iostat_set		iostat;
 
+	/* only allocated while the queue has QUEUE_FLAG_LAT_HIST set */
+	struct blkg_lat_hist __percpu	*lat_hist_cpu;
+	struct blkg_lat_hist_set	*lat_hist;
+
 	struct blkg_policy_data		*pd[BLKCG_MAX_POLS];
 
 	spinlock_t			async_bio_lock;
@@ -46,6 +46,7 @@ struct rq_qos;
 struct blk_queue_stats;
 struct blk_stat_callback;
 struct blk_keyslot_manager;
+struct io_uring_cmd;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -643,6 +644,7 @@ struct request_queue {
 #define QUEUE_FLAG_NOWAIT       29	/* device supports NOWAIT */
 /*at least one blk-mq hctx can't get driver tag */
 #define QUEUE_FLAG_HCTX_WAIT	30
+#define QUEUE_FLAG_LAT_HIST	31	/* per-blkcg latency histograms */
 
 #define QUEUE_FLAG_MQ_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_SAME_COMP) |		\
@@ -1269,6 +1271,8 @@ struct blk_plug {
 	unsigned short rq_count;
 	bool multiple_queues;
 	bool nowait;
+	/* number of I/Os the owner expects to submit under this plug */
+	KABI_FILL_HOLE(unsigned short nr_ios)
 };
 
 struct blk_plug_cb;
@@ -1281,6 +1285,7 @@ struct blk_plug_cb {
 extern struct blk_plug_cb *blk_check_plugged(blk_plug_cb_fn unplug,
 					     void *data, int size);
 extern void blk_start_plug(struct blk_plug *);
+extern void blk_start_plug_nr_ios(struct blk_plug *, unsigned int);
 extern void blk_finish_plug(struct blk_plug *);
 extern void blk_flush_plug_list(struct blk_plug *, bool);
 
@@ -1319,6 +1324,11 @@ static inline void blk_start_plug(struct blk_plug *plug)
 {
 }
 
+static inline void blk_start_plug_nr_ios(struct blk_plug *plug,
+					 unsigned int nr_ios)
+{
+}
+
 static inline void blk_finish_plug(struct blk_plug *plug)
 {
 }
@@ -1908,8 +1918,13 @@ struct block_device_operations {
 	struct module *owner;
 	const struct pr_ops *pr_ops;
 
-	KABI_RESERVE(1)
-	KABI_RESERVE(2)
+	/* io_uring passthrough commands, see ->uring_cmd in file_operations */
+	KABI_USE(1, int (*uring_cmd)(struct block_device *bdev,
+				     struct io_uring_cmd *ioucmd,
+				     unsigned int issue_flags))
+	KABI_USE(2, int (*uring_cmd_iopoll)(struct block_device *bdev,
+					    struct io_uring_cmd *ioucmd,
+					    bool spin))
 	KABI_RESERVE(3)
 	KABI_RESERVE(4)
 };
@@ -328,6 +328,8 @@ enum rw_hint {
 /* iocb->ki_waitq is valid */
 #define IOCB_WAITQ		(1 << 19)
 #define IOCB_NOIO		(1 << 20)
+/* can use bio alloc cache */
+#define IOCB_ALLOC_CACHE	(1 << 21)
 
 struct kiocb {
 	struct file		*ki_filp;
@@ -1877,6 +1879,7 @@ struct dir_context {
 #define COPY_FILE_SPLICE		(1 << 0)
 
 struct iov_iter;
+struct io_uring_cmd;
 
 struct file_operations {
 	struct module *owner;
@@ -1920,8 +1923,10 @@ struct file_operations {
 	int (*fadvise)(struct file *, loff_t, loff_t, int);
 
 	KABI_USE(1, bool may_pollfree)
-	KABI_RESERVE(2)
-	KABI_RESERVE(3)
+	KABI_USE(2, int (*uring_cmd)(struct io_uring_cmd *ioucmd,
+				     unsigned int issue_flags))
+	KABI_USE(3, int (*uring_cmd_iopoll)(struct io_uring_cmd *ioucmd,
+					    bool spin))
 	KABI_RESERVE(4)
 } __randomize_layout;
 
@@ -5,6 +5,31 @@
 #include <linux/sched.h>
 #include <linux/xarray.h>
 
+struct iov_iter;
+
+enum io_uring_cmd_flags {
+	IO_URING_F_NONBLOCK		= 1,
+	IO_URING_F_COMPLETE_DEFER	= 2,
+	/* the ring has 128 byte SQEs, ->cmd holds 80 bytes */
+	IO_URING_F_SQE128		= 4,
+	/* the ring is IORING_SETUP_IOPOLL, complete through ->uring_cmd_iopoll */
+	IO_URING_F_IOPOLL		= 8,
+};
+
+/*
+ * IORING_OP_URING_CMD, passed to ->uring_cmd() of the target file. It
+ * aliases the request's per-op data, so the layout must not grow past it.
+ */
+struct io_uring_cmd {
+	struct file	*file;
+	const void	*cmd;
+	/* callback to defer completions to task context */
+	void (*task_work_cb)(struct io_uring_cmd *cmd);
+	u32		cmd_op;
+	u32		flags;
+	u8		pdu[32]; /* available inline for free use */
+};
+
 struct io_identity {
 	struct files_struct		*files;
 	struct mm_struct		*mm;
@@ -37,6 +62,11 @@ struct io_uring_task {
 #endif
 
 #if defined(CONFIG_IO_URING)
+int io_uring_cmd_import_fixed(u64 ubuf, unsigned long len, int rw,
+			      struct iov_iter *iter, void *ioucmd);
+void io_uring_cmd_done(struct io_uring_cmd *cmd, ssize_t ret, ssize_t res2);
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *));
 struct sock *io_uring_get_socket(struct file *file);
 void __io_uring_cancel(bool cancel_all);
 void __io_uring_free(struct task_struct *tsk);
@@ -57,6 +87,19 @@ static inline void io_uring_free(struct task_struct *tsk)
 		__io_uring_free(tsk);
 }
 #else
+static inline int io_uring_cmd_import_fixed(u64 ubuf, unsigned long len,
+			int rw, struct iov_iter *iter, void *ioucmd)
+{
+	return -EOPNOTSUPP;
+}
+static inline void io_uring_cmd_done(struct io_uring_cmd *cmd, ssize_t ret,
+		ssize_t res2)
+{
+}
+static inline void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *))
+{
+}
 static inline struct sock *io_uring_get_socket(struct file *file)
 {
 	return NULL;
@@ -4,12 +4,37 @@
 
 #include <linux/memcontrol.h>
 #include <linux/seq_file.h>
+#include <linux/shmem_fs.h>
+#include <linux/fs.h>
 
 #ifdef CONFIG_MEMCG_MEMFS_INFO
 void mem_cgroup_print_memfs_info(struct mem_cgroup *memcg, char *pathbuf,
 				 struct seq_file *m);
 int mem_cgroup_memfs_files_show(struct seq_file *m, void *v);
 void mem_cgroup_memfs_info_init(void);
+unsigned long mem_cgroup_memfs_pages(struct mem_cgroup *memcg);
+
+/*
+ * Pages of files on mounted tmpfs instances, including rootfs when it
+ * is tmpfs.  The kernel internal shm mount backing SysV shm, memfd and
+ * shared anonymous memory is not a memfs.
+ */
+static inline bool memcg_memfs_mapping(struct address_space *mapping)
+{
+	return mapping && shmem_mapping(mapping) &&
+	       !(mapping->host->i_sb->s_flags & SB_KERNMOUNT);
+}
+
+/*
+ * Keep MEMCG_MEMFS in step with NR_SHMEM, call wherever the latter is
+ * modified for a page cache page.  Must be called with irqs disabled.
+ */
+static inline void __memcg_memfs_page_state(struct address_space *mapping,
+					    struct page *page, int nr)
+{
+	if (memcg_memfs_mapping(mapping))
+		__mod_memcg_page_state(page, MEMCG_MEMFS, nr);
+}
 #else
 static inline void mem_cgroup_print_memfs_info(struct mem_cgroup *memcg,
 					       char *pathbuf,
@@ -19,5 +44,13 @@ static inline void mem_cgroup_print_memfs_info(struct mem_cgroup *memcg,
 static inline void mem_cgroup_memfs_info_init(void)
 {
 }
+static inline bool memcg_memfs_mapping(struct address_space *mapping)
+{
+	return false;
+}
+static inline void __memcg_memfs_page_state(struct address_space *mapping,
+					    struct page *page, int nr)
+{
+}
 #endif
 #endif
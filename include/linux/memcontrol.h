@@ -35,6 +35,9 @@ enum memcg_stat_item {
 	MEMCG_SWAP = NR_VM_NODE_STAT_ITEMS,
 	MEMCG_SOCK,
 	MEMCG_PERCPU_B,
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+	MEMCG_MEMFS,
+#endif
 	MEMCG_NR_STAT,
 };
 
@@ -250,6 +253,20 @@ struct swap_device {
 	int type;
 };
 
+/*
+ * Rate based high_async reclaim: async reclaim is also started when usage,
+ * growing at its smoothed rate, would reach memory.high within lead_ms.
+ */
+struct memcg_high_async {
+	unsigned int lead_ms;		/* 0 disables the rate based mode */
+	unsigned long sample_time;	/* jiffies of the last rate sample */
+	unsigned long sample_usage;	/* usage at the last rate sample */
+	unsigned long rate;		/* smoothed usage growth, pages/s */
+	atomic_long_t nr_runs;
+	atomic_long_t nr_reclaimed;
+	atomic_long_t nr_avoided;
+};
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -402,7 +419,7 @@ struct mem_cgroup {
 	KABI_RESERVE(3)
 	KABI_RESERVE(4)
 #endif
-	KABI_RESERVE(5)
+	KABI_USE(5, struct memcg_high_async *high_async)
 #if defined(CONFIG_DYNAMIC_HUGETLB) && defined(CONFIG_ARM64)
 	KABI_USE(6, struct dhugetlb_pool *hpool)
 #else
@@ -431,6 +448,25 @@ bool memcg_low_priority_scan_tasks(int (*)(struct task_struct *, void *),
 void memcg_print_bad_task(struct oom_control *oc);
 extern int sysctl_memcg_qos_handler(struct ctl_table *table,
 		int write, void __user *buffer, size_t *length, loff_t *ppos);
+void memcg_qos_account_reclaim(struct mem_cgroup *memcg,
+			       unsigned long scanned, unsigned long reclaimed);
+
+static inline bool mem_cgroup_low_priority(struct mem_cgroup *memcg)
+{
+	return memcg && memcg->memcg_priority;
+}
+
+/*
+ * Whether reclaim below @target should be ordered by memcg priority.
+ * When @target is low priority itself, so is everything below it and
+ * there is nothing to order.
+ */
+static inline bool mem_cgroup_qos_reclaim(struct mem_cgroup *target)
+{
+	if (!static_branch_unlikely(&memcg_qos_stat_key))
+		return false;
+	return !mem_cgroup_low_priority(target);
+}
 #else
 void memcg_print_bad_task(struct oom_control *oc);
 #endif
@@ -1735,6 +1771,24 @@ static inline void memcg_remove_swapfile(int type)
 }
 #endif /* CONFIG_MEMCG */
 
+#ifndef CONFIG_MEMCG_QOS
+static inline void memcg_qos_account_reclaim(struct mem_cgroup *memcg,
+					     unsigned long scanned,
+					     unsigned long reclaimed)
+{
+}
+
+static inline bool mem_cgroup_low_priority(struct mem_cgroup *memcg)
+{
+	return false;
+}
+
+static inline bool mem_cgroup_qos_reclaim(struct mem_cgroup *target)
+{
+	return false;
+}
+#endif
+
 /* idx can be of type enum memcg_stat_item or node_stat_item */
 static inline void __inc_memcg_state(struct mem_cgroup *memcg,
 				     int idx)
@@ -276,6 +276,11 @@ struct psi_group_stat_cpu {
 	u32 times_prev[NR_PSI_AGGREGATORS][NR_PSI_STAT_STATES];
 	int prev_throttle;
 	int cur_throttle;
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+	/* flushed up from the children, and the subtree times sent up */
+	u32 child_times[NR_PSI_STAT_STATES];
+	u32 flushed_times[NR_PSI_STAT_STATES];
+#endif
 };
 
 struct psi_group_ext {
@@ -286,6 +291,10 @@ struct psi_group_ext {
 	/* Total fine grained stall times and sampled pressure averages */
 	u64 total[NR_PSI_AGGREGATORS][NR_PSI_STAT_STATES];
 	unsigned long avg[NR_PSI_STAT_STATES][3];
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+	/* NULL for psi_stat_system, see psi_stat_cgroup() */
+	struct cgroup *cgroup;
+#endif
 };
 #else
 struct psi_group_ext { };
@@ -463,6 +463,8 @@ enum {
  * false on data copy or out of memory error caused by data copy attempt.
  * The ctx field is used to track device context.
  * The desc field is used to track userspace buffer index.
+ * UBUF_F_DONT_ORPHAN in flags tells skb_orphan_frags() that the owner keeps
+ * the frag pages valid until the callback runs, so they need no copy.
  */
 struct ubuf_info {
 	void (*callback)(struct ubuf_info *, bool zerocopy_success);
@@ -479,6 +481,7 @@ struct ubuf_info {
 		};
 	};
 	refcount_t refcnt;
+	KABI_FILL_HOLE(u8 flags)
 
 	struct mmpin {
 		struct user_struct *user;
@@ -486,6 +489,8 @@ struct ubuf_info {
 	} mmp;
 };
 
+#define UBUF_F_DONT_ORPHAN	0x1
+
 #define skb_uarg(SKB)	((struct ubuf_info *)(skb_shinfo(SKB)->destructor_arg))
 
 int mm_account_pinned_pages(struct mmpin *mmp, size_t size);
@@ -2825,7 +2830,8 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    (skb_uarg(skb)->callback == sock_zerocopy_callback ||
+	     skb_uarg(skb)->flags & UBUF_F_DONT_ORPHAN))
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
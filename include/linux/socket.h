@@ -65,6 +65,13 @@ struct msghdr {
 	__kernel_size_t	msg_controllen;	/* ancillary data buffer length */
 	unsigned int	msg_flags;	/* flags on received message */
 	struct kiocb	*msg_iocb;	/* ptr to iocb for async requests */
+	/*
+	 * kABI: msghdr has no pointer sized hole on any arch and callers
+	 * allocate it on their stack, so this can't be hidden behind
+	 * KABI_FILL_HOLE or KABI_EXTEND.  Adding it is a deliberate kABI
+	 * break; modules passing a msghdr need to be rebuilt.
+	 */
+	struct ubuf_info *msg_ubuf;	/* caller provided zerocopy uarg */
 };
 
 struct user_msghdr {
@@ -427,6 +434,7 @@ extern struct file *do_accept(struct file *file, unsigned file_flags,
 extern int __sys_accept4(int fd, struct sockaddr __user *upeer_sockaddr,
 			 int __user *upeer_addrlen, int flags);
 extern int __sys_socket(int family, int type, int protocol);
+extern struct file *__sys_socket_file(int family, int type, int protocol);
 extern int __sys_bind(int fd, struct sockaddr __user *umyaddr, int addrlen);
 extern int __sys_connect_file(struct file *file, struct sockaddr_storage *addr,
 			      int addrlen, int file_flags);
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_DIRTY_PAGES_H
+#define _UAPI_LINUX_DIRTY_PAGES_H
+
+#include <linux/types.h>
+
+/*
+ * Record emitted by /proc/dirty/dirty_list once "format=binary" has been
+ * written to the open file, one per inode that passed the filters.
+ * cgroup_id is the id of the cgroup owning the inode's writeback, or 0
+ * if cgroup writeback is not in use for the inode.
+ */
+struct dirty_page_record {
+	__u32 dev_major;
+	__u32 dev_minor;
+	__u64 ino;
+	__u64 nr_dirty;
+	__u64 cgroup_id;
+};
+
+#endif /* _UAPI_LINUX_DIRTY_PAGES_H */
@@ -22,6 +22,10 @@ struct io_uring_sqe {
 	union {
 		__u64	off;	/* offset into file */
 		__u64	addr2;
+		struct {
+			__u32	cmd_op;
+			__u32	__pad1;
+		};
 	};
 	union {
 		__u64	addr;	/* pointer to buffer or iovecs */
@@ -45,6 +49,7 @@ struct io_uring_sqe {
 		__u32		rename_flags;
 		__u32		unlink_flags;
 		__u32		hardlink_flags;
+		__u32		uring_cmd_flags;
 	};
 	__u64	user_data;	/* data to be passed back at completion time */
 	/* pack this to avoid bogus arm OABI complaints */
@@ -60,7 +65,14 @@ struct io_uring_sqe {
 		__s32	splice_fd_in;
 		__u32	file_index;
 	};
-	__u64	__pad2[2];
+	union {
+		__u64	__pad2[2];
+		/*
+		 * If the ring is initialized with IORING_SETUP_SQE128, then
+		 * this field is used for 80 bytes of arbitrary command data
+		 */
+		__u8	cmd[0];
+	};
 };
 
 enum {
@@ -98,6 +110,13 @@ enum {
 #define IORING_SETUP_CLAMP	(1U << 4)	/* clamp SQ/CQ ring sizes */
 #define IORING_SETUP_ATTACH_WQ	(1U << 5)	/* attach to existing wq */
 #define IORING_SETUP_R_DISABLED	(1U << 6)	/* start with ring disabled */
+#define IORING_SETUP_SQE128	(1U << 10)	/* SQEs are 128 byte */
+#define IORING_SETUP_SINGLE_ISSUER	(1U << 12)	/* only one task submits */
+/*
+ * Defer completion task_work until the application waits for events in
+ * io_uring_enter(), instead of interrupting it. Needs SINGLE_ISSUER.
+ */
+#define IORING_SETUP_DEFER_TASKRUN	(1U << 13)
 
 enum {
 	IORING_OP_NOP,
@@ -138,10 +157,22 @@ enum {
 	IORING_OP_RENAMEAT,
 	IORING_OP_UNLINKAT,
 
+	/* 37 - 44 are taken upstream by ops this kernel doesn't support */
+	IORING_OP_SOCKET = 45,
+	IORING_OP_URING_CMD,
+	IORING_OP_SEND_ZC,
+
 	/* this goes last, obviously */
 	IORING_OP_LAST,
 };
 
+/*
+ * sqe->uring_cmd_flags
+ * IORING_URING_CMD_FIXED	use registered buffer; pass this flag
+ *				along with setting sqe->buf_index.
+ */
+#define IORING_URING_CMD_FIXED	(1U << 0)
+
 /*
  * sqe->fsync_flags
  */
@@ -178,6 +209,35 @@ enum {
 #define IORING_POLL_UPDATE_EVENTS	(1U << 1)
 #define IORING_POLL_UPDATE_USER_DATA	(1U << 2)
 
+/*
+ * RECV flags, stored in sqe->ioprio.
+ *
+ * IORING_RECV_MULTISHOT	Multishot recv. Needs IOSQE_BUFFER_SELECT and
+ *				a zero sqe->len. Sets IORING_CQE_F_MORE if
+ *				the handler will continue to report CQEs on
+ *				behalf of the same SQE.
+ */
+#define IORING_RECV_MULTISHOT	(1U << 1)
+
+/*
+ * SEND_ZC flags, stored in sqe->ioprio.
+ *
+ * IORING_RECVSEND_FIXED_BUF	Use registered buffer, pass it along with
+ *				sqe->buf_index.
+ */
+#define IORING_RECVSEND_FIXED_BUF	(1U << 2)
+
+/*
+ * ACCEPT flags, stored in sqe->ioprio.
+ *
+ * IORING_ACCEPT_MULTISHOT	Multishot accept. Posts a CQE with the new fd
+ *				for every incoming connection, with
+ *				IORING_CQE_F_MORE set as long as the request
+ *				stays armed. Can't be used with a fixed file
+ *				slot.
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
 /*
  * IO completion data structure (Completion Queue Entry)
  */
@@ -192,9 +252,12 @@ struct io_uring_cqe {
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
  * IORING_CQE_F_MORE	If set, parent SQE will generate more CQE entries
+ * IORING_CQE_F_NOTIF	Set for the SEND_ZC notification posted once the
+ *			kernel no longer references the buffer
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
 #define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 3)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
@@ -254,6 +317,7 @@ struct io_cqring_offsets {
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
 #define IORING_ENTER_SQ_WAIT	(1U << 2)
 #define IORING_ENTER_EXT_ARG	(1U << 3)
+#define IORING_ENTER_REGISTERED_RING	(1U << 4)
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -317,6 +381,20 @@ enum {
 	/* set/get max number of io-wq workers */
 	IORING_REGISTER_IOWQ_MAX_WORKERS	= 19,
 
+	/* register/unregister io_uring fd with the ring */
+	IORING_REGISTER_RING_FDS		= 20,
+	IORING_UNREGISTER_RING_FDS		= 21,
+
+	/* register/unregister a provided buffer ring */
+	IORING_REGISTER_PBUF_RING		= 22,
+	IORING_UNREGISTER_PBUF_RING		= 23,
+
+	/* numbers below 64 are left to upstream */
+
+	/* per-node io-wq worker limits and affinities, and io-wq stats */
+	IORING_REGISTER_IOWQ_NODE		= 64,
+	IORING_REGISTER_IOWQ_STATS		= 65,
+
 	/* this goes last */
 	IORING_REGISTER_LAST
 };
@@ -327,6 +405,37 @@ enum {
 	IO_WQ_UNBOUND,
 };
 
+/*
+ * Argument for IORING_REGISTER_IOWQ_NODE, an array with one entry per node
+ * to configure. Arrays are indexed by IO_WQ_BOUND / IO_WQ_UNBOUND. Zero
+ * max_workers and cpu_mask entries leave that setting alone, the previous
+ * worker limits are written back to max_workers.
+ */
+struct io_uring_iowq_node {
+	__u32	node;
+	__u32	max_workers[2];
+	__u32	cpu_mask_len;	/* size in bytes of the masks */
+	__u64	cpu_mask[2];	/* pointers to cpu masks */
+	__u64	resv[2];
+};
+
+/*
+ * Argument for IORING_REGISTER_IOWQ_STATS, an array with node set in every
+ * entry, filled in with the io-wq state of that node. nr_queued counts the
+ * work waiting for a worker, wait_time_ns sums the time the nr_dispatched
+ * items handed to a worker so far spent waiting.
+ */
+struct io_uring_iowq_stats {
+	__u32	node;
+	__u32	resv;
+	__u32	nr_workers[2];
+	__u32	max_workers[2];
+	__u32	nr_running[2];
+	__u32	nr_queued[2];
+	__u64	nr_dispatched[2];
+	__u64	wait_time_ns[2];
+};
+
 /* deprecated, see struct io_uring_rsrc_update */
 struct io_uring_files_update {
 	__u32 offset;
@@ -357,6 +466,40 @@ struct io_uring_rsrc_update2 {
 	__u32 resv2;
 };
 
+struct io_uring_buf {
+	__u64	addr;
+	__u32	len;
+	__u16	bid;
+	__u16	resv;
+};
+
+/*
+ * Provided buffer ring, shared with the kernel. The application fills in
+ * bufs[] and publishes new entries by advancing ->tail with a store-release;
+ * the kernel consumes from its own private head. ->tail overlays the resv
+ * field of bufs[0], so the ring holds exactly ring_entries buffers.
+ */
+struct io_uring_buf_ring {
+	union {
+		struct {
+			__u64	resv1;
+			__u32	resv2;
+			__u16	resv3;
+			__u16	tail;
+		};
+		struct io_uring_buf	bufs[0];
+	};
+};
+
+/* argument for IORING_(UN)REGISTER_PBUF_RING */
+struct io_uring_buf_reg {
+	__u64	ring_addr;
+	__u32	ring_entries;
+	__u16	bgid;
+	__u16	pad;
+	__u64	resv[3];
+};
+
 /* Skip updating fd indexes set to this value in the fd table */
 #define IORING_REGISTER_FILES_SKIP	(-2)
 
@@ -14,6 +14,7 @@
 #include <linux/rculist_nulls.h>
 #include <linux/cpu.h>
 #include <linux/tracehook.h>
+#include <linux/sched/clock.h>
 #include <uapi/linux/io_uring.h>
 
 #include "io-wq.h"
@@ -49,6 +50,9 @@ struct io_worker {
 	struct io_wq_work *cur_work;
 	spinlock_t lock;
 
+	/* acct->aff_seq the worker last applied acct->cpu_mask for */
+	unsigned int aff_seq;
+
 	struct completion ref_done;
 
 	unsigned long create_state;
@@ -76,6 +80,17 @@ struct io_wqe_acct {
 	atomic_t nr_running;
 	struct io_wq_work_list work_list;
 	unsigned long flags;
+
+	/* bumped on every cpu_mask update, see io_worker_update_affinity() */
+	unsigned int aff_seq;
+	cpumask_var_t cpu_mask;
+	/* the mask asked for, cpu_mask is that minus the cpus gone offline */
+	cpumask_var_t user_mask;
+
+	/* queued includes hashed work a worker has taken but not started */
+	atomic_t nr_queued;
+	atomic64_t nr_dispatched;
+	atomic64_t wait_time;
 };
 
 enum {
@@ -100,8 +115,6 @@ struct io_wqe {
 
 	struct io_wq *wq;
 	struct io_wq_work *hash_tail[IO_WQ_NR_HASH_BUCKETS];
-
-	cpumask_var_t cpu_mask;
 };
 
 /*
@@ -536,6 +549,24 @@ static void io_assign_current_work(struct io_worker *worker,
 
 static void io_wqe_enqueue(struct io_wqe *wqe, struct io_wq_work *work);
 
+static inline u32 io_wq_clock(void)
+{
+	/* ~1us resolution, wraps after an hour which is plenty for a wait */
+	return local_clock() >> 10;
+}
+
+static void io_wqe_work_dispatched(struct io_wqe_acct *acct,
+				   struct io_wq_work *work)
+{
+	s32 wait = io_wq_clock() - work->queued_at;
+
+	atomic_dec(&acct->nr_queued);
+	atomic64_inc(&acct->nr_dispatched);
+	/* queued and dispatched on different cpus, clocks may be skewed */
+	if (wait > 0)
+		atomic64_add((u64)wait << 10, &acct->wait_time);
+}
+
 static void io_worker_handle_work(struct io_worker *worker)
 	__releases(wqe->lock)
 {
@@ -546,6 +577,7 @@ static void io_worker_handle_work(struct io_worker *worker)
 
 	do {
 		struct io_wq_work *work;
+		bool queued;
 get_next:
 		/*
 		 * If we got some work, mark us as busy. If we didn't, but
@@ -563,6 +595,7 @@ static void io_worker_handle_work(struct io_worker *worker)
 			break;
 		io_assign_current_work(worker, work);
 		__set_current_state(TASK_RUNNING);
+		queued = true;
 
 		/* handle a whole dependent link */
 		do {
@@ -573,6 +606,8 @@ static void io_worker_handle_work(struct io_worker *worker)
 
 			if (unlikely(do_kill) && (work->flags & IO_WQ_WORK_UNBOUND))
 				work->flags |= IO_WQ_WORK_CANCEL;
+			if (queued)
+				io_wqe_work_dispatched(acct, work);
 			wq->do_work(work);
 			io_assign_current_work(worker, NULL);
 
@@ -581,6 +616,8 @@ static void io_worker_handle_work(struct io_worker *worker)
 			if (!work && linked && !io_wq_is_hashed(linked)) {
 				work = linked;
 				linked = NULL;
+				/* taken straight over, never was on the queue */
+				queued = false;
 			}
 			io_assign_current_work(worker, work);
 			if (linked)
@@ -606,6 +643,19 @@ static void io_worker_handle_work(struct io_worker *worker)
 	} while (1);
 }
 
+/*
+ * The mask of running workers can't be changed from the register path, as
+ * set_cpus_allowed_ptr() may sleep. Workers pick up a new mask themselves
+ * the next time they look for work, a racing update bumps aff_seq again
+ * and gets applied on the next pass.
+ */
+static void io_worker_update_affinity(struct io_worker *worker,
+				      struct io_wqe_acct *acct)
+{
+	worker->aff_seq = smp_load_acquire(&acct->aff_seq);
+	set_cpus_allowed_ptr(current, acct->cpu_mask);
+}
+
 static int io_wqe_worker(void *data)
 {
 	struct io_worker *worker = data;
@@ -623,6 +673,9 @@ static int io_wqe_worker(void *data)
 	while (!test_bit(IO_WQ_BIT_EXIT, &wq->state)) {
 		long ret;
 
+		if (unlikely(worker->aff_seq != READ_ONCE(acct->aff_seq)))
+			io_worker_update_affinity(worker, acct);
+
 		set_current_state(TASK_INTERRUPTIBLE);
 loop:
 		raw_spin_lock(&wqe->lock);
@@ -704,9 +757,12 @@ void io_wq_worker_sleeping(struct task_struct *tsk)
 static void io_init_new_worker(struct io_wqe *wqe, struct io_worker *worker,
 			       struct task_struct *tsk)
 {
+	struct io_wqe_acct *acct = io_wqe_get_acct(worker);
+
 	tsk->pf_io_worker = worker;
 	worker->task = tsk;
-	set_cpus_allowed_ptr(tsk, wqe->cpu_mask);
+	worker->aff_seq = smp_load_acquire(&acct->aff_seq);
+	set_cpus_allowed_ptr(tsk, acct->cpu_mask);
 	tsk->flags |= PF_NO_SETAFFINITY;
 
 	raw_spin_lock(&wqe->lock);
@@ -881,6 +937,9 @@ static void io_wqe_insert_work(struct io_wqe *wqe, struct io_wq_work *work)
 	unsigned int hash;
 	struct io_wq_work *tail;
 
+	work->queued_at = io_wq_clock();
+	atomic_inc(&acct->nr_queued);
+
 	if (!io_wq_is_hashed(work)) {
 append:
 		wq_list_add_tail(&work->list, &acct->work_list);
@@ -1006,6 +1065,7 @@ static inline void io_wqe_remove_pending(struct io_wqe *wqe,
 			wqe->hash_tail[hash] = NULL;
 	}
 	wq_list_del(&acct->work_list, &work->list, prev);
+	atomic_dec(&acct->nr_queued);
 }
 
 static bool io_acct_cancel_pending_work(struct io_wqe *wqe,
@@ -1153,9 +1213,6 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 		if (!wqe)
 			goto err;
 		wq->wqes[node] = wqe;
-		if (!alloc_cpumask_var(&wqe->cpu_mask, GFP_KERNEL))
-			goto err;
-		cpumask_copy(wqe->cpu_mask, cpumask_of_node(node));
 		wqe->node = alloc_node;
 		wqe->acct[IO_WQ_ACCT_BOUND].max_workers = bounded;
 		wqe->acct[IO_WQ_ACCT_UNBOUND].max_workers =
@@ -1168,6 +1225,11 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 			acct->index = i;
 			atomic_set(&acct->nr_running, 0);
 			INIT_WQ_LIST(&acct->work_list);
+			if (!alloc_cpumask_var(&acct->cpu_mask, GFP_KERNEL) ||
+			    !alloc_cpumask_var(&acct->user_mask, GFP_KERNEL))
+				goto err;
+			cpumask_copy(acct->cpu_mask, cpumask_of_node(node));
+			cpumask_copy(acct->user_mask, cpumask_of_node(node));
 		}
 		wqe->wq = wq;
 		raw_spin_lock_init(&wqe->lock);
@@ -1185,7 +1247,10 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	for_each_node(node) {
 		if (!wq->wqes[node])
 			continue;
-		free_cpumask_var(wq->wqes[node]->cpu_mask);
+		for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+			free_cpumask_var(wq->wqes[node]->acct[i].cpu_mask);
+			free_cpumask_var(wq->wqes[node]->acct[i].user_mask);
+		}
 		kfree(wq->wqes[node]);
 	}
 err_wq:
@@ -1256,7 +1321,7 @@ static void io_wq_exit_workers(struct io_wq *wq)
 
 static void io_wq_destroy(struct io_wq *wq)
 {
-	int node;
+	int node, i;
 
 	cpuhp_state_remove_instance_nocalls(io_wq_online, &wq->cpuhp_node);
 
@@ -1267,7 +1332,10 @@ static void io_wq_destroy(struct io_wq *wq)
 			.cancel_all	= true,
 		};
 		io_wqe_cancel_pending_work(wqe, &match);
-		free_cpumask_var(wqe->cpu_mask);
+		for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+			free_cpumask_var(wqe->acct[i].cpu_mask);
+			free_cpumask_var(wqe->acct[i].user_mask);
+		}
 		kfree(wqe);
 	}
 	io_wq_put_hash(wq->hash);
@@ -1282,33 +1350,42 @@ void io_wq_put_and_exit(struct io_wq *wq)
 	io_wq_destroy(wq);
 }
 
-struct online_data {
-	unsigned int cpu;
-	bool online;
-};
-
-static bool io_wq_worker_affinity(struct io_worker *worker, void *data)
+static bool io_wq_worker_kick(struct io_worker *worker, void *data)
 {
-	struct online_data *od = data;
-
-	if (od->online)
-		cpumask_set_cpu(od->cpu, worker->wqe->cpu_mask);
-	else
-		cpumask_clear_cpu(od->cpu, worker->wqe->cpu_mask);
+	wake_up_process(worker->task);
 	return false;
 }
 
+/*
+ * A cpu coming back is only added to the accts that asked for it. Workers
+ * apply the new mask themselves, see io_worker_update_affinity().
+ */
 static int __io_wq_cpu_online(struct io_wq *wq, unsigned int cpu, bool online)
 {
-	struct online_data od = {
-		.cpu = cpu,
-		.online = online
-	};
-	int i;
+	int i, node;
 
 	rcu_read_lock();
-	for_each_node(i)
-		io_wq_for_each_worker(wq->wqes[i], io_wq_worker_affinity, &od);
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+		bool changed = false;
+
+		raw_spin_lock(&wqe->lock);
+		for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+			struct io_wqe_acct *acct = &wqe->acct[i];
+
+			if (!cpumask_test_cpu(cpu, acct->user_mask))
+				continue;
+			if (online)
+				cpumask_set_cpu(cpu, acct->cpu_mask);
+			else
+				cpumask_clear_cpu(cpu, acct->cpu_mask);
+			smp_store_release(&acct->aff_seq, acct->aff_seq + 1);
+			changed = true;
+		}
+		raw_spin_unlock(&wqe->lock);
+		if (changed)
+			io_wq_for_each_worker(wqe, io_wq_worker_kick, NULL);
+	}
 	rcu_read_unlock();
 	return 0;
 }
@@ -1327,23 +1404,95 @@ static int io_wq_cpu_offline(unsigned int cpu, struct hlist_node *node)
 	return __io_wq_cpu_online(wq, cpu, false);
 }
 
+static void io_wqe_cpu_affinity(struct io_wqe *wqe, int node, int index,
+				cpumask_var_t mask)
+{
+	struct io_wqe_acct *acct = &wqe->acct[index];
+
+	raw_spin_lock(&wqe->lock);
+	if (mask)
+		cpumask_copy(acct->user_mask, mask);
+	else
+		cpumask_copy(acct->user_mask, cpumask_of_node(node));
+	cpumask_and(acct->cpu_mask, acct->user_mask, cpu_online_mask);
+	smp_store_release(&acct->aff_seq, acct->aff_seq + 1);
+	raw_spin_unlock(&wqe->lock);
+}
+
 int io_wq_cpu_affinity(struct io_wq *wq, cpumask_var_t mask)
 {
-	int i;
+	int i, node;
 
+	/* cpu_mask follows cpu_online_mask, see __io_wq_cpu_online() */
+	cpus_read_lock();
 	rcu_read_lock();
-	for_each_node(i) {
-		struct io_wqe *wqe = wq->wqes[i];
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
 
-		if (mask)
-			cpumask_copy(wqe->cpu_mask, mask);
-		else
-			cpumask_copy(wqe->cpu_mask, cpumask_of_node(i));
+		for (i = 0; i < IO_WQ_ACCT_NR; i++)
+			io_wqe_cpu_affinity(wqe, node, i, mask);
+		io_wq_for_each_worker(wqe, io_wq_worker_kick, NULL);
 	}
 	rcu_read_unlock();
+	cpus_read_unlock();
 	return 0;
 }
 
+/*
+ * Set the cpu mask of the bound or unbound workers of one node, a NULL
+ * mask resets it to the cpus of the node.
+ */
+int io_wq_node_cpu_affinity(struct io_wq *wq, int node, int index,
+			    cpumask_var_t mask)
+{
+	struct io_wqe *wqe;
+
+	if (node < 0 || node >= nr_node_ids || !node_possible(node))
+		return -EINVAL;
+	if (index != IO_WQ_ACCT_BOUND && index != IO_WQ_ACCT_UNBOUND)
+		return -EINVAL;
+
+	cpus_read_lock();
+	if (mask && !cpumask_intersects(mask, cpu_online_mask)) {
+		cpus_read_unlock();
+		return -EINVAL;
+	}
+
+	wqe = wq->wqes[node];
+	io_wqe_cpu_affinity(wqe, node, index, mask);
+	cpus_read_unlock();
+	rcu_read_lock();
+	io_wq_for_each_worker(wqe, io_wq_worker_kick, NULL);
+	rcu_read_unlock();
+	return 0;
+}
+
+static void io_wqe_max_workers(struct io_wqe *wqe, int *new_count, int *prev)
+{
+	struct io_wqe_acct *acct;
+	int i;
+
+	raw_spin_lock(&wqe->lock);
+	for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+		acct = &wqe->acct[i];
+		if (prev)
+			prev[i] = max_t(int, acct->max_workers, prev[i]);
+		if (new_count[i])
+			acct->max_workers = new_count[i];
+	}
+	raw_spin_unlock(&wqe->lock);
+}
+
+static void io_wq_clamp_max_workers(int *new_count)
+{
+	int i;
+
+	for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+		if (new_count[i] > task_rlimit(current, RLIMIT_NPROC))
+			new_count[i] = task_rlimit(current, RLIMIT_NPROC);
+	}
+}
+
 /*
  * Set max number of unbounded workers, returns old value. If new_count is 0,
  * then just return the old value.
@@ -1358,28 +1507,15 @@ int io_wq_max_workers(struct io_wq *wq, int *new_count)
 	BUILD_BUG_ON((int) IO_WQ_ACCT_UNBOUND != (int) IO_WQ_UNBOUND);
 	BUILD_BUG_ON((int) IO_WQ_ACCT_NR      != 2);
 
-	for (i = 0; i < 2; i++) {
-		if (new_count[i] > task_rlimit(current, RLIMIT_NPROC))
-			new_count[i] = task_rlimit(current, RLIMIT_NPROC);
-	}
+	io_wq_clamp_max_workers(new_count);
 
 	for (i = 0; i < IO_WQ_ACCT_NR; i++)
 		prev[i] = 0;
 
 	rcu_read_lock();
 	for_each_node(node) {
-		struct io_wqe *wqe = wq->wqes[node];
-		struct io_wqe_acct *acct;
-
-		raw_spin_lock(&wqe->lock);
-		for (i = 0; i < IO_WQ_ACCT_NR; i++) {
-			acct = &wqe->acct[i];
-			if (first_node)
-				prev[i] = max_t(int, acct->max_workers, prev[i]);
-			if (new_count[i])
-				acct->max_workers = new_count[i];
-		}
-		raw_spin_unlock(&wqe->lock);
+		io_wqe_max_workers(wq->wqes[node], new_count,
+				   first_node ? prev : NULL);
 		first_node = false;
 	}
 	rcu_read_unlock();
@@ -1390,6 +1526,48 @@ int io_wq_max_workers(struct io_wq *wq, int *new_count)
 	return 0;
 }
 
+/*
+ * Same as io_wq_max_workers(), for a single node.
+ */
+int io_wq_node_max_workers(struct io_wq *wq, int node, int *new_count)
+{
+	int prev[IO_WQ_ACCT_NR] = { 0, };
+	int i;
+
+	if (node < 0 || node >= nr_node_ids || !node_possible(node))
+		return -EINVAL;
+
+	io_wq_clamp_max_workers(new_count);
+	io_wqe_max_workers(wq->wqes[node], new_count, prev);
+
+	for (i = 0; i < IO_WQ_ACCT_NR; i++)
+		new_count[i] = prev[i];
+	return 0;
+}
+
+int io_wq_node_stats(struct io_wq *wq, int node,
+		     struct io_uring_iowq_stats *stats)
+{
+	struct io_wqe *wqe;
+	int i;
+
+	if (node < 0 || node >= nr_node_ids || !node_possible(node))
+		return -EINVAL;
+
+	wqe = wq->wqes[node];
+	for (i = 0; i < IO_WQ_ACCT_NR; i++) {
+		struct io_wqe_acct *acct = &wqe->acct[i];
+
+		stats->nr_workers[i] = READ_ONCE(acct->nr_workers);
+		stats->max_workers[i] = READ_ONCE(acct->max_workers);
+		stats->nr_running[i] = max(atomic_read(&acct->nr_running), 0);
+		stats->nr_queued[i] = max(atomic_read(&acct->nr_queued), 0);
+		stats->nr_dispatched[i] = atomic64_read(&acct->nr_dispatched);
+		stats->wait_time_ns[i] = atomic64_read(&acct->wait_time);
+	}
+	return 0;
+}
+
 static __init int io_wq_init(void)
 {
 	int ret;
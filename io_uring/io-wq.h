@@ -4,6 +4,7 @@
 #include <linux/refcount.h>
 #include <linux/io_uring.h>
 struct io_wq;
+struct io_uring_iowq_stats;
 
 enum {
 	IO_WQ_WORK_CANCEL	= 1,
@@ -88,6 +89,8 @@ static inline void wq_list_del(struct io_wq_work_list *list,
 struct io_wq_work {
 	struct io_wq_work_node list;
 	unsigned flags;
+	/* for the queue wait stats, in io_wq_clock() units */
+	u32 queued_at;
 };
 
 static inline struct io_wq_work *wq_next_work(struct io_wq_work *work)
@@ -129,6 +132,11 @@ void io_wq_hash_work(struct io_wq_work *work, void *val);
 
 int io_wq_cpu_affinity(struct io_wq *wq, cpumask_var_t mask);
 int io_wq_max_workers(struct io_wq *wq, int *new_count);
+int io_wq_node_cpu_affinity(struct io_wq *wq, int node, int index,
+			    cpumask_var_t mask);
+int io_wq_node_max_workers(struct io_wq *wq, int node, int *new_count);
+int io_wq_node_stats(struct io_wq *wq, int node,
+		     struct io_uring_iowq_stats *stats);
 
 static inline bool io_wq_is_hashed(struct io_wq_work *work)
 {
@@ -70,6 +70,7 @@
 #include <linux/sizes.h>
 #include <linux/hugetlb.h>
 #include <linux/highmem.h>
+#include <linux/vmalloc.h>
 #include <linux/namei.h>
 #include <linux/fsnotify.h>
 #include <linux/fadvise.h>
@@ -89,6 +90,8 @@
 #include "io-wq.h"
 
 #define IORING_MAX_ENTRIES	32768
+/* number of ring fds a task can register, see io_ringfd_register() */
+#define IO_RINGFD_REG_MAX	16
 #define IORING_MAX_CQ_ENTRIES	(2 * IORING_MAX_ENTRIES)
 #define IORING_SQPOLL_CAP_ENTRIES_VALUE 8
 
@@ -194,11 +197,6 @@ struct io_rings {
 	struct io_uring_cqe	cqes[] ____cacheline_aligned_in_smp;
 };
 
-enum io_uring_cmd_flags {
-	IO_URING_F_NONBLOCK		= 1,
-	IO_URING_F_COMPLETE_DEFER	= 2,
-};
-
 struct io_mapped_ubuf {
 	u64		ubuf;
 	u64		ubuf_end;
@@ -262,6 +260,18 @@ struct io_buffer {
 	__u16 bid;
 };
 
+/*
+ * A provided buffer ring registered through IORING_REGISTER_PBUF_RING. The
+ * application owns ->tail, the kernel consumes from ->head under ->uring_lock.
+ */
+struct io_buffer_ring {
+	struct io_uring_buf_ring	*br;
+	struct page			**pages;
+	unsigned int			nr_pages;
+	__u16				head;
+	__u16				mask;
+};
+
 struct io_restriction {
 	DECLARE_BITMAP(register_op, IORING_REGISTER_LAST);
 	DECLARE_BITMAP(sqe_op, IORING_OP_LAST);
@@ -270,6 +280,12 @@ struct io_restriction {
 	bool registered;
 };
 
+/* IORING_REGISTER_IOWQ_NODE settings of one node, a NULL mask is unset */
+struct io_iowq_node_cfg {
+	u32			max_workers[2];
+	struct cpumask		*cpu_mask[2];
+};
+
 enum {
 	IO_SQ_THREAD_SHOULD_STOP = 0,
 	IO_SQ_THREAD_SHOULD_PARK,
@@ -340,6 +356,8 @@ struct io_ring_ctx {
 		unsigned int		restricted: 1;
 		unsigned int		off_timeout_used: 1;
 		unsigned int		drain_active: 1;
+		/* the only task allowed in, IORING_SETUP_SINGLE_ISSUER */
+		struct task_struct	*submitter_task;
 	} ____cacheline_aligned_in_smp;
 
 	/* submission data */
@@ -378,6 +396,7 @@ struct io_ring_ctx {
 		struct list_head	ltimeout_list;
 		struct list_head	cq_overflow_list;
 		struct xarray		io_buffers;
+		struct xarray		io_buf_rings;
 		struct xarray		personalities;
 		u32			pers_next;
 		unsigned		sq_thread_idle;
@@ -406,6 +425,9 @@ struct io_ring_ctx {
 		unsigned		cq_last_tm_flush;
 	} ____cacheline_aligned_in_smp;
 
+	/* task_work deferred until the submitter waits, DEFER_TASKRUN only */
+	struct llist_head	work_llist;
+
 	struct {
 		spinlock_t		completion_lock;
 
@@ -458,6 +480,8 @@ struct io_ring_ctx {
 		struct completion		ref_comp;
 		u32				iowq_limits[2];
 		bool				iowq_limits_set;
+		/* nr_node_ids entries, protected by uring_lock */
+		struct io_iowq_node_cfg		*iowq_node_cfg;
 	};
 };
 
@@ -477,6 +501,8 @@ struct io_uring_task {
 	struct io_wq_work_list	task_list;
 	struct callback_head	task_work;
 	bool			task_running;
+
+	struct file		*registered_rings[IO_RINGFD_REG_MAX];
 };
 #endif
 
@@ -524,6 +550,16 @@ struct io_accept {
 	unsigned long			nofile;
 };
 
+struct io_socket {
+	struct file			*file;
+	int				domain;
+	int				type;
+	int				protocol;
+	int				flags;
+	u32				file_slot;
+	unsigned long			nofile;
+};
+
 struct io_sync {
 	struct file			*file;
 	loff_t				len;
@@ -582,7 +618,12 @@ struct io_sr_msg {
 	int				bgid;
 	size_t				len;
 	size_t				done_io;
-	struct io_buffer		*kbuf;
+	union {
+		/* valid IFF REQ_F_BUFFER_SELECTED is set */
+		struct io_buffer	*kbuf;
+		/* valid IFF REQ_F_BUFFER_RING is set */
+		void __user		*ring_buf;
+	};
 	void __user			*msg_control;
 };
 
@@ -713,6 +754,15 @@ struct io_async_msghdr {
 	struct sockaddr_storage		addr;
 };
 
+/*
+ * SEND_ZC attaches this uarg to the skbs it fills, and the network stack
+ * holds a reference on it for as long as any of them point at the buffer.
+ */
+struct io_sendzc_notif {
+	struct ubuf_info		uarg;
+	struct io_kiocb			*req;
+};
+
 struct io_async_rw {
 	struct iovec			fast_iov[UIO_FASTIOV];
 	const struct iovec		*free_iovec;
@@ -745,6 +795,8 @@ enum {
 	REQ_F_REFCOUNT_BIT,
 	REQ_F_ARM_LTIMEOUT_BIT,
 	REQ_F_PARTIAL_IO_BIT,
+	REQ_F_BUFFER_RING_BIT,
+	REQ_F_APOLL_MULTISHOT_BIT,
 	/* keep async read/write and isreg together and in order */
 	REQ_F_NOWAIT_READ_BIT,
 	REQ_F_NOWAIT_WRITE_BIT,
@@ -802,6 +854,10 @@ enum {
 	REQ_F_ARM_LTIMEOUT	= BIT(REQ_F_ARM_LTIMEOUT_BIT),
 	/* request has already done partial IO */
 	REQ_F_PARTIAL_IO	= BIT(REQ_F_PARTIAL_IO_BIT),
+	/* buffer taken from a provided buffer ring, bid is in ->buf_index */
+	REQ_F_BUFFER_RING	= BIT(REQ_F_BUFFER_RING_BIT),
+	/* multishot recv/accept, driven by async poll */
+	REQ_F_APOLL_MULTISHOT	= BIT(REQ_F_APOLL_MULTISHOT_BIT),
 };
 
 struct async_poll {
@@ -809,6 +865,14 @@ struct async_poll {
 	struct io_poll_iocb	*double_poll;
 };
 
+/*
+ * We can't reliably detect loops in repeated poll triggers and issue
+ * subsequently failing. But rather than fail these immediately, allow a
+ * certain amount of retries before we give up. Given that this condition
+ * should _rarely_ trigger even once, we should be fine with a larger value.
+ */
+#define APOLL_MAX_RETRY		128
+
 typedef void (*io_req_tw_func_t)(struct io_kiocb *req, bool *locked);
 
 struct io_task_work {
@@ -837,6 +901,7 @@ struct io_kiocb {
 		struct io_poll_iocb	poll;
 		struct io_poll_update	poll_update;
 		struct io_accept	accept;
+		struct io_socket	sock;
 		struct io_sync		sync;
 		struct io_cancel	cancel;
 		struct io_timeout	timeout;
@@ -858,6 +923,7 @@ struct io_kiocb {
 		struct io_mkdir		mkdir;
 		struct io_symlink	symlink;
 		struct io_hardlink	hardlink;
+		struct io_uring_cmd	uring_cmd;
 		/* use only after cleaning per-op data, see io_clean_op() */
 		struct io_completion	compl;
 	};
@@ -1073,6 +1139,24 @@ static const struct io_op_def io_op_defs[] = {
 	},
 	[IORING_OP_RENAMEAT] = {},
 	[IORING_OP_UNLINKAT] = {},
+	[IORING_OP_UNLINKAT + 1 ... IORING_OP_SOCKET - 1] = {
+		.not_supported		= 1,
+	},
+	[IORING_OP_SOCKET] = {},
+	[IORING_OP_URING_CMD] = {
+		.needs_file		= 1,
+		.plug			= 1,
+		.needs_async_setup	= 1,
+		/* the cmd area of a 128 byte SQE */
+		.async_size		= 2 * sizeof(struct io_uring_sqe) -
+					  offsetof(struct io_uring_sqe, cmd),
+	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+		.async_size		= sizeof(struct io_sendzc_notif),
+	},
 };
 
 /* requests with any of those set should undergo io_disarm_next() */
@@ -1270,11 +1354,23 @@ static inline void req_fail_link_node(struct io_kiocb *req, int res)
 	req->result = res;
 }
 
+/*
+ * The submitter of a DEFER_TASKRUN ring quiesces on ->cq_wait, as it has to
+ * wake up for its deferred task_work as well, see io_quiesce_wait().
+ */
+static void io_quiesce_complete(struct io_ring_ctx *ctx,
+				struct completion *done)
+{
+	complete(done);
+	if (ctx->flags & IORING_SETUP_DEFER_TASKRUN)
+		wake_up_all(&ctx->cq_wait);
+}
+
 static void io_ring_ctx_ref_free(struct percpu_ref *ref)
 {
 	struct io_ring_ctx *ctx = container_of(ref, struct io_ring_ctx, refs);
 
-	complete(&ctx->ref_comp);
+	io_quiesce_complete(ctx, &ctx->ref_comp);
 }
 
 static inline bool io_is_timeout_noseq(struct io_kiocb *req)
@@ -1344,6 +1440,8 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 	INIT_LIST_HEAD(&ctx->cq_overflow_list);
 	init_completion(&ctx->ref_comp);
 	xa_init_flags(&ctx->io_buffers, XA_FLAGS_ALLOC1);
+	xa_init(&ctx->io_buf_rings);
+	init_llist_head(&ctx->work_llist);
 	xa_init_flags(&ctx->personalities, XA_FLAGS_ALLOC1);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->cq_wait);
@@ -2231,6 +2329,26 @@ static void tctx_task_work(struct callback_head *cb)
 		io_uring_drop_tctx_refs(current);
 }
 
+/*
+ * With IORING_SETUP_DEFER_TASKRUN, task_work goes on a ctx list instead of
+ * interrupting the submitter with a signal-like notification. The list is
+ * run when the submitter waits for completions, so only the first entry
+ * needs to wake up a waiter.
+ */
+static void io_req_local_work_add(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (!llist_add(&req->io_task_work.fallback_node, &ctx->work_llist))
+		return;
+	/*
+	 * Nothing has been posted yet, so don't signal an eventfd here, the
+	 * waiter runs the work and io_cqring_ev_posted() follows from that.
+	 */
+	if (wq_has_sleeper(&ctx->cq_wait))
+		wake_up_all(&ctx->cq_wait);
+}
+
 static void io_req_task_work_add(struct io_kiocb *req)
 {
 	struct task_struct *tsk = req->task;
@@ -2240,6 +2358,11 @@ static void io_req_task_work_add(struct io_kiocb *req)
 	unsigned long flags;
 	bool running;
 
+	if (req->ctx->flags & IORING_SETUP_DEFER_TASKRUN) {
+		io_req_local_work_add(req);
+		return;
+	}
+
 	WARN_ON_ONCE(!tctx);
 
 	spin_lock_irqsave(&tctx->task_lock, flags);
@@ -2280,6 +2403,58 @@ static void io_req_task_work_add(struct io_kiocb *req)
 	}
 }
 
+/*
+ * Run the deferred task_work of a DEFER_TASKRUN ring. Only the submitter
+ * gets here, and it always holds ->uring_lock while doing so, so all the
+ * completions end up in one batched flush. Returns the number of items run.
+ */
+static int io_run_local_work(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req, *tmp;
+	struct llist_node *node;
+	bool locked = true;
+	int ret = 0;
+
+	if (llist_empty(&ctx->work_llist))
+		return 0;
+
+	mutex_lock(&ctx->uring_lock);
+	node = llist_del_all(&ctx->work_llist);
+	/* llist_add() pushes to the front, run in the order queued */
+	node = llist_reverse_order(node);
+	llist_for_each_entry_safe(req, tmp, node, io_task_work.fallback_node) {
+		req->io_task_work.func(req, &locked);
+		ret++;
+	}
+	if (ctx->submit_state.compl_nr)
+		io_submit_flush_completions(ctx);
+	mutex_unlock(&ctx->uring_lock);
+	return ret;
+}
+
+/*
+ * Deferred task_work still has to run on cancellation and ring exit. The
+ * submitter runs it itself, anyone else hands it to the fallback worker.
+ */
+static bool io_flush_local_work(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req, *tmp;
+	struct llist_node *node;
+
+	if (llist_empty(&ctx->work_llist))
+		return false;
+	if (current == ctx->submitter_task)
+		return io_run_local_work(ctx) > 0;
+
+	node = llist_del_all(&ctx->work_llist);
+	llist_for_each_entry_safe(req, tmp, node, io_task_work.fallback_node) {
+		if (llist_add(&req->io_task_work.fallback_node,
+			      &ctx->fallback_llist))
+			schedule_delayed_work(&ctx->fallback_work, 1);
+	}
+	return true;
+}
+
 static void io_req_task_cancel(struct io_kiocb *req, bool *locked)
 {
 	struct io_ring_ctx *ctx = req->ctx;
@@ -2467,12 +2642,24 @@ static unsigned int io_put_kbuf(struct io_kiocb *req, struct io_buffer *kbuf)
 	return cflags;
 }
 
+static unsigned int io_put_ring_kbuf(struct io_kiocb *req)
+{
+	unsigned int cflags;
+
+	cflags = req->buf_index << IORING_CQE_BUFFER_SHIFT;
+	cflags |= IORING_CQE_F_BUFFER;
+	req->flags &= ~REQ_F_BUFFER_RING;
+	return cflags;
+}
+
 static inline unsigned int io_put_rw_kbuf(struct io_kiocb *req)
 {
 	struct io_buffer *kbuf;
 
-	if (likely(!(req->flags & REQ_F_BUFFER_SELECTED)))
+	if (likely(!(req->flags & (REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING))))
 		return 0;
+	if (req->flags & REQ_F_BUFFER_RING)
+		return io_put_ring_kbuf(req);
 	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
 	return io_put_kbuf(req, kbuf);
 }
@@ -2574,7 +2761,13 @@ static int io_do_iopoll(struct io_ring_ctx *ctx, unsigned int *nr_events,
 		if (!list_empty(&done))
 			break;
 
-		ret = kiocb->ki_filp->f_op->iopoll(kiocb, spin);
+		if (req->opcode == IORING_OP_URING_CMD) {
+			struct io_uring_cmd *ioucmd = &req->uring_cmd;
+
+			ret = req->file->f_op->uring_cmd_iopoll(ioucmd, spin);
+		} else {
+			ret = kiocb->ki_filp->f_op->iopoll(kiocb, spin);
+		}
 		if (unlikely(ret < 0))
 			return ret;
 		else if (ret)
@@ -2659,6 +2852,7 @@ static int io_iopoll_check(struct io_ring_ctx *ctx, long min)
 
 			mutex_unlock(&ctx->uring_lock);
 			io_run_task_work();
+			io_run_local_work(ctx);
 			mutex_lock(&ctx->uring_lock);
 
 			/* some requests don't go through iopoll_list */
@@ -2868,7 +3062,9 @@ static void io_iopoll_req_issued(struct io_kiocb *req)
 
 		if (list_req->file != req->file) {
 			ctx->poll_multi_queue = true;
-		} else {
+		} else if (list_req->opcode != IORING_OP_URING_CMD &&
+			   req->opcode != IORING_OP_URING_CMD) {
+			/* passthrough commands keep their cookie to the driver */
 			queue_num0 = blk_qc_t_to_queue_num(list_req->rw.kiocb.ki_cookie);
 			queue_num1 = blk_qc_t_to_queue_num(req->rw.kiocb.ki_cookie);
 			if (queue_num0 != queue_num1)
@@ -2996,7 +3192,8 @@ static int io_prep_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		    !kiocb->ki_filp->f_op->iopoll)
 			return -EOPNOTSUPP;
 
-		kiocb->ki_flags |= IOCB_HIPRI;
+		/* polled completions are reaped in task context */
+		kiocb->ki_flags |= IOCB_HIPRI | IOCB_ALLOC_CACHE;
 		kiocb->ki_complete = io_complete_rw_iopoll;
 		req->iopoll_completed = 0;
 	} else {
@@ -3107,11 +3304,10 @@ static void kiocb_done(struct kiocb *kiocb, ssize_t ret,
 	}
 }
 
-static int __io_import_fixed(struct io_kiocb *req, int rw, struct iov_iter *iter,
-			     struct io_mapped_ubuf *imu)
+static int __io_import_fixed(u64 buf_addr, size_t len, int rw,
+			     struct iov_iter *iter, struct io_mapped_ubuf *imu)
 {
-	size_t len = req->rw.len;
-	u64 buf_end, buf_addr = req->rw.addr;
+	u64 buf_end;
 	size_t offset;
 
 	if (unlikely(check_add_overflow(buf_addr, (u64)len, &buf_end)))
@@ -3169,7 +3365,7 @@ static int io_import_fixed(struct io_kiocb *req, int rw, struct iov_iter *iter)
 {
 	if (WARN_ON_ONCE(!req->imu))
 		return -EFAULT;
-	return __io_import_fixed(req, rw, iter, req->imu);
+	return __io_import_fixed(req->rw.addr, req->rw.len, rw, iter, req->imu);
 }
 
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
@@ -3190,54 +3386,100 @@ static void io_ring_submit_lock(struct io_ring_ctx *ctx, bool needs_lock)
 		mutex_lock(&ctx->uring_lock);
 }
 
-static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len,
-					  int bgid, struct io_buffer *kbuf,
-					  bool needs_lock)
+static void __user *io_ring_buffer_select(struct io_kiocb *req, size_t *len,
+					  struct io_buffer_ring *bl)
+{
+	struct io_uring_buf *buf;
+	__u32 buf_len;
+	__u16 tail;
+
+	/* pairs with the store-release of ->tail by the application */
+	tail = smp_load_acquire(&bl->br->tail);
+	if (tail == bl->head)
+		return ERR_PTR(-ENOBUFS);
+
+	buf = &bl->br->bufs[bl->head & bl->mask];
+	buf_len = READ_ONCE(buf->len);
+	if (*len > buf_len)
+		*len = buf_len;
+	req->buf_index = READ_ONCE(buf->bid);
+	req->flags |= REQ_F_BUFFER_RING;
+	bl->head++;
+	return u64_to_user_ptr(READ_ONCE(buf->addr));
+}
+
+/*
+ * Pick a buffer from group @bgid, either from a provided buffer ring or from
+ * the classic list. A list buffer is handed back through @kbuf and sets
+ * REQ_F_BUFFER_SELECTED, a ring buffer sets REQ_F_BUFFER_RING and only needs
+ * the returned address.
+ */
+static void __user *io_buffer_select(struct io_kiocb *req, size_t *len,
+				     int bgid, struct io_buffer **kbuf,
+				     bool needs_lock)
 {
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer_ring *bl;
 	struct io_buffer *head;
+	void __user *ret;
 
-	if (req->flags & REQ_F_BUFFER_SELECTED)
-		return kbuf;
+	io_ring_submit_lock(ctx, needs_lock);
 
-	io_ring_submit_lock(req->ctx, needs_lock);
+	lockdep_assert_held(&ctx->uring_lock);
 
-	lockdep_assert_held(&req->ctx->uring_lock);
+	bl = xa_load(&ctx->io_buf_rings, bgid);
+	if (bl) {
+		ret = io_ring_buffer_select(req, len, bl);
+		goto out;
+	}
 
-	head = xa_load(&req->ctx->io_buffers, bgid);
+	head = xa_load(&ctx->io_buffers, bgid);
 	if (head) {
 		if (!list_empty(&head->list)) {
-			kbuf = list_last_entry(&head->list, struct io_buffer,
+			*kbuf = list_last_entry(&head->list, struct io_buffer,
 							list);
-			list_del(&kbuf->list);
+			list_del(&(*kbuf)->list);
 		} else {
-			kbuf = head;
-			xa_erase(&req->ctx->io_buffers, bgid);
+			*kbuf = head;
+			xa_erase(&ctx->io_buffers, bgid);
 		}
-		if (*len > kbuf->len)
-			*len = kbuf->len;
+		if (*len > (*kbuf)->len)
+			*len = (*kbuf)->len;
+		req->flags |= REQ_F_BUFFER_SELECTED;
+		ret = u64_to_user_ptr((*kbuf)->addr);
 	} else {
-		kbuf = ERR_PTR(-ENOBUFS);
+		ret = ERR_PTR(-ENOBUFS);
 	}
+out:
+	io_ring_submit_unlock(ctx, needs_lock);
 
-	io_ring_submit_unlock(req->ctx, needs_lock);
-
-	return kbuf;
+	return ret;
 }
 
 static void __user *io_rw_buffer_select(struct io_kiocb *req, size_t *len,
 					bool needs_lock)
 {
 	struct io_buffer *kbuf;
-	u16 bgid;
+	void __user *buf;
 
-	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
-	bgid = req->buf_index;
-	kbuf = io_buffer_select(req, len, bgid, kbuf, needs_lock);
-	if (IS_ERR(kbuf))
-		return kbuf;
-	req->rw.addr = (u64) (unsigned long) kbuf;
-	req->flags |= REQ_F_BUFFER_SELECTED;
-	return u64_to_user_ptr(kbuf->addr);
+	if (req->flags & REQ_F_BUFFER_SELECTED) {
+		kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
+		return u64_to_user_ptr(kbuf->addr);
+	}
+	if (req->flags & REQ_F_BUFFER_RING)
+		return u64_to_user_ptr(req->rw.addr);
+
+	buf = io_buffer_select(req, len, req->buf_index, &kbuf, needs_lock);
+	if (IS_ERR(buf))
+		return buf;
+	if (req->flags & REQ_F_BUFFER_RING) {
+		/* ->buf_index now holds the bid, keep the buffer in ->rw */
+		req->rw.addr = (u64) (unsigned long) buf;
+		req->rw.len = *len;
+	} else {
+		req->rw.addr = (u64) (unsigned long) kbuf;
+	}
+	return buf;
 }
 
 #ifdef CONFIG_COMPAT
@@ -3299,6 +3541,11 @@ static ssize_t io_iov_buffer_select(struct io_kiocb *req, struct iovec *iov,
 		iov[0].iov_len = kbuf->len;
 		return 0;
 	}
+	if (req->flags & REQ_F_BUFFER_RING) {
+		iov[0].iov_base = u64_to_user_ptr(req->rw.addr);
+		iov[0].iov_len = req->rw.len;
+		return 0;
+	}
 	if (req->rw.len != 1)
 		return -EINVAL;
 
@@ -4435,7 +4682,11 @@ static int io_provide_buffers(struct io_kiocb *req, unsigned int issue_flags)
 
 	list = head = xa_load(&ctx->io_buffers, p->bgid);
 
-	ret = io_add_buffers(p, &head);
+	/* a group is either a list or a ring, never both */
+	if (unlikely(xa_load(&ctx->io_buf_rings, p->bgid)))
+		ret = -EEXIST;
+	else
+		ret = io_add_buffers(p, &head);
 	if (ret >= 0 && !list) {
 		ret = xa_insert(&ctx->io_buffers, p->bgid, head,
 				GFP_KERNEL_ACCOUNT);
@@ -4713,6 +4964,63 @@ static bool io_net_retry(struct socket *sock, int flags)
 	return sock->type == SOCK_STREAM || sock->type == SOCK_SEQPACKET;
 }
 
+/* CQEs a multishot request posts in one go before yielding to task_work */
+#define IO_MULTISHOT_BATCH	32
+
+/*
+ * Post an intermediate CQE for a multishot recv/accept. Returns false if the
+ * request has to finish with a normal completion instead: it runs from io-wq
+ * and must not hog the worker, or the CQ ring is overflowing and we stop
+ * producing until the application has caught up.
+ */
+static bool io_multishot_post(struct io_kiocb *req, s32 res, u32 cflags,
+			      unsigned int issue_flags)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	bool filled;
+
+	if (!(issue_flags & IO_URING_F_NONBLOCK))
+		return false;
+	if (test_bit(0, &ctx->check_cq_overflow))
+		return false;
+
+	spin_lock(&ctx->completion_lock);
+	filled = io_fill_cqe_aux(ctx, req->user_data, res,
+				 cflags | IORING_CQE_F_MORE);
+	io_commit_cqring(ctx);
+	spin_unlock(&ctx->completion_lock);
+	if (!filled)
+		return false;
+	io_cqring_ev_posted(ctx);
+
+	/* re-arming after having posted a CQE is progress, not a poll retry */
+	if (req->flags & REQ_F_POLLED)
+		req->apoll->poll.retries = APOLL_MAX_RETRY;
+	return true;
+}
+
+/*
+ * Hand back a ring buffer picked for a receive that found nothing to read,
+ * rather than holding it over the poll wait. A nonblocking issue holds
+ * ->uring_lock from the selection till here, so nobody else moved the head.
+ * Buffers that already got partial data are kept.
+ */
+static void io_recv_kbuf_recycle(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_buffer_ring *bl;
+
+	if (!(req->flags & REQ_F_BUFFER_RING) || req->sr_msg.done_io ||
+	    !(issue_flags & IO_URING_F_NONBLOCK))
+		return;
+
+	lockdep_assert_held(&req->ctx->uring_lock);
+
+	bl = xa_load(&req->ctx->io_buf_rings, req->sr_msg.bgid);
+	if (bl)
+		bl->head--;
+	req->flags &= ~REQ_F_BUFFER_RING;
+}
+
 static int io_setup_async_msg(struct io_kiocb *req,
 			      struct io_async_msghdr *kmsg)
 {
@@ -4865,6 +5173,7 @@ static int io_send(struct io_kiocb *req, unsigned int issue_flags)
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_namelen = 0;
+	msg.msg_ubuf = NULL;
 
 	flags = req->sr_msg.msg_flags;
 	if (issue_flags & IO_URING_F_NONBLOCK)
@@ -4896,110 +5205,302 @@ static int io_send(struct io_kiocb *req, unsigned int issue_flags)
 	return 0;
 }
 
-static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
-				 struct io_async_msghdr *iomsg)
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
-	struct iovec __user *uiov;
-	size_t iov_len;
-	int ret;
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned int zc_flags;
 
-	ret = __copy_msghdr_from_user(&iomsg->msg, sr->umsg,
-					&iomsg->uaddr, &uiov, &iov_len);
-	if (ret)
-		return ret;
+	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (unlikely(sqe->addr2 || sqe->file_index))
+		return -EINVAL;
 
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		if (iov_len > 1)
-			return -EINVAL;
-		if (copy_from_user(iomsg->fast_iov, uiov, sizeof(*uiov)))
+	zc_flags = READ_ONCE(sqe->ioprio);
+	if (zc_flags & ~IORING_RECVSEND_FIXED_BUF)
+		return -EINVAL;
+
+	req->imu = NULL;
+	if (zc_flags & IORING_RECVSEND_FIXED_BUF) {
+		u16 index;
+
+		req->buf_index = READ_ONCE(sqe->buf_index);
+		if (unlikely(req->buf_index >= ctx->nr_user_bufs))
 			return -EFAULT;
-		sr->len = iomsg->fast_iov[0].iov_len;
-		iomsg->free_iov = NULL;
-	} else {
-		iomsg->free_iov = iomsg->fast_iov;
-		ret = __import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
-				     &iomsg->free_iov, &iomsg->msg.msg_iter,
-				     false);
-		if (ret > 0)
-			ret = 0;
+		index = array_index_nospec(req->buf_index, ctx->nr_user_bufs);
+		req->imu = ctx->user_bufs[index];
+		io_req_set_rsrc_node(req);
 	}
 
-	return ret;
+	sr->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	sr->len = READ_ONCE(sqe->len);
+	sr->msg_flags = READ_ONCE(sqe->msg_flags) | MSG_NOSIGNAL;
+	if (sr->msg_flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	return 0;
 }
 
-#ifdef CONFIG_COMPAT
-static int __io_compat_recvmsg_copy_hdr(struct io_kiocb *req,
-					struct io_async_msghdr *iomsg)
+static void io_sendzc_notif_tw(struct io_kiocb *req, bool *locked)
 {
-	struct io_sr_msg *sr = &req->sr_msg;
-	struct compat_iovec __user *uiov;
-	compat_uptr_t ptr;
-	compat_size_t len;
-	int ret;
+	struct io_sendzc_notif *notif = req->async_data;
 
-	ret = __get_compat_msghdr(&iomsg->msg, sr->umsg_compat, &iomsg->uaddr,
-				  &ptr, &len);
-	if (ret)
-		return ret;
+	mm_unaccount_pinned_pages(&notif->uarg.mmp);
 
-	uiov = compat_ptr(ptr);
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		compat_ssize_t clen;
+	if (*locked) {
+		struct io_ring_ctx *ctx = req->ctx;
+		struct io_submit_state *state = &ctx->submit_state;
 
-		if (len > 1)
-			return -EINVAL;
-		if (!access_ok(uiov, sizeof(*uiov)))
-			return -EFAULT;
-		if (__get_user(clen, &uiov->iov_len))
-			return -EFAULT;
-		if (clen < 0)
-			return -EINVAL;
-		sr->len = clen;
-		iomsg->free_iov = NULL;
+		io_req_complete_state(req, 0, IORING_CQE_F_NOTIF);
+		state->compl_reqs[state->compl_nr++] = req;
+		if (state->compl_nr == ARRAY_SIZE(state->compl_reqs))
+			io_submit_flush_completions(ctx);
 	} else {
-		iomsg->free_iov = iomsg->fast_iov;
-		ret = __import_iovec(READ, (struct iovec __user *)uiov, len,
-				   UIO_FASTIOV, &iomsg->free_iov,
-				   &iomsg->msg.msg_iter, true);
-		if (ret < 0)
-			return ret;
+		io_req_complete_post(req, 0, IORING_CQE_F_NOTIF);
 	}
-
-	return 0;
 }
-#endif
 
-static int io_recvmsg_copy_hdr(struct io_kiocb *req,
-			       struct io_async_msghdr *iomsg)
+/*
+ * Called for every skb releasing the buffer and once by the issuer for its
+ * own reference, from any context. The last one completes the request in
+ * task context, which posts the notification CQE.
+ */
+static void io_sendzc_callback(struct ubuf_info *uarg, bool success)
 {
-	iomsg->msg.msg_name = &iomsg->addr;
+	struct io_sendzc_notif *notif;
 
-#ifdef CONFIG_COMPAT
-	if (req->ctx->compat)
-		return __io_compat_recvmsg_copy_hdr(req, iomsg);
-#endif
+	if (!refcount_dec_and_test(&uarg->refcnt))
+		return;
 
-	return __io_recvmsg_copy_hdr(req, iomsg);
+	notif = container_of(uarg, struct io_sendzc_notif, uarg);
+	notif->req->io_task_work.func = io_sendzc_notif_tw;
+	io_req_task_work_add(notif->req);
 }
 
-static struct io_buffer *io_recv_buffer_select(struct io_kiocb *req,
-					       bool needs_lock)
+static void io_sendzc_unaccount(struct io_sendzc_notif *notif)
 {
-	struct io_sr_msg *sr = &req->sr_msg;
-	struct io_buffer *kbuf;
-
-	kbuf = io_buffer_select(req, &sr->len, sr->bgid, sr->kbuf, needs_lock);
-	if (IS_ERR(kbuf))
-		return kbuf;
-
-	sr->kbuf = kbuf;
-	req->flags |= REQ_F_BUFFER_SELECTED;
-	return kbuf;
+	mm_unaccount_pinned_pages(&notif->uarg.mmp);
+	notif->uarg.mmp.user = NULL;
+	notif->uarg.mmp.num_pg = 0;
+}
+
+/*
+ * Only tcp_sendmsg_locked() attaches msg_ubuf to its skbs. UDP, raw and the
+ * rest set up a uarg of their own for MSG_ZEROCOPY, which the notification
+ * can't wait for, so they get a plain copying send and the notification
+ * follows the send CQE right away.
+ */
+static bool io_sendzc_supported(struct socket *sock)
+{
+	struct sock *sk = sock->sk;
+
+	return (sk->sk_family == AF_INET || sk->sk_family == AF_INET6) &&
+	       sk->sk_type == SOCK_STREAM && sk->sk_protocol == IPPROTO_TCP;
+}
+
+static int io_sendzc(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_sendzc_notif *notif;
+	struct msghdr msg;
+	struct iovec iov;
+	struct socket *sock;
+	unsigned flags;
+	int min_ret = 0;
+	bool zc;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		return ret;
+	zc = io_sendzc_supported(sock);
+
+	notif = req->async_data;
+	if (!notif) {
+		if (io_alloc_async_data(req))
+			return -ENOMEM;
+		notif = req->async_data;
+		notif->req = req;
+		notif->uarg.callback = io_sendzc_callback;
+		notif->uarg.flags = UBUF_F_DONT_ORPHAN;
+		notif->uarg.mmp.user = NULL;
+		notif->uarg.mmp.num_pg = 0;
+		refcount_set(&notif->uarg.refcnt, 1);
+	}
+
+	if (req->imu) {
+		ret = __io_import_fixed((unsigned long)sr->buf, sr->len, WRITE,
+					&msg.msg_iter, req->imu);
+	} else {
+		ret = import_single_range(WRITE, sr->buf, sr->len, &iov,
+					  &msg.msg_iter);
+		/* registered buffers are already charged to the ring owner */
+		if (!ret && zc)
+			ret = mm_account_pinned_pages(&notif->uarg.mmp, sr->len);
+	}
+	if (unlikely(ret))
+		return ret;
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_iocb = NULL;
+	msg.msg_ubuf = NULL;
+
+	flags = sr->msg_flags & ~MSG_ZEROCOPY;
+	if (zc) {
+		msg.msg_ubuf = &notif->uarg;
+		flags |= MSG_ZEROCOPY;
+	}
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		flags |= MSG_DONTWAIT;
+	if (flags & MSG_WAITALL)
+		min_ret = iov_iter_count(&msg.msg_iter);
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	if (ret < min_ret) {
+		/*
+		 * Nothing was queued on -EAGAIN. A short send isn't retried
+		 * like io_send() does, the skbs already queued hold the
+		 * buffer and the request can't be failed under them.
+		 */
+		if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK)) {
+			io_sendzc_unaccount(notif);
+			return -EAGAIN;
+		}
+		if (ret == -ERESTARTSYS)
+			ret = -EINTR;
+		req_set_fail(req);
+	}
+
+	/* nothing references the buffer, no notification needed */
+	if (ret <= 0) {
+		io_sendzc_unaccount(notif);
+		__io_req_complete(req, issue_flags, ret, 0);
+		return 0;
+	}
+
+	spin_lock(&ctx->completion_lock);
+	io_fill_cqe_aux(ctx, req->user_data, ret, IORING_CQE_F_MORE);
+	io_commit_cqring(ctx);
+	spin_unlock(&ctx->completion_lock);
+	io_cqring_ev_posted(ctx);
+
+	/* drop the issue reference, the last skb posts the notification */
+	io_sendzc_callback(&notif->uarg, true);
+	return 0;
+}
+
+static int __io_recvmsg_copy_hdr(struct io_kiocb *req,
+				 struct io_async_msghdr *iomsg)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct iovec __user *uiov;
+	size_t iov_len;
+	int ret;
+
+	ret = __copy_msghdr_from_user(&iomsg->msg, sr->umsg,
+					&iomsg->uaddr, &uiov, &iov_len);
+	if (ret)
+		return ret;
+
+	if (req->flags & REQ_F_BUFFER_SELECT) {
+		if (iov_len > 1)
+			return -EINVAL;
+		if (copy_from_user(iomsg->fast_iov, uiov, sizeof(*uiov)))
+			return -EFAULT;
+		sr->len = iomsg->fast_iov[0].iov_len;
+		iomsg->free_iov = NULL;
+	} else {
+		iomsg->free_iov = iomsg->fast_iov;
+		ret = __import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
+				     &iomsg->free_iov, &iomsg->msg.msg_iter,
+				     false);
+		if (ret > 0)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+#ifdef CONFIG_COMPAT
+static int __io_compat_recvmsg_copy_hdr(struct io_kiocb *req,
+					struct io_async_msghdr *iomsg)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct compat_iovec __user *uiov;
+	compat_uptr_t ptr;
+	compat_size_t len;
+	int ret;
+
+	ret = __get_compat_msghdr(&iomsg->msg, sr->umsg_compat, &iomsg->uaddr,
+				  &ptr, &len);
+	if (ret)
+		return ret;
+
+	uiov = compat_ptr(ptr);
+	if (req->flags & REQ_F_BUFFER_SELECT) {
+		compat_ssize_t clen;
+
+		if (len > 1)
+			return -EINVAL;
+		if (!access_ok(uiov, sizeof(*uiov)))
+			return -EFAULT;
+		if (__get_user(clen, &uiov->iov_len))
+			return -EFAULT;
+		if (clen < 0)
+			return -EINVAL;
+		sr->len = clen;
+		iomsg->free_iov = NULL;
+	} else {
+		iomsg->free_iov = iomsg->fast_iov;
+		ret = __import_iovec(READ, (struct iovec __user *)uiov, len,
+				   UIO_FASTIOV, &iomsg->free_iov,
+				   &iomsg->msg.msg_iter, true);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+#endif
+
+static int io_recvmsg_copy_hdr(struct io_kiocb *req,
+			       struct io_async_msghdr *iomsg)
+{
+	iomsg->msg.msg_name = &iomsg->addr;
+
+#ifdef CONFIG_COMPAT
+	if (req->ctx->compat)
+		return __io_compat_recvmsg_copy_hdr(req, iomsg);
+#endif
+
+	return __io_recvmsg_copy_hdr(req, iomsg);
+}
+
+static void __user *io_recv_buffer_select(struct io_kiocb *req,
+					  bool needs_lock)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	void __user *buf;
+
+	if (req->flags & REQ_F_BUFFER_SELECTED)
+		return u64_to_user_ptr(sr->kbuf->addr);
+	if (req->flags & REQ_F_BUFFER_RING)
+		return sr->ring_buf;
+
+	buf = io_buffer_select(req, &sr->len, sr->bgid, &sr->kbuf, needs_lock);
+	if (!IS_ERR(buf) && (req->flags & REQ_F_BUFFER_RING))
+		sr->ring_buf = buf;
+	return buf;
 }
 
 static inline unsigned int io_put_recv_kbuf(struct io_kiocb *req)
 {
+	if (req->flags & REQ_F_BUFFER_RING)
+		return io_put_ring_kbuf(req);
 	return io_put_kbuf(req, req->sr_msg.kbuf);
 }
 
@@ -5016,13 +5517,12 @@ static int io_recvmsg_prep_async(struct io_kiocb *req)
 static int io_recvmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
+	unsigned int flags;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
 	if (unlikely(sqe->addr2 || sqe->file_index))
 		return -EINVAL;
-	if (unlikely(sqe->addr2 || sqe->file_index || sqe->ioprio))
-		return -EINVAL;
 
 	sr->umsg = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	sr->len = READ_ONCE(sqe->len);
@@ -5031,6 +5531,19 @@ static int io_recvmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	if (sr->msg_flags & MSG_DONTWAIT)
 		req->flags |= REQ_F_NOWAIT;
 
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_RECV_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_RECV_MULTISHOT) {
+		/* every message needs a fresh buffer, sized by the buffer */
+		if (req->opcode != IORING_OP_RECV ||
+		    !(req->flags & REQ_F_BUFFER_SELECT) ||
+		    (sr->msg_flags & MSG_WAITALL) || sr->len)
+			return -EINVAL;
+		sr->len = MAX_RW_COUNT;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
+
 #ifdef CONFIG_COMPAT
 	if (req->ctx->compat)
 		sr->msg_flags |= MSG_CMSG_COMPAT;
@@ -5044,7 +5557,7 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 	struct io_async_msghdr iomsg, *kmsg;
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct socket *sock;
-	struct io_buffer *kbuf;
+	void __user *buf;
 	unsigned flags;
 	int min_ret = 0;
 	int ret, cflags = 0;
@@ -5063,10 +5576,10 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 	}
 
 	if (req->flags & REQ_F_BUFFER_SELECT) {
-		kbuf = io_recv_buffer_select(req, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		kmsg->fast_iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
+		buf = io_recv_buffer_select(req, !force_nonblock);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+		kmsg->fast_iov[0].iov_base = buf;
 		kmsg->fast_iov[0].iov_len = req->sr_msg.len;
 		iov_iter_init(&kmsg->msg.msg_iter, READ, kmsg->fast_iov,
 				1, req->sr_msg.len);
@@ -5081,8 +5594,10 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 	ret = __sys_recvmsg_sock(sock, &kmsg->msg, req->sr_msg.umsg,
 					kmsg->uaddr, flags);
 	if (ret < min_ret) {
-		if (ret == -EAGAIN && force_nonblock)
+		if (ret == -EAGAIN && force_nonblock) {
+			io_recv_kbuf_recycle(req, issue_flags);
 			return io_setup_async_msg(req, kmsg);
+		}
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
 		if (ret > 0 && io_net_retry(sock, flags)) {
@@ -5097,7 +5612,7 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 		req_set_fail(req);
 	}
 
-	if (req->flags & REQ_F_BUFFER_SELECTED)
+	if (req->flags & (REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING))
 		cflags = io_put_recv_kbuf(req);
 	/* fast path, check for non-NULL to avoid function call */
 	if (kmsg->free_iov)
@@ -5113,7 +5628,6 @@ static int io_recvmsg(struct io_kiocb *req, unsigned int issue_flags)
 
 static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 {
-	struct io_buffer *kbuf;
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct msghdr msg;
 	void __user *buf = sr->buf;
@@ -5122,17 +5636,18 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 	unsigned flags;
 	int min_ret = 0;
 	int ret, cflags = 0;
+	int nr_posted = 0;
 	bool force_nonblock = issue_flags & IO_URING_F_NONBLOCK;
 
 	sock = sock_from_file(req->file, &ret);
 	if (unlikely(!sock))
 		return ret;
 
+retry_multishot:
 	if (req->flags & REQ_F_BUFFER_SELECT) {
-		kbuf = io_recv_buffer_select(req, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		buf = u64_to_user_ptr(kbuf->addr);
+		buf = io_recv_buffer_select(req, !force_nonblock);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
 	}
 
 	ret = import_single_range(READ, buf, sr->len, &iov, &msg.msg_iter);
@@ -5154,8 +5669,10 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 
 	ret = sock_recvmsg(sock, &msg, flags);
 	if (ret < min_ret) {
-		if (ret == -EAGAIN && force_nonblock)
+		if (ret == -EAGAIN && force_nonblock) {
+			io_recv_kbuf_recycle(req, issue_flags);
 			return -EAGAIN;
+		}
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
 		if (ret > 0 && io_net_retry(sock, flags)) {
@@ -5170,12 +5687,24 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 out_free:
 		req_set_fail(req);
 	}
-	if (req->flags & REQ_F_BUFFER_SELECTED)
+	if (req->flags & (REQ_F_BUFFER_SELECTED | REQ_F_BUFFER_RING))
 		cflags = io_put_recv_kbuf(req);
 	if (ret >= 0)
 		ret += sr->done_io;
 	else if (sr->done_io)
 		ret = sr->done_io;
+
+	/* multishot keeps going until an error, EOF, or the CQ backs up */
+	if ((req->flags & REQ_F_APOLL_MULTISHOT) && ret > 0 &&
+	    io_multishot_post(req, ret, cflags, issue_flags)) {
+		cflags = 0;
+		sr->len = MAX_RW_COUNT;
+		if (++nr_posted < IO_MULTISHOT_BATCH)
+			goto retry_multishot;
+		/* let others run, carry on from task_work */
+		io_req_task_queue(req);
+		return 0;
+	}
 	__io_req_complete(req, issue_flags, ret, cflags);
 	return 0;
 }
@@ -5183,10 +5712,11 @@ static int io_recv(struct io_kiocb *req, unsigned int issue_flags)
 static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_accept *accept = &req->accept;
+	unsigned int flags;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
 		return -EINVAL;
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
@@ -5201,6 +5731,16 @@ static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 		return -EINVAL;
 	if (SOCK_NONBLOCK != O_NONBLOCK && (accept->flags & SOCK_NONBLOCK))
 		accept->flags = (accept->flags & ~SOCK_NONBLOCK) | O_NONBLOCK;
+
+	flags = READ_ONCE(sqe->ioprio);
+	if (flags & ~IORING_ACCEPT_MULTISHOT)
+		return -EINVAL;
+	if (flags & IORING_ACCEPT_MULTISHOT) {
+		/* a single fixed slot can't take more than one connection */
+		if (accept->file_slot)
+			return -EINVAL;
+		req->flags |= REQ_F_APOLL_MULTISHOT;
+	}
 	return 0;
 }
 
@@ -5211,8 +5751,10 @@ static int io_accept(struct io_kiocb *req, unsigned int issue_flags)
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
 	bool fixed = !!accept->file_slot;
 	struct file *file;
+	int nr_posted = 0;
 	int ret, fd;
 
+retry_multishot:
 	if (!fixed) {
 		fd = __get_unused_fd_flags(accept->flags, accept->nofile);
 		if (unlikely(fd < 0))
@@ -5239,6 +5781,70 @@ static int io_accept(struct io_kiocb *req, unsigned int issue_flags)
 		ret = io_install_fixed_file(req, file, issue_flags,
 					    accept->file_slot - 1);
 	}
+
+	if ((req->flags & REQ_F_APOLL_MULTISHOT) && ret >= 0 &&
+	    io_multishot_post(req, ret, 0, issue_flags)) {
+		if (++nr_posted < IO_MULTISHOT_BATCH)
+			goto retry_multishot;
+		io_req_task_queue(req);
+		return 0;
+	}
+	__io_req_complete(req, issue_flags, ret, 0);
+	return 0;
+}
+
+static int io_socket_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_socket *sock = &req->sock;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->addr || sqe->rw_flags || sqe->buf_index)
+		return -EINVAL;
+
+	sock->domain = READ_ONCE(sqe->fd);
+	sock->type = READ_ONCE(sqe->off);
+	sock->protocol = READ_ONCE(sqe->len);
+	sock->file_slot = READ_ONCE(sqe->file_index);
+	sock->nofile = rlimit(RLIMIT_NOFILE);
+
+	sock->flags = sock->type & ~SOCK_TYPE_MASK;
+	if (sock->file_slot && (sock->flags & SOCK_CLOEXEC))
+		return -EINVAL;
+	if (sock->flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK))
+		return -EINVAL;
+	return 0;
+}
+
+static int io_socket(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_socket *sock = &req->sock;
+	bool fixed = !!sock->file_slot;
+	struct file *file;
+	int ret, fd;
+
+	if (!fixed) {
+		fd = __get_unused_fd_flags(sock->flags, sock->nofile);
+		if (unlikely(fd < 0))
+			return fd;
+	}
+	file = __sys_socket_file(sock->domain, sock->type, sock->protocol);
+	if (IS_ERR(file)) {
+		if (!fixed)
+			put_unused_fd(fd);
+		ret = PTR_ERR(file);
+		if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+			return -EAGAIN;
+		if (ret == -ERESTARTSYS)
+			ret = -EINTR;
+		req_set_fail(req);
+	} else if (!fixed) {
+		fd_install(fd, file);
+		ret = fd;
+	} else {
+		ret = io_install_fixed_file(req, file, issue_flags,
+					    sock->file_slot - 1);
+	}
 	__io_req_complete(req, issue_flags, ret, 0);
 	return 0;
 }
@@ -5331,7 +5937,9 @@ IO_NETOP_PREP_ASYNC(sendmsg);
 IO_NETOP_PREP_ASYNC(recvmsg);
 IO_NETOP_PREP_ASYNC(connect);
 IO_NETOP_PREP(accept);
+IO_NETOP_PREP(socket);
 IO_NETOP_FN(send);
+IO_NETOP_PREP(sendzc);
 IO_NETOP_FN(recv);
 #endif /* CONFIG_NET */
 
@@ -5783,14 +6391,6 @@ enum {
 	IO_APOLL_READY
 };
 
-/*
- * We can't reliably detect loops in repeated poll triggers and issue
- * subsequently failing. But rather than fail these immediately, allow a
- * certain amount of retries before we give up. Given that this condition
- * should _rarely_ trigger even once, we should be fine with a larger value.
- */
-#define APOLL_MAX_RETRY		128
-
 static int io_arm_poll_handler(struct io_kiocb *req)
 {
 	const struct io_op_def *def = &io_op_defs[req->opcode];
@@ -6478,33 +7078,173 @@ static int io_files_update(struct io_kiocb *req, unsigned int issue_flags)
 	return 0;
 }
 
-static int io_req_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+static void io_uring_cmd_work(struct io_kiocb *req, bool *locked)
 {
-	switch (req->opcode) {
-	case IORING_OP_NOP:
-		return 0;
-	case IORING_OP_READV:
-	case IORING_OP_READ_FIXED:
-	case IORING_OP_READ:
-		return io_read_prep(req, sqe);
-	case IORING_OP_WRITEV:
-	case IORING_OP_WRITE_FIXED:
-	case IORING_OP_WRITE:
-		return io_write_prep(req, sqe);
-	case IORING_OP_POLL_ADD:
-		return io_poll_add_prep(req, sqe);
-	case IORING_OP_POLL_REMOVE:
-		return io_poll_update_prep(req, sqe);
-	case IORING_OP_FSYNC:
-		return io_fsync_prep(req, sqe);
-	case IORING_OP_SYNC_FILE_RANGE:
-		return io_sfr_prep(req, sqe);
-	case IORING_OP_SENDMSG:
-	case IORING_OP_SEND:
-		return io_sendmsg_prep(req, sqe);
-	case IORING_OP_RECVMSG:
-	case IORING_OP_RECV:
-		return io_recvmsg_prep(req, sqe);
+	req->uring_cmd.task_work_cb(&req->uring_cmd);
+}
+
+/*
+ * Drivers complete from irq context, this gets them back to the submitter
+ * task, where io_uring_cmd_done() and user memory unmapping can be done.
+ */
+void io_uring_cmd_complete_in_task(struct io_uring_cmd *ioucmd,
+			void (*task_work_cb)(struct io_uring_cmd *))
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	ioucmd->task_work_cb = task_work_cb;
+	req->io_task_work.func = io_uring_cmd_work;
+	io_req_task_work_add(req);
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_complete_in_task);
+
+static void __io_uring_cmd_done(struct io_kiocb *req, ssize_t ret,
+				unsigned int issue_flags)
+{
+	if (ret < 0)
+		req_set_fail(req);
+	if (req->ctx->flags & IORING_SETUP_IOPOLL) {
+		WRITE_ONCE(req->result, ret);
+		/* order with io_iopoll_complete() checking ->result */
+		smp_wmb();
+		WRITE_ONCE(req->iopoll_completed, 1);
+	} else {
+		__io_req_complete(req, issue_flags, ret, 0);
+	}
+}
+
+/*
+ * Called by consumers of io_uring_cmd, if they originally returned
+ * -EIOCBQUEUED upon receiving the command. @res2 is the driver's extra
+ * result, which has no room in a 16 byte CQE and is dropped.
+ */
+void io_uring_cmd_done(struct io_uring_cmd *ioucmd, ssize_t ret, ssize_t res2)
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	__io_uring_cmd_done(req, ret, 0);
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_done);
+
+int io_uring_cmd_import_fixed(u64 ubuf, unsigned long len, int rw,
+			      struct iov_iter *iter, void *ioucmd)
+{
+	struct io_kiocb *req = container_of(ioucmd, struct io_kiocb, uring_cmd);
+
+	if (WARN_ON_ONCE(!req->imu))
+		return -EFAULT;
+	return __io_import_fixed(ubuf, len, rw, iter, req->imu);
+}
+EXPORT_SYMBOL_GPL(io_uring_cmd_import_fixed);
+
+static int io_uring_cmd_prep(struct io_kiocb *req,
+			     const struct io_uring_sqe *sqe)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (unlikely(req->flags & REQ_F_BUFFER_SELECT))
+		return -EINVAL;
+	if (sqe->ioprio || sqe->__pad1)
+		return -EINVAL;
+
+	ioucmd->flags = READ_ONCE(sqe->uring_cmd_flags);
+	if (ioucmd->flags & ~IORING_URING_CMD_FIXED)
+		return -EINVAL;
+
+	req->imu = NULL;
+	if (ioucmd->flags & IORING_URING_CMD_FIXED) {
+		u16 index;
+
+		req->buf_index = READ_ONCE(sqe->buf_index);
+		if (unlikely(req->buf_index >= ctx->nr_user_bufs))
+			return -EFAULT;
+		index = array_index_nospec(req->buf_index, ctx->nr_user_bufs);
+		req->imu = ctx->user_bufs[index];
+		io_req_set_rsrc_node(req);
+	}
+
+	if (ctx->flags & IORING_SETUP_IOPOLL)
+		req->iopoll_completed = 0;
+	ioucmd->cmd = sqe->cmd;
+	ioucmd->cmd_op = READ_ONCE(sqe->cmd_op);
+	return 0;
+}
+
+/*
+ * The command lives in the SQ ring, which the application may reuse as soon
+ * as we return. Copy it out before the request is retried from io-wq.
+ */
+static void io_uring_cmd_prep_async(struct io_kiocb *req)
+{
+	size_t cmd_size = io_op_defs[IORING_OP_URING_CMD].async_size;
+
+	if (!(req->ctx->flags & IORING_SETUP_SQE128))
+		cmd_size -= sizeof(struct io_uring_sqe);
+	memcpy(req->async_data, req->uring_cmd.cmd, cmd_size);
+	req->uring_cmd.cmd = req->async_data;
+}
+
+static int io_uring_cmd(struct io_kiocb *req, unsigned int issue_flags)
+{
+	struct io_uring_cmd *ioucmd = &req->uring_cmd;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	int ret;
+
+	if (!file->f_op->uring_cmd)
+		return -EOPNOTSUPP;
+
+	if (ctx->flags & IORING_SETUP_SQE128)
+		issue_flags |= IO_URING_F_SQE128;
+	if (ctx->flags & IORING_SETUP_IOPOLL) {
+		if (!file->f_op->uring_cmd_iopoll)
+			return -EOPNOTSUPP;
+		issue_flags |= IO_URING_F_IOPOLL;
+	}
+
+	ret = file->f_op->uring_cmd(ioucmd, issue_flags);
+	if (ret == -EAGAIN) {
+		if (!req->async_data) {
+			if (io_alloc_async_data(req))
+				return -ENOMEM;
+			io_uring_cmd_prep_async(req);
+		}
+		return -EAGAIN;
+	}
+
+	if (ret != -EIOCBQUEUED)
+		__io_uring_cmd_done(req, ret, issue_flags);
+	return 0;
+}
+
+static int io_req_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	switch (req->opcode) {
+	case IORING_OP_NOP:
+		return 0;
+	case IORING_OP_READV:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_READ:
+		return io_read_prep(req, sqe);
+	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE_FIXED:
+	case IORING_OP_WRITE:
+		return io_write_prep(req, sqe);
+	case IORING_OP_POLL_ADD:
+		return io_poll_add_prep(req, sqe);
+	case IORING_OP_POLL_REMOVE:
+		return io_poll_update_prep(req, sqe);
+	case IORING_OP_FSYNC:
+		return io_fsync_prep(req, sqe);
+	case IORING_OP_SYNC_FILE_RANGE:
+		return io_sfr_prep(req, sqe);
+	case IORING_OP_SENDMSG:
+	case IORING_OP_SEND:
+		return io_sendmsg_prep(req, sqe);
+	case IORING_OP_RECVMSG:
+	case IORING_OP_RECV:
+		return io_recvmsg_prep(req, sqe);
 	case IORING_OP_CONNECT:
 		return io_connect_prep(req, sqe);
 	case IORING_OP_TIMEOUT:
@@ -6549,6 +7289,12 @@ static int io_req_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 		return io_renameat_prep(req, sqe);
 	case IORING_OP_UNLINKAT:
 		return io_unlinkat_prep(req, sqe);
+	case IORING_OP_URING_CMD:
+		return io_uring_cmd_prep(req, sqe);
+	case IORING_OP_SOCKET:
+		return io_socket_prep(req, sqe);
+	case IORING_OP_SEND_ZC:
+		return io_sendzc_prep(req, sqe);
 	}
 
 	printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
@@ -6576,6 +7322,9 @@ static int io_req_prep_async(struct io_kiocb *req)
 		return io_recvmsg_prep_async(req);
 	case IORING_OP_CONNECT:
 		return io_connect_prep_async(req);
+	case IORING_OP_URING_CMD:
+		io_uring_cmd_prep_async(req);
+		return 0;
 	}
 	printk_once(KERN_WARNING "io_uring: prep_async() bad opcode %d\n",
 		    req->opcode);
@@ -6843,6 +7592,15 @@ static int io_issue_sqe(struct io_kiocb *req, unsigned int issue_flags)
 	case IORING_OP_UNLINKAT:
 		ret = io_unlinkat(req, issue_flags);
 		break;
+	case IORING_OP_URING_CMD:
+		ret = io_uring_cmd(req, issue_flags);
+		break;
+	case IORING_OP_SOCKET:
+		ret = io_socket(req, issue_flags);
+		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_sendzc(req, issue_flags);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -7163,7 +7921,8 @@ static int io_init_req(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	/* enforce forwards compatibility on users */
 	if (unlikely(sqe_flags & ~SQE_VALID_FLAGS))
 		return -EINVAL;
-	if (unlikely(req->opcode >= IORING_OP_LAST))
+	if (unlikely(req->opcode >= IORING_OP_LAST ||
+		     io_op_defs[req->opcode].not_supported))
 		return -EINVAL;
 	if (!io_check_restriction(ctx, req, sqe_flags))
 		return -EACCES;
@@ -7190,7 +7949,7 @@ static int io_init_req(struct io_ring_ctx *ctx, struct io_kiocb *req,
 	 */
 	if (!state->plug_started && state->ios_left > 1 &&
 	    io_op_defs[req->opcode].plug) {
-		blk_start_plug(&state->plug);
+		blk_start_plug_nr_ios(&state->plug, state->ios_left);
 		state->plug_started = true;
 	}
 
@@ -7348,8 +8107,12 @@ static const struct io_uring_sqe *io_get_sqe(struct io_ring_ctx *ctx)
 	 *    though the application is the one updating it.
 	 */
 	head = READ_ONCE(ctx->sq_array[sq_idx]);
-	if (likely(head < ctx->sq_entries))
+	if (likely(head < ctx->sq_entries)) {
+		/* double index for 128-byte SQEs, twice as long */
+		if (ctx->flags & IORING_SETUP_SQE128)
+			head <<= 1;
 		return &ctx->sq_sqes[head];
+	}
 
 	/* drop invalid entries */
 	ctx->cq_extra--;
@@ -7613,13 +8376,17 @@ static int io_wake_function(struct wait_queue_entry *curr, unsigned int mode,
 	 * Cannot safely flush overflowed CQEs from here, ensure we wake up
 	 * the task, and the next invocation will do it.
 	 */
-	if (io_should_wake(iowq) || test_bit(0, &iowq->ctx->check_cq_overflow))
+	if (io_should_wake(iowq) || test_bit(0, &iowq->ctx->check_cq_overflow) ||
+	    !llist_empty(&iowq->ctx->work_llist))
 		return autoremove_wake_function(curr, mode, wake_flags, key);
 	return -1;
 }
 
-static int io_run_task_work_sig(void)
+static int io_run_task_work_sig(struct io_ring_ctx *ctx)
 {
+	if ((ctx->flags & IORING_SETUP_DEFER_TASKRUN) &&
+	    io_run_local_work(ctx) > 0)
+		return 1;
 	if (io_run_task_work())
 		return 1;
 	if (!signal_pending(current))
@@ -7629,6 +8396,34 @@ static int io_run_task_work_sig(void)
 	return -EINTR;
 }
 
+/*
+ * Wait for a quiesce completion. The references it waits for may be held by
+ * requests whose completion is deferred task_work of a DEFER_TASKRUN ring,
+ * which only the submitter waiting here can run, so bail out when there is
+ * some and let the caller run it through io_run_task_work_sig().
+ */
+static int io_quiesce_wait(struct io_ring_ctx *ctx, struct completion *done)
+{
+	DEFINE_WAIT(wait);
+	int ret = 0;
+
+	if (!(ctx->flags & IORING_SETUP_DEFER_TASKRUN))
+		return wait_for_completion_interruptible(done);
+
+	for (;;) {
+		prepare_to_wait(&ctx->cq_wait, &wait, TASK_INTERRUPTIBLE);
+		if (try_wait_for_completion(done))
+			break;
+		if (!llist_empty(&ctx->work_llist) || signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		schedule();
+	}
+	finish_wait(&ctx->cq_wait, &wait);
+	return ret;
+}
+
 /* when returns >0, the caller should retry */
 static inline int io_cqring_wait_schedule(struct io_ring_ctx *ctx,
 					  struct io_wait_queue *iowq,
@@ -7637,12 +8432,15 @@ static inline int io_cqring_wait_schedule(struct io_ring_ctx *ctx,
 	int token, ret;
 
 	/* make sure we run task_work before checking for signals */
-	ret = io_run_task_work_sig();
+	ret = io_run_task_work_sig(ctx);
 	if (ret || io_should_wake(iowq))
 		return ret;
 	/* let the caller flush overflows, retry */
 	if (test_bit(0, &ctx->check_cq_overflow))
 		return 1;
+	/* deferred task_work may post what we're waiting for, run it first */
+	if (!llist_empty(&ctx->work_llist))
+		return 1;
 
 	/*
 	 * Use io_schedule_prepare/finish, so cpufreq can take into account
@@ -7671,10 +8469,11 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 	int ret;
 
 	do {
+		io_run_local_work(ctx);
 		io_cqring_overflow_flush(ctx);
 		if (io_cqring_events(ctx) >= min_events)
 			return 0;
-		if (!io_run_task_work())
+		if (!io_run_task_work() && llist_empty(&ctx->work_llist))
 			break;
 	} while (1);
 
@@ -7708,6 +8507,7 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 
 	trace_io_uring_cqring_wait(ctx, min_events);
 	do {
+		io_run_local_work(ctx);
 		/* if we can't even flush overflow, don't wait for more */
 		if (!io_cqring_overflow_flush(ctx)) {
 			ret = -EBUSY;
@@ -7865,7 +8665,7 @@ static int io_rsrc_ref_quiesce(struct io_rsrc_data *data, struct io_ring_ctx *ct
 			break;
 		mutex_unlock(&ctx->uring_lock);
 		flush_delayed_work(&ctx->rsrc_put_work);
-		ret = wait_for_completion_interruptible(&data->done);
+		ret = io_quiesce_wait(ctx, &data->done);
 		if (!ret) {
 			mutex_lock(&ctx->uring_lock);
 			if (atomic_read(&data->refs) > 0) {
@@ -7884,7 +8684,7 @@ static int io_rsrc_ref_quiesce(struct io_rsrc_data *data, struct io_ring_ctx *ct
 		flush_delayed_work(&ctx->rsrc_put_work);
 		reinit_completion(&data->done);
 
-		ret = io_run_task_work_sig();
+		ret = io_run_task_work_sig(ctx);
 		mutex_lock(&ctx->uring_lock);
 	} while (ret >= 0);
 	data->quiesce = false;
@@ -8327,7 +9127,7 @@ static void __io_rsrc_put_work(struct io_rsrc_node *ref_node)
 
 	io_rsrc_node_destroy(ref_node);
 	if (atomic_dec_and_test(&rsrc_data->refs))
-		complete(&rsrc_data->done);
+		io_quiesce_complete(ctx, &rsrc_data->done);
 }
 
 static void io_rsrc_put_work(struct work_struct *work)
@@ -9353,13 +10153,26 @@ static int io_eventfd_unregister(struct io_ring_ctx *ctx)
 	return -ENXIO;
 }
 
+static void io_free_buffer_ring(struct io_buffer_ring *bl)
+{
+	vunmap(bl->br);
+	unpin_user_pages(bl->pages, bl->nr_pages);
+	kvfree(bl->pages);
+	kfree(bl);
+}
+
 static void io_destroy_buffers(struct io_ring_ctx *ctx)
 {
+	struct io_buffer_ring *bl;
 	struct io_buffer *buf;
 	unsigned long index;
 
 	xa_for_each(&ctx->io_buffers, index, buf)
 		__io_remove_buffers(ctx, buf, index, -1U);
+	xa_for_each(&ctx->io_buf_rings, index, bl) {
+		xa_erase(&ctx->io_buf_rings, index);
+		io_free_buffer_ring(bl);
+	}
 }
 
 static void io_req_cache_free(struct list_head *list)
@@ -9394,6 +10207,53 @@ static void io_wait_rsrc_data(struct io_rsrc_data *data)
 		wait_for_completion(&data->done);
 }
 
+static void io_iowq_node_cfg_free(struct io_iowq_node_cfg *cfg)
+{
+	int node;
+
+	if (!cfg)
+		return;
+	for (node = 0; node < nr_node_ids; node++) {
+		kfree(cfg[node].cpu_mask[IO_WQ_BOUND]);
+		kfree(cfg[node].cpu_mask[IO_WQ_UNBOUND]);
+	}
+	kfree(cfg);
+}
+
+/*
+ * Apply the IORING_REGISTER_IOWQ_NODE settings of one node to an io-wq and
+ * return its previous worker limits in @prev.
+ */
+static void io_iowq_node_cfg_apply(struct io_ring_ctx *ctx, struct io_wq *wq,
+				   int node, int *prev)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_iowq_node_cfg *cfg = &ctx->iowq_node_cfg[node];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cfg->cpu_mask); i++) {
+		/* ignore errors, the cpus may have gone offline since */
+		if (cfg->cpu_mask[i])
+			(void)io_wq_node_cpu_affinity(wq, node, i,
+						      cfg->cpu_mask[i]);
+		prev[i] = cfg->max_workers[i];
+	}
+	(void)io_wq_node_max_workers(wq, node, prev);
+}
+
+static void io_iowq_node_cfg_apply_all(struct io_ring_ctx *ctx,
+				       struct io_wq *wq)
+	__must_hold(&ctx->uring_lock)
+{
+	int prev[2];
+	int node;
+
+	if (!ctx->iowq_node_cfg || !wq)
+		return;
+	for_each_node(node)
+		io_iowq_node_cfg_apply(ctx, wq, node, prev);
+}
+
 static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 {
 	io_sq_thread_finish(ctx);
@@ -9414,6 +10274,8 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 	io_destroy_buffers(ctx);
 	if (ctx->sq_creds)
 		put_cred(ctx->sq_creds);
+	if (ctx->submitter_task)
+		put_task_struct(ctx->submitter_task);
 
 	/* there are no registered resources left, nobody uses it */
 	if (ctx->rsrc_node)
@@ -9448,6 +10310,7 @@ static void io_ring_ctx_free(struct io_ring_ctx *ctx)
 		io_wq_put_hash(ctx->hash_map);
 	kfree(ctx->cancel_hash);
 	kfree(ctx->dummy_ubuf);
+	io_iowq_node_cfg_free(ctx->iowq_node_cfg);
 	kfree(ctx);
 }
 
@@ -9478,7 +10341,8 @@ static __poll_t io_uring_poll(struct file *file, poll_table *wait)
 	 * Users may get EPOLLIN meanwhile seeing nothing in cqring, this
 	 * pushs them to do the flush.
 	 */
-	if (io_cqring_events(ctx) || test_bit(0, &ctx->check_cq_overflow))
+	if (io_cqring_events(ctx) || test_bit(0, &ctx->check_cq_overflow) ||
+	    !llist_empty(&ctx->work_llist))
 		mask |= EPOLLIN | EPOLLRDNORM;
 
 	return mask;
@@ -9778,6 +10642,7 @@ static void io_uring_try_cancel_requests(struct io_ring_ctx *ctx,
 		ret |= io_kill_timeouts(ctx, task, cancel_all);
 		if (task)
 			ret |= io_run_task_work();
+		ret |= io_flush_local_work(ctx);
 		if (!ret)
 			break;
 		cond_resched();
@@ -9821,6 +10686,7 @@ static int __io_uring_add_tctx_node(struct io_ring_ctx *ctx)
 
 		mutex_lock(&ctx->uring_lock);
 		list_add(&node->ctx_node, &ctx->tctx_list);
+		io_iowq_node_cfg_apply_all(ctx, tctx->io_wq);
 		mutex_unlock(&ctx->uring_lock);
 	}
 	tctx->last = ctx;
@@ -9961,8 +10827,25 @@ static void io_uring_cancel_generic(bool cancel_all, struct io_sq_data *sqd)
 	}
 }
 
+/*
+ * Drop the ring files registered by this task, called on exit and exec.
+ */
+static void io_uring_unreg_ringfd(void)
+{
+	struct io_uring_task *tctx = current->io_uring;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (tctx->registered_rings[i]) {
+			fput(tctx->registered_rings[i]);
+			tctx->registered_rings[i] = NULL;
+		}
+	}
+}
+
 void __io_uring_cancel(bool cancel_all)
 {
+	io_uring_unreg_ringfd();
 	io_uring_cancel_generic(cancel_all, NULL);
 }
 
@@ -10100,10 +10983,25 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	io_run_task_work();
 
 	if (unlikely(flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
-			       IORING_ENTER_SQ_WAIT | IORING_ENTER_EXT_ARG)))
+			       IORING_ENTER_SQ_WAIT | IORING_ENTER_EXT_ARG |
+			       IORING_ENTER_REGISTERED_RING)))
 		return -EINVAL;
 
-	f = fdget(fd);
+	/*
+	 * Ring fd has been registered via IORING_REGISTER_RING_FDS, we
+	 * need only dereference our task private array to find it.
+	 */
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_task *tctx = current->io_uring;
+
+		if (unlikely(!tctx || fd >= IO_RINGFD_REG_MAX))
+			return -EINVAL;
+		fd = array_index_nospec(fd, IO_RINGFD_REG_MAX);
+		f.file = tctx->registered_rings[fd];
+		f.flags = 0;
+	} else {
+		f = fdget(fd);
+	}
 	if (unlikely(!f.file))
 		return -EBADF;
 
@@ -10119,6 +11017,9 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	ret = -EBADFD;
 	if (unlikely(ctx->flags & IORING_SETUP_R_DISABLED))
 		goto out;
+	ret = -EEXIST;
+	if (ctx->submitter_task && ctx->submitter_task != current)
+		goto out;
 
 	/*
 	 * For SQ polling, the thread will do all submissions and completions.
@@ -10179,7 +11080,8 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 out:
 	percpu_ref_put(&ctx->refs);
 out_fput:
-	fdput(f);
+	if (!(flags & IORING_ENTER_REGISTERED_RING))
+		fdput(f);
 	return submitted ? submitted : ret;
 }
 
@@ -10332,7 +11234,10 @@ static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
 	rings->sq_ring_entries = p->sq_entries;
 	rings->cq_ring_entries = p->cq_entries;
 
-	size = array_size(sizeof(struct io_uring_sqe), p->sq_entries);
+	if (p->flags & IORING_SETUP_SQE128)
+		size = array_size(2 * sizeof(struct io_uring_sqe), p->sq_entries);
+	else
+		size = array_size(sizeof(struct io_uring_sqe), p->sq_entries);
 	if (size == SIZE_MAX) {
 		io_mem_free(ctx->rings);
 		ctx->rings = NULL;
@@ -10447,6 +11352,10 @@ static int io_uring_create(unsigned entries, struct io_uring_params *p,
 	ctx->compat = in_compat_syscall();
 	if (!capable(CAP_IPC_LOCK))
 		ctx->user = get_uid(current_user());
+	/* a disabled ring belongs to whoever enables it */
+	if ((ctx->flags & IORING_SETUP_SINGLE_ISSUER) &&
+	    !(ctx->flags & IORING_SETUP_R_DISABLED))
+		ctx->submitter_task = get_task_struct(current);
 
 	/*
 	 * This is just grabbed for accounting purposes. When a process exits,
@@ -10544,8 +11453,18 @@ static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
 	if (p.flags & ~(IORING_SETUP_IOPOLL | IORING_SETUP_SQPOLL |
 			IORING_SETUP_SQ_AFF | IORING_SETUP_CQSIZE |
 			IORING_SETUP_CLAMP | IORING_SETUP_ATTACH_WQ |
-			IORING_SETUP_R_DISABLED))
+			IORING_SETUP_R_DISABLED | IORING_SETUP_SQE128 |
+			IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN))
 		return -EINVAL;
+	/*
+	 * Deferred task_work is only run by the submitter, so there must be
+	 * exactly one, and it can't be an SQPOLL thread that never waits.
+	 */
+	if (p.flags & IORING_SETUP_DEFER_TASKRUN) {
+		if (!(p.flags & IORING_SETUP_SINGLE_ISSUER) ||
+		    (p.flags & IORING_SETUP_SQPOLL))
+			return -EINVAL;
+	}
 
 	return  io_uring_create(entries, &p, params);
 }
@@ -10690,6 +11609,9 @@ static int io_register_enable_rings(struct io_ring_ctx *ctx)
 	if (ctx->restrictions.registered)
 		ctx->restricted = 1;
 
+	if ((ctx->flags & IORING_SETUP_SINGLE_ISSUER) && !ctx->submitter_task)
+		ctx->submitter_task = get_task_struct(current);
+
 	ctx->flags &= ~IORING_SETUP_R_DISABLED;
 	if (ctx->sq_data && wq_has_sleeper(&ctx->sq_data->wait))
 		wake_up(&ctx->sq_data->wait);
@@ -10773,41 +11695,171 @@ static int io_register_rsrc(struct io_ring_ctx *ctx, void __user *arg,
 	return -EINVAL;
 }
 
-static int io_register_iowq_aff(struct io_ring_ctx *ctx, void __user *arg,
-				unsigned len)
+static int io_ring_add_registered_fd(struct io_uring_task *tctx, int fd,
+				     int start, int end)
+{
+	struct file *file;
+	int offset;
+
+	for (offset = start; offset < end; offset++) {
+		offset = array_index_nospec(offset, IO_RINGFD_REG_MAX);
+		if (tctx->registered_rings[offset])
+			continue;
+
+		file = fget(fd);
+		if (!file)
+			return -EBADF;
+		if (file->f_op != &io_uring_fops) {
+			fput(file);
+			return -EOPNOTSUPP;
+		}
+		tctx->registered_rings[offset] = file;
+		return offset;
+	}
+
+	return -EBUSY;
+}
+
+/*
+ * Register a ring fd to avoid fdget/fdput for each io_uring_enter()
+ * invocation. User passes in an array of struct io_uring_rsrc_update
+ * with ->data set to the ring_fd, and ->offset given for the desired
+ * index. If no index is desired, application may set ->offset == -1U
+ * and we'll find an available index. Returns number of entries
+ * successfully processed, or < 0 on error if none were processed.
+ */
+static int io_ringfd_register(struct io_ring_ctx *ctx, void __user *__arg,
+			      unsigned nr_args)
+	__must_hold(&ctx->uring_lock)
 {
+	struct io_uring_rsrc_update __user *arg = __arg;
+	struct io_uring_rsrc_update reg;
+	struct io_uring_task *tctx;
+	int ret, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	mutex_unlock(&ctx->uring_lock);
+	ret = io_uring_add_tctx_node(ctx);
+	mutex_lock(&ctx->uring_lock);
+	if (ret)
+		return ret;
+
+	tctx = current->io_uring;
+	for (i = 0; i < nr_args; i++) {
+		int start, end;
+
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = reg.offset;
+			end = start + 1;
+		}
+
+		ret = io_ring_add_registered_fd(tctx, reg.data, start, end);
+		if (ret < 0)
+			break;
+
+		reg.offset = ret;
+		if (copy_to_user(&arg[i], &reg, sizeof(reg))) {
+			fput(tctx->registered_rings[reg.offset]);
+			tctx->registered_rings[reg.offset] = NULL;
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_ringfd_unregister(struct io_ring_ctx *ctx, void __user *__arg,
+				unsigned nr_args)
+{
+	struct io_uring_rsrc_update __user *arg = __arg;
 	struct io_uring_task *tctx = current->io_uring;
-	cpumask_var_t new_mask;
-	int ret;
+	struct io_uring_rsrc_update reg;
+	int ret = 0, i;
 
-	if (!tctx || !tctx->io_wq)
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
 		return -EINVAL;
+	if (!tctx)
+		return 0;
 
-	if (!alloc_cpumask_var(&new_mask, GFP_KERNEL))
-		return -ENOMEM;
+	for (i = 0; i < nr_args; i++) {
+		if (copy_from_user(&reg, &arg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		reg.offset = array_index_nospec(reg.offset, IO_RINGFD_REG_MAX);
+		if (tctx->registered_rings[reg.offset]) {
+			fput(tctx->registered_rings[reg.offset]);
+			tctx->registered_rings[reg.offset] = NULL;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_copy_cpumask_from_user(cpumask_var_t mask,
+				     const void __user *arg, unsigned len)
+{
+	int ret;
 
-	cpumask_clear(new_mask);
+	cpumask_clear(mask);
 	if (len > cpumask_size())
 		len = cpumask_size();
 
 #ifdef CONFIG_COMPAT
 	if (in_compat_syscall()) {
-		ret = compat_get_bitmap(cpumask_bits(new_mask),
+		ret = compat_get_bitmap(cpumask_bits(mask),
 					(const compat_ulong_t __user *)arg,
 					len * 8 /* CHAR_BIT */);
 	} else {
-		ret = copy_from_user(new_mask, arg, len);
+		ret = copy_from_user(mask, arg, len);
 	}
 #else
-	ret = copy_from_user(new_mask, arg, len);
+	ret = copy_from_user(mask, arg, len);
 #endif
 
-	if (ret) {
-		free_cpumask_var(new_mask);
-		return -EFAULT;
-	}
+	return ret ? -EFAULT : 0;
+}
 
-	ret = io_wq_cpu_affinity(tctx->io_wq, new_mask);
+static int io_register_iowq_aff(struct io_ring_ctx *ctx, void __user *arg,
+				unsigned len)
+{
+	struct io_uring_task *tctx = current->io_uring;
+	cpumask_var_t new_mask;
+	int ret;
+
+	if (!tctx || !tctx->io_wq)
+		return -EINVAL;
+
+	if (!alloc_cpumask_var(&new_mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = io_copy_cpumask_from_user(new_mask, arg, len);
+	if (!ret)
+		ret = io_wq_cpu_affinity(tctx->io_wq, new_mask);
 	free_cpumask_var(new_mask);
 	return ret;
 }
@@ -10906,6 +11958,257 @@ static int io_register_iowq_max_workers(struct io_ring_ctx *ctx,
 	return ret;
 }
 
+/*
+ * Like IORING_REGISTER_IOWQ_MAX_WORKERS, the settings are kept in the ctx and
+ * applied to the io-wq of every task using the ring, or of the SQPOLL thread.
+ * The whole array is checked before any of it is applied.
+ */
+static int io_register_iowq_node(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_uring_iowq_node __user *uarg = arg;
+	struct io_iowq_node_cfg *new_cfg, *old_cfg;
+	struct io_uring_iowq_node *regs;
+	struct io_uring_task *tctx = NULL;
+	struct io_sq_data *sqd = NULL;
+	struct io_tctx_node *node;
+	int new_count[2];
+	int i, j, ret;
+
+	if (!nr_args || nr_args > nr_node_ids)
+		return -EINVAL;
+
+	regs = memdup_user(uarg, array_size(nr_args, sizeof(*regs)));
+	if (IS_ERR(regs))
+		return PTR_ERR(regs);
+
+	ret = -ENOMEM;
+	new_cfg = kcalloc(nr_node_ids, sizeof(*new_cfg), GFP_KERNEL);
+	if (!new_cfg)
+		goto out;
+	old_cfg = ctx->iowq_node_cfg;
+	for (i = 0; old_cfg && i < nr_node_ids; i++) {
+		for (j = 0; j < ARRAY_SIZE(new_cfg->cpu_mask); j++) {
+			new_cfg[i].max_workers[j] = old_cfg[i].max_workers[j];
+			if (!old_cfg[i].cpu_mask[j])
+				continue;
+			new_cfg[i].cpu_mask[j] = kmemdup(old_cfg[i].cpu_mask[j],
+							 cpumask_size(),
+							 GFP_KERNEL);
+			if (!new_cfg[i].cpu_mask[j])
+				goto out;
+		}
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		struct io_uring_iowq_node *reg = &regs[i];
+		struct io_iowq_node_cfg *cfg;
+
+		ret = -EINVAL;
+		if (reg->resv[0] || reg->resv[1])
+			goto out;
+		if (reg->node >= nr_node_ids || !node_possible(reg->node))
+			goto out;
+		if (reg->max_workers[0] > INT_MAX ||
+		    reg->max_workers[1] > INT_MAX)
+			goto out;
+		if ((reg->cpu_mask[0] || reg->cpu_mask[1]) &&
+		    !reg->cpu_mask_len)
+			goto out;
+
+		cfg = &new_cfg[reg->node];
+		for (j = 0; j < ARRAY_SIZE(reg->cpu_mask); j++) {
+			if (reg->max_workers[j])
+				cfg->max_workers[j] = reg->max_workers[j];
+			if (!reg->cpu_mask[j])
+				continue;
+			ret = -ENOMEM;
+			if (!cfg->cpu_mask[j])
+				cfg->cpu_mask[j] = kmalloc(cpumask_size(),
+							   GFP_KERNEL);
+			if (!cfg->cpu_mask[j])
+				goto out;
+			ret = io_copy_cpumask_from_user(cfg->cpu_mask[j],
+					u64_to_user_ptr(reg->cpu_mask[j]),
+					reg->cpu_mask_len);
+			if (ret)
+				goto out;
+			ret = -EINVAL;
+			if (!cpumask_intersects(cfg->cpu_mask[j],
+						cpu_online_mask))
+				goto out;
+		}
+	}
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		sqd = ctx->sq_data;
+		if (sqd) {
+			/* see io_register_iowq_max_workers() */
+			refcount_inc(&sqd->refs);
+			mutex_unlock(&ctx->uring_lock);
+			mutex_lock(&sqd->lock);
+			mutex_lock(&ctx->uring_lock);
+			if (sqd->thread)
+				tctx = sqd->thread->io_uring;
+		}
+	} else {
+		tctx = current->io_uring;
+	}
+
+	swap(ctx->iowq_node_cfg, new_cfg);
+
+	for (i = 0; i < nr_args; i++) {
+		memset(new_count, 0, sizeof(new_count));
+		if (tctx && tctx->io_wq)
+			io_iowq_node_cfg_apply(ctx, tctx->io_wq, regs[i].node,
+					       new_count);
+		for (j = 0; j < ARRAY_SIZE(new_count); j++)
+			regs[i].max_workers[j] = new_count[j];
+	}
+
+	if (sqd) {
+		mutex_unlock(&sqd->lock);
+		io_put_sq_data(sqd);
+	} else {
+		/* SQPOLL only has its own task, else propagate to all users */
+		list_for_each_entry(node, &ctx->tctx_list, ctx_node) {
+			struct io_uring_task *tctx = node->task->io_uring;
+
+			if (WARN_ON_ONCE(!tctx->io_wq))
+				continue;
+			for (i = 0; i < nr_args; i++)
+				io_iowq_node_cfg_apply(ctx, tctx->io_wq,
+						       regs[i].node, new_count);
+		}
+	}
+
+	ret = 0;
+	for (i = 0; i < nr_args; i++) {
+		if (copy_to_user(&uarg[i].max_workers, regs[i].max_workers,
+				 sizeof(regs[i].max_workers))) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+out:
+	io_iowq_node_cfg_free(new_cfg);
+	kfree(regs);
+	return ret;
+}
+
+static int io_register_iowq_stats(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct io_uring_iowq_stats __user *ustats = arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_iowq_stats stats;
+	int i, ret;
+
+	if (!tctx || !tctx->io_wq)
+		return -EINVAL;
+	if (nr_args > nr_node_ids)
+		return -EINVAL;
+
+	for (i = 0; i < nr_args; i++) {
+		if (copy_from_user(&stats, &ustats[i], sizeof(stats)))
+			return -EFAULT;
+		if (stats.resv)
+			return -EINVAL;
+		ret = io_wq_node_stats(tctx->io_wq, stats.node, &stats);
+		if (ret)
+			return ret;
+		if (copy_to_user(&ustats[i], &stats, sizeof(stats)))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static int io_register_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+	unsigned long size;
+	int ret, nr_pages;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+	if (!reg.ring_addr || (reg.ring_addr & ~PAGE_MASK))
+		return -EINVAL;
+	/* head and tail are u16, the ring can't have more entries than that */
+	if (!is_power_of_2(reg.ring_entries) || reg.ring_entries > (1U << 15))
+		return -EINVAL;
+	if (xa_load(&ctx->io_buf_rings, reg.bgid) ||
+	    xa_load(&ctx->io_buffers, reg.bgid))
+		return -EEXIST;
+
+	bl = kzalloc(sizeof(*bl), GFP_KERNEL_ACCOUNT);
+	if (!bl)
+		return -ENOMEM;
+
+	size = (unsigned long)reg.ring_entries * sizeof(struct io_uring_buf);
+	nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+	bl->pages = kvmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!bl->pages) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	ret = pin_user_pages_fast(reg.ring_addr, nr_pages,
+				  FOLL_WRITE | FOLL_LONGTERM, bl->pages);
+	if (ret != nr_pages) {
+		if (ret > 0)
+			unpin_user_pages(bl->pages, ret);
+		ret = ret < 0 ? ret : -EFAULT;
+		goto err_free;
+	}
+	bl->nr_pages = nr_pages;
+
+	bl->br = vmap(bl->pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!bl->br) {
+		ret = -ENOMEM;
+		goto err_unpin;
+	}
+	bl->mask = reg.ring_entries - 1;
+
+	ret = xa_insert(&ctx->io_buf_rings, reg.bgid, bl, GFP_KERNEL_ACCOUNT);
+	if (!ret)
+		return 0;
+
+	vunmap(bl->br);
+err_unpin:
+	unpin_user_pages(bl->pages, nr_pages);
+err_free:
+	kvfree(bl->pages);
+	kfree(bl);
+	return ret;
+}
+
+static int io_unregister_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+	__must_hold(&ctx->uring_lock)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *bl;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+
+	/*
+	 * Requests holding a ring buffer only keep its address and bid, so the
+	 * ring can go away under them.
+	 */
+	bl = xa_erase(&ctx->io_buf_rings, reg.bgid);
+	if (!bl)
+		return -ENOENT;
+	io_free_buffer_ring(bl);
+	return 0;
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -10924,6 +12227,12 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_IOWQ_AFF:
 	case IORING_UNREGISTER_IOWQ_AFF:
 	case IORING_REGISTER_IOWQ_MAX_WORKERS:
+	case IORING_REGISTER_PBUF_RING:
+	case IORING_UNREGISTER_PBUF_RING:
+	case IORING_REGISTER_IOWQ_NODE:
+	case IORING_REGISTER_IOWQ_STATS:
+	case IORING_REGISTER_RING_FDS:
+	case IORING_UNREGISTER_RING_FDS:
 		return false;
 	default:
 		return true;
@@ -10945,10 +12254,10 @@ static int io_ctx_quiesce(struct io_ring_ctx *ctx)
 	 */
 	mutex_unlock(&ctx->uring_lock);
 	do {
-		ret = wait_for_completion_interruptible(&ctx->ref_comp);
+		ret = io_quiesce_wait(ctx, &ctx->ref_comp);
 		if (!ret)
 			break;
-		ret = io_run_task_work_sig();
+		ret = io_run_task_work_sig(ctx);
 	} while (ret >= 0);
 	mutex_lock(&ctx->uring_lock);
 
@@ -10972,6 +12281,9 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 	if (percpu_ref_is_dying(&ctx->refs))
 		return -ENXIO;
 
+	if (ctx->submitter_task && ctx->submitter_task != current)
+		return -EEXIST;
+
 	if (ctx->restricted) {
 		opcode = array_index_nospec(opcode, IORING_REGISTER_LAST);
 		if (!test_bit(opcode, ctx->restrictions.register_op))
@@ -11084,6 +12396,36 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_register_iowq_max_workers(ctx, arg);
 		break;
+	case IORING_REGISTER_RING_FDS:
+		ret = io_ringfd_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_RING_FDS:
+		ret = io_ringfd_unregister(ctx, arg, nr_args);
+		break;
+	case IORING_REGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_pbuf_ring(ctx, arg);
+		break;
+	case IORING_UNREGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_unregister_pbuf_ring(ctx, arg);
+		break;
+	case IORING_REGISTER_IOWQ_NODE:
+		ret = -EINVAL;
+		if (!arg || !nr_args)
+			break;
+		ret = io_register_iowq_node(ctx, arg, nr_args);
+		break;
+	case IORING_REGISTER_IOWQ_STATS:
+		ret = -EINVAL;
+		if (!arg || !nr_args)
+			break;
+		ret = io_register_iowq_stats(ctx, arg, nr_args);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -11145,6 +12487,7 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(4,  __s32,  fd);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  off);
 	BUILD_BUG_SQE_ELEM(8,  __u64,  addr2);
+	BUILD_BUG_SQE_ELEM(8,  __u32,  cmd_op);
 	BUILD_BUG_SQE_ELEM(16, __u64,  addr);
 	BUILD_BUG_SQE_ELEM(16, __u64,  splice_off_in);
 	BUILD_BUG_SQE_ELEM(24, __u32,  len);
@@ -11163,12 +12506,17 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(28, __u32,  statx_flags);
 	BUILD_BUG_SQE_ELEM(28, __u32,  fadvise_advice);
 	BUILD_BUG_SQE_ELEM(28, __u32,  splice_flags);
+	BUILD_BUG_SQE_ELEM(28, __u32,  uring_cmd_flags);
 	BUILD_BUG_SQE_ELEM(32, __u64,  user_data);
 	BUILD_BUG_SQE_ELEM(40, __u16,  buf_index);
 	BUILD_BUG_SQE_ELEM(40, __u16,  buf_group);
 	BUILD_BUG_SQE_ELEM(42, __u16,  personality);
 	BUILD_BUG_SQE_ELEM(44, __s32,  splice_fd_in);
 	BUILD_BUG_SQE_ELEM(44, __u32,  file_index);
+	BUILD_BUG_SQE_ELEM(48, __u8,   cmd[0]);
+
+	/* io_uring_cmd is a member of the io_kiocb per-op union */
+	BUILD_BUG_ON(sizeof(struct io_uring_cmd) > sizeof(struct io_rw));
 
 	BUILD_BUG_ON(sizeof(struct io_uring_files_update) !=
 		     sizeof(struct io_uring_rsrc_update));
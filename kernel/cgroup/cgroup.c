@@ -5268,11 +5268,12 @@ static void css_free_rwork_fn(struct work_struct *work)
 			 * We get a ref to the parent, and put the ref when
 			 * this cgroup is being freed, so it's guaranteed
 			 * that the parent won't be destroyed before its
-			 * children.
+			 * children. psi hands its last stall times to the
+			 * parent, free it first.
 			 */
+			psi_cgroup_free(cgrp);
 			cgroup_put(cgroup_parent(cgrp));
 			kernfs_put(cgrp->kn);
-			psi_cgroup_free(cgrp);
 			cgroup_rstat_exit(cgrp);
 			kfree(cgrp);
 		} else {
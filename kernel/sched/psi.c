@@ -415,7 +415,7 @@ static bool test_fine_grained_stat(unsigned int *stat_tasks,
 }
 
 static void psi_group_stat_change(struct psi_group *group, int cpu,
-				  int clear, int set)
+				  int clear, int set, bool leaf)
 {
 	int t;
 	u32 state_mask = 0;
@@ -424,6 +424,23 @@ static void psi_group_stat_change(struct psi_group *group, int cpu,
 	struct psi_group_cpu *groupc = per_cpu_ptr(group->pcpu, cpu);
 	struct psi_group_stat_cpu *ext_groupc = per_cpu_ptr(psi_ext->pcpu, cpu);
 
+	/* Only the task's own group, the ancestors catch up in psi_stat_flush() */
+	if (IS_ENABLED(CONFIG_PSI_FINE_GRAINED_LAZY) && !leaf)
+		return;
+
+	/*
+	 * Most task changes in most groups don't involve any fine grained
+	 * stall: no stat counts change, none are held (an empty state_mask
+	 * means all the stat task counts are zero), and the current task
+	 * isn't in a typed memstall. The new state would be empty as well
+	 * and there is no time to record, so skip the update. This keeps
+	 * the cost of deep hierarchies on context switches down to the
+	 * regular psi_group_change() work.
+	 */
+	if (!clear && !set && !ext_groupc->state_mask &&
+	    !((groupc->state_mask & PSI_ONCPU) && cpu_curr(cpu)->memstall_type))
+		return;
+
 	write_seqcount_begin(&groupc->seq);
 	record_stat_times(psi_ext, cpu);
 
@@ -488,6 +505,10 @@ static void get_recent_stat_times(struct psi_group *group, int cpu,
 	for (s = 0; s < NR_PSI_STAT_STATES; s++) {
 		if (ext_groupc->state_mask & (1 << s))
 			times[s] += ext_groupc->times_delta;
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+		if (s < PSI_CPU_CFS_BANDWIDTH_FULL)
+			times[s] += READ_ONCE(ext_groupc->child_times[s]);
+#endif
 		delta = times[s] - ext_groupc->times_prev[aggregator][s];
 		ext_groupc->times_prev[aggregator][s] = times[s];
 		times[s] = delta;
@@ -509,9 +530,136 @@ static void update_stat_averages(struct psi_group_ext *psi_ext,
 		calc_avgs(psi_ext->avg[s], missed_periods, sample, period);
 	}
 }
+
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+/*
+ * With lazy propagation only the group a task is in tracks the fine grained
+ * memstall states. Ancestors are caught up when their times are collected:
+ * the descendants are walked children first, and each group adds the growth
+ * of its subtree times since the last flush to its parent's child_times.
+ *
+ * A parent's times are thus the sum of its children's. That is more than
+ * the real SOME time when two children stall on a cpu at the same time,
+ * and FULL ignores the other children's running tasks. collect_percpu_times()
+ * caps each cpu at the non-idle time of the group.
+ */
+static DEFINE_MUTEX(psi_stat_flush_mutex);
+
+/* The psi group of the parent cgroup, mirrors iterate_groups() */
+static struct psi_group *psi_stat_parent(struct cgroup *cgroup)
+{
+	struct cgroup *parent = cgroup_parent(cgroup);
+
+	return cgroup_parent(parent) ? cgroup_psi(parent) : &psi_system;
+}
+
+/* The cgroup whose descendants feed @group, NULL if there are none */
+static struct cgroup *psi_stat_cgroup(struct psi_group *group)
+{
+	if (group != &psi_system)
+		return to_psi_group_ext(group)->cgroup;
+#ifdef CONFIG_PSI_CGROUP_V1
+#ifdef CONFIG_CGROUP_CPUACCT
+	if (!cgroup_subsys_on_dfl(cpuacct_cgrp_subsys)) {
+		if (static_branch_likely(&psi_v1_disabled))
+			return NULL;
+		return &cpuacct_cgrp_subsys.root->cgrp;
+	}
+#else
+	return NULL;
+#endif
+#endif
+	return &cgrp_dfl_root.cgrp;
+}
+
+/* Own times of @group on @cpu, in flight ones included, plus its children's */
+static void psi_stat_subtree_times(struct psi_group *group, int cpu,
+				   u32 *times)
+{
+	struct psi_group_ext *psi_ext = to_psi_group_ext(group);
+	struct psi_group_stat_cpu *ext_groupc = per_cpu_ptr(psi_ext->pcpu, cpu);
+	struct psi_group_cpu *groupc = per_cpu_ptr(group->pcpu, cpu);
+	enum psi_stat_states s;
+	u64 now, state_start;
+	unsigned int seq;
+	u32 state_mask;
+
+	do {
+		seq = read_seqcount_begin(&groupc->seq);
+		now = cpu_clock(cpu);
+		memcpy(times, ext_groupc->times, sizeof(ext_groupc->times));
+		state_mask = ext_groupc->state_mask;
+		state_start = groupc->state_start;
+	} while (read_seqcount_retry(&groupc->seq, seq));
+
+	for (s = 0; s < PSI_CPU_CFS_BANDWIDTH_FULL; s++) {
+		if (state_mask & (1 << s))
+			times[s] += now - state_start;
+		times[s] += ext_groupc->child_times[s];
+	}
+}
+
+static void psi_stat_flush_one(struct psi_group *group,
+			       struct psi_group *parent)
+{
+	struct psi_group_ext *psi_ext = to_psi_group_ext(group);
+	struct psi_group_ext *parent_ext = to_psi_group_ext(parent);
+	u32 times[NR_PSI_STAT_STATES];
+	enum psi_stat_states s;
+	int cpu;
+
+	lockdep_assert_held(&psi_stat_flush_mutex);
+
+	for_each_possible_cpu(cpu) {
+		struct psi_group_stat_cpu *ext_groupc;
+		struct psi_group_stat_cpu *parentc;
+
+		ext_groupc = per_cpu_ptr(psi_ext->pcpu, cpu);
+		parentc = per_cpu_ptr(parent_ext->pcpu, cpu);
+		psi_stat_subtree_times(group, cpu, times);
+		for (s = 0; s < PSI_CPU_CFS_BANDWIDTH_FULL; s++) {
+			WRITE_ONCE(parentc->child_times[s],
+				   parentc->child_times[s] + times[s] -
+				   ext_groupc->flushed_times[s]);
+			ext_groupc->flushed_times[s] = times[s];
+		}
+	}
+}
+
+static void psi_stat_flush(struct psi_group *group)
+{
+	struct cgroup *cgroup = psi_stat_cgroup(group);
+	struct cgroup_subsys_state *css;
+
+	if (!cgroup)
+		return;
+
+	mutex_lock(&psi_stat_flush_mutex);
+	rcu_read_lock();
+	css_for_each_descendant_post(css, &cgroup->self) {
+		if (css == &cgroup->self)
+			continue;
+		psi_stat_flush_one(cgroup_psi(css->cgroup),
+				   psi_stat_parent(css->cgroup));
+	}
+	rcu_read_unlock();
+	mutex_unlock(&psi_stat_flush_mutex);
+}
+
+/* Hand what a dying group hasn't flushed yet to its parent */
+static void psi_stat_cgroup_free(struct cgroup *cgroup)
+{
+	mutex_lock(&psi_stat_flush_mutex);
+	psi_stat_flush_one(cgroup->psi, psi_stat_parent(cgroup));
+	mutex_unlock(&psi_stat_flush_mutex);
+}
+#else
+static inline void psi_stat_flush(struct psi_group *group) {}
+static inline void psi_stat_cgroup_free(struct cgroup *cgroup) {}
+#endif
 #else
 static inline void psi_group_stat_change(struct psi_group *group, int cpu,
-					 int clear, int set) {}
+					 int clear, int set, bool leaf) {}
 static inline void update_psi_stat_delta(struct psi_group *group, int cpu,
 					 u64 now) {}
 static inline void psi_stat_flags_change(struct task_struct *task,
@@ -584,6 +732,12 @@ static void collect_percpu_times(struct psi_group *group,
 	int cpu;
 	int s;
 
+#ifdef CONFIG_PSI_FINE_GRAINED
+	/* fine grained stats have no triggers, catch up for the averages */
+	if (aggregator == PSI_AVGS)
+		psi_stat_flush(group);
+#endif
+
 	/*
 	 * Collect the per-cpu time buckets and average them into a
 	 * single time sample that is normalized to wallclock time.
@@ -608,8 +762,15 @@ static void collect_percpu_times(struct psi_group *group,
 			deltas[s] += (u64)times[s] * nonidle;
 #ifdef CONFIG_PSI_FINE_GRAINED
 		get_recent_stat_times(group, cpu, aggregator, stat_times);
-		for (s = 0; s < NR_PSI_STAT_STATES; s++)
+		for (s = 0; s < NR_PSI_STAT_STATES; s++) {
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+			/* summed up from the children, see psi_stat_flush() */
+			if (s < PSI_CPU_CFS_BANDWIDTH_FULL)
+				stat_times[s] = min(stat_times[s],
+						    times[PSI_NONIDLE]);
+#endif
 			stat_delta[s] += (u64)stat_times[s] * nonidle;
+		}
 #endif
 	}
 
@@ -1110,6 +1271,7 @@ void psi_task_change(struct task_struct *task, int clear, int set)
 	int cpu = task_cpu(task);
 	struct psi_group *group;
 	void *iter = NULL;
+	bool leaf = true;
 	u64 now;
 	int stat_set = 0;
 	int stat_clear = 0;
@@ -1125,7 +1287,8 @@ void psi_task_change(struct task_struct *task, int clear, int set)
 	while ((group = iterate_groups(task, &iter))) {
 		update_psi_stat_delta(group, cpu, now);
 		psi_group_change(group, cpu, clear, set, now, true);
-		psi_group_stat_change(group, cpu, stat_clear, stat_set);
+		psi_group_stat_change(group, cpu, stat_clear, stat_set, leaf);
+		leaf = false;
 	}
 }
 
@@ -1136,6 +1299,7 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 	int cpu = task_cpu(prev);
 	void *iter;
 	u64 now = cpu_clock(cpu);
+	bool leaf;
 
 	if (next->pid) {
 		update_throttle_type(next, cpu, true);
@@ -1146,6 +1310,7 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 		 * TSK_ONCPU bit set, and we can stop the iteration there.
 		 */
 		iter = NULL;
+		leaf = true;
 		while ((group = iterate_groups(next, &iter))) {
 			if (per_cpu_ptr(group->pcpu, cpu)->state_mask &
 			    PSI_ONCPU) {
@@ -1155,7 +1320,8 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 
 			update_psi_stat_delta(group, cpu, now);
 			psi_group_change(group, cpu, 0, TSK_ONCPU, now, true);
-			psi_group_stat_change(group, cpu, 0, 0);
+			psi_group_stat_change(group, cpu, 0, 0, leaf);
+			leaf = false;
 		}
 	}
 
@@ -1195,10 +1361,13 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 		psi_stat_flags_change(prev, &stat_set, &stat_clear, set, clear);
 
 		iter = NULL;
+		leaf = true;
 		while ((group = iterate_groups(prev, &iter)) && group != common) {
 			update_psi_stat_delta(group, cpu, now);
 			psi_group_change(group, cpu, clear, set, now, wake_clock);
-			psi_group_stat_change(group, cpu, stat_clear, stat_set);
+			psi_group_stat_change(group, cpu, stat_clear, stat_set,
+					      leaf);
+			leaf = false;
 		}
 #ifdef CONFIG_PSI_FINE_GRAINED
 		if (next->memstall_type != prev->memstall_type)
@@ -1217,7 +1386,8 @@ void psi_task_switch(struct task_struct *prev, struct task_struct *next,
 				update_psi_stat_delta(group, cpu, now);
 				psi_group_change(group, cpu, clear, set, now, wake_clock);
 				psi_group_stat_change(group, cpu, stat_clear,
-						      stat_set);
+						      stat_set, leaf);
+				leaf = false;
 			}
 		}
 	}
@@ -1350,6 +1520,9 @@ int psi_cgroup_alloc(struct cgroup *cgroup)
 		kfree(psi_ext);
 		return -ENOMEM;
 	}
+#ifdef CONFIG_PSI_FINE_GRAINED_LAZY
+	psi_ext->cgroup = cgroup;
+#endif
 	cgroup->psi = &psi_ext->psi;
 #else
 	cgroup->psi = kzalloc(sizeof(struct psi_group), GFP_KERNEL);
@@ -1377,6 +1550,9 @@ void psi_cgroup_free(struct cgroup *cgroup)
 		return;
 
 	cancel_delayed_work_sync(&cgroup->psi->avgs_work);
+#ifdef CONFIG_PSI_FINE_GRAINED
+	psi_stat_cgroup_free(cgroup);
+#endif
 	free_percpu(cgroup->psi->pcpu);
 	/* All triggers must be removed by now */
 	WARN_ONCE(cgroup->psi->poll_states, "psi: trigger leak\n");
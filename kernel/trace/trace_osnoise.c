@@ -22,6 +22,9 @@
 #include <linux/cpumask.h>
 #include <linux/delay.h>
 #include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/interrupt.h>
+#include <linux/sort.h>
 #include <uapi/linux/sched/types.h>
 #include <linux/sched.h>
 #include "trace.h"
@@ -277,6 +280,132 @@ static inline void osn_var_reset_all(void)
 	tlat_var_reset();
 }
 
+/*
+ * In-kernel histograms.
+ *
+ * Each CPU keeps a log-linear histogram (in ns) per noise source and per
+ * timerlat context, so the tracer can run as an always-on monitor without
+ * consuming the per-sample events. Values below 2^OSN_HIST_SUB_BITS get
+ * one bucket each, above that every power of two is split into
+ * 2^OSN_HIST_SUB_BITS linear buckets. Values of 2^OSN_HIST_MAX_SHIFT ns
+ * (~68 s) and above land in an extra overflow bucket.
+ */
+#define OSN_HIST_SUB_BITS	3
+#define OSN_HIST_SUB		(1 << OSN_HIST_SUB_BITS)
+#define OSN_HIST_MAX_SHIFT	36
+#define OSN_HIST_GROUPS		(OSN_HIST_MAX_SHIFT - OSN_HIST_SUB_BITS + 1)
+#define OSN_HIST_BUCKETS	(OSN_HIST_GROUPS * OSN_HIST_SUB)
+#define OSN_HIST_OVERFLOW	OSN_HIST_BUCKETS
+
+enum osn_hist_type {
+	OSN_HIST_NMI,
+	OSN_HIST_IRQ,
+	OSN_HIST_SOFTIRQ,
+	OSN_HIST_THREAD,
+	OSN_HIST_NOISE,
+	OSN_HIST_TIMERLAT_IRQ,
+	OSN_HIST_TIMERLAT_THREAD,
+	OSN_HIST_MAX,
+};
+
+static const char * const osn_hist_names[OSN_HIST_MAX] = {
+	[OSN_HIST_NMI]			= "nmi",
+	[OSN_HIST_IRQ]			= "irq",
+	[OSN_HIST_SOFTIRQ]		= "softirq",
+	[OSN_HIST_THREAD]		= "thread",
+	[OSN_HIST_NOISE]		= "noise",
+	[OSN_HIST_TIMERLAT_IRQ]		= "timerlat_irq",
+	[OSN_HIST_TIMERLAT_THREAD]	= "timerlat_thread",
+};
+
+struct osn_hist {
+	unsigned int	gen;
+	u64		count;
+	u64		sum;
+	u64		max;
+	u64		bucket[OSN_HIST_BUCKETS + 1];
+};
+
+struct osnoise_hists {
+	struct osn_hist	hist[OSN_HIST_MAX];
+};
+
+static struct osnoise_hists __percpu *osnoise_hists;
+
+/* Bumped by osn_hist_reset(), histograms of an older one are empty */
+static unsigned int osn_hist_gen;
+
+/*
+ * osn_hist_bucket - Return the histogram bucket of a value in ns
+ */
+static inline unsigned int osn_hist_bucket(u64 val)
+{
+	unsigned int shift;
+
+	if (val < OSN_HIST_SUB)
+		return val;
+
+	shift = fls64(val) - 1;
+	if (shift >= OSN_HIST_MAX_SHIFT)
+		return OSN_HIST_OVERFLOW;
+
+	return ((shift - OSN_HIST_SUB_BITS + 1) << OSN_HIST_SUB_BITS) |
+	       ((val >> (shift - OSN_HIST_SUB_BITS)) & (OSN_HIST_SUB - 1));
+}
+
+/*
+ * osn_hist_bucket_start - Return the lowest value of a histogram bucket
+ */
+static inline u64 osn_hist_bucket_start(unsigned int idx)
+{
+	unsigned int group = idx >> OSN_HIST_SUB_BITS;
+	u64 sub = idx & (OSN_HIST_SUB - 1);
+
+	if (!group)
+		return sub;
+
+	return (OSN_HIST_SUB + sub) << (group - 1);
+}
+
+/*
+ * osn_hist_add - Account a value in ns to this CPU's histogram of a type
+ *
+ * Each histogram is only written by one context on its CPU, which is also
+ * the one that clears it once osn_hist_gen moved on.
+ */
+static void osn_hist_add(enum osn_hist_type type, u64 val)
+{
+	struct osn_hist *hist;
+	unsigned int gen;
+
+	if (!osnoise_hists)
+		return;
+
+	hist = &this_cpu_ptr(osnoise_hists)->hist[type];
+	gen = READ_ONCE(osn_hist_gen);
+	if (unlikely(hist->gen != gen)) {
+		memset(hist, 0, sizeof(*hist));
+		hist->gen = gen;
+	}
+	hist->bucket[osn_hist_bucket(val)]++;
+	hist->count++;
+	hist->sum += val;
+	if (val > hist->max)
+		hist->max = val;
+}
+
+/*
+ * osn_hist_reset - Reset the histograms of all CPUs
+ *
+ * Nothing is cleared here, which would need an IPI to the possibly
+ * isolated CPUs being measured. Readers skip the histograms of an older
+ * generation, and each CPU clears them on its next update.
+ */
+static void osn_hist_reset(void)
+{
+	WRITE_ONCE(osn_hist_gen, osn_hist_gen + 1);
+}
+
 /*
  * Tells NMIs to call back to the osnoise tracer to record timestamps.
  */
@@ -322,6 +451,8 @@ static struct osnoise_data {
 	u64	sample_runtime;		/* active sampling portion of period */
 	u64	stop_tracing;		/* stop trace in the internal operation (loop/irq) */
 	u64	stop_tracing_total;	/* stop trace in the final operation (report/thread) */
+	u64	hist_only;		/* only update the histograms, no sample records */
+	u64	attribution;		/* attribute noise to its causes */
 #ifdef CONFIG_TIMERLAT_TRACER
 	u64	timerlat_period;	/* timerlat period */
 	u64	print_stack;		/* print IRQ stack if total > */
@@ -333,6 +464,8 @@ static struct osnoise_data {
 	.sample_runtime			= DEFAULT_SAMPLE_RUNTIME,
 	.stop_tracing			= 0,
 	.stop_tracing_total		= 0,
+	.hist_only			= 0,
+	.attribution			= 0,
 #ifdef CONFIG_TIMERLAT_TRACER
 	.print_stack			= 0,
 	.timerlat_period		= DEFAULT_TIMERLAT_PERIOD,
@@ -340,6 +473,137 @@ static struct osnoise_data {
 #endif
 };
 
+/*
+ * Noise attribution.
+ *
+ * When osnoise/attribution is set, each CPU keeps a table of the IRQs,
+ * softirqs and threads that caused noise, with their cumulative noise.
+ * The table holds OSN_TOP_ENTRIES causes. When it is full, the cause
+ * with the least total noise is evicted, so the heavy hitters stay. NMIs
+ * are only counted, as they cannot be serialized against the table.
+ */
+#define OSN_TOP_ENTRIES		16
+
+enum osn_cause_type {
+	OSN_CAUSE_IRQ,
+	OSN_CAUSE_SOFTIRQ,
+	OSN_CAUSE_THREAD,
+};
+
+static const char * const osn_cause_names[] = {
+	[OSN_CAUSE_IRQ]		= "irq",
+	[OSN_CAUSE_SOFTIRQ]	= "softirq",
+	[OSN_CAUSE_THREAD]	= "thread",
+};
+
+struct osn_cause {
+	u64			count;
+	u64			total;
+	u64			max;
+	enum osn_cause_type	type;
+	int			id;		/* irq, softirq vector or pid */
+	char			name[TASK_COMM_LEN];
+};
+
+struct osnoise_top {
+	unsigned int		gen;
+	struct osn_cause	cause[OSN_TOP_ENTRIES];
+	int			nr;
+	u64			evicted;
+	unsigned int		nmi_gen;	/* nmi_* only written from NMI */
+	u64			nmi_count;
+	u64			nmi_total;
+};
+
+static struct osnoise_top __percpu *osnoise_tops;
+
+/* Bumped by osn_top_reset(), see osn_hist_gen */
+static unsigned int osn_top_gen;
+
+/*
+ * osn_top_add - Attribute a noise interval to its cause on this CPU
+ */
+static void osn_top_add(enum osn_cause_type type, int id, const char *name,
+			u64 duration)
+{
+	struct osn_cause *cause, *min = NULL;
+	struct osnoise_top *top;
+	unsigned long flags;
+	unsigned int gen;
+	int i;
+
+	if (!osnoise_tops || !READ_ONCE(osnoise_data.attribution))
+		return;
+
+	local_irq_save(flags);
+	top = this_cpu_ptr(osnoise_tops);
+	gen = READ_ONCE(osn_top_gen);
+	if (unlikely(top->gen != gen)) {
+		top->nr = 0;
+		top->evicted = 0;
+		top->gen = gen;
+	}
+
+	for (i = 0; i < top->nr; i++) {
+		cause = &top->cause[i];
+		if (cause->type == type && cause->id == id &&
+		    (type != OSN_CAUSE_THREAD || !strcmp(cause->name, name)))
+			goto found;
+		if (!min || cause->total < min->total)
+			min = cause;
+	}
+
+	if (top->nr < OSN_TOP_ENTRIES) {
+		cause = &top->cause[top->nr++];
+	} else {
+		cause = min;
+		top->evicted++;
+	}
+
+	cause->count = 0;
+	cause->total = 0;
+	cause->max = 0;
+	cause->type = type;
+	cause->id = id;
+	strscpy(cause->name, name ? : "", sizeof(cause->name));
+found:
+	cause->count++;
+	cause->total += duration;
+	if (duration > cause->max)
+		cause->max = duration;
+	local_irq_restore(flags);
+}
+
+static void osn_top_add_nmi(u64 duration)
+{
+	struct osnoise_top *top;
+	unsigned int gen;
+
+	if (!osnoise_tops || !READ_ONCE(osnoise_data.attribution))
+		return;
+
+	top = this_cpu_ptr(osnoise_tops);
+	gen = READ_ONCE(osn_top_gen);
+	if (unlikely(top->nmi_gen != gen)) {
+		top->nmi_count = 0;
+		top->nmi_total = 0;
+		top->nmi_gen = gen;
+	}
+	top->nmi_count++;
+	top->nmi_total += duration;
+}
+
+/*
+ * osn_top_reset - Reset the noise attribution tables of all CPUs
+ *
+ * Like osn_hist_reset(), the tables are cleared by their own CPU on the
+ * next update.
+ */
+static void osn_top_reset(void)
+{
+	WRITE_ONCE(osn_top_gen, osn_top_gen + 1);
+}
+
 #ifdef CONFIG_TIMERLAT_TRACER
 static inline bool timerlat_enabled(void)
 {
@@ -501,6 +765,9 @@ static void trace_osnoise_sample(struct osnoise_sample *sample)
 	struct osnoise_instance *inst;
 	struct trace_buffer *buffer;
 
+	if (READ_ONCE(osnoise_data.hist_only))
+		return;
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(inst, &osnoise_instances, list) {
 		buffer = inst->tr->array_buffer.buffer;
@@ -555,6 +822,9 @@ static void trace_timerlat_sample(struct timerlat_sample *sample)
 	struct osnoise_instance *inst;
 	struct trace_buffer *buffer;
 
+	if (READ_ONCE(osnoise_data.hist_only))
+		return;
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(inst, &osnoise_instances, list) {
 		buffer = inst->tr->array_buffer.buffer;
@@ -852,6 +1122,8 @@ void trace_osnoise_callback(bool enter)
 			duration = time_get() - osn_var->nmi.delta_start;
 
 			trace_nmi_noise(osn_var->nmi.delta_start, duration);
+			osn_hist_add(OSN_HIST_NMI, duration);
+			osn_top_add_nmi(duration);
 
 			cond_move_irq_delta_start(osn_var, duration);
 			cond_move_softirq_delta_start(osn_var, duration);
@@ -905,6 +1177,8 @@ void osnoise_trace_irq_exit(int id, const char *desc)
 
 	duration = get_int_safe_duration(osn_var, &osn_var->irq.delta_start);
 	trace_irq_noise(id, desc, osn_var->irq.arrival_time, duration);
+	osn_hist_add(OSN_HIST_IRQ, duration);
+	osn_top_add(OSN_CAUSE_IRQ, id, desc, duration);
 	osn_var->irq.arrival_time = 0;
 	cond_move_softirq_delta_start(osn_var, duration);
 	cond_move_thread_delta_start(osn_var, duration);
@@ -1040,6 +1314,8 @@ static void trace_softirq_exit_callback(void *data, unsigned int vec_nr)
 
 	duration = get_int_safe_duration(osn_var, &osn_var->softirq.delta_start);
 	trace_softirq_noise(vec_nr, osn_var->softirq.arrival_time, duration);
+	osn_hist_add(OSN_HIST_SOFTIRQ, duration);
+	osn_top_add(OSN_CAUSE_SOFTIRQ, vec_nr, softirq_to_name[vec_nr], duration);
 	cond_move_thread_delta_start(osn_var, duration);
 	osn_var->softirq.arrival_time = 0;
 }
@@ -1137,6 +1413,8 @@ thread_exit(struct osnoise_variables *osn_var, struct task_struct *t)
 	duration = get_int_safe_duration(osn_var, &osn_var->thread.delta_start);
 
 	trace_thread_noise(t, osn_var->thread.arrival_time, duration);
+	osn_hist_add(OSN_HIST_THREAD, duration);
+	osn_top_add(OSN_CAUSE_THREAD, t->pid, t->comm, duration);
 
 	osn_var->thread.arrival_time = 0;
 }
@@ -1361,6 +1639,7 @@ static int run_osnoise(void)
 			sum_noise += noise;
 
 			trace_sample_threshold(last_sample, noise, interference);
+			osn_hist_add(OSN_HIST_NOISE, noise);
 
 			if (osnoise_data.stop_tracing)
 				if (noise > stop_in)
@@ -1525,6 +1804,7 @@ static enum hrtimer_restart timerlat_irq(struct hrtimer *timer)
 	s.context = IRQ_CONTEXT;
 
 	trace_timerlat_sample(&s);
+	osn_hist_add(OSN_HIST_TIMERLAT_IRQ, diff);
 
 	notify_new_max_latency(diff);
 
@@ -1613,6 +1893,7 @@ static int timerlat_main(void *data)
 		s.context = THREAD_CONTEXT;
 
 		trace_timerlat_sample(&s);
+		osn_hist_add(OSN_HIST_TIMERLAT_THREAD, diff);
 
 		timerlat_dump_stack(time_to_us(diff));
 
@@ -1942,6 +2223,28 @@ static struct trace_min_max_param osnoise_stop_tracing_total = {
 	.min	= NULL,
 };
 
+/*
+ * osnoise/hist_only: 0 or 1.
+ */
+static u64 osnoise_hist_only_max = 1;
+static struct trace_min_max_param osnoise_hist_only = {
+	.lock	= &interface_lock,
+	.val	= &osnoise_data.hist_only,
+	.max	= &osnoise_hist_only_max,
+	.min	= NULL,
+};
+
+/*
+ * osnoise/attribution: 0 or 1.
+ */
+static u64 osnoise_attribution_max = 1;
+static struct trace_min_max_param osnoise_attribution = {
+	.lock	= &interface_lock,
+	.val	= &osnoise_data.attribution,
+	.max	= &osnoise_attribution_max,
+	.min	= NULL,
+};
+
 #ifdef CONFIG_TIMERLAT_TRACER
 /*
  * osnoise/print_stack: print the stacktrace of the IRQ handler if the total
@@ -1974,6 +2277,182 @@ static const struct file_operations cpus_fops = {
 	.llseek		= generic_file_llseek,
 };
 
+/*
+ * osnoise_hist_show - Print the histograms of all CPUs, summed up
+ *
+ * For each type, print the totals and then one line per non-empty bucket
+ * with its range in ns.
+ */
+static int osnoise_hist_show(struct seq_file *s, void *v)
+{
+	unsigned int gen = READ_ONCE(osn_hist_gen);
+	struct osn_hist *sum, *hist;
+	int type, cpu, i;
+
+	if (!osnoise_hists)
+		return -ENODEV;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for (type = 0; type < OSN_HIST_MAX; type++) {
+		memset(sum, 0, sizeof(*sum));
+		for_each_possible_cpu(cpu) {
+			hist = &per_cpu_ptr(osnoise_hists, cpu)->hist[type];
+			if (READ_ONCE(hist->gen) != gen)
+				continue;
+			sum->count += READ_ONCE(hist->count);
+			sum->sum += READ_ONCE(hist->sum);
+			sum->max = max(sum->max, READ_ONCE(hist->max));
+			for (i = 0; i <= OSN_HIST_OVERFLOW; i++)
+				sum->bucket[i] += READ_ONCE(hist->bucket[i]);
+		}
+
+		seq_printf(s, "%s: count %llu sum_ns %llu max_ns %llu\n",
+			   osn_hist_names[type], sum->count, sum->sum, sum->max);
+
+		for (i = 0; i <= OSN_HIST_OVERFLOW; i++) {
+			if (!sum->bucket[i])
+				continue;
+			if (i == OSN_HIST_OVERFLOW)
+				seq_printf(s, "  %llu- %llu\n",
+					   osn_hist_bucket_start(i), sum->bucket[i]);
+			else
+				seq_printf(s, "  %llu-%llu %llu\n",
+					   osn_hist_bucket_start(i),
+					   osn_hist_bucket_start(i + 1) - 1,
+					   sum->bucket[i]);
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+
+static int osnoise_hist_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = tracing_check_open_get_tr(NULL);
+	if (ret)
+		return ret;
+
+	return single_open(file, osnoise_hist_show, NULL);
+}
+
+/*
+ * osnoise_hist_write - Writing anything to osnoise/hist resets it
+ */
+static ssize_t osnoise_hist_write(struct file *filp, const char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	osn_hist_reset();
+
+	return count;
+}
+
+static const struct file_operations hist_fops = {
+	.open		= osnoise_hist_open,
+	.read		= seq_read,
+	.write		= osnoise_hist_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int osn_cause_cmp(const void *a, const void *b)
+{
+	const struct osn_cause *ca = a, *cb = b;
+
+	if (ca->total == cb->total)
+		return 0;
+
+	return ca->total < cb->total ? 1 : -1;
+}
+
+/*
+ * osnoise_top_show - Print the noise causes of each CPU, worst first
+ *
+ * The tables are copied without stopping the CPUs, so an entry that is
+ * being replaced at the same time may be printed inconsistently.
+ */
+static int osnoise_top_show(struct seq_file *s, void *v)
+{
+	unsigned int gen = READ_ONCE(osn_top_gen);
+	struct osnoise_top *top;
+	struct osn_cause *cause;
+	int cpu, i;
+
+	if (!osnoise_tops)
+		return -ENODEV;
+
+	top = kmalloc(sizeof(*top), GFP_KERNEL);
+	if (!top)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		memcpy(top, per_cpu_ptr(osnoise_tops, cpu), sizeof(*top));
+		/* not cleared since the last reset yet */
+		if (top->gen != gen) {
+			top->nr = 0;
+			top->evicted = 0;
+		}
+		if (top->nmi_gen != gen)
+			top->nmi_count = 0;
+		top->nr = min_t(int, top->nr, OSN_TOP_ENTRIES);
+		if (!top->nr && !top->nmi_count)
+			continue;
+
+		sort(top->cause, top->nr, sizeof(*cause), osn_cause_cmp, NULL);
+
+		seq_printf(s, "cpu %d: evicted %llu\n", cpu, top->evicted);
+		if (top->nmi_count)
+			seq_printf(s, "  %-7s %7s %-16s count %llu total_ns %llu\n",
+				   "nmi", "-", "-", top->nmi_count, top->nmi_total);
+
+		for (i = 0; i < top->nr; i++) {
+			cause = &top->cause[i];
+			seq_printf(s, "  %-7s %7d %-16.*s count %llu total_ns %llu max_ns %llu\n",
+				   osn_cause_names[cause->type], cause->id,
+				   (int)sizeof(cause->name), cause->name,
+				   cause->count, cause->total, cause->max);
+		}
+	}
+
+	kfree(top);
+	return 0;
+}
+
+static int osnoise_top_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = tracing_check_open_get_tr(NULL);
+	if (ret)
+		return ret;
+
+	return single_open(file, osnoise_top_show, NULL);
+}
+
+/*
+ * osnoise_top_write - Writing anything to osnoise/top resets it
+ */
+static ssize_t osnoise_top_write(struct file *filp, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	osn_top_reset();
+
+	return count;
+}
+
+static const struct file_operations top_fops = {
+	.open		= osnoise_top_open,
+	.read		= seq_read,
+	.write		= osnoise_top_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 #ifdef CONFIG_TIMERLAT_TRACER
 #ifdef CONFIG_STACKTRACE
 static int init_timerlat_stack_tracefs(struct dentry *top_dir)
@@ -2060,6 +2539,24 @@ static int init_tracefs(void)
 	if (!tmp)
 		goto err;
 
+	tmp = tracefs_create_file("hist_only", TRACE_MODE_WRITE, top_dir,
+				  &osnoise_hist_only, &trace_min_max_fops);
+	if (!tmp)
+		goto err;
+
+	tmp = trace_create_file("hist", TRACE_MODE_WRITE, top_dir, NULL, &hist_fops);
+	if (!tmp)
+		goto err;
+
+	tmp = tracefs_create_file("attribution", TRACE_MODE_WRITE, top_dir,
+				  &osnoise_attribution, &trace_min_max_fops);
+	if (!tmp)
+		goto err;
+
+	tmp = trace_create_file("top", TRACE_MODE_WRITE, top_dir, NULL, &top_fops);
+	if (!tmp)
+		goto err;
+
 	ret = init_timerlat_tracefs(top_dir);
 	if (ret)
 		goto err;
@@ -2128,6 +2625,8 @@ static int osnoise_workload_start(void)
 		return 0;
 
 	osn_var_reset_all();
+	osn_hist_reset();
+	osn_top_reset();
 
 	retval = osnoise_hook_events();
 	if (retval)
@@ -2348,6 +2847,15 @@ __init static int init_osnoise_tracer(void)
 
 	cpumask_copy(&osnoise_cpumask, cpu_all_mask);
 
+	/* The tracers still work without histograms. */
+	osnoise_hists = alloc_percpu(struct osnoise_hists);
+	if (!osnoise_hists)
+		pr_warn(BANNER "Error allocating the histograms\n");
+
+	osnoise_tops = alloc_percpu(struct osnoise_top);
+	if (!osnoise_tops)
+		pr_warn(BANNER "Error allocating the noise attribution tables\n");
+
 	ret = register_tracer(&osnoise_tracer);
 	if (ret) {
 		pr_err(BANNER "Error registering osnoise!\n");
@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/sort.h>
 #include <linux/kmemleak.h>
+#include <linux/percpu.h>
 
 #include "tracing_map.h"
 #include "trace.h"
@@ -38,7 +39,21 @@
  */
 void tracing_map_update_sum(struct tracing_map_elt *elt, unsigned int i, u64 n)
 {
-	atomic64_add(n, &elt->fields[i].sum);
+	if (elt->map->percpu)
+		this_cpu_add(elt->pcpu_sums[i], n);
+	else
+		atomic64_add(n, &elt->fields[i].sum);
+}
+
+static u64 tracing_map_sum_percpu(struct tracing_map_elt *elt, unsigned int i)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(elt->pcpu_sums, cpu)[i]);
+
+	return sum;
 }
 
 /**
@@ -51,10 +66,16 @@ void tracing_map_update_sum(struct tracing_map_elt *elt, unsigned int i, u64 n)
  * call to tracing_map_add_sum_field() when the tracing map was set
  * up.
  *
+ * For a per-cpu map, the per-cpu sums are added up, which makes this
+ * O(nr_cpus).
+ *
  * Return: The sum associated with field i for elt.
  */
 u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i)
 {
+	if (elt->map->percpu)
+		return tracing_map_sum_percpu(elt, i);
+
 	return (u64)atomic64_read(&elt->fields[i].sum);
 }
 
@@ -125,6 +146,62 @@ u64 tracing_map_read_var_once(struct tracing_map_elt *elt, unsigned int i)
 	return (u64)atomic64_read(&elt->vars[i]);
 }
 
+static inline void tracing_map_inc_hits(struct tracing_map *map)
+{
+	if (map->percpu)
+		this_cpu_inc(map->stats->hits);
+	else
+		atomic64_inc(&map->hits);
+}
+
+static inline void tracing_map_inc_drops(struct tracing_map *map)
+{
+	if (map->percpu)
+		this_cpu_inc(map->stats->drops);
+	else
+		atomic64_inc(&map->drops);
+}
+
+/**
+ * tracing_map_read_hits - Return the number of hits of a tracing_map
+ * @map: The tracing_map
+ *
+ * Return: The number of successful insertions and retrievals.
+ */
+u64 tracing_map_read_hits(struct tracing_map *map)
+{
+	u64 hits = 0;
+	int cpu;
+
+	if (!map->percpu)
+		return (u64)atomic64_read(&map->hits);
+
+	for_each_possible_cpu(cpu)
+		hits += READ_ONCE(per_cpu_ptr(map->stats, cpu)->hits);
+
+	return hits;
+}
+
+/**
+ * tracing_map_read_drops - Return the number of drops of a tracing_map
+ * @map: The tracing_map
+ *
+ * Return: The number of failed insertions.
+ */
+u64 tracing_map_read_drops(struct tracing_map *map)
+{
+	u64 drops = 0;
+	int cpu;
+
+	if (!map->percpu)
+		return (u64)atomic64_read(&map->drops);
+
+	for_each_possible_cpu(cpu)
+		drops += READ_ONCE(per_cpu_ptr(map->stats, cpu)->drops);
+
+	return drops;
+}
+
 int tracing_map_cmp_string(void *val_a, void *val_b)
 {
 	char *a = val_a;
@@ -358,11 +435,18 @@ static struct tracing_map_array *tracing_map_array_alloc(unsigned int n_elts,
 static void tracing_map_elt_clear(struct tracing_map_elt *elt)
 {
 	unsigned i;
+	int cpu;
 
 	for (i = 0; i < elt->map->n_fields; i++)
 		if (elt->fields[i].cmp_fn == tracing_map_cmp_atomic64)
 			atomic64_set(&elt->fields[i].sum, 0);
 
+	if (elt->pcpu_sums) {
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(elt->pcpu_sums, cpu), 0,
+			       elt->map->n_fields * sizeof(u64));
+	}
+
 	for (i = 0; i < elt->map->n_vars; i++) {
 		atomic64_set(&elt->vars[i], 0);
 		elt->var_set[i] = false;
@@ -394,6 +478,7 @@ static void tracing_map_elt_free(struct tracing_map_elt *elt)
 	if (elt->map->ops && elt->map->ops->elt_free)
 		elt->map->ops->elt_free(elt);
 	kfree(elt->fields);
+	free_percpu(elt->pcpu_sums);
 	kfree(elt->vars);
 	kfree(elt->var_set);
 	kfree(elt->key);
@@ -423,6 +508,15 @@ static struct tracing_map_elt *tracing_map_elt_alloc(struct tracing_map *map)
 		goto free;
 	}
 
+	if (map->percpu) {
+		elt->pcpu_sums = __alloc_percpu(map->n_fields * sizeof(u64),
+						sizeof(u64));
+		if (!elt->pcpu_sums) {
+			err = -ENOMEM;
+			goto free;
+		}
+	}
+
 	elt->vars = kcalloc(map->n_vars, sizeof(*elt->vars), GFP_KERNEL);
 	if (!elt->vars) {
 		err = -ENOMEM;
@@ -535,7 +629,7 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 			if (val &&
 			    keys_match(key, val->key, map->key_size)) {
 				if (!lookup_only)
-					atomic64_inc(&map->hits);
+					tracing_map_inc_hits(map);
 				return val;
 			} else if (unlikely(!val)) {
 				/*
@@ -552,7 +646,7 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 
 				dup_try++;
 				if (dup_try > map->map_size) {
-					atomic64_inc(&map->drops);
+					tracing_map_inc_drops(map);
 					break;
 				}
 				continue;
@@ -568,14 +662,14 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 
 				elt = get_free_elt(map);
 				if (!elt) {
-					atomic64_inc(&map->drops);
+					tracing_map_inc_drops(map);
 					entry->key = 0;
 					break;
 				}
 
 				memcpy(elt->key, key, map->key_size);
 				entry->val = elt;
-				atomic64_inc(&map->hits);
+				tracing_map_inc_hits(map);
 
 				return entry->val;
 			} else {
@@ -676,6 +770,7 @@ void tracing_map_destroy(struct tracing_map *map)
 	tracing_map_free_elts(map);
 
 	tracing_map_array_free(map->map);
+	free_percpu(map->stats);
 	kfree(map);
 }
 
@@ -693,11 +788,18 @@ void tracing_map_destroy(struct tracing_map *map)
 void tracing_map_clear(struct tracing_map *map)
 {
 	unsigned int i;
+	int cpu;
 
 	atomic_set(&map->next_elt, -1);
 	atomic64_set(&map->hits, 0);
 	atomic64_set(&map->drops, 0);
 
+	if (map->stats) {
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(map->stats, cpu), 0,
+			       sizeof(struct tracing_map_stats));
+	}
+
 	tracing_map_array_clear(map->map);
 
 	for (i = 0; i < map->max_elts; i++)
@@ -802,6 +904,34 @@ struct tracing_map *tracing_map_create(unsigned int map_bits,
 	goto out;
 }
 
+/**
+ * tracing_map_set_percpu - Switch a tracing_map to per-cpu sums
+ * @map: The tracing_map, not yet initialized with tracing_map_init()
+ *
+ * Makes every tracing_map_elt of the map keep its sums, and the map its
+ * hits and drops, in per-cpu counters which are only added up on read.
+ * See the overview in tracing_map.h.
+ *
+ * Return: 0 if successful, -EBUSY if the map is already initialized,
+ * -ENOMEM if the per-cpu counters couldn't be allocated.
+ */
+int tracing_map_set_percpu(struct tracing_map *map)
+{
+	if (map->elts)
+		return -EBUSY;
+
+	if (map->percpu)
+		return 0;
+
+	map->stats = alloc_percpu(struct tracing_map_stats);
+	if (!map->stats)
+		return -ENOMEM;
+
+	map->percpu = true;
+
+	return 0;
+}
+
 /**
  * tracing_map_init - Allocate and clear a map's tracing_map_elts
  * @map: The tracing_map to initialize
@@ -958,6 +1088,30 @@ create_sort_entry(void *key, struct tracing_map_elt *elt)
 	return sort_entry;
 }
 
+/*
+ * Per-cpu maps are merged on read: snapshot the per-cpu sums of the
+ * entries to sort into the shared sum fields, which are otherwise unused
+ * in that mode, so that the sort compares stable values.
+ */
+static void fold_percpu_sums(struct tracing_map *map,
+			     struct tracing_map_sort_entry **entries,
+			     int n_entries)
+{
+	struct tracing_map_elt *elt;
+	unsigned int i;
+	int n;
+
+	for (n = 0; n < n_entries; n++) {
+		elt = entries[n]->elt;
+		for (i = 0; i < map->n_fields; i++) {
+			if (elt->fields[i].cmp_fn != tracing_map_cmp_atomic64)
+				continue;
+			atomic64_set(&elt->fields[i].sum,
+				     tracing_map_sum_percpu(elt, i));
+		}
+	}
+}
+
 static void detect_dups(struct tracing_map_sort_entry **sort_entries,
 		      int n_entries, unsigned int key_size)
 {
@@ -1100,6 +1254,9 @@ int tracing_map_sort_entries(struct tracing_map *map,
 		goto free;
 	}
 
+	if (map->percpu)
+		fold_percpu_sums(map, entries, n_entries);
+
 	if (n_entries == 1) {
 		*sort_entries = entries;
 		return 1;
@@ -125,6 +125,17 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * user, tracing_map_sort_entry objects contain a number of additional
  * fields which are used for caching and internal purposes and can
  * safely be ignored.
+ *
+ * A map can also be switched to per-cpu mode with tracing_map_set_percpu()
+ * before tracing_map_init() is called.  The hash table and the
+ * tracing_map_elts (keys and variables) stay shared, so events seen on
+ * different CPUs still meet in the same element, but each
+ * tracing_map_elt gets a per-cpu copy of its sums and the map keeps
+ * per-cpu hit/drop counters.  Updating a sum is then a this_cpu_add()
+ * instead of an atomic on a cache line shared by all CPUs, and the
+ * per-cpu copies are only added up when the map is read or sorted.
+ * This trades nr_cpus * n_fields * 8 bytes per element for update
+ * scalability.
 */
 
 struct tracing_map_field {
@@ -138,6 +149,7 @@ struct tracing_map_field {
 struct tracing_map_elt {
 	struct tracing_map		*map;
 	struct tracing_map_field	*fields;
+	u64 __percpu			*pcpu_sums;
 	atomic64_t			*vars;
 	bool				*var_set;
 	void				*key;
@@ -180,6 +192,11 @@ struct tracing_map_array {
 #define TRACING_MAP_ELT(array, idx)					\
 	((struct tracing_map_elt **)TRACING_MAP_ARRAY_ELT(array, idx))
 
+struct tracing_map_stats {
+	u64				hits;
+	u64				drops;
+};
+
 struct tracing_map {
 	unsigned int			key_size;
 	unsigned int			map_bits;
@@ -198,6 +215,8 @@ struct tracing_map {
 	unsigned int			n_vars;
 	atomic64_t			hits;
 	atomic64_t			drops;
+	bool				percpu;
+	struct tracing_map_stats __percpu *stats;
 };
 
 /**
@@ -242,6 +261,7 @@ tracing_map_create(unsigned int map_bits,
 		   unsigned int key_size,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
+extern int tracing_map_set_percpu(struct tracing_map *map);
 extern int tracing_map_init(struct tracing_map *map);
 
 extern int tracing_map_add_sum_field(struct tracing_map *map);
@@ -271,6 +291,8 @@ extern bool tracing_map_var_set(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var_once(struct tracing_map_elt *elt, unsigned int i);
+extern u64 tracing_map_read_hits(struct tracing_map *map);
+extern u64 tracing_map_read_drops(struct tracing_map *map);
 
 extern void tracing_map_set_field_descr(struct tracing_map *map,
 					unsigned int i,
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * tracing_map benchmark: shared vs per-cpu sums
+ *
+ * Runs one thread per online CPU, each inserting keys into the same
+ * tracing_map and updating two sums per hit, the way a hist trigger on a
+ * high-rate event does.  The run is done once with a shared map and once
+ * with a per-cpu map, and the cost per update is reported for both.
+ */
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/security.h>
+#include <linux/sched/clock.h>
+#include <linux/slab.h>
+
+#include "tracing_map.h"
+
+#define TMB_MAP_BITS		10
+#define TMB_NR_KEYS		64
+#define TMB_NR_UPDATES		(1 << 20)
+
+struct tmb_map {
+	struct tracing_map	*map;
+	int			hitcount_idx;
+	int			val_idx;
+};
+
+static struct tmb_map tmb;
+static atomic_t tmb_running;
+static atomic64_t tmb_total_ns;
+static DECLARE_COMPLETION(tmb_start);
+static DECLARE_COMPLETION(tmb_done);
+
+static int tmb_thread(void *arg)
+{
+	struct tracing_map_elt *elt;
+	u64 key, start, stop;
+	unsigned int i;
+
+	wait_for_completion(&tmb_start);
+
+	start = local_clock();
+	for (i = 0; i < TMB_NR_UPDATES; i++) {
+		key = (i + smp_processor_id()) % TMB_NR_KEYS;
+		elt = tracing_map_insert(tmb.map, &key);
+		if (!elt)
+			continue;
+		tracing_map_update_sum(elt, tmb.hitcount_idx, 1);
+		tracing_map_update_sum(elt, tmb.val_idx, i);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	stop = local_clock();
+
+	atomic64_add(stop - start, &tmb_total_ns);
+	if (atomic_dec_and_test(&tmb_running))
+		complete(&tmb_done);
+
+	return 0;
+}
+
+static int tmb_map_create(bool percpu)
+{
+	int ret;
+
+	tmb.map = tracing_map_create(TMB_MAP_BITS, sizeof(u64), NULL, NULL);
+	if (IS_ERR(tmb.map))
+		return PTR_ERR(tmb.map);
+
+	ret = tracing_map_add_key_field(tmb.map, 0, tracing_map_cmp_num(8, 0));
+	if (ret < 0)
+		goto out;
+	tmb.hitcount_idx = tracing_map_add_sum_field(tmb.map);
+	tmb.val_idx = tracing_map_add_sum_field(tmb.map);
+	if (tmb.hitcount_idx < 0 || tmb.val_idx < 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (percpu) {
+		ret = tracing_map_set_percpu(tmb.map);
+		if (ret)
+			goto out;
+	}
+
+	ret = tracing_map_init(tmb.map);
+	if (!ret)
+		return 0;
+ out:
+	tracing_map_destroy(tmb.map);
+	return ret;
+}
+
+static int tmb_run(bool percpu)
+{
+	struct tracing_map_sort_entry **entries;
+	struct tracing_map_sort_key sort_key = {
+		.field_idx = 1,
+		.descending = true,
+	};
+	unsigned int nr_cpus = 0;
+	u64 hits = 0, ns;
+	int cpu, n, i, ret;
+
+	ret = tmb_map_create(percpu);
+	if (ret)
+		return ret;
+
+	atomic64_set(&tmb_total_ns, 0);
+	atomic_set(&tmb_running, 1);
+	reinit_completion(&tmb_start);
+	reinit_completion(&tmb_done);
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		struct task_struct *t;
+
+		t = kthread_create_on_cpu(tmb_thread, NULL, cpu, "tmbench/%u");
+		if (WARN_ON(IS_ERR(t)))
+			continue;
+		atomic_inc(&tmb_running);
+		nr_cpus++;
+		wake_up_process(t);
+	}
+	cpus_read_unlock();
+
+	complete_all(&tmb_start);
+	if (!atomic_dec_and_test(&tmb_running))
+		wait_for_completion(&tmb_done);
+
+	/* Merge on read, and check that no update was lost on the way. */
+	n = tracing_map_sort_entries(tmb.map, &sort_key, 1, &entries);
+	if (n > 0) {
+		for (i = 0; i < n; i++)
+			hits += tracing_map_read_sum(entries[i]->elt,
+						     tmb.hitcount_idx);
+		tracing_map_destroy_sort_entries(entries, n);
+	}
+
+	ns = atomic64_read(&tmb_total_ns);
+	if (nr_cpus)
+		ns = div64_u64(ns, (u64)nr_cpus * TMB_NR_UPDATES);
+
+	pr_info("tracing_map benchmark: %-6s map, %u cpus: %llu ns/update, hits %llu/%llu\n",
+		percpu ? "percpu" : "shared", nr_cpus, ns,
+		tracing_map_read_hits(tmb.map), (u64)nr_cpus * TMB_NR_UPDATES);
+
+	WARN_ON(hits != tracing_map_read_hits(tmb.map));
+
+	tracing_map_destroy(tmb.map);
+	tmb.map = NULL;
+
+	return 0;
+}
+
+static __init int tracing_map_benchmark(void)
+{
+	if (security_locked_down(LOCKDOWN_TRACEFS)) {
+		pr_warn("Lockdown is enabled, skipping tracing_map benchmark\n");
+		return 0;
+	}
+
+	if (tmb_run(false))
+		pr_warn("tracing_map benchmark: shared map run failed\n");
+	if (tmb_run(true))
+		pr_warn("tracing_map benchmark: percpu map run failed\n");
+
+	return 0;
+}
+late_initcall(tracing_map_benchmark);
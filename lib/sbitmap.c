@@ -449,6 +449,62 @@ int __sbitmap_queue_get(struct sbitmap_queue *sbq)
 }
 EXPORT_SYMBOL_GPL(__sbitmap_queue_get);
 
+unsigned long __sbitmap_queue_get_batch(struct sbitmap_queue *sbq, int nr_tags,
+					unsigned int *offset)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned int hint, depth;
+	unsigned long index;
+	int i;
+
+	if (unlikely(sbq->round_robin))
+		return 0;
+
+	nr_tags = min(nr_tags, BITS_PER_LONG - 1);
+	depth = READ_ONCE(sb->depth);
+	hint = this_cpu_read(*sbq->alloc_hint);
+	if (unlikely(hint >= depth))
+		hint = depth ? prandom_u32() % depth : 0;
+
+	index = SB_NR_TO_INDEX(sb, hint);
+	for (i = 0; i < sb->map_nr; i++) {
+		struct sbitmap_word *map = &sb->map[index];
+		unsigned long map_depth = READ_ONCE(map->depth);
+		unsigned long nr, n, mask, val;
+
+		if (READ_ONCE(map->cleared))
+			sbitmap_deferred_clear(sb, index);
+
+		/*
+		 * Grab a run of bits starting at the first free one with a
+		 * single atomic op.  Bits in the run that someone else owns
+		 * are simply left alone, the caller gets the rest.
+		 */
+		nr = find_first_zero_bit(&map->word, map_depth);
+		if (nr < map_depth) {
+			n = min_t(unsigned long, nr_tags, map_depth - nr);
+			mask = ((1UL << n) - 1) << nr;
+			val = atomic_long_fetch_or_acquire(mask,
+						(atomic_long_t *)&map->word);
+			mask = (mask & ~val) >> nr;
+			if (mask) {
+				*offset = nr + (index << sb->shift);
+				hint = *offset + n;
+				if (hint >= depth - 1)
+					hint = 0;
+				this_cpu_write(*sbq->alloc_hint, hint);
+				return mask;
+			}
+		}
+
+		if (++index >= sb->map_nr)
+			index = 0;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__sbitmap_queue_get_batch);
+
 int __sbitmap_queue_get_shallow(struct sbitmap_queue *sbq,
 				unsigned int shallow_depth)
 {
@@ -589,6 +645,47 @@ void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr,
 }
 EXPORT_SYMBOL_GPL(sbitmap_queue_clear);
 
+void sbitmap_queue_clear_batch(struct sbitmap_queue *sbq, int offset,
+			       int *tags, int nr_tags)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned long *addr = NULL;
+	unsigned long mask = 0;
+	int i, nr;
+
+	/* see sbitmap_queue_clear() for the barriers */
+	smp_mb__before_atomic();
+	for (i = 0; i < nr_tags; i++) {
+		const int tag = tags[i] - offset;
+		unsigned long *this_addr;
+
+		/*
+		 * Clear the word directly instead of going through the
+		 * deferred mask, runs of tags on the same word are cleared
+		 * with a single atomic op.
+		 */
+		this_addr = &sb->map[SB_NR_TO_INDEX(sb, tag)].word;
+		if (addr != this_addr) {
+			if (mask)
+				atomic_long_andnot(mask, (atomic_long_t *)addr);
+			mask = 0;
+			addr = this_addr;
+		}
+		mask |= 1UL << SB_NR_TO_BIT(sb, tag);
+	}
+	if (mask)
+		atomic_long_andnot(mask, (atomic_long_t *)addr);
+	smp_mb__after_atomic();
+
+	for (i = 0; i < nr_tags; i++)
+		sbitmap_queue_wake_up(sbq);
+
+	nr = tags[nr_tags - 1] - offset;
+	if (likely(!sbq->round_robin && nr < sbq->sb.depth))
+		this_cpu_write(*sbq->alloc_hint, nr);
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_clear_batch);
+
 void sbitmap_queue_wake_all(struct sbitmap_queue *sbq)
 {
 	int i, wake_index;
@@ -44,6 +44,7 @@
 #include <linux/ramfs.h>
 #include <linux/page_idle.h>
 #include <linux/migrate.h>
+#include <linux/memcg_memfs_info.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -194,6 +195,7 @@ static void unaccount_page_cache_page(struct address_space *mapping,
 	__mod_lruvec_page_state(page, NR_FILE_PAGES, -nr);
 	if (PageSwapBacked(page)) {
 		__mod_lruvec_page_state(page, NR_SHMEM, -nr);
+		__memcg_memfs_page_state(mapping, page, -nr);
 		shmem_reliable_page_counter(page, -nr);
 		if (PageTransHuge(page))
 			__dec_node_page_state(page, NR_SHMEM_THPS);
@@ -805,10 +807,12 @@ int replace_page_cache_page(struct page *old, struct page *new, gfp_t gfp_mask)
 		__inc_lruvec_page_state(new, NR_FILE_PAGES);
 	if (PageSwapBacked(old)) {
 		__dec_lruvec_page_state(old, NR_SHMEM);
+		__memcg_memfs_page_state(mapping, old, -1);
 		shmem_reliable_page_counter(old, -1);
 	}
 	if (PageSwapBacked(new)) {
 		__inc_lruvec_page_state(new, NR_SHMEM);
+		__memcg_memfs_page_state(mapping, new, 1);
 		shmem_reliable_page_counter(new, 1);
 	}
 	xas_unlock_irqrestore(&xas, flags);
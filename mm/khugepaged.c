@@ -18,6 +18,7 @@
 #include <linux/page_idle.h>
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
+#include <linux/memcg_memfs_info.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -1926,8 +1927,10 @@ static void collapse_file(struct mm_struct *mm,
 
 	if (nr_none) {
 		__mod_lruvec_page_state(new_page, NR_FILE_PAGES, nr_none);
-		if (is_shmem)
+		if (is_shmem) {
 			__mod_lruvec_page_state(new_page, NR_SHMEM, nr_none);
+			__memcg_memfs_page_state(mapping, new_page, nr_none);
+		}
 	}
 
 xa_locked:
@@ -168,7 +168,14 @@ void mem_cgroup_print_memfs_info(struct mem_cgroup *memcg, char *pathbuf,
 	};
 	int i;
 
-	if (!memfs_enable || !memcg)
+	if (!memcg)
+		return;
+
+	SEQ_printf(m, "memfs usage: %lukB\n",
+		   mem_cgroup_memfs_pages(memcg) << (PAGE_SHIFT - 10));
+
+	/* The per-file breakdown walks every memfs inode, keep it opt-in. */
+	if (!memfs_enable)
 		return;
 
 	pfc.pathbuf = pathbuf;
@@ -121,6 +121,18 @@ static bool do_memsw_account(void)
 #define HIGH_ASYNC_RATIO_BASE			100
 #define HIGH_ASYNC_RATIO_GAP			10
 
+/*
+ * Rate based mode, see struct memcg_high_async.  The growth rate of
+ * usage is sampled at most every HIGH_ASYNC_SAMPLE_INTERVAL and smoothed
+ * with a weight of 1/2^HIGH_ASYNC_RATE_SHIFT for the newest sample.  Async
+ * reclaim then aims for HIGH_ASYNC_LEAD_FACTOR lead times of headroom
+ * below memory.high, so that it does not restart right away.
+ */
+#define HIGH_ASYNC_SAMPLE_INTERVAL		(HZ / 10)
+#define HIGH_ASYNC_RATE_SHIFT			2
+#define HIGH_ASYNC_LEAD_FACTOR			2
+#define HIGH_ASYNC_LEAD_MS_MAX			60000
+
 /*
  * Cgroups above their limits are maintained in a RB-Tree, independent of
  * their hierarchy representation
@@ -1459,6 +1471,9 @@ static struct memory_stat memory_stats[] = {
 	{ "percpu", 1, MEMCG_PERCPU_B },
 	{ "sock", PAGE_SIZE, MEMCG_SOCK },
 	{ "shmem", PAGE_SIZE, NR_SHMEM },
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+	{ "memfs", PAGE_SIZE, MEMCG_MEMFS },
+#endif
 	{ "file_mapped", PAGE_SIZE, NR_FILE_MAPPED },
 	{ "file_dirty", PAGE_SIZE, NR_FILE_DIRTY },
 	{ "file_writeback", PAGE_SIZE, NR_WRITEBACK },
@@ -1651,6 +1666,14 @@ void mem_cgroup_print_oom_meminfo(struct mem_cgroup *memcg)
 	mem_cgroup_print_memfs_info(memcg, pathbuf, NULL);
 }
 
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+unsigned long mem_cgroup_memfs_pages(struct mem_cgroup *memcg)
+{
+	mem_cgroup_flush_stats();
+	return memcg_page_state(memcg, MEMCG_MEMFS);
+}
+#endif
+
 /*
  * Return the memory (and swap, if configured) limit for a memcg.
  */
@@ -2392,39 +2415,117 @@ static unsigned long reclaim_high(struct mem_cgroup *memcg,
 	return nr_reclaimed;
 }
 
+/*
+ * Fold the usage growth of @memcg since the last sample into the smoothed
+ * rate, once per sample interval.  Usage is net of uncharges, so a group
+ * that frees as fast as it charges projects no growth.  Only one cpu wins
+ * the sample.
+ */
+static void memcg_high_async_sample(struct mem_cgroup *memcg)
+{
+	struct memcg_high_async *ha = memcg->high_async;
+	unsigned long now = jiffies;
+	unsigned long last, usage, prev, elapsed, rate, old;
+
+	if (!READ_ONCE(ha->lead_ms))
+		return;
+
+	last = READ_ONCE(ha->sample_time);
+	if (time_before(now, last + HIGH_ASYNC_SAMPLE_INTERVAL))
+		return;
+	if (cmpxchg(&ha->sample_time, last, now) != last)
+		return;
+
+	elapsed = now - last;
+	usage = page_counter_read(&memcg->memory);
+	prev = xchg(&ha->sample_usage, usage);
+	rate = usage > prev ? (usage - prev) * HZ / elapsed : 0;
+
+	/* After a quiet period the old estimate says nothing, restart. */
+	old = READ_ONCE(ha->rate);
+	if (elapsed > 8 * HIGH_ASYNC_SAMPLE_INTERVAL)
+		WRITE_ONCE(ha->rate, rate);
+	else
+		WRITE_ONCE(ha->rate, old - (old >> HIGH_ASYNC_RATE_SHIFT) +
+				     (rate >> HIGH_ASYNC_RATE_SHIFT));
+}
+
+/* Pages expected to be charged to @memcg within its lead time. */
+static unsigned long memcg_high_async_lead_pages(struct mem_cgroup *memcg)
+{
+	struct memcg_high_async *ha = memcg->high_async;
+	unsigned int lead_ms = READ_ONCE(ha->lead_ms);
+
+	if (!lead_ms)
+		return 0;
+
+	return READ_ONCE(ha->rate) * lead_ms / MSEC_PER_SEC;
+}
+
 static bool is_high_async_reclaim(struct mem_cgroup *memcg)
 {
 	int ratio = READ_ONCE(memcg->high_async_ratio);
 	unsigned long memcg_high = READ_ONCE(memcg->memory.high);
+	unsigned long usage, lead_pages;
 
-	if (ratio == HIGH_ASYNC_RATIO_BASE || memcg_high == PAGE_COUNTER_MAX)
+	if (memcg_high == PAGE_COUNTER_MAX)
 		return false;
 
-	return page_counter_read(&memcg->memory) >
-	       memcg_high * ratio / HIGH_ASYNC_RATIO_BASE;
+	usage = page_counter_read(&memcg->memory);
+	if (ratio != HIGH_ASYNC_RATIO_BASE &&
+	    usage > memcg_high * ratio / HIGH_ASYNC_RATIO_BASE)
+		return true;
+
+	/* Would memory.high be reached within the lead time? */
+	lead_pages = memcg_high_async_lead_pages(memcg);
+	return lead_pages && usage + lead_pages > memcg_high;
 }
 
 static void async_reclaim_high(struct mem_cgroup *memcg)
 {
-	unsigned long nr_pages, pflags;
+	struct memcg_high_async *ha = memcg->high_async;
+	unsigned long nr_pages, nr_reclaimed, pflags;
 	unsigned long memcg_high = READ_ONCE(memcg->memory.high);
 	unsigned long memcg_usage = page_counter_read(&memcg->memory);
 	int ratio = READ_ONCE(memcg->high_async_ratio) - HIGH_ASYNC_RATIO_GAP;
 	unsigned long safe_pages = memcg_high * ratio / HIGH_ASYNC_RATIO_BASE;
+	unsigned long lead_pages;
 
 	if (!is_high_async_reclaim(memcg)) {
 		WRITE_ONCE(memcg->high_async_reclaim, false);
 		return;
 	}
 
+	/*
+	 * In rate mode leave room for a few lead times of charges, so
+	 * reclaim backs off once the projected time to high is long
+	 * enough again.
+	 */
+	lead_pages = memcg_high_async_lead_pages(memcg);
+	if (lead_pages) {
+		lead_pages *= HIGH_ASYNC_LEAD_FACTOR;
+		if (READ_ONCE(memcg->high_async_ratio) == HIGH_ASYNC_RATIO_BASE)
+			safe_pages = memcg_high;
+		safe_pages = min(safe_pages, memcg_high > lead_pages ?
+				 memcg_high - lead_pages : 0);
+	}
+
 #ifdef CONFIG_PSI_FINE_GRAINED
 	pflags = PSI_ASYNC_MEMCG_RECLAIM;
 #endif
 	psi_memstall_enter(&pflags);
 	nr_pages = memcg_usage > safe_pages ? memcg_usage - safe_pages :
 		   MEMCG_CHARGE_BATCH;
-	try_to_free_mem_cgroup_pages(memcg, nr_pages, GFP_KERNEL, true);
+	nr_reclaimed = try_to_free_mem_cgroup_pages(memcg, nr_pages,
+						    GFP_KERNEL, true);
 	psi_memstall_leave(&pflags);
+
+	atomic_long_inc(&ha->nr_runs);
+	atomic_long_add(nr_reclaimed, &ha->nr_reclaimed);
+	/* Still below high: the allocators did not have to reclaim. */
+	if (page_counter_read(&memcg->memory) <= READ_ONCE(memcg->memory.high))
+		atomic_long_inc(&ha->nr_avoided);
+
 	WRITE_ONCE(memcg->high_async_reclaim, false);
 }
 
@@ -2674,6 +2775,7 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	bool passed_oom = false;
 	unsigned int reclaim_options = MEMCG_RECLAIM_MAY_SWAP;
 	bool drained = false;
+	bool handled = false;
 	unsigned long pflags;
 
 	if (mem_cgroup_is_root(memcg))
@@ -2810,10 +2912,18 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 	 * not recorded as it most likely matches current's and won't
 	 * change in the meantime.  As high limit is checked again before
 	 * reclaim, the cost of mismatch is negligible.
+	 *
+	 * Once reclaim has been arranged for, only ancestors in rate mode
+	 * are still checked, their projection is independent of the level
+	 * that triggered.
 	 */
 	do {
 		bool mem_high, swap_high;
 
+		memcg_high_async_sample(memcg);
+		if (handled && !READ_ONCE(memcg->high_async->lead_ms))
+			continue;
+
 		mem_high = page_counter_read(&memcg->memory) >
 			READ_ONCE(memcg->memory.high);
 		swap_high = page_counter_read(&memcg->swap) >
@@ -2821,9 +2931,9 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 
 		/* Don't bother a random interrupted task */
 		if (in_interrupt()) {
-			if (mem_high) {
+			if (mem_high && !handled) {
 				schedule_work(&memcg->high_work);
-				break;
+				handled = true;
 			}
 			continue;
 		}
@@ -2831,10 +2941,11 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		if (is_high_async_reclaim(memcg) && !mem_high) {
 			WRITE_ONCE(memcg->high_async_reclaim, true);
 			schedule_work(&memcg->high_work);
-			break;
+			handled = true;
+			continue;
 		}
 
-		if (mem_high || swap_high) {
+		if (!handled && (mem_high || swap_high)) {
 			/*
 			 * The allocating tasks in this cgroup will need to do
 			 * reclaim or be throttled to prevent further growth
@@ -2846,7 +2957,7 @@ static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 			 */
 			current->memcg_nr_pages_over_high += batch;
 			set_notify_resume(current);
-			break;
+			handled = true;
 		}
 	} while ((memcg = parent_mem_cgroup(memcg)));
 
@@ -3898,6 +4009,47 @@ static int mem_cgroup_move_charge_write(struct cgroup_subsys_state *css,
 int sysctl_memcg_qos_stat = DISABLE_MEMCG_QOS;
 DEFINE_STATIC_KEY_FALSE(memcg_qos_stat_key);
 
+enum memcg_qos_class {
+	MEMCG_QOS_NORMAL,
+	MEMCG_QOS_LOW,
+	MEMCG_QOS_NR_CLASSES,
+};
+
+static const char *const memcg_qos_class_names[MEMCG_QOS_NR_CLASSES] = {
+	"normal",
+	"low",
+};
+
+/* Pages scanned and reclaimed by priority ordered reclaim, per class */
+static atomic_long_t memcg_qos_scanned[MEMCG_QOS_NR_CLASSES];
+static atomic_long_t memcg_qos_reclaimed[MEMCG_QOS_NR_CLASSES];
+
+void memcg_qos_account_reclaim(struct mem_cgroup *memcg,
+			       unsigned long scanned, unsigned long reclaimed)
+{
+	int class = mem_cgroup_low_priority(memcg) ? MEMCG_QOS_LOW :
+						     MEMCG_QOS_NORMAL;
+
+	if (scanned)
+		atomic_long_add(scanned, &memcg_qos_scanned[class]);
+	if (reclaimed)
+		atomic_long_add(reclaimed, &memcg_qos_reclaimed[class]);
+}
+
+static int memcg_qos_reclaim_stat_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_QOS_NR_CLASSES; i++) {
+		seq_printf(m, "%s_scanned %lu\n", memcg_qos_class_names[i],
+			   atomic_long_read(&memcg_qos_scanned[i]));
+		seq_printf(m, "%s_reclaimed %lu\n", memcg_qos_class_names[i],
+			   atomic_long_read(&memcg_qos_reclaimed[i]));
+	}
+
+	return 0;
+}
+
 static void memcg_hierarchy_qos_set(struct mem_cgroup *memcg, int val)
 {
 	struct mem_cgroup *iter;
@@ -4535,6 +4687,9 @@ static const unsigned int memcg1_stats[] = {
 	NR_ANON_THPS,
 #endif
 	NR_SHMEM,
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+	MEMCG_MEMFS,
+#endif
 	NR_FILE_MAPPED,
 	NR_FILE_DIRTY,
 	NR_WRITEBACK,
@@ -4548,6 +4703,9 @@ static const char *const memcg1_stat_names[] = {
 	"rss_huge",
 #endif
 	"shmem",
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+	"memfs",
+#endif
 	"mapped_file",
 	"dirty",
 	"writeback",
@@ -5750,6 +5908,48 @@ static ssize_t memcg_high_async_ratio_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static u64 memcg_high_async_lead_ms_read(struct cgroup_subsys_state *css,
+					 struct cftype *cft)
+{
+	return READ_ONCE(mem_cgroup_from_css(css)->high_async->lead_ms);
+}
+
+static int memcg_high_async_lead_ms_write(struct cgroup_subsys_state *css,
+					  struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+	struct memcg_high_async *ha = memcg->high_async;
+
+	if (val > HIGH_ASYNC_LEAD_MS_MAX)
+		return -EINVAL;
+
+	/* Start from a clean estimate whenever the mode is switched on. */
+	if (!READ_ONCE(ha->lead_ms)) {
+		WRITE_ONCE(ha->rate, 0);
+		WRITE_ONCE(ha->sample_usage, page_counter_read(&memcg->memory));
+		WRITE_ONCE(ha->sample_time, jiffies);
+	}
+	WRITE_ONCE(ha->lead_ms, val);
+
+	return 0;
+}
+
+static int memcg_high_async_stat_show(struct seq_file *m, void *v)
+{
+	struct memcg_high_async *ha = mem_cgroup_from_seq(m)->high_async;
+
+	seq_printf(m, "charge_rate %lu\n",
+		   READ_ONCE(ha->lead_ms) ? READ_ONCE(ha->rate) : 0);
+	seq_printf(m, "async_reclaim_runs %lu\n",
+		   atomic_long_read(&ha->nr_runs));
+	seq_printf(m, "async_reclaimed %lu\n",
+		   atomic_long_read(&ha->nr_reclaimed));
+	seq_printf(m, "direct_reclaim_avoided %lu\n",
+		   atomic_long_read(&ha->nr_avoided));
+
+	return 0;
+}
+
 #ifdef CONFIG_KSM
 static int memcg_set_ksm_for_tasks(struct mem_cgroup *memcg, bool enable)
 {
@@ -5991,6 +6191,11 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.read_s64 = memcg_qos_read,
 		.write_s64 = memcg_qos_write,
 	},
+	{
+		.name = "qos_reclaim_stat",
+		.flags = CFTYPE_ONLY_ON_ROOT,
+		.seq_show = memcg_qos_reclaim_stat_show,
+	},
 #endif
 #ifdef CONFIG_DYNAMIC_HUGETLB
 	{
@@ -6140,6 +6345,17 @@ static struct cftype mem_cgroup_legacy_files[] = {
 		.seq_show = memcg_high_async_ratio_show,
 		.write = memcg_high_async_ratio_write,
 	},
+	{
+		.name = "high_async_lead_ms",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memcg_high_async_lead_ms_read,
+		.write_u64 = memcg_high_async_lead_ms_write,
+	},
+	{
+		.name = "high_async_stat",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memcg_high_async_stat_show,
+	},
 #ifdef CONFIG_CGROUP_V1_WRITEBACK
 	{
 		.name = "wb_blkio_ino",
@@ -6269,6 +6485,7 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 		free_mem_cgroup_per_node_info(memcg, node);
 	free_percpu(memcg->vmstats_percpu);
 	memcg_free_swap_device(memcg);
+	kfree(memcg->high_async);
 	kfree(memcg);
 }
 
@@ -6296,6 +6513,11 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	if (memcg_alloc_swap_device(memcg))
 		goto fail;
 
+	memcg->high_async = kzalloc(sizeof(struct memcg_high_async),
+				    GFP_KERNEL);
+	if (!memcg->high_async)
+		goto fail;
+
 	memcg->id.id = idr_alloc(&mem_cgroup_idr, NULL,
 				 1, MEM_CGROUP_ID_MAX + 1, GFP_KERNEL);
 	if (memcg->id.id < 0) {
@@ -6796,6 +7018,12 @@ static int mem_cgroup_move_account(struct page *page,
 		if (PageSwapBacked(page)) {
 			__mod_lruvec_state(from_vec, NR_SHMEM, -nr_pages);
 			__mod_lruvec_state(to_vec, NR_SHMEM, nr_pages);
+#ifdef CONFIG_MEMCG_MEMFS_INFO
+			if (memcg_memfs_mapping(page_mapping(page))) {
+				__mod_memcg_state(from, MEMCG_MEMFS, -nr_pages);
+				__mod_memcg_state(to, MEMCG_MEMFS, nr_pages);
+			}
+#endif
 		}
 
 		if (page_mapped(page)) {
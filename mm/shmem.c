@@ -81,6 +81,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/rmap.h>
 #include <linux/uuid.h>
 #include <linux/share_pool.h>
+#include <linux/memcg_memfs_info.h>
 
 #include <linux/uaccess.h>
 
@@ -752,6 +753,7 @@ static int shmem_add_to_page_cache(struct page *page,
 		mapping->nrpages += nr;
 		__mod_lruvec_page_state(page, NR_FILE_PAGES, nr);
 		__mod_lruvec_page_state(page, NR_SHMEM, nr);
+		__memcg_memfs_page_state(mapping, page, nr);
 		shmem_reliable_page_counter(page, nr);
 unlock:
 		xas_unlock_irq(&xas);
@@ -785,6 +787,7 @@ static void shmem_delete_from_page_cache(struct page *page, void *radswap)
 	mapping->nrpages--;
 	__dec_lruvec_page_state(page, NR_FILE_PAGES);
 	__dec_lruvec_page_state(page, NR_SHMEM);
+	__memcg_memfs_page_state(mapping, page, -1);
 	shmem_reliable_page_counter(page, -1);
 	xa_unlock_irq(&mapping->i_pages);
 	put_page(page);
@@ -2839,7 +2839,24 @@ static inline bool should_continue_reclaim(struct pglist_data *pgdat,
 	return inactive_lru_pages > pages_for_compaction;
 }
 
-static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
+/*
+ * With memcg priority enabled, reclaim makes one pass over the low
+ * priority memcgs before it looks at the normal ones.
+ */
+enum memcg_reclaim_pass {
+	MEMCG_RECLAIM_ALL,
+	MEMCG_RECLAIM_LOW_PRIO,
+	MEMCG_RECLAIM_NORMAL_PRIO,
+};
+
+/*
+ * Low priority memcgs are scanned as if reclaim priority was this much
+ * higher, i.e. 2^MEMCG_QOS_RECLAIM_BOOST times as many pages per pass.
+ */
+#define MEMCG_QOS_RECLAIM_BOOST	2
+
+static void __shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc,
+				 enum memcg_reclaim_pass pass)
 {
 	struct mem_cgroup *target_memcg = sc->target_mem_cgroup;
 	struct mem_cgroup *memcg;
@@ -2849,6 +2866,7 @@ static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
 		struct lruvec *lruvec = mem_cgroup_lruvec(memcg, pgdat);
 		unsigned long reclaimed;
 		unsigned long scanned;
+		int priority = sc->priority;
 
 		/*
 		 * This loop can become CPU-bound when target memcgs
@@ -2858,6 +2876,11 @@ static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
 		 */
 		cond_resched();
 
+		if (pass != MEMCG_RECLAIM_ALL &&
+		    mem_cgroup_low_priority(memcg) !=
+		    (pass == MEMCG_RECLAIM_LOW_PRIO))
+			continue;
+
 		mem_cgroup_calculate_protection(target_memcg, memcg);
 
 		if (mem_cgroup_below_min(memcg)) {
@@ -2883,20 +2906,47 @@ static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
 		reclaimed = sc->nr_reclaimed;
 		scanned = sc->nr_scanned;
 
+		if (pass == MEMCG_RECLAIM_LOW_PRIO)
+			sc->priority = max(priority - MEMCG_QOS_RECLAIM_BOOST, 0);
+
 		shrink_lruvec(lruvec, sc);
 
 		shrink_slab(sc->gfp_mask, pgdat->node_id, memcg,
 			    sc->priority);
 
+		sc->priority = priority;
+
 		/* Record the group's reclaim efficiency */
 		if (!sc->proactive)
 			vmpressure(sc->gfp_mask, memcg, false,
 				   sc->nr_scanned - scanned,
 				   sc->nr_reclaimed - reclaimed);
 
+		if (pass != MEMCG_RECLAIM_ALL)
+			memcg_qos_account_reclaim(memcg,
+						  sc->nr_scanned - scanned,
+						  sc->nr_reclaimed - reclaimed);
+
 	} while ((memcg = mem_cgroup_iter(target_memcg, memcg, NULL)));
 }
 
+static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
+{
+	if (!mem_cgroup_qos_reclaim(sc->target_mem_cgroup)) {
+		__shrink_node_memcgs(pgdat, sc, MEMCG_RECLAIM_ALL);
+		return;
+	}
+
+	/*
+	 * Take from low priority memcgs first and harder, and only touch
+	 * the normal ones when that did not satisfy this reclaim.
+	 */
+	__shrink_node_memcgs(pgdat, sc, MEMCG_RECLAIM_LOW_PRIO);
+	if (sc->nr_reclaimed >= sc->nr_to_reclaim)
+		return;
+	__shrink_node_memcgs(pgdat, sc, MEMCG_RECLAIM_NORMAL_PRIO);
+}
+
 static void shrink_node(pg_data_t *pgdat, struct scan_control *sc)
 {
 	struct reclaim_state *reclaim_state = current->reclaim_state;
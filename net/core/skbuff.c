@@ -1280,7 +1280,7 @@ EXPORT_SYMBOL_GPL(sock_zerocopy_put);
 
 void sock_zerocopy_put_abort(struct ubuf_info *uarg, bool have_uref)
 {
-	if (uarg) {
+	if (uarg && uarg->callback == sock_zerocopy_callback) {
 		struct sock *sk = skb_from_uarg(uarg)->sk;
 
 		atomic_dec(&sk->sk_zckey);
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
 #include "liburing.h"
 #include "barrier.h"
@@ -482,6 +483,8 @@ int main(int argc, char *argv[])
 	struct submitter *s = &submitters[0];
 	unsigned long done, calls, reap;
 	int err, i, flags, fd;
+	unsigned long long cpu_ns = 0;
+	clockid_t cpu_clock;
 	char *fdepths;
 	void *ret;
 
@@ -558,6 +561,8 @@ int main(int argc, char *argv[])
 	printf(" QD=%d, sq_ring=%d, cq_ring=%d\n", DEPTH, *s->sq_ring.ring_entries, *s->cq_ring.ring_entries);
 
 	pthread_create(&s->thread, NULL, submitter_fn, s);
+	if (pthread_getcpuclockid(s->thread, &cpu_clock))
+		cpu_clock = -1;
 
 	fdepths = malloc(8 * s->nr_files);
 	reap = calls = done = 0;
@@ -566,8 +571,18 @@ int main(int argc, char *argv[])
 		unsigned long this_reap = 0;
 		unsigned long this_call = 0;
 		unsigned long rpc = 0, ipc = 0;
+		unsigned long long this_cpu_ns = 0;
+		unsigned long iops_core = 0;
+		struct timespec ts;
 
 		sleep(1);
+		if (cpu_clock != -1 && !clock_gettime(cpu_clock, &ts))
+			this_cpu_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		/* IOPS for one fully busy submitter core */
+		if (this_cpu_ns > cpu_ns)
+			iops_core = (s->done - done) * 1000000000ULL /
+					(this_cpu_ns - cpu_ns);
+		cpu_ns = this_cpu_ns;
 		this_done += s->done;
 		this_call += s->calls;
 		this_reap += s->reaps;
@@ -577,9 +592,9 @@ int main(int argc, char *argv[])
 		} else
 			rpc = ipc = -1;
 		file_depths(fdepths);
-		printf("IOPS=%lu, IOS/call=%ld/%ld, inflight=%u (%s)\n",
-				this_done - done, rpc, ipc, s->inflight,
-				fdepths);
+		printf("IOPS=%lu, IOPS/core=%lu, IOS/call=%ld/%ld, inflight=%u (%s)\n",
+				this_done - done, iops_core, rpc, ipc,
+				s->inflight, fdepths);
 		done = this_done;
 		calls = this_call;
 		reap = this_reap;
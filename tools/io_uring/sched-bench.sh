@@ -0,0 +1,87 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# Compare the IOPS of a multi-queue null_blk device with no I/O scheduler
+# and with mq-deadline, running one io_uring-bench per cpu so that every
+# hardware queue has its own submitter.
+#
+# The device is created through configfs, so null_blk devices that are
+# already set up are left alone.  The module is only unloaded at the end if
+# it was loaded here.
+#
+# Usage: sched-bench.sh [seconds] [nr_cpus]
+
+RUNTIME=${1:-10}
+NR_CPUS=${2:-$(nproc)}
+BENCH=$(dirname "$0")/io_uring-bench
+CONFIG=/sys/kernel/config/nullb/sched-bench
+LOADED=
+
+if [ ! -x "$BENCH" ]; then
+	echo "$BENCH not found, run make first"
+	exit 1
+fi
+
+cleanup()
+{
+	echo 0 > $CONFIG/power 2>/dev/null
+	rmdir $CONFIG 2>/dev/null
+	[ -n "$LOADED" ] && modprobe -r null_blk
+}
+
+if [ ! -d /sys/module/null_blk ]; then
+	if ! modprobe null_blk nr_devices=0; then
+		echo "failed to load null_blk"
+		exit 1
+	fi
+	LOADED=1
+fi
+
+if ! mkdir $CONFIG; then
+	echo "failed to create a null_blk device, is configfs mounted?"
+	cleanup
+	exit 1
+fi
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+echo 2 > $CONFIG/queue_mode &&
+echo 0 > $CONFIG/irqmode &&
+echo "$NR_CPUS" > $CONFIG/submit_queues &&
+echo 1 > $CONFIG/power || exit 1
+DEV=nullb$(cat $CONFIG/index)
+
+# wait for udev to create the device node
+for i in $(seq 50); do
+	[ -b /dev/$DEV ] && break
+	sleep 0.1
+done
+
+run()
+{
+	sched=$1
+	total=0
+
+	echo "$sched" > /sys/block/$DEV/queue/scheduler || return 1
+
+	for cpu in $(seq 0 $((NR_CPUS - 1))); do
+		timeout -s INT "$RUNTIME" taskset -c "$cpu" \
+			"$BENCH" /dev/$DEV > /tmp/sched-bench.$cpu 2>&1 &
+	done
+	wait
+
+	for cpu in $(seq 0 $((NR_CPUS - 1))); do
+		iops=$(grep '^IOPS=' /tmp/sched-bench.$cpu | tail -n 1 |
+		       sed 's/^IOPS=\([0-9]*\),.*/\1/')
+		total=$((total + ${iops:-0}))
+		rm -f /tmp/sched-bench.$cpu
+	done
+
+	echo "$sched: $NR_CPUS submitters, IOPS=$total"
+}
+
+run none
+run mq-deadline
+if [ -d /sys/kernel/debug/block/$DEV/sched ]; then
+	echo "mq-deadline shards: $(cat /sys/kernel/debug/block/$DEV/sched/nr_shards)"
+fi
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+#define _GNU_SOURCE
+
+#include <linux/limits.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/sysinfo.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../kselftest.h"
+#include "cgroup_util.h"
+
+#define FILES_LIMIT		100
+#define BENCH_SECONDS		5
+#define BENCH_FDS_PER_THREAD	16
+
+/*
+ * Open /dev/null until the files controller refuses, then check that
+ * exactly files.limit descriptors were granted.  fd charges are batched
+ * per cpu, so this verifies that the batching never lets the cgroup
+ * exceed its limit, nor fails a charge while there is headroom left.
+ * FILES_LIMIT is kept well below the default RLIMIT_NOFILE so that the
+ * EMFILE comes from the cgroup and not from the rlimit.
+ */
+static int open_until_limit(const char *cgroup, void *arg)
+{
+	long usage, opened = 0;
+	int fd;
+
+	usage = cg_read_long(cgroup, "files.usage");
+	if (usage <= 0)
+		return -1;
+
+	for (;;) {
+		fd = open("/dev/null", O_RDONLY);
+		if (fd < 0)
+			break;
+		opened++;
+	}
+
+	if (errno != EMFILE)
+		return -1;
+	if (usage + opened != FILES_LIMIT)
+		return -1;
+	if (cg_read_long(cgroup, "files.usage") != FILES_LIMIT)
+		return -1;
+
+	return 0;
+}
+
+static int test_files_limit_exact(const char *root)
+{
+	int ret = KSFT_FAIL;
+	char buf[32];
+	char *cg;
+
+	cg = cg_name(root, "files_limit_test");
+	if (!cg)
+		goto cleanup;
+
+	if (cg_create(cg))
+		goto cleanup;
+
+	snprintf(buf, sizeof(buf), "%d", FILES_LIMIT);
+	if (cg_write(cg, "files.limit", buf))
+		goto cleanup;
+
+	if (!cg_run(cg, open_until_limit, NULL))
+		ret = KSFT_PASS;
+
+cleanup:
+	cg_destroy(cg);
+	free(cg);
+
+	return ret;
+}
+
+static volatile int bench_stop;
+
+static void *open_close_fn(void *arg)
+{
+	unsigned long *ops = arg;
+	int fds[BENCH_FDS_PER_THREAD];
+	int i;
+
+	while (!bench_stop) {
+		for (i = 0; i < BENCH_FDS_PER_THREAD; i++)
+			fds[i] = open("/dev/null", O_RDONLY);
+		for (i = 0; i < BENCH_FDS_PER_THREAD; i++) {
+			if (fds[i] < 0)
+				return (void *)-1L;
+			close(fds[i]);
+		}
+		*ops += BENCH_FDS_PER_THREAD;
+	}
+
+	return NULL;
+}
+
+/*
+ * Run one open/close loop per cpu inside a cgroup with a files limit
+ * and report the aggregate throughput.  The limit is set well above the
+ * working set so that the numbers reflect charging cost only.
+ */
+static int open_close_bench(const char *cgroup, void *arg)
+{
+	int nr_threads = get_nprocs();
+	unsigned long *ops, total = 0;
+	struct timespec start, end;
+	pthread_t *tinfo;
+	double secs;
+	void *res;
+	int i, ret = 0;
+
+	tinfo = calloc(nr_threads, sizeof(pthread_t));
+	ops = calloc(nr_threads, sizeof(unsigned long));
+	if (!tinfo || !ops)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&tinfo[i], NULL, open_close_fn, &ops[i])) {
+			nr_threads = i;
+			bench_stop = 1;
+			ret = -1;
+			break;
+		}
+	}
+
+	if (!ret)
+		sleep(BENCH_SECONDS);
+	bench_stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(tinfo[i], &res) || res)
+			ret = -1;
+		total += ops[i];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	ksft_print_msg("%d threads: %.0f open+close/s (%.0f per thread)\n",
+		       get_nprocs(), total / secs, total / secs / get_nprocs());
+
+	free(ops);
+	free(tinfo);
+	return ret;
+}
+
+static int test_files_open_close_bench(const char *root)
+{
+	int ret = KSFT_FAIL;
+	char buf[32];
+	char *cg;
+
+	cg = cg_name(root, "files_bench_test");
+	if (!cg)
+		goto cleanup;
+
+	if (cg_create(cg))
+		goto cleanup;
+
+	snprintf(buf, sizeof(buf), "%d",
+		 get_nprocs() * BENCH_FDS_PER_THREAD * 4 + FILES_LIMIT);
+	if (cg_write(cg, "files.limit", buf))
+		goto cleanup;
+
+	if (!cg_run(cg, open_close_bench, NULL))
+		ret = KSFT_PASS;
+
+cleanup:
+	cg_destroy(cg);
+	free(cg);
+
+	return ret;
+}
+
+#define T(x) { x, #x }
+struct files_test {
+	int (*fn)(const char *root);
+	const char *name;
+} tests[] = {
+	T(test_files_limit_exact),
+	T(test_files_open_close_bench),
+};
+#undef T
+
+int main(int argc, char **argv)
+{
+	char root[PATH_MAX];
+	int i, ret = EXIT_SUCCESS;
+
+	if (cg_find_unified_root(root, sizeof(root)))
+		ksft_exit_skip("cgroup v2 isn't mounted\n");
+
+	if (cg_read_strstr(root, "cgroup.controllers", "files"))
+		ksft_exit_skip("files controller isn't available\n");
+
+	if (cg_read_strstr(root, "cgroup.subtree_control", "files"))
+		if (cg_write(root, "cgroup.subtree_control", "+files"))
+			ksft_exit_skip("Failed to set files controller\n");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		switch (tests[i].fn(root)) {
+		case KSFT_PASS:
+			ksft_test_result_pass("%s\n", tests[i].name);
+			break;
+		case KSFT_SKIP:
+			ksft_test_result_skip("%s\n", tests[i].name);
+			break;
+		default:
+			ret = EXIT_FAILURE;
+			ksft_test_result_fail("%s\n", tests[i].name);
+			break;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0
+#define _GNU_SOURCE
+
+#include <linux/limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../kselftest.h"
+#include "cgroup_util.h"
+
+#define BENCH_MAX_DEPTH		8
+#define BENCH_ROUND_TRIPS	200000
+#define STALL_USEC		500000
+
+/*
+ * Ping-pong a byte between two processes pinned to the same cpu, so
+ * that every round trip is two context switches between tasks of the
+ * cgroup, and report the cost per switch.  Each switch walks the psi
+ * groups of the hierarchy the tasks live in.
+ */
+static int ping_pong(const char *cgroup, void *arg)
+{
+	int depth = (long)arg;
+	int ping[2], pong[2];
+	struct timespec start, end;
+	cpu_set_t cpus;
+	double ns;
+	char c = 0;
+	pid_t pid;
+	int i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		return -1;
+
+	if (pipe(ping) || pipe(pong))
+		return -1;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (!pid) {
+		for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+			if (read(ping[0], &c, 1) != 1 ||
+			    write(pong[1], &c, 1) != 1)
+				exit(EXIT_FAILURE);
+		}
+		exit(EXIT_SUCCESS);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+		if (write(ping[1], &c, 1) != 1 ||
+		    read(pong[0], &c, 1) != 1)
+			break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (i != BENCH_ROUND_TRIPS)
+		kill(pid, SIGKILL);
+	if (clone_reap(pid, WEXITED) || i != BENCH_ROUND_TRIPS)
+		return -1;
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	ksft_print_msg("depth %d: %.0f ns/switch\n", depth,
+		       ns / (2.0 * BENCH_ROUND_TRIPS));
+
+	return 0;
+}
+
+/*
+ * Measure the context switch cost for tasks at cgroup depth 1 to
+ * BENCH_MAX_DEPTH, to show how psi accounting scales with the depth
+ * of the hierarchy.
+ */
+static int test_psi_switch_depth_bench(const char *root)
+{
+	char *cg[BENCH_MAX_DEPTH + 1] = { NULL };
+	int ret = KSFT_FAIL;
+	int depth;
+
+	cg[0] = strdup(root);
+	if (!cg[0])
+		goto cleanup;
+
+	for (depth = 1; depth <= BENCH_MAX_DEPTH; depth++) {
+		cg[depth] = cg_name_indexed(cg[depth - 1], "psi_bench", depth);
+		if (!cg[depth] || cg_create(cg[depth]))
+			goto cleanup;
+
+		if (depth == 1 &&
+		    cg_read_strstr(cg[depth], "cpu.pressure", "some")) {
+			ret = KSFT_SKIP;
+			goto cleanup;
+		}
+
+		if (cg_run(cg[depth], ping_pong, (void *)(long)depth))
+			goto cleanup;
+	}
+
+	ret = KSFT_PASS;
+
+cleanup:
+	for (depth = BENCH_MAX_DEPTH; depth >= 0; depth--) {
+		if (!cg[depth])
+			continue;
+		if (depth)
+			cg_destroy(cg[depth]);
+		free(cg[depth]);
+	}
+
+	return ret;
+}
+
+/*
+ * Spin in two processes pinned to the same cpu for STALL_USEC, so that
+ * one of them is always waiting for the cpu and the cgroup sees about
+ * STALL_USEC of cpu pressure.
+ */
+static int cpu_hog(const char *cgroup, void *arg)
+{
+	struct timespec start, now;
+	cpu_set_t cpus;
+	pid_t pid;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		return -1;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000 +
+		 (now.tv_nsec - start.tv_nsec) / 1000 < STALL_USEC);
+
+	if (!pid)
+		exit(EXIT_SUCCESS);
+
+	return clone_reap(pid, WEXITED);
+}
+
+/*
+ * Stall the tasks of a cgroup BENCH_MAX_DEPTH levels down and check that
+ * every ancestor reports the same stall time as the leaf, as none of them
+ * has any other tasks.
+ */
+static int test_psi_ancestor_totals(const char *root)
+{
+	char *cg[BENCH_MAX_DEPTH + 1] = { NULL };
+	int ret = KSFT_FAIL;
+	long leaf, total;
+	int depth;
+
+	cg[0] = strdup(root);
+	if (!cg[0])
+		goto cleanup;
+
+	for (depth = 1; depth <= BENCH_MAX_DEPTH; depth++) {
+		cg[depth] = cg_name_indexed(cg[depth - 1], "psi_test", depth);
+		if (!cg[depth] || cg_create(cg[depth]))
+			goto cleanup;
+	}
+
+	if (cg_read_strstr(cg[1], "cpu.pressure", "some")) {
+		ret = KSFT_SKIP;
+		goto cleanup;
+	}
+
+	if (cg_run(cg[BENCH_MAX_DEPTH], cpu_hog, NULL))
+		goto cleanup;
+
+	leaf = cg_read_key_long(cg[BENCH_MAX_DEPTH], "cpu.pressure", "total=");
+	if (leaf < STALL_USEC / 2) {
+		ksft_print_msg("leaf: %ld usecs of cpu pressure\n", leaf);
+		goto cleanup;
+	}
+
+	for (depth = 1; depth < BENCH_MAX_DEPTH; depth++) {
+		total = cg_read_key_long(cg[depth], "cpu.pressure", "total=");
+		if (!values_close(total, leaf, 5)) {
+			ksft_print_msg("depth %d: %ld usecs, leaf: %ld usecs\n",
+				       depth, total, leaf);
+			goto cleanup;
+		}
+	}
+
+	ret = KSFT_PASS;
+
+cleanup:
+	for (depth = BENCH_MAX_DEPTH; depth >= 0; depth--) {
+		if (!cg[depth])
+			continue;
+		if (depth)
+			cg_destroy(cg[depth]);
+		free(cg[depth]);
+	}
+
+	return ret;
+}
+
+#define T(x) { x, #x }
+struct psi_test {
+	int (*fn)(const char *root);
+	const char *name;
+} tests[] = {
+	T(test_psi_switch_depth_bench),
+	T(test_psi_ancestor_totals),
+};
+#undef T
+
+int main(int argc, char **argv)
+{
+	char root[PATH_MAX];
+	int i, ret = EXIT_SUCCESS;
+
+	if (cg_find_unified_root(root, sizeof(root)))
+		ksft_exit_skip("cgroup v2 isn't mounted\n");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		switch (tests[i].fn(root)) {
+		case KSFT_PASS:
+			ksft_test_result_pass("%s\n", tests[i].name);
+			break;
+		case KSFT_SKIP:
+			ksft_test_result_skip("%s\n", tests[i].name);
+			break;
+		default:
+			ret = EXIT_FAILURE;
+			ksft_test_result_fail("%s\n", tests[i].name);
+			break;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: GPL-2.0
+#define _GNU_SOURCE
+
+#include <linux/limits.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+#include "cgroup_util.h"
+
+#define NULLB_MODULE		"/sys/module/null_blk"
+#define NULLB_CONFIG		"/sys/kernel/config/nullb/throttle_test"
+#define BLKCG_PARAMS		"/sys/module/blk_cgroup/parameters"
+#define PCPU_WINDOW_MS		"100"
+#define NR_READS		10000
+#define BS			4096
+#define RATE_WINDOW_MS		2000
+#define RATE_IOPS		1000
+
+struct nullb {
+	char dev[PATH_MAX];
+	char queue[PATH_MAX];
+	dev_t rdev;
+	bool loaded;
+};
+
+struct read_args {
+	const char *dev;
+	int nr_reads;		/* stop after this many reads if set, */
+	int window_ms;		/* else after this many milliseconds */
+	long *done;		/* shared with the parent, if set */
+	long *usecs;
+};
+
+/*
+ * Set up a null_blk device of our own through configfs, so that devices
+ * somebody else created are left alone.  The module is loaded without any
+ * devices if it isn't there yet, and only then unloaded again afterwards.
+ */
+static int nullb_create(struct nullb *nb)
+{
+	char index[16];
+	int i;
+
+	memset(nb, 0, sizeof(*nb));
+
+	if (access(NULLB_MODULE, F_OK)) {
+		if (system("modprobe null_blk nr_devices=0 >/dev/null 2>&1"))
+			return -1;
+		nb->loaded = true;
+	}
+
+	if (mkdir(NULLB_CONFIG, 0755))
+		goto unload;
+
+	if (cg_write(NULLB_CONFIG, "queue_mode", "2") ||
+	    cg_write(NULLB_CONFIG, "irqmode", "0") ||
+	    cg_write(NULLB_CONFIG, "power", "1") ||
+	    cg_read(NULLB_CONFIG, "index", index, sizeof(index)))
+		goto remove;
+
+	snprintf(nb->dev, sizeof(nb->dev), "/dev/nullb%d", atoi(index));
+	snprintf(nb->queue, sizeof(nb->queue), "/sys/block/nullb%d/queue",
+		 atoi(index));
+
+	/* udev may take a moment to create the device node */
+	for (i = 0; i < 50; i++) {
+		struct stat st;
+
+		if (!stat(nb->dev, &st)) {
+			nb->rdev = st.st_rdev;
+			return 0;
+		}
+		usleep(100000);
+	}
+
+remove:
+	cg_write(NULLB_CONFIG, "power", "0");
+	rmdir(NULLB_CONFIG);
+unload:
+	if (nb->loaded)
+		system("modprobe -r null_blk >/dev/null 2>&1");
+	return -1;
+}
+
+static void nullb_destroy(struct nullb *nb)
+{
+	cg_write(NULLB_CONFIG, "power", "0");
+	rmdir(NULLB_CONFIG);
+	if (nb->loaded)
+		system("modprobe -r null_blk >/dev/null 2>&1");
+}
+
+static long elapsed_usecs(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * Read the null_blk device with direct I/O from a single cpu, so that the
+ * reads following the first one of a slice can be covered by the budget
+ * that dispatch hands to the cpu.
+ */
+static int read_nullb(const char *cgroup, void *arg)
+{
+	struct read_args *args = arg;
+	struct timespec start;
+	cpu_set_t cpus;
+	long usecs = 0;
+	void *buf;
+	int fd, i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		return -1;
+
+	if (posix_memalign(&buf, BS, BS))
+		return -1;
+
+	fd = open(args->dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		free(buf);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; !args->nr_reads || i < args->nr_reads; i++) {
+		if (args->window_ms &&
+		    (usecs = elapsed_usecs(&start)) >= args->window_ms * 1000L)
+			break;
+		if (pread(fd, buf, BS, (off_t)(i % 1024) * BS) != BS) {
+			i = -1;
+			break;
+		}
+	}
+
+	if (args->done) {
+		*args->done = i;
+		*args->usecs = elapsed_usecs(&start);
+	}
+
+	close(fd);
+	free(buf);
+	if (i < 0)
+		return -1;
+	return !args->nr_reads || i == args->nr_reads ? 0 : -1;
+}
+
+/*
+ * A group with an iops limit directly below the root, whose throttle
+ * group has no limits and never starts a slice, must still get per-cpu
+ * dispatch budgets once throttle_pcpu_window is set.
+ */
+static int test_throttle_pcpu_budget(const char *root)
+{
+	char buf[64], debug_stats[8] = "N";
+	struct read_args args = {};
+	int ret = KSFT_FAIL;
+	struct nullb nb;
+	char *cg = NULL;
+	long nr;
+
+	if (cg_read_strstr(root, "cgroup.controllers", "io") ||
+	    cg_write(root, "cgroup.subtree_control", "+io"))
+		return KSFT_SKIP;
+
+	if (nullb_create(&nb))
+		return KSFT_SKIP;
+	if (cg_read(BLKCG_PARAMS, "blkcg_debug_stats", debug_stats,
+		    sizeof(debug_stats))) {
+		ret = KSFT_SKIP;
+		goto cleanup_nullb;
+	}
+
+	if (cg_write(nb.queue, "throttle_pcpu_window", PCPU_WINDOW_MS) ||
+	    cg_write(BLKCG_PARAMS, "blkcg_debug_stats", "Y"))
+		goto cleanup;
+
+	cg = cg_name(root, "throttle_pcpu_test");
+	if (!cg || cg_create(cg))
+		goto cleanup;
+
+	snprintf(buf, sizeof(buf), "%u:%u riops=100000",
+		 major(nb.rdev), minor(nb.rdev));
+	if (cg_write(cg, "io.max", buf))
+		goto cleanup;
+
+	args.dev = nb.dev;
+	args.nr_reads = NR_READS;
+	if (cg_run(cg, read_nullb, &args))
+		goto cleanup;
+
+	nr = cg_read_key_long(cg, "io.stat", "throttle.pcpu_rios=");
+	ksft_print_msg("%ld of %d reads dispatched from per-cpu budgets\n",
+		       nr, NR_READS);
+	if (nr > 0)
+		ret = KSFT_PASS;
+
+cleanup:
+	if (cg) {
+		cg_destroy(cg);
+		free(cg);
+	}
+	cg_write(BLKCG_PARAMS, "blkcg_debug_stats", debug_stats);
+	cg_write(nb.queue, "throttle_pcpu_window", "0");
+cleanup_nullb:
+	nullb_destroy(&nb);
+	return ret;
+}
+
+/*
+ * Per-cpu budgets must not let a group go faster than its limit: reading
+ * for RATE_WINDOW_MS under a riops and then an equivalent rbps limit has
+ * to complete about RATE_IOPS reads a second either way.
+ */
+static int test_throttle_pcpu_rate(const char *root)
+{
+	static const char * const limits[] = { "riops", "rbps" };
+	struct read_args args = {};
+	int i, ret = KSFT_FAIL;
+	long *shared = NULL;
+	struct nullb nb;
+	char *cg = NULL;
+	char buf[64];
+
+	if (cg_read_strstr(root, "cgroup.controllers", "io") ||
+	    cg_write(root, "cgroup.subtree_control", "+io"))
+		return KSFT_SKIP;
+
+	if (nullb_create(&nb))
+		return KSFT_SKIP;
+
+	if (cg_write(nb.queue, "throttle_pcpu_window", PCPU_WINDOW_MS))
+		goto cleanup;
+
+	shared = mmap(NULL, 2 * sizeof(long), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		shared = NULL;
+		goto cleanup;
+	}
+
+	cg = cg_name(root, "throttle_rate_test");
+	if (!cg || cg_create(cg))
+		goto cleanup;
+
+	args.dev = nb.dev;
+	args.window_ms = RATE_WINDOW_MS;
+	args.done = &shared[0];
+	args.usecs = &shared[1];
+
+	for (i = 0; i < ARRAY_SIZE(limits); i++) {
+		long rate;
+
+		snprintf(buf, sizeof(buf), "%u:%u %s=%ld",
+			 major(nb.rdev), minor(nb.rdev), limits[i],
+			 i ? (long)RATE_IOPS * BS : (long)RATE_IOPS);
+		if (cg_write(cg, "io.max", buf))
+			goto cleanup;
+
+		if (cg_run(cg, read_nullb, &args) || shared[1] <= 0)
+			goto cleanup;
+
+		rate = shared[0] * 1000000L / shared[1];
+		ksft_print_msg("%s: %ld reads in %ld usecs, %ld reads/s, limit %d\n",
+			       limits[i], shared[0], shared[1], rate,
+			       RATE_IOPS);
+		if (!values_close(rate, RATE_IOPS, 10))
+			goto cleanup;
+
+		snprintf(buf, sizeof(buf), "%u:%u %s=max",
+			 major(nb.rdev), minor(nb.rdev), limits[i]);
+		if (cg_write(cg, "io.max", buf))
+			goto cleanup;
+	}
+
+	ret = KSFT_PASS;
+
+cleanup:
+	if (cg) {
+		cg_destroy(cg);
+		free(cg);
+	}
+	if (shared)
+		munmap(shared, 2 * sizeof(long));
+	cg_write(nb.queue, "throttle_pcpu_window", "0");
+	nullb_destroy(&nb);
+	return ret;
+}
+
+#define T(x) { x, #x }
+struct throttle_test {
+	int (*fn)(const char *root);
+	const char *name;
+} tests[] = {
+	T(test_throttle_pcpu_budget),
+	T(test_throttle_pcpu_rate),
+};
+#undef T
+
+int main(int argc, char **argv)
+{
+	char root[PATH_MAX];
+	int i, ret = EXIT_SUCCESS;
+
+	if (cg_find_unified_root(root, sizeof(root)))
+		ksft_exit_skip("cgroup v2 isn't mounted\n");
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		switch (tests[i].fn(root)) {
+		case KSFT_PASS:
+			ksft_test_result_pass("%s\n", tests[i].name);
+			break;
+		case KSFT_SKIP:
+			ksft_test_result_skip("%s\n", tests[i].name);
+			break;
+		default:
+			ret = EXIT_FAILURE;
+			ksft_test_result_fail("%s\n", tests[i].name);
+			break;
+		}
+	}
+
+	return ret;
+}